@@ -75,6 +75,7 @@ export class FileAutoComplete extends React.Component {
         var channel = cockpit.channel({
             payload: "fslist1",
             path,
+            "page-size": 1000,
             superuser: this.props.superuser
         });
         var results = [];
@@ -90,7 +91,16 @@ export class FileAutoComplete extends React.Component {
 
         channel.addEventListener("message", (ev, data) => {
             const item = JSON.parse(data);
-            if (item && item.path && item.event == 'present') {
+            if (!item || !item.path || item.event != 'present')
+                return;
+
+            /* Paged listings send a whole page of entries in columns */
+            if (Array.isArray(item.path)) {
+                item.path.forEach((name, i) => {
+                    const type = item.type[i];
+                    results.push({ path: name + (type == 'directory' ? '/' : ''), type });
+                });
+            } else {
                 item.path = item.path + (item.type == 'directory' ? '/' : '');
                 results.push(item);
             }
@@ -26,6 +26,18 @@ function generate_session_key(host) {
     return session_prefix + "/" + host;
 }
 
+/* The per-package checksums that cockpit-ws can route for this host, from
+   the X-Cockpit-Pkg-Checksums header that comes back with the manifests */
+function package_checksums(header) {
+    var result = { };
+    (header || "").split(" ").forEach(function (part) {
+        var eq = part.indexOf("=");
+        if (eq > 0)
+            result[part.substring(0, eq)] = part.substring(eq + 1);
+    });
+    return result;
+}
+
 function Machines() {
     var self = this;
 
@@ -455,6 +467,7 @@ function Loader(machines, session_only) {
         } else if (problem) {
             values.manifests = null;
             values.checksum = null;
+            values.package_checksums = null;
         }
         machines.overlay(host, values);
     }
@@ -538,8 +551,9 @@ function Loader(machines, session_only) {
         var open = local;
         var problem = null;
 
+        /* The manifests are loaded again to learn the package checksums */
         var url;
-        if (!machine.manifests) {
+        if (!machine.manifests || !machine.package_checksums) {
             if (machine.checksum)
                 url = "../../" + machine.checksum + "/manifests.json";
             else
@@ -555,9 +569,13 @@ function Loader(machines, session_only) {
 
         /* Here we load the machine manifests, and expect them before going to "connected" */
         function request_manifest() {
-            request = $.ajax({ url: url, dataType: "json", cache: true })
+            /* Not from the browser cache: cockpit-ws needs to see these to route the package checksums */
+            request = $.ajax({ url: url, dataType: "json", cache: false })
                     .done(function(manifests) {
-                        var overlay = { manifests: manifests };
+                        var overlay = {
+                            manifests: manifests,
+                            package_checksums: package_checksums(request.getResponseHeader("X-Cockpit-Pkg-Checksums"))
+                        };
                         var etag = request.getResponseHeader("ETag");
                         if (etag) /* and remove quotes */
                             overlay.checksum = etag.replace(/^"(.+)"$/, '$1');
@@ -593,7 +611,8 @@ function Loader(machines, session_only) {
                                if (args[0] == "cockpit.Packages") {
                                    if (args[1].Manifests) {
                                        var manifests = JSON.parse(args[1].Manifests.v);
-                                       machines.overlay(host, { manifests: manifests });
+                                       /* cockpit-ws hasn't seen these, so it can't route their package checksums */
+                                       machines.overlay(host, { manifests: manifests, package_checksums: null });
                                    }
                                }
                            });
@@ -31,6 +31,15 @@ function component_checksum(machine, component) {
         return "$" + machine.manifests[pkg][".checksum"];
 }
 
+function package_checksum(machine, component) {
+    var pkg = component.split("/")[0];
+    var checksum = machine.manifests && machine.manifests[pkg] && machine.manifests[pkg][".package-checksum"];
+
+    /* Only what cockpit-ws said it routes to this host, see machines.js */
+    if (checksum && machine.package_checksums && machine.package_checksums[pkg] === checksum)
+        return "$" + checksum;
+}
+
 function Frames(index, setupTimers) {
     var self = this;
     let language = document.cookie.replace(/(?:(?:^|.*;\s*)CockpitLang\s*=\s*([^;]*).*$)|^.*$/, "$1");
@@ -158,7 +167,11 @@ function Frames(index, setupTimers) {
                     checksum = machine.checksum;
             }
 
-            if (checksum && checksum == component_checksum(machine, component)) {
+            if (machine && package_checksum(machine, component)) {
+                /* Only changes to this package change the URL, and identical
+                   packages on other hosts share it, and thus the cache. */
+                base = "../../" + package_checksum(machine, component);
+            } else if (checksum && checksum == component_checksum(machine, component)) {
                 if (host === "localhost")
                     base = "..";
                 else
@@ -170,9 +183,7 @@ function Frames(index, setupTimers) {
                    cache with wrong files.
 
                    We can't use a $<component-checksum> path since cockpit-ws only knows how to
-                   route the machine checksum.
-
-                   TODO - make it possible to use $<component-checksum>.
+                   route the machine checksum and the per-package checksums.
                 */
                 base = "../../@" + host;
             }
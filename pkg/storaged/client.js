@@ -380,7 +380,7 @@ function init_model(callback) {
     }
 
     function pull_time() {
-        return cockpit.spawn(["date", "+%s"])
+        return cockpit.spawn(["date", "+%s"], { cache: 0 })
                 .then(function (now) {
                     client.time_offset = parseInt(now, 10) * 1000 - new Date().getTime();
                 });
@@ -423,7 +423,7 @@ function init_model(callback) {
     }
 
     function enable_clevis_features() {
-        return cockpit.spawn(["which", "clevis-luks-bind"], { err: "ignore" }).then(
+        return cockpit.spawn(["which", "clevis-luks-bind"], { err: "ignore", cache: 5 * 60 * 1000 }).then(
             function () {
                 client.features.clevis = true;
                 return cockpit.resolve();
@@ -574,7 +574,42 @@ function nfs_mounts() {
         return python.spawn([inotify_py, nfs_mounts_py], args, { superuser: "try", err: "message" });
     }
 
+    /* The bridge watches fstab and the mount table, and reports
+     * usage of mounted entries.  Older bridges don't, and there we
+     * use the monitor helper and "stat" instead.
+     */
+    var channel_active = false;
+
     function start() {
+        var channel = cockpit.channel({ payload: "nfs-mounts1", superuser: "try" });
+        var seen_message = false;
+
+        channel.addEventListener("message", function (event, data) {
+            var msg = JSON.parse(data);
+            seen_message = true;
+            channel_active = true;
+            if (msg.entries) {
+                self.entries = msg.entries;
+                self.fsys_sizes = { };
+            }
+            if (msg.usage) {
+                Object.keys(msg.usage).forEach(function (path) {
+                    self.fsys_sizes[path] = msg.usage[path];
+                });
+            }
+            client.dispatchEvent('changed');
+        });
+
+        channel.addEventListener("close", function (event, options) {
+            channel_active = false;
+            if (!seen_message)
+                start_monitor();
+            else if (options.problem)
+                console.warn(options.message || options.problem);
+        });
+    }
+
+    function start_monitor() {
         var buf = "";
         spawn_nfs_mounts(["monitor"])
                 .stream(function (output) {
@@ -596,15 +631,22 @@ function nfs_mounts() {
                 });
     }
 
+    /* Returns false when the usage is unknown, such as when the server
+     * doesn't answer, and null when it isn't there yet.
+     */
     function get_fsys_size(entry) {
         var path = entry.fields[1];
-        if (self.fsys_sizes[path])
-            return self.fsys_sizes[path];
+        var size = self.fsys_sizes[path];
+        if (Array.isArray(size))
+            return size;
+
+        if (size === null)
+            return false;
 
-        if (self.fsys_sizes[path] === false)
+        if (size === "pending" || channel_active)
             return null;
 
-        self.fsys_sizes[path] = false;
+        self.fsys_sizes[path] = "pending";
         cockpit.spawn(["stat", "-f", "-c", "[ %S, %f, %b ]", path], { err: "message" })
                 .done(function (output) {
                     var data = JSON.parse(output);
@@ -612,7 +654,7 @@ function nfs_mounts() {
                     client.dispatchEvent('changed');
                 })
                 .fail(function () {
-                    self.fsys_sizes[path] = [0, 0];
+                    self.fsys_sizes[path] = null;
                     client.dispatchEvent('changed');
                 });
 
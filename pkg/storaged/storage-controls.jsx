@@ -187,6 +187,8 @@ export class StorageOnOff extends React.Component {
  */
 
 export const StorageUsageBar = ({ stats, critical }) => {
+    if (stats === false)
+        return _("Unknown");
     if (!stats)
         return null;
 
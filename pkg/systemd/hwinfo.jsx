@@ -117,7 +117,7 @@ function availableMitigations() {
     if (availableMitigations.cachedMitigations !== undefined)
         return Promise.resolve(availableMitigations.cachedMitigations);
     /* nosmt */
-    const promises = [cockpit.spawn(["lscpu"], { environ: ["LC_ALL=C.UTF-8"], }), cockpit.file("/proc/cmdline").read()];
+    const promises = [cockpit.spawn(["lscpu"], { environ: ["LC_ALL=C.UTF-8"], cache: 5 * 60 * 1000 }), cockpit.file("/proc/cmdline").read()];
     return Promise.all(promises).then(values => {
         let threads_per_core;
         try {
@@ -560,39 +560,106 @@ $(function() {
             path_by_id[id] = path;
         });
 
-        $(systemd_manager).on("JobNew JobRemoved", function(event, number, path, unit_id, result) {
-            var unit_path = path_by_id[unit_id];
-            if (unit_path) {
-                refresh_properties(unit_path);
-                process_failed_units();
-            }
-        });
+        function watch_units_legacy() {
+            $(systemd_manager).on("JobNew JobRemoved", function(event, number, path, unit_id, result) {
+                var unit_path = path_by_id[unit_id];
+                if (unit_path) {
+                    refresh_properties(unit_path);
+                    process_failed_units();
+                }
+            });
+
+            systemd_client.subscribe({
+                interface: "org.freedesktop.DBus.Properties",
+                member: "PropertiesChanged"
+            },
+                                     function(path, iface, signal, args) {
+                                         var unit = units_by_path[path];
+                                         if (unit) {
+                                             update_properties(unit, args[1]);
+                                             render();
+                                             process_failed_units();
+                                         }
+                                     });
+
+            $(systemd_manager).on("UnitFilesChanged", function(event) {
+                update_all();
+            });
+
+            $(systemd_manager).on("Reloading", function(event, reloading) {
+                if (!reloading)
+                    update_all();
+            });
 
-        systemd_client.subscribe({
-            interface: "org.freedesktop.DBus.Properties",
-            member: "PropertiesChanged"
-        },
-                                 function(path, iface, signal, args) {
-                                     var unit = units_by_path[path];
-                                     if (unit) {
-                                         update_properties(unit, args[1]);
-                                         render();
-                                         process_failed_units();
-                                     }
-                                 });
-
-        $(systemd_manager).on("UnitFilesChanged", function(event) {
             update_all();
-        });
+        }
 
-        $(systemd_manager).on("Reloading", function(event, reloading) {
-            if (!reloading)
-                update_all();
-        });
+        /* The "systemd-units" channel does the reconciliation of
+         * ListUnits and ListUnitFiles described above in the bridge,
+         * and then sends us only what changed.  Older bridges don't
+         * have it, and there we do it all ourselves.
+         */
+        function watch_units() {
+            const channel = cockpit.channel({ payload: "systemd-units", superuser: "try" });
+            let fields = null;
+
+            function record_row(row) {
+                const u = { };
+                fields.forEach((field, i) => { u[field] = row[i] });
+
+                if (!u.path) {
+                    // A template, create a fake unit for it
+                    units_by_path[u.id] = {
+                        Id: u.id,
+                        Description: cockpit.format(_("$0 Template"), u.id),
+                        UnitFileState: u["unit-file-state"],
+                        is_timer: (u.id.slice(-5) == "timer")
+                    };
+                    path_by_id[u.id] = u.id;
+                    return;
+                }
+
+                const unit = get_unit(u.path);
+                unit.Id = u.id;
+                unit.Description = u.description;
+                unit.LoadState = u["load-state"];
+                unit.ActiveState = u["active-state"];
+                unit.SubState = u["sub-state"];
+                unit.UnitFileState = u["unit-file-state"] || undefined;
+                unit.aliases = u.aliases;
+                path_by_id[unit.Id] = unit.path;
+                update_computed_properties(unit);
+            }
+
+            channel.addEventListener("message", (event, data) => {
+                const msg = JSON.parse(data);
+                if (msg.fields) {
+                    fields = msg.fields;
+                    Object.keys(units_by_path).forEach(key => { delete units_by_path[key] });
+                    msg.units.forEach(record_row);
+                } else {
+                    msg.changed.forEach(record_row);
+                    msg.removed.forEach(id => {
+                        delete units_by_path[path_by_id[id] || id];
+                    });
+                }
+                process_failed_units();
+                render();
+            });
+
+            channel.addEventListener("close", (event, options) => {
+                if (!fields) {
+                    console.log("systemd-units channel failed, listing units directly:", options.problem);
+                    watch_units_legacy();
+                } else if (options.problem) {
+                    console.warn("systemd-units channel closed:", options.message || options.problem);
+                }
+            });
+        }
 
         $('#services-dropdown').on('change', render);
 
-        update_all();
+        watch_units();
     }
 
     var cur_unit_id;
@@ -835,7 +902,7 @@ $(function() {
     });
 
     function update_time() {
-        cockpit.spawn(["cat", "/proc/uptime"])
+        cockpit.spawn(["cat", "/proc/uptime"], { cache: 0 })
                 .fail(function(err) {
                     console.log(err);
                 })
@@ -844,7 +911,7 @@ $(function() {
                     var uptime = parseFloat(contents.split(' ')[0]);
                     clock_monotonic_now = parseInt(uptime * 1000000, 10);
                 });
-        cockpit.spawn(["date", "+%s"])
+        cockpit.spawn(["date", "+%s"], { cache: 0 })
                 .fail(function(err) {
                     console.log(err);
                 })
@@ -473,7 +473,7 @@ PageAccountsCreate.prototype = {
         var tasks = [
             () => {
                 const dfd = cockpit.defer();
-                cockpit.spawn(["/usr/sbin/useradd", "-D"])
+                cockpit.spawn(["/usr/sbin/useradd", "-D"], { cache: 60 * 1000 })
                         .done(defaults => {
                             defaults.split("\n").forEach(item => {
                                 if (item.indexOf("SHELL=") === 0) {
@@ -3259,6 +3259,10 @@ function factory() {
                         options.type = msg.type;
                     if (msg.flags)
                         options.flags = msg.flags;
+                    if (msg.generation !== undefined) {
+                        options.generation = msg.generation;
+                        options.resumed = !!msg.resumed;
+                    }
                     dfd.resolve(msg.reply[0] || [], options);
                     delete calls[msg.id];
                 }
@@ -3289,7 +3293,7 @@ function factory() {
                 } else if (msg.call) {
                     handle(msg.call, msg.id);
                 } else if (msg.notify) {
-                    notify(msg.notify);
+                    notify(msg.notify, msg.generation);
                 } else if (msg.meta) {
                     meta(msg.meta);
                 } else if (msg.owner !== undefined) {
@@ -3328,7 +3332,7 @@ function factory() {
             meta(data);
         };
 
-        function notify(data) {
+        function notify(data, generation) {
             ensure_cache();
             var path, iface, props;
             for (path in data) {
@@ -3340,7 +3344,10 @@ function factory() {
                         cache.update(path, iface, props);
                 }
             }
-            self.dispatchEvent("notify", data);
+            if (generation !== undefined)
+                self.dispatchEvent("notify", data, generation);
+            else
+                self.dispatchEvent("notify", data);
         }
 
         this.notify = notify;
@@ -3446,7 +3453,7 @@ function factory() {
             };
         };
 
-        self.watch = function watch(path) {
+        self.watch = function watch(path, options) {
             var match;
             if (is_plain_object(path))
                 match = extend({ }, path);
@@ -3457,7 +3464,7 @@ function factory() {
             last_cookie++;
             var dfd = cockpit.defer();
 
-            var msg = JSON.stringify({ watch: match, id: id });
+            var msg = JSON.stringify(extend({ }, options, { watch: match, id: id }));
             if (send(msg))
                 calls[id] = dfd;
             else
@@ -3818,33 +3825,149 @@ function factory() {
 
         var watch_channel = null;
         var watch_tag;
+        var watch_content;
+
+        /* Set when the bridge can't watch with fsread1 */
+        var watch_fallback = false;
+
+        function open_fswatch_channel() {
+            var opts = extend({ }, base_channel_options, {
+                payload: "fswatch1",
+                path: path
+            });
+            watch_channel = cockpit.channel(opts);
+            watch_channel.addEventListener("message", function (event, message_string) {
+                var message;
+                try { message = JSON.parse(message_string) } catch (e) { message = null }
+                if (message && message.path == path && message.tag && message.tag != watch_tag)
+                    read();
+            });
+        }
+
+        /*
+         * The bridge sends the initial content and each later change as
+         * a "change" control message, followed by the bytes between the
+         * unchanged head and tail of the file.
+         */
+        function open_fsread_watch_channel() {
+            var opts = extend({ }, base_channel_options, {
+                payload: "fsread1",
+                path: path,
+                watch: true,
+                binary: "raw"
+            });
+
+            var channel = cockpit.channel(opts);
+            var data = null;
+            var tag = null;
+            var change = null;
+            var parts = [];
+            var received = 0;
+            var changes = 0;
+
+            function slice(array, beg, end) {
+                return array.subarray ? array.subarray(beg, end) : array.slice(beg, end);
+            }
+
+            function apply_change() {
+                var length = data ? data.length : 0;
+                var buffers = [];
+                if (change.prefix)
+                    buffers.push(slice(data, 0, change.prefix));
+                buffers.push.apply(buffers, parts);
+                if (change.suffix)
+                    buffers.push(slice(data, length - change.suffix, length));
+
+                tag = change.tag;
+                data = (tag == "-") ? null : join_data(buffers, true);
+                change = null;
+                parts = [];
+                received = 0;
+
+                if (tag == watch_tag)
+                    return;
+
+                var content = null;
+                if (data) {
+                    try {
+                        content = parse(binary ? data : cockpit.utf8_decoder().decode(data));
+                    } catch (e) {
+                        fire_watch_callbacks(null, null, e);
+                        return;
+                    }
+                }
+
+                fire_watch_callbacks(content, tag);
+            }
+
+            channel.addEventListener("control", function (event, message) {
+                if (channel !== watch_channel || message.command != "change")
+                    return;
+
+                changes += 1;
+                if ((message.base || null) !== tag ||
+                    message.prefix + message.suffix > (data ? data.length : 0)) {
+                    /* Out of step with the bridge, start again */
+                    watch_channel.close();
+                    watch_channel = null;
+                    ensure_watch_channel();
+                    return;
+                }
+
+                change = message;
+                if (change.size - change.prefix - change.suffix <= 0)
+                    apply_change();
+            });
+
+            channel.addEventListener("message", function (event, payload) {
+                if (channel !== watch_channel)
+                    return;
+
+                parts.push(payload);
+                received += payload.length;
+                if (change && received >= change.size - change.prefix - change.suffix)
+                    apply_change();
+            });
+
+            channel.addEventListener("close", function (event, message) {
+                if (channel !== watch_channel)
+                    return;
+
+                watch_channel = null;
+                watch_fallback = true;
+
+                ensure_watch_channel();
+                if (message.problem)
+                    fire_watch_callbacks(null, null, new BasicError(message.problem, message.message));
+                else if (changes === 0)
+                    read(); /* An older bridge just read the file and closed */
+            });
+
+            watch_channel = channel;
+        }
 
         function ensure_watch_channel() {
             if (n_watch_callbacks > 0) {
                 if (watch_channel)
                     return;
-
-                var opts = extend({ }, base_channel_options, {
-                    payload: "fswatch1",
-                    path: path
-                });
-                watch_channel = cockpit.channel(opts);
-                watch_channel.addEventListener("message", function (event, message_string) {
-                    var message;
-                    try { message = JSON.parse(message_string) } catch (e) { message = null }
-                    if (message && message.path == path && message.tag && message.tag != watch_tag)
-                        read();
-                });
+                if (watch_fallback)
+                    open_fswatch_channel();
+                else
+                    open_fsread_watch_channel();
             } else {
                 if (watch_channel) {
-                    watch_channel.close();
+                    var channel = watch_channel;
                     watch_channel = null;
+                    channel.close();
                 }
+                watch_tag = null;
+                watch_content = undefined;
             }
         }
 
         function fire_watch_callbacks(/* content, tag, error */) {
             watch_tag = arguments[1] || null;
+            watch_content = arguments[2] ? undefined : arguments[0];
             invoke_functions(watch_callbacks, self, arguments);
         }
 
@@ -3852,10 +3975,19 @@ function factory() {
             if (callback)
                 watch_callbacks.push(callback);
             n_watch_callbacks += 1;
-            ensure_watch_channel();
 
-            watch_tag = null;
-            read();
+            if (watch_fallback) {
+                ensure_watch_channel();
+                watch_tag = null;
+                read();
+            } else if (watch_channel) {
+                /* Already watching, hand out what we have */
+                if (watch_content !== undefined)
+                    fire_watch_callbacks(watch_content, watch_tag);
+            } else {
+                watch_tag = null;
+                ensure_watch_channel();
+            }
 
             return {
                 remove: function () {
@@ -3872,17 +4004,109 @@ function factory() {
         }
 
         function close() {
+            var cancel_watch = watch_channel && !watch_fallback && !read_channel;
             if (read_channel)
                 read_channel.close("cancelled");
             if (replace_channel)
                 replace_channel.close("cancelled");
-            if (watch_channel)
-                watch_channel.close("cancelled");
+            if (watch_channel) {
+                var channel = watch_channel;
+                watch_channel = null;
+                channel.close("cancelled");
+            }
+            /* A pending read tells the watchers itself */
+            if (cancel_watch)
+                fire_watch_callbacks(null, null, new BasicError("cancelled"));
         }
 
         return self;
     };
 
+    cockpit.read_files = function read_files(paths, options) {
+        var dfd = cockpit.defer();
+        var contents = { };
+        var tags = { };
+
+        function path_of(entry) {
+            return (typeof entry === "string") ? entry : entry.path;
+        }
+
+        /* Older bridges don't know fsread-multi1, read one at a time */
+        function read_each() {
+            var remaining = paths.length;
+            if (remaining === 0)
+                dfd.resolve(contents, tags);
+            paths.forEach(function(entry) {
+                var path = path_of(entry);
+                var file_options = options;
+                if (typeof entry !== "string" && entry.max_read_size !== undefined)
+                    file_options = extend({ }, options, { max_read_size: entry.max_read_size });
+                var file = cockpit.file(path, file_options);
+                file.read()
+                        .done(function(content, tag) {
+                            contents[path] = content;
+                            tags[path] = tag;
+                            remaining -= 1;
+                            if (remaining === 0)
+                                dfd.resolve(contents, tags);
+                        })
+                        .fail(function(error) {
+                            dfd.reject(error);
+                        })
+                        .always(function() {
+                            file.close();
+                        });
+            });
+        }
+
+        var opts = extend({ }, options, {
+            payload: "fsread-multi1",
+            paths: paths
+        });
+
+        var channel = cockpit.channel(opts);
+        var parts = [];
+        channel.addEventListener("message", function(event, message) {
+            parts.push(message);
+        });
+        channel.addEventListener("close", function(event, message) {
+            if (message.problem == "not-supported") {
+                read_each();
+                return;
+            } else if (message.problem) {
+                dfd.reject(new BasicError(message.problem, message.message));
+                return;
+            }
+
+            var results;
+            try {
+                results = JSON.parse(parts.join(""));
+            } catch (ex) {
+                dfd.reject(ex);
+                return;
+            }
+
+            var i, path, result;
+            for (i = 0; i < paths.length; i++) {
+                path = path_of(paths[i]);
+                result = results[path];
+                if (!result) {
+                    dfd.reject(new BasicError("internal-error", "no result for " + path));
+                    return;
+                } else if (result.problem) {
+                    dfd.reject(new BasicError(result.problem, result.message));
+                    return;
+                }
+                contents[path] = (result.tag == "-") ? null : result.content;
+                tags[path] = result.tag;
+            }
+
+            dfd.resolve(contents, tags);
+        });
+
+        return dfd.promise;
+    };
+
     /* ---------------------------------------------------------------------
      * Localization
      */
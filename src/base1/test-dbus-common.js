@@ -797,6 +797,43 @@ function common_dbus_tests(channel_options, bus_name) { // eslint-disable-line n
                 });
     });
 
+    QUnit.test("watch generation", function (assert) {
+        const done = assert.async();
+        assert.expect(6);
+
+        var last;
+        var first = cockpit.dbus(bus_name, channel_options);
+        $(first).on("notify", function(event, data, generation) {
+            last = generation;
+        });
+        first.watch({ path_namespace: "/otree" }, { generation: null })
+                .done(function(reply, options) {
+                    assert.equal(typeof options.generation, "string", "has generation");
+                    assert.equal(last, options.generation, "notify had generation");
+                    $(first).off();
+                    first.close();
+
+                    last = undefined;
+                    var notified = 0;
+                    var second = cockpit.dbus(bus_name, channel_options);
+                    $(second).on("notify", function(event, data, generation) {
+                        notified += 1;
+                        last = generation;
+                    });
+
+                    second.watch({ path_namespace: "/otree" }, { generation: options.generation })
+                            .done(function(reply, options) {
+                                assert.equal(typeof options.generation, "string", "has new generation");
+                                assert.strictEqual(options.resumed, true, "resumed");
+                                assert.equal(notified, 0, "nothing changed");
+                                assert.strictEqual(last, undefined, "no notify");
+                                $(second).off();
+                                second.close();
+                                done();
+                            });
+                });
+    });
+
     QUnit.test("watch interfaces", function (assert) {
         const done = assert.async();
         assert.expect(3);
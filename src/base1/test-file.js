@@ -428,6 +428,38 @@ QUnit.test("syntax watching", function (assert) {
     }
 });
 
+QUnit.test("watching changes", function (assert) {
+    const done = assert.async();
+    assert.expect(4);
+
+    var file = cockpit.file(dir + "/watched");
+    var watch;
+
+    var n = 0;
+    function changed(content, tag) {
+        n += 1;
+        if (n == 1) {
+            assert.equal(content, "line 1\nline 2\n", "initial content");
+            cockpit.spawn(["bash", "-c", "echo line 3 >> " + dir + "/watched"]);
+        } else if (n == 2) {
+            assert.equal(content, "line 1\nline 2\nline 3\n", "appended content");
+            cockpit.spawn(["sed", "-i", "s/line 2/second line/", dir + "/watched"]);
+        } else if (n == 3) {
+            assert.equal(content, "line 1\nsecond line\nline 3\n", "changed content");
+            cockpit.spawn(["truncate", "-s", "7", dir + "/watched"]);
+        } else if (n == 4) {
+            assert.equal(content, "line 1\n", "truncated content");
+            watch.remove();
+            done();
+        }
+    }
+
+    cockpit.spawn(["bash", "-c", "printf 'line 1\nline 2\n' > " + dir + "/watched"])
+            .done(function () {
+                watch = file.watch(changed);
+            });
+});
+
 QUnit.test("closing", function (assert) {
     const done = assert.async();
     assert.expect(2);
@@ -477,6 +509,36 @@ QUnit.test("channel options", function (assert) {
             });
 });
 
+QUnit.test("read many files", function (assert) {
+    const done = assert.async();
+    assert.expect(6);
+    cockpit.read_files([dir + "/foo", dir + "/blah", { path: dir + "/foo.json", max_read_size: 100 }])
+            .done(function(contents, tags) {
+                assert.equal(contents[dir + "/foo"], "1234\n", "correct content");
+                assert.equal(contents[dir + "/blah"], null, "non-existent is null");
+                assert.equal(tags[dir + "/blah"], "-", "non-existent tag");
+                assert.ok(tags[dir + "/foo"].length > 1, "got tag");
+                assert.equal(JSON.parse(contents[dir + "/foo.json"]).foo, 12, "correct json");
+            })
+            .always(function() {
+                assert.equal(this.state(), "resolved", "didn't fail");
+                done();
+            });
+});
+
+QUnit.test("read many files too large", function (assert) {
+    const done = assert.async();
+    assert.expect(2);
+    cockpit.read_files([dir + "/foo"], { max_read_size: 2 })
+            .fail(function(error) {
+                assert.equal(error.problem, "too-large", "got error");
+            })
+            .always(function() {
+                assert.equal(this.state(), "rejected", "failed");
+                done();
+            });
+});
+
 QUnit.test("remove testdir", function (assert) {
     const done = assert.async();
     assert.expect(1);
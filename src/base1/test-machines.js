@@ -234,6 +234,35 @@ QUnit.test("updating and existing delta file", function (assert) {
             });
 });
 
+QUnit.test("Changed signal only has changed machines", function (assert) {
+    const done = assert.async();
+    assert.expect(3);
+
+    var subscription = null;
+
+    cockpit.file(configDir + "/cockpit/machines.d/01-green.json")
+            .replace('{"green": {"address": "1.2.3.4"}, "blue": {"address": "fe80::1"}}')
+            .then(() => dbus.call("/machines", "org.freedesktop.DBus.Properties",
+                                  "Get", ["cockpit.Machines", "Machines"], { type: "ss" }))
+            /* Let the signals for writing the file above go out first */
+            .then(() => new Promise(resolve => window.setTimeout(resolve, 500)))
+            .then(function() {
+                subscription = dbus.subscribe({ path: "/machines", interface: "cockpit.Machines", member: "Changed" },
+                                              function(path, iface, signal, args) {
+                                                  if (!args[0].green || !args[0].green.color)
+                                                      return;
+                                                  assert.deepEqual(Object.keys(args[0]), ["green"], "only green changed");
+                                                  assert.equal(args[0].green.color.v, "pitchblack", "new property");
+                                                  assert.deepEqual(args[1], [], "nothing removed");
+                                                  subscription.remove();
+                                                  done();
+                                              });
+                return dbus.call("/machines", "cockpit.Machines", "Update",
+                                 ["99-webui.json", "green", { color: cockpit.variant('s', "pitchblack") }],
+                                 { type: "ssa{sv}" });
+            });
+});
+
 /* The test cockpit-bridge gets started with temp $XDG_CONFIG_DIRS instead of defaulting to /etc/.
  * Read it from the bridge so that we can put our test files into it. */
 var proxy = dbus.proxy("cockpit.Environment", "/environment");
@@ -22,12 +22,15 @@
 #include "cockpitdbusinternal.h"
 #include "cockpitdbusjson.h"
 #include "cockpitechochannel.h"
+#include "cockpitfsarchive.h"
 #include "cockpitfslist.h"
 #include "cockpitfsread.h"
+#include "cockpitfsreadmulti.h"
 #include "cockpitfswatch.h"
 #include "cockpitfsreplace.h"
 #include "cockpithttpstream.h"
 #include "cockpitinteracttransport.h"
+#include "cockpitnfsmounts.h"
 #include "cockpitnullchannel.h"
 #include "cockpitpackages.h"
 #include "cockpitpacketchannel.h"
@@ -35,6 +38,7 @@
 #include "cockpitinternalmetrics.h"
 #include "cockpitpolkitagent.h"
 #include "cockpitrouter.h"
+#include "cockpitsystemdunits.h"
 #include "cockpitwebsocketstream.h"
 
 #include "common/cockpitassets.h"
@@ -66,6 +70,10 @@
 
 static CockpitPackages *packages = NULL;
 
+static gint64 startup_time = 0;
+
+static gboolean accept_shm = FALSE;
+
 static CockpitPayloadType payload_types[] = {
   { "dbus-json3", cockpit_dbus_json_get_type },
   { "http-stream1", cockpit_http_stream_get_type },
@@ -73,9 +81,13 @@ static CockpitPayloadType payload_types[] = {
   { "stream", cockpit_pipe_channel_get_type },
   { "packet", cockpit_packet_channel_get_type },
   { "fsread1", cockpit_fsread_get_type },
+  { "fsread-multi1", cockpit_fsread_multi_get_type },
   { "fsreplace1", cockpit_fsreplace_get_type },
   { "fswatch1", cockpit_fswatch_get_type },
   { "fslist1", cockpit_fslist_get_type },
+  { "fsarchive1", cockpit_fsarchive_get_type },
+  { "systemd-units", cockpit_systemd_units_get_type },
+  { "nfs-mounts1", cockpit_nfs_mounts_get_type },
   { "null", cockpit_null_channel_get_type },
   { "echo", cockpit_echo_channel_get_type },
   { "websocket-stream1", cockpit_web_socket_stream_get_type },
@@ -124,6 +136,7 @@ send_init_command (CockpitTransport *transport,
   const gchar *checksum;
   JsonObject *object;
   JsonObject *block;
+  JsonArray *capabilities;
   GHashTable *os_release;
   gchar **names;
   GBytes *bytes;
@@ -144,13 +157,14 @@ send_init_command (CockpitTransport *transport,
     }
   else
     {
-      checksum = cockpit_packages_get_checksum (packages);
+      /* Without a package server there is nothing to announce */
+      checksum = packages ? cockpit_packages_get_checksum (packages) : NULL;
       if (checksum)
         json_object_set_string_member (object, "checksum", checksum);
 
       /* This is encoded as an object to allow for future expansion */
       block = json_object_new ();
-      names = cockpit_packages_get_names (packages);
+      names = packages ? cockpit_packages_get_names (packages) : NULL;
       for (i = 0; names && names[i] != NULL; i++)
         json_object_set_null_member (block, names[i]);
       json_object_set_object_member (object, "packages", block);
@@ -169,6 +183,14 @@ send_init_command (CockpitTransport *transport,
       session_id = secure_getenv ("XDG_SESSION_ID");
       if (session_id)
         json_object_set_string_member (object, "session-id", session_id);
+
+      /* Set up in run_bridge() when we talk over a local socket */
+      if (accept_shm)
+        {
+          capabilities = json_array_new ();
+          json_array_add_string_element (capabilities, "shm");
+          json_object_set_array_member (object, "capabilities", capabilities);
+        }
     }
 
   bytes = cockpit_json_write_bytes (object);
@@ -188,14 +210,15 @@ setup_dbus_daemon (gpointer addrfd)
   cockpit_unix_fd_close_all (3, GPOINTER_TO_INT (addrfd));
 }
 
+/*
+ * Launches dbus-daemon but doesn't wait for it to print its address,
+ * so that the daemon can start up while we do other work. Call
+ * read_dbus_address() with the returned @addrfd to finish up.
+ */
 static GPid
-start_dbus_daemon (void)
+start_dbus_daemon (gint *addrfd_out)
 {
   GError *error = NULL;
-  GString *address = NULL;
-  gchar *line;
-  gsize len;
-  gssize ret;
   GPid pid = 0;
   gchar *print_address = NULL;
   int addrfd[2] = { -1, -1 };
@@ -239,20 +262,39 @@ start_dbus_daemon (void)
     }
 
   g_debug ("launched %s", dbus_argv[0]);
+  *addrfd_out = addrfd[0];
+  addrfd[0] = -1;
+
+out:
+  if (addrfd[0] >= 0)
+    close (addrfd[0]);
+  g_free (print_address);
+  return pid;
+}
+
+static gchar *
+read_dbus_address (gint addrfd)
+{
+  GString *address;
+  gchar *line;
+  gsize len;
+  gssize ret;
 
   address = g_string_new ("");
   for (;;)
     {
       len = address->len;
       g_string_set_size (address, len + 256);
-      ret = read (addrfd[0], address->str + len, 256);
+      ret = read (addrfd, address->str + len, 256);
       if (ret < 0)
         {
           g_string_set_size (address, len);
           if (errno != EAGAIN && errno != EINTR)
             {
               g_warning ("couldn't read address from dbus-daemon: %s", g_strerror (errno));
-              goto out;
+              g_string_free (address, TRUE);
+              close (addrfd);
+              return NULL;
             }
         }
       else if (ret == 0)
@@ -272,23 +314,17 @@ start_dbus_daemon (void)
         }
     }
 
+  close (addrfd);
+
   if (address->str[0] == '\0')
     {
       g_message ("dbus-daemon didn't send us a dbus address; not installed?");
-    }
-  else
-    {
-      g_setenv ("DBUS_SESSION_BUS_ADDRESS", address->str, TRUE);
-      g_debug ("session bus address: %s", address->str);
+      g_string_free (address, TRUE);
+      return NULL;
     }
 
-out:
-  if (addrfd[0] >= 0)
-    close (addrfd[0]);
-  if (address)
-    g_string_free (address, TRUE);
-  g_free (print_address);
-  return pid;
+  g_debug ("session bus address: %s", address->str);
+  return g_string_free (address, FALSE);
 }
 
 static void
@@ -433,21 +469,13 @@ update_router (CockpitRouter *router,
 }
 
 static CockpitRouter *
-setup_router (CockpitTransport *transport,
-              gboolean privileged_slave)
+setup_router (CockpitTransport *transport)
 {
   CockpitRouter *router = NULL;
 
-  packages = cockpit_packages_new ();
-
   router = cockpit_router_new (transport, payload_types, NULL);
   add_router_channels (router);
 
-  /* This has to happen after add_router_channels as the
-   * packages based bridges should have priority.
-   */
-  update_router (router, privileged_slave);
-
   return router;
 }
 
@@ -463,6 +491,87 @@ call_update_router (gconstpointer user_data)
   update_router (data->router, data->privileged_slave);
 }
 
+/*
+ * Startup timing, use G_MESSAGES_DEBUG=cockpit-bridge to see it.
+ */
+static void
+trace_startup (const gchar *phase)
+{
+  g_debug ("startup: %s after %" G_GINT64_FORMAT " ms", phase,
+           (g_get_monotonic_time () - startup_time) / 1000);
+}
+
+/*
+ * Everything that doesn't depend on the package listing happens in
+ * run_bridge() while the packages are walked in a thread. The rest
+ * of the startup, and the "init" message which carries the package
+ * names and checksum, follows here once the listing is complete.
+ */
+struct StartupData {
+  CockpitTransport *transport;
+  struct CallUpdateRouterData update;
+  gboolean interactive;
+  gint daemon_fd;
+  gboolean listed;
+};
+
+static void
+finish_startup (struct StartupData *data)
+{
+  gchar *address;
+
+  /*
+   * Don't touch the environment while the package thread is running,
+   * reading the login messages consumes their environment variable.
+   */
+  cockpit_dbus_login_messages_startup ();
+
+  if (data->daemon_fd >= 0)
+    {
+      address = read_dbus_address (data->daemon_fd);
+      data->daemon_fd = -1;
+      if (address)
+        g_setenv ("DBUS_SESSION_BUS_ADDRESS", address, TRUE);
+      g_free (address);
+      trace_startup ("session bus ready");
+    }
+
+  /* This has to happen after add_router_channels as the
+   * packages based bridges should have priority.
+   */
+  if (packages)
+    {
+      update_router (data->update.router, data->update.privileged_slave);
+      cockpit_packages_dbus_startup (packages);
+      cockpit_packages_on_change (packages, call_update_router, &data->update);
+    }
+
+  if (!data->interactive)
+    {
+      send_init_command (data->transport, FALSE);
+      trace_startup ("sent init");
+    }
+}
+
+static void
+on_packages_ready (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+  struct StartupData *data = user_data;
+
+  packages = cockpit_packages_new_finish (result);
+  data->listed = TRUE;
+  if (packages)
+    trace_startup ("packages listed");
+  else
+    g_message ("couldn't start package server, continuing without packages");
+
+  /* Otherwise run_bridge() is still busy and will finish up itself */
+  if (data->transport)
+    finish_startup (data);
+}
+
 static int
 run_bridge (const gchar *interactive,
             gboolean privileged_slave)
@@ -481,7 +590,9 @@ run_bridge (const gchar *interactive,
   guint sig_int;
   int outfd;
   uid_t uid;
-  struct CallUpdateRouterData call_update_router_data;
+  struct StartupData startup_data = { NULL, { NULL, FALSE }, FALSE, -1, FALSE };
+
+  startup_time = g_get_monotonic_time ();
 
   /*
    * This process talks on stdin/stdout. However lots of stuff wants to write
@@ -533,15 +644,22 @@ run_bridge (const gchar *interactive,
   /* Reset the umask, typically this is done in .bashrc for a login shell */
   umask (022);
 
-  /* Start daemons if necessary */
+  /*
+   * Start daemons if necessary. The dbus-daemon address is collected
+   * later, it comes up while ssh-agent and the rest of startup run.
+   */
   if (!interactive && !privileged_slave)
     {
       if (!have_env ("DBUS_SESSION_BUS_ADDRESS"))
-        daemon_pid = start_dbus_daemon ();
+        daemon_pid = start_dbus_daemon (&startup_data.daemon_fd);
       if (!have_env ("SSH_AUTH_SOCK"))
         agent_pid = start_ssh_agent ();
+      trace_startup ("launched daemons");
     }
 
+  /* Walk the packages in a thread, see on_packages_ready() */
+  cockpit_packages_new_async (on_packages_ready, &startup_data);
+
   sig_term = g_unix_signal_add (SIGTERM, on_signal_done, &terminated);
   sig_int = g_unix_signal_add (SIGINT, on_signal_done, &interupted);
 
@@ -555,6 +673,10 @@ run_bridge (const gchar *interactive,
   else
     {
       transport = cockpit_pipe_transport_new_fds ("stdio", 0, outfd);
+
+      /* Only cockpit-ws offers shared memory, and it never talks to a privileged bridge */
+      if (!privileged_slave)
+        accept_shm = cockpit_pipe_transport_accept_shm (COCKPIT_PIPE_TRANSPORT (transport));
     }
 
   if (uid != 0)
@@ -575,25 +697,31 @@ run_bridge (const gchar *interactive,
       g_signal_connect (transport, "control", G_CALLBACK (on_logout_set_flag), &closed);
     }
 
-  router = setup_router (transport, privileged_slave);
+  router = setup_router (transport);
 
   cockpit_dbus_user_startup (pwd);
   cockpit_dbus_setup_startup ();
   cockpit_dbus_process_startup ();
   cockpit_dbus_machines_startup ();
   cockpit_dbus_config_startup ();
-  cockpit_packages_dbus_startup (packages);
-  cockpit_dbus_login_messages_startup ();
-
-  call_update_router_data.router = router;
-  call_update_router_data.privileged_slave = privileged_slave;
-  cockpit_packages_on_change (packages, call_update_router, &call_update_router_data);
+  cockpit_dbus_debug_startup ();
+  trace_startup ("internal services registered");
 
   g_free (pwd);
   pwd = NULL;
 
   g_signal_connect (transport, "closed", G_CALLBACK (on_closed_set_flag), &closed);
-  send_init_command (transport, interactive ? TRUE : FALSE);
+
+  startup_data.transport = transport;
+  startup_data.update.router = router;
+  startup_data.update.privileged_slave = privileged_slave;
+  startup_data.interactive = interactive ? TRUE : FALSE;
+
+  /* The pretend init message doesn't need the package listing */
+  if (interactive)
+    send_init_command (transport, TRUE);
+  if (startup_data.listed)
+    finish_startup (&startup_data);
 
   while (!terminated && !closed && !interupted)
     g_main_context_iteration (NULL, TRUE);
@@ -604,7 +732,10 @@ run_bridge (const gchar *interactive,
   g_object_unref (router);
   g_object_unref (transport);
 
-  cockpit_packages_on_change (packages, NULL, NULL);
+  if (packages)
+    cockpit_packages_on_change (packages, NULL, NULL);
+  if (startup_data.daemon_fd >= 0)
+    close (startup_data.daemon_fd);
 
   cockpit_dbus_machines_cleanup ();
   cockpit_dbus_internal_cleanup ();
@@ -21,6 +21,9 @@
 
 #include "cockpitconnect.h"
 
+#include "cockpitdnscache.h"
+#include "cockpittlscachesamples.h"
+
 #include "common/cockpitjson.h"
 #include "common/cockpitloopback.h"
 
@@ -28,7 +31,10 @@
 
 #include <gio/gunixsocketaddress.h>
 
+#include <sys/stat.h>
+
 #include <errno.h>
+#include <string.h>
 
 const gchar * cockpit_bridge_local_address = NULL;
 
@@ -78,10 +84,28 @@ cockpit_connectable_unref (gpointer data)
     }
 }
 
+/*
+ * Host names are looked up through the DNS cache, and the addresses
+ * are tried Happy Eyeballs style (RFC 8305): families are interleaved,
+ * and when an attempt hasn't completed after a short delay the next
+ * one is started alongside it. The first connection wins.
+ *
+ * Everything else, unix sockets, loopback and so on, is enumerated
+ * and tried one address after another.
+ */
+
+#define CONNECT_ATTEMPT_DELAY 250
+
 typedef struct {
   CockpitConnectable *connectable;
   GSocketAddressEnumerator *enumerator;
+  GQueue candidates;
   GCancellable *cancellable;
+  gulong sig_cancelled;
+  GCancellable *racing;
+  guint attempts;
+  guint delay;
+  gboolean complete;
   GIOStream *io;
   GError *error;
 } ConnectStream;
@@ -93,14 +117,51 @@ connect_stream_free (gpointer data)
   if (cs->connectable)
     cockpit_connectable_unref (cs->connectable);
   if (cs->cancellable)
-    g_object_unref (cs->cancellable);
-  g_object_unref (cs->enumerator);
+    {
+      g_cancellable_disconnect (cs->cancellable, cs->sig_cancelled);
+      g_object_unref (cs->cancellable);
+    }
+  g_object_unref (cs->racing);
+  if (cs->enumerator)
+    g_object_unref (cs->enumerator);
+  while (!g_queue_is_empty (&cs->candidates))
+    g_object_unref (g_queue_pop_head (&cs->candidates));
   g_clear_error (&cs->error);
   if (cs->io)
     g_object_unref (cs->io);
   g_free (cs);
 }
 
+static void
+connect_set_error (ConnectStream *cs,
+                   GError *error)
+{
+  g_clear_error (&cs->error);
+  cs->error = error;
+}
+
+static void
+connect_complete (GSimpleAsyncResult *simple)
+{
+  ConnectStream *cs = g_simple_async_result_get_op_res_gpointer (simple);
+
+  if (cs->complete)
+    return;
+
+  cs->complete = TRUE;
+  if (cs->delay)
+    g_source_remove (cs->delay);
+  cs->delay = 0;
+
+  /* Stop any attempts that lost the race */
+  g_cancellable_cancel (cs->racing);
+
+  g_simple_async_result_complete (simple);
+}
+
+static void
+connect_next (GSimpleAsyncResult *simple);
+
 static void
 on_address_next (GObject *object,
                  GAsyncResult *result,
@@ -116,18 +177,23 @@ on_socket_connect (GObject *object,
   CockpitConnectable *connectable = cs->connectable;
   GError *error = NULL;
 
-  g_socket_connection_connect_finish (G_SOCKET_CONNECTION (object), result, &error);
+  g_assert (cs->attempts > 0);
+  cs->attempts--;
 
-  g_debug ("%s: connected", connectable->name);
+  g_socket_connection_connect_finish (G_SOCKET_CONNECTION (object), result, &error);
 
-  if (error)
+  if (cs->complete)
+    {
+      /* Another attempt already won, or we gave up */
+      g_clear_error (&error);
+    }
+  else if (error)
     {
       g_debug ("%s: couldn't connect: %s", connectable->name, error->message);
-      g_clear_error (&cs->error);
-      cs->error = error;
+      connect_set_error (cs, error);
 
-      g_socket_address_enumerator_next_async (cs->enumerator, cs->cancellable,
-                                              on_address_next, g_object_ref (simple));
+      /* Don't wait for the delay when an attempt fails */
+      connect_next (simple);
     }
   else
     {
@@ -139,6 +205,7 @@ on_socket_connect (GObject *object,
           if (cs->io)
             {
               g_debug ("%s: tls handshake", connectable->name);
+              cockpit_tls_cache_stats ()->connections++;
 
               g_tls_client_connection_set_validation_flags (G_TLS_CLIENT_CONNECTION (cs->io),
                                                             connectable->tls_flags);
@@ -155,8 +222,7 @@ on_socket_connect (GObject *object,
           else if (error)
             {
               g_debug ("%s: couldn't open tls connection: %s", connectable->name, error->message);
-              g_clear_error (&cs->error);
-              cs->error = error;
+              connect_set_error (cs, error);
             }
         }
       else
@@ -164,13 +230,94 @@ on_socket_connect (GObject *object,
           cs->io = g_object_ref (object);
         }
 
-      g_simple_async_result_complete (simple);
+      connect_complete (simple);
     }
 
   g_object_unref (object);
   g_object_unref (simple);
 }
 
+static gboolean
+on_connect_delay (gpointer user_data)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (user_data);
+  ConnectStream *cs = g_simple_async_result_get_op_res_gpointer (simple);
+
+  g_debug ("%s: trying next address", cs->connectable->name);
+
+  cs->delay = 0;
+  connect_next (simple);
+  return FALSE;
+}
+
+static gboolean
+connect_attempt (GSimpleAsyncResult *simple,
+                 GSocketAddress *address)
+{
+  ConnectStream *cs = g_simple_async_result_get_op_res_gpointer (simple);
+  GSocketConnection *connection;
+  GError *error = NULL;
+  GSocket *sock;
+
+  sock = g_socket_new (g_socket_address_get_family (address), G_SOCKET_TYPE_STREAM, 0, &error);
+  if (!sock)
+    {
+      g_debug ("%s: couldn't open socket: %s", cs->connectable->name, error->message);
+      connect_set_error (cs, error);
+      return FALSE;
+    }
+
+  g_socket_set_blocking (sock, FALSE);
+
+  connection = g_socket_connection_factory_create_connection (sock);
+  g_object_unref (sock);
+
+  cs->attempts++;
+  g_socket_connection_connect_async (connection, address, cs->racing,
+                                     on_socket_connect, g_object_ref (simple));
+
+  /* Don't let a slow address hold up the others */
+  if (!g_queue_is_empty (&cs->candidates))
+    {
+      cs->delay = g_timeout_add_full (G_PRIORITY_DEFAULT, CONNECT_ATTEMPT_DELAY, on_connect_delay,
+                                      g_object_ref (simple), g_object_unref);
+    }
+
+  return TRUE;
+}
+
+static void
+connect_next (GSimpleAsyncResult *simple)
+{
+  ConnectStream *cs = g_simple_async_result_get_op_res_gpointer (simple);
+  GSocketAddress *address;
+
+  if (cs->complete)
+    return;
+
+  if (cs->delay)
+    g_source_remove (cs->delay);
+  cs->delay = 0;
+
+  while ((address = g_queue_pop_head (&cs->candidates)))
+    {
+      gboolean started = connect_attempt (simple, address);
+      g_object_unref (address);
+      if (started)
+        return;
+    }
+
+  if (cs->enumerator)
+    {
+      g_socket_address_enumerator_next_async (cs->enumerator, cs->cancellable,
+                                              on_address_next, g_object_ref (simple));
+    }
+  else if (cs->attempts == 0)
+    {
+      connect_complete (simple);
+    }
+}
+
 static void
 on_address_next (GObject *object,
                  GAsyncResult *result,
@@ -179,10 +326,8 @@ on_address_next (GObject *object,
   GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (user_data);
   ConnectStream *cs = g_simple_async_result_get_op_res_gpointer (simple);
   CockpitConnectable *connectable = cs->connectable;
-  GSocketConnection *connection;
   GSocketAddress *address;
   GError *error = NULL;
-  GSocket *sock;
 
   address = g_socket_address_enumerator_next_finish (G_SOCKET_ADDRESS_ENUMERATOR (object),
                                                      result, &error);
@@ -190,43 +335,102 @@ on_address_next (GObject *object,
   if (error)
     {
       g_debug ("%s: couldn't resolve: %s", connectable->name, error->message);
-      g_clear_error (&cs->error);
-      cs->error = error;
-      g_simple_async_result_complete (simple);
+      connect_set_error (cs, error);
+      connect_complete (simple);
     }
   else if (address)
     {
-      sock = g_socket_new (g_socket_address_get_family (address), G_SOCKET_TYPE_STREAM, 0, &error);
-      if (sock)
-        {
-          g_socket_set_blocking (sock, FALSE);
-
-          connection = g_socket_connection_factory_create_connection (sock);
-          g_object_unref (sock);
-
-          g_socket_connection_connect_async (connection, address, cs->cancellable,
-                                             on_socket_connect, g_object_ref (simple));
-        }
-
-      if (error)
-        {
-          g_debug ("%s: couldn't open socket: %s", connectable->name, error->message);
-          g_clear_error (&cs->error);
-          cs->error = error;
-          g_simple_async_result_complete (simple);
-        }
+      if (!connect_attempt (simple, address))
+        connect_next (simple);
       g_object_unref (address);
     }
   else
     {
       if (!cs->error)
           g_message ("%s: no addresses found", connectable->name);
-      g_simple_async_result_complete (simple);
+      g_clear_object (&cs->enumerator);
+      connect_next (simple);
+    }
+
+  g_object_unref (simple);
+}
+
+static void
+on_address_resolved (GObject *object,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (user_data);
+  ConnectStream *cs = g_simple_async_result_get_op_res_gpointer (simple);
+  CockpitConnectable *connectable = cs->connectable;
+  GQueue preferred = G_QUEUE_INIT;
+  GQueue other = G_QUEUE_INIT;
+  GList *addresses, *l;
+  GSocketFamily family;
+  GSocketAddress *address;
+  GError *error = NULL;
+  guint16 port;
+
+  addresses = cockpit_dns_cache_lookup_finish (result, &error);
+  if (error)
+    {
+      g_debug ("%s: couldn't resolve: %s", connectable->name, error->message);
+      connect_set_error (cs, error);
+      connect_complete (simple);
+    }
+  else
+    {
+      if (!addresses)
+        g_message ("%s: no addresses found", connectable->name);
+
+      /* Alternate address families, starting with the preferred one */
+      port = g_network_address_get_port (G_NETWORK_ADDRESS (connectable->address));
+      family = addresses ? g_inet_address_get_family (addresses->data) : G_SOCKET_FAMILY_INVALID;
+      for (l = addresses; l != NULL; l = g_list_next (l))
+        {
+          address = g_inet_socket_address_new (l->data, port);
+          if (g_inet_address_get_family (l->data) == family)
+            g_queue_push_tail (&preferred, address);
+          else
+            g_queue_push_tail (&other, address);
+        }
+      while (!g_queue_is_empty (&preferred) || !g_queue_is_empty (&other))
+        {
+          if (!g_queue_is_empty (&preferred))
+            g_queue_push_tail (&cs->candidates, g_queue_pop_head (&preferred));
+          if (!g_queue_is_empty (&other))
+            g_queue_push_tail (&cs->candidates, g_queue_pop_head (&other));
+        }
+
+      g_resolver_free_addresses (addresses);
+      connect_next (simple);
     }
 
   g_object_unref (simple);
 }
 
+static void
+on_connect_cancelled (GCancellable *cancellable,
+                      gpointer user_data)
+{
+  g_cancellable_cancel (user_data);
+}
+
+static const gchar *
+network_hostname (GSocketConnectable *address)
+{
+  const gchar *hostname;
+
+  if (!G_IS_NETWORK_ADDRESS (address))
+    return NULL;
+
+  hostname = g_network_address_get_hostname (G_NETWORK_ADDRESS (address));
+  if (!hostname || g_hostname_is_ip_address (hostname))
+    return NULL;
+
+  return hostname;
+}
+
 void
 cockpit_connect_stream (GSocketConnectable *address,
                         GCancellable *cancellable,
@@ -248,6 +452,7 @@ cockpit_connect_stream_full (CockpitConnectable *connectable,
                              gpointer user_data)
 {
   GSimpleAsyncResult *simple;
+  const gchar *hostname;
   ConnectStream *cs;
 
   g_return_if_fail (connectable != NULL);
@@ -257,12 +462,28 @@ cockpit_connect_stream_full (CockpitConnectable *connectable,
   simple = g_simple_async_result_new (NULL, callback, user_data, cockpit_connect_stream);
   cs = g_new0 (ConnectStream, 1);
   cs->connectable = cockpit_connectable_ref (connectable);
-  cs->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
-  cs->enumerator = g_socket_connectable_enumerate (connectable->address);
+  cs->racing = g_cancellable_new ();
+  g_queue_init (&cs->candidates);
   g_simple_async_result_set_op_res_gpointer (simple, cs, connect_stream_free);
 
-  g_socket_address_enumerator_next_async (cs->enumerator, NULL,
-                                          on_address_next, g_object_ref (simple));
+  if (cancellable)
+    {
+      cs->cancellable = g_object_ref (cancellable);
+      cs->sig_cancelled = g_cancellable_connect (cancellable, G_CALLBACK (on_connect_cancelled),
+                                                 g_object_ref (cs->racing), g_object_unref);
+    }
+
+  hostname = network_hostname (connectable->address);
+  if (hostname)
+    {
+      cockpit_dns_cache_lookup_async (hostname, cs->cancellable,
+                                      on_address_resolved, g_object_ref (simple));
+    }
+  else
+    {
+      cs->enumerator = g_socket_connectable_enumerate (connectable->address);
+      connect_next (simple);
+    }
 
   g_object_unref (simple);
 }
@@ -498,39 +719,158 @@ out:
   return connectable;
 }
 
-GSocketAddress *
-cockpit_connect_parse_address (CockpitChannel *channel,
-                               gchar **possible_name)
-{
+typedef struct {
   GSocketConnectable *connectable;
-  GSocketAddressEnumerator *enumerator;
+  gchar *name;
+} ParseAddress;
+
+static void
+parse_address_free (gpointer data)
+{
+  ParseAddress *pa = data;
+  g_object_unref (pa->connectable);
+  g_free (pa->name);
+  g_free (pa);
+}
+
+static void
+on_parse_address_resolved (GObject *object,
+                           GAsyncResult *result,
+                           gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  ParseAddress *pa = g_task_get_task_data (task);
+  GError *error = NULL;
+  GList *addresses;
+  guint16 port;
+
+  addresses = cockpit_dns_cache_lookup_finish (result, &error);
+  if (error)
+    {
+      g_task_return_error (task, error);
+    }
+  else if (!addresses)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No addresses found");
+    }
+  else
+    {
+      port = g_network_address_get_port (G_NETWORK_ADDRESS (pa->connectable));
+      g_task_return_pointer (task, g_inet_socket_address_new (addresses->data, port), g_object_unref);
+    }
+
+  g_resolver_free_addresses (addresses);
+  g_object_unref (task);
+}
+
+static void
+on_parse_address_enumerated (GObject *object,
+                             GAsyncResult *result,
+                             gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
   GSocketAddress *address;
   GError *error = NULL;
-  gchar *name = NULL;
 
-  connectable = parse_address (channel, &name, NULL);
-  if (!connectable)
-    return NULL;
+  address = g_socket_address_enumerator_next_finish (G_SOCKET_ADDRESS_ENUMERATOR (object), result, &error);
+  if (error)
+    g_task_return_error (task, error);
+  else if (!address)
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No addresses found");
+  else
+    g_task_return_pointer (task, address, g_object_unref);
 
-  /* This is sync, but realistically, it doesn't matter for current use cases */
-  enumerator = g_socket_connectable_enumerate (connectable);
-  g_object_unref (connectable);
+  g_object_unref (task);
+}
 
-  address = g_socket_address_enumerator_next (enumerator, NULL, &error);
-  g_object_unref (enumerator);
+/**
+ * cockpit_connect_parse_address_async:
+ * @channel: the channel with the address options
+ * @cancellable: optional cancellable
+ * @callback: called when the address is known
+ * @user_data: data for @callback
+ *
+ * Parses the address options of @channel, and looks up the address
+ * to connect to. Host names go through the DNS cache without
+ * blocking the main loop.
+ */
+void
+cockpit_connect_parse_address_async (CockpitChannel *channel,
+                                     GCancellable *cancellable,
+                                     GAsyncReadyCallback callback,
+                                     gpointer user_data)
+{
+  GSocketAddressEnumerator *enumerator;
+  const gchar *hostname;
+  ParseAddress *pa;
+  GTask *task;
+
+  g_return_if_fail (COCKPIT_IS_CHANNEL (channel));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (channel, cancellable, callback, user_data);
+  g_task_set_source_tag (task, cockpit_connect_parse_address_async);
+
+  pa = g_new0 (ParseAddress, 1);
+  pa->connectable = parse_address (channel, &pa->name, NULL);
+  if (!pa->connectable)
+    {
+      /* The channel has already failed */
+      g_free (pa->name);
+      g_free (pa);
+      g_task_return_pointer (task, NULL, NULL);
+      g_object_unref (task);
+      return;
+    }
+
+  g_task_set_task_data (task, pa, parse_address_free);
+
+  hostname = network_hostname (pa->connectable);
+  if (hostname)
+    {
+      cockpit_dns_cache_lookup_async (hostname, cancellable, on_parse_address_resolved, task);
+    }
+  else
+    {
+      enumerator = g_socket_connectable_enumerate (pa->connectable);
+      g_socket_address_enumerator_next_async (enumerator, cancellable, on_parse_address_enumerated, task);
+      g_object_unref (enumerator);
+    }
+}
+
+/**
+ * cockpit_connect_parse_address_finish:
+ * @channel: the channel passed to cockpit_connect_parse_address_async()
+ * @result: the result passed to the callback
+ * @possible_name: location to place a name for the address
+ *
+ * If the address could not be found, @channel is failed with
+ * a "not-found" problem.
+ *
+ * Returns: (transfer full): the address or %NULL
+ */
+GSocketAddress *
+cockpit_connect_parse_address_finish (CockpitChannel *channel,
+                                      GAsyncResult *result,
+                                      gchar **possible_name)
+{
+  GSocketAddress *address;
+  GError *error = NULL;
+  ParseAddress *pa;
+
+  g_return_val_if_fail (g_task_is_valid (result, channel), NULL);
 
+  pa = g_task_get_task_data (G_TASK (result));
+  address = g_task_propagate_pointer (G_TASK (result), &error);
   if (error != NULL)
     {
-      cockpit_channel_fail (channel, "not-found", "couldn't find address: %s: %s", name, error->message);
+      cockpit_channel_fail (channel, "not-found", "couldn't find address: %s: %s", pa->name, error->message);
       g_error_free (error);
-      g_free (name);
       return NULL;
     }
 
-  if (possible_name)
-    *possible_name = name;
-  else
-    g_free (name);
+  if (address && possible_name)
+    *possible_name = g_strdup (pa->name);
 
   return address;
 }
@@ -729,6 +1069,164 @@ parse_cert_option_as_database (CockpitChannel *channel,
   return ret;
 }
 
+/*
+ * Parsed TLS credentials, keyed by a checksum of the options that
+ * produced them. Channels that connect with the same "tls" options
+ * share the certificate and database objects instead of parsing PEM
+ * data, or writing out temporary authority files, every time.
+ *
+ * Sharing also keeps the client certificate identical between
+ * connections, which the TLS backend's session cache relies on to
+ * resume sessions to the same host and port.
+ */
+
+#define TLS_CREDENTIALS_MAX 32
+
+typedef struct {
+  GTlsCertificate *cert;
+  GTlsDatabase *database;
+  gint64 used;
+} TlsCredentials;
+
+static GHashTable *tls_credentials;
+
+static void
+tls_credentials_free (gpointer data)
+{
+  TlsCredentials *creds = data;
+  if (creds->cert)
+    g_object_unref (creds->cert);
+  if (creds->database)
+    g_object_unref (creds->database);
+  g_slice_free (TlsCredentials, creds);
+}
+
+static gboolean
+tls_credentials_key_add (CockpitChannel *channel,
+                         JsonObject *options,
+                         const gchar *option,
+                         GChecksum *checksum)
+{
+  const gchar *file;
+  const gchar *data;
+  struct stat st;
+  gchar *path;
+  gchar *stamp;
+
+  if (!parse_option_file_or_data (channel, options, option, &file, &data))
+    return FALSE;
+
+  g_checksum_update (checksum, (const guchar *)option, -1);
+
+  if (file)
+    {
+      /* Changes to the file invalidate what we parsed from it */
+      path = expand_filename (file);
+      if (g_stat (path, &st) < 0)
+        memset (&st, 0, sizeof (st));
+      stamp = g_strdup_printf ("\nfile:%s:%" G_GUINT64_FORMAT ":%" G_GINT64_FORMAT ":%ld\n", path,
+                               (guint64)st.st_ino, (gint64)st.st_size, (long)st.st_mtime);
+      g_checksum_update (checksum, (const guchar *)stamp, -1);
+      g_free (stamp);
+      g_free (path);
+    }
+  else if (data)
+    {
+      g_checksum_update (checksum, (const guchar *)"\ndata:", -1);
+      g_checksum_update (checksum, (const guchar *)data, -1);
+    }
+
+  g_checksum_update (checksum, (const guchar *)"\n", 1);
+  return TRUE;
+}
+
+static gboolean
+tls_credentials_key (CockpitChannel *channel,
+                     JsonObject *options,
+                     gchar **key)
+{
+  GChecksum *checksum;
+  gboolean ret = FALSE;
+
+  *key = NULL;
+
+  /* Nothing to parse, nothing to cache */
+  if (!json_object_has_member (options, "certificate") &&
+      !json_object_has_member (options, "authority"))
+    return TRUE;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  /* The "key" is only looked at along with a "certificate" */
+  if (tls_credentials_key_add (channel, options, "certificate", checksum) &&
+      (!json_object_has_member (options, "certificate") ||
+       tls_credentials_key_add (channel, options, "key", checksum)) &&
+      tls_credentials_key_add (channel, options, "authority", checksum))
+    {
+      *key = g_strdup (g_checksum_get_string (checksum));
+      ret = TRUE;
+    }
+
+  g_checksum_free (checksum);
+  return ret;
+}
+
+static gboolean
+tls_credentials_lookup (const gchar *key,
+                        GTlsCertificate **cert,
+                        GTlsDatabase **database)
+{
+  TlsCredentials *creds = NULL;
+
+  if (key && tls_credentials)
+    creds = g_hash_table_lookup (tls_credentials, key);
+
+  if (!creds)
+    return FALSE;
+
+  creds->used = g_get_monotonic_time ();
+  *cert = creds->cert ? g_object_ref (creds->cert) : NULL;
+  *database = creds->database ? g_object_ref (creds->database) : NULL;
+  return TRUE;
+}
+
+static void
+tls_credentials_store (gchar *key,
+                       GTlsCertificate *cert,
+                       GTlsDatabase *database)
+{
+  TlsCredentials *oldest = NULL;
+  const gchar *oldest_key = NULL;
+  TlsCredentials *creds;
+  GHashTableIter iter;
+  gpointer k, v;
+
+  if (!tls_credentials)
+    tls_credentials = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, tls_credentials_free);
+
+  if (g_hash_table_size (tls_credentials) >= TLS_CREDENTIALS_MAX)
+    {
+      g_hash_table_iter_init (&iter, tls_credentials);
+      while (g_hash_table_iter_next (&iter, &k, &v))
+        {
+          creds = v;
+          if (!oldest || creds->used < oldest->used)
+            {
+              oldest = creds;
+              oldest_key = k;
+            }
+        }
+      g_hash_table_remove (tls_credentials, oldest_key);
+    }
+
+  creds = g_slice_new0 (TlsCredentials);
+  creds->cert = cert ? g_object_ref (cert) : NULL;
+  creds->database = database ? g_object_ref (database) : NULL;
+  creds->used = g_get_monotonic_time ();
+  g_hash_table_replace (tls_credentials, key, creds);
+
+  cockpit_tls_cache_stats ()->entries = g_hash_table_size (tls_credentials);
+}
+
 static gboolean
 parse_stream_options (CockpitChannel *channel,
                       CockpitConnectable *connectable)
@@ -739,6 +1237,7 @@ parse_stream_options (CockpitChannel *channel,
   gboolean use_tls = FALSE;
   GError *error = NULL;
   GString *pem = NULL;
+  gchar *key = NULL;
   JsonObject *options;
   JsonNode *node;
 
@@ -765,6 +1264,19 @@ parse_stream_options (CockpitChannel *channel,
        * GLib here.
        */
 
+      if (!tls_credentials_key (channel, options, &key))
+        goto out;
+
+      if (tls_credentials_lookup (key, &cert, &database))
+        {
+          g_debug ("using cached tls credentials");
+          cockpit_tls_cache_stats ()->hits++;
+          goto validate;
+        }
+
+      if (key)
+        cockpit_tls_cache_stats ()->misses++;
+
       pem = g_string_sized_new (8192);
 
       if (!parse_cert_option_as_pem (channel, options, "certificate", pem))
@@ -788,6 +1300,13 @@ parse_stream_options (CockpitChannel *channel,
       if (!parse_cert_option_as_database (channel, options, "authority", &database))
         goto out;
 
+      if (key)
+        {
+          tls_credentials_store (key, cert, database);
+          key = NULL;
+        }
+
+validate:
       if (!cockpit_json_get_bool (options, "validate", validate, &validate))
         {
           cockpit_channel_fail (channel, "protocol-error", "invalid \"validate\" option");
@@ -821,6 +1340,7 @@ out:
         }
     }
 
+  g_free (key);
   if (pem)
     g_string_free (pem, TRUE);
   if (cert)
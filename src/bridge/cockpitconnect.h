@@ -61,8 +61,14 @@ GIOStream *             cockpit_connect_stream_finish (GAsyncResult *result,
 
 CockpitConnectable *    cockpit_connect_parse_stream  (CockpitChannel *self);
 
-GSocketAddress *        cockpit_connect_parse_address (CockpitChannel *self,
-                                                       gchar **possible_name);
+void                    cockpit_connect_parse_address_async  (CockpitChannel *self,
+                                                              GCancellable *cancellable,
+                                                              GAsyncReadyCallback callback,
+                                                              gpointer user_data);
+
+GSocketAddress *        cockpit_connect_parse_address_finish (CockpitChannel *self,
+                                                              GAsyncResult *result,
+                                                              gchar **possible_name);
 
 void                    cockpit_connect_add_internal_address        (const gchar *name,
                                                                      GSocketAddress *address);
@@ -21,6 +21,7 @@
 
 #include "cockpitdbuscache.h"
 
+#include "cockpitdbuscachesamples.h"
 #include "cockpitdbusrules.h"
 #include "cockpitpaths.h"
 
@@ -92,6 +93,13 @@ struct _CockpitDBusCache {
 
   /* Interned strings */
   GHashTable *interned;
+
+  /* Statistics, see cockpitdbuscachesamples.c */
+  gint64 calls;
+  gint64 barriers_done;
+  gint64 barrier_usec;
+  gint64 barrier_max_usec;
+  gint64 depth[COCKPIT_DBUS_CACHE_DEPTH_BUCKETS];
 };
 
 enum {
@@ -133,10 +141,27 @@ intern_string (CockpitDBusCache *self,
 
 typedef struct {
   guint number;
+  gint64 queued;
   CockpitDBusBarrierFunc callback;
   gpointer user_data;
 } BarrierData;
 
+static void
+barrier_complete (CockpitDBusCache *self,
+                  BarrierData *barrier)
+{
+  gint64 waited;
+
+  waited = g_get_monotonic_time () - barrier->queued;
+  self->barriers_done++;
+  self->barrier_usec += waited;
+  if (waited > self->barrier_max_usec)
+    self->barrier_max_usec = waited;
+
+  (barrier->callback) (self, barrier->user_data);
+  g_slice_free (BarrierData, barrier);
+}
+
 typedef struct {
   gint refs;
   guint number;
@@ -194,8 +219,7 @@ barrier_progress (CockpitDBusCache *self)
             break;
 
           g_queue_pop_head (self->barriers);
-          (barrier->callback) (self, barrier->user_data);
-          g_slice_free (BarrierData, barrier);
+          barrier_complete (self, barrier);
         }
     }
 
@@ -212,8 +236,7 @@ barrier_flush (CockpitDBusCache *self)
       barrier = g_queue_pop_head (self->barriers);
       if (!barrier)
         return;
-      (barrier->callback) (self, barrier->user_data);
-      g_slice_free (BarrierData, barrier);
+      barrier_complete (self, barrier);
     }
 }
 
@@ -487,6 +510,8 @@ on_introspect_reply (GObject *source,
   GVariant *retval;
   const gchar *xml;
 
+  self->calls--;
+
   /* All done with this introspect */
   id = g_queue_pop_head (self->introspects);
 
@@ -560,6 +585,7 @@ introspect_next (CockpitDBusCache *self)
               g_debug ("%s: calling Introspect() on %s", self->logname, id->path);
 
               id->introspecting = TRUE;
+              self->calls++;
               g_dbus_connection_call (self->connection, self->name, id->path,
                                       "org.freedesktop.DBus.Introspectable", "Introspect",
                                       g_variant_new ("()"), G_VARIANT_TYPE ("(s)"),
@@ -627,6 +653,7 @@ introspect_queue (CockpitDBusCache *self,
   g_debug ("%s: queueing introspect %s %s%s", self->logname, path,
            interface ? "for " : "", interface ? interface : "");
   g_queue_push_tail (self->introspects, id);
+  self->depth[cockpit_dbus_cache_stats_bucket (self->introspects->length)]++;
 
   introspect_next (self);
 }
@@ -883,6 +910,8 @@ on_get_reply (GObject *source,
   GVariant *retval;
   GError *error = NULL;
 
+  self->calls--;
+
   retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
   if (error)
     {
@@ -979,6 +1008,7 @@ process_properties_changed (CockpitDBusCache *self,
       gd->path = pcd->path;
       gd->iface = iface;
 
+      self->calls++;
       g_dbus_connection_call (self->connection, self->name, gd->path,
                               "org.freedesktop.DBus.Properties", "Get",
                               g_variant_new ("(ss)", iface->name, property),
@@ -1257,6 +1287,62 @@ on_manager_signal (GDBusConnection *connection,
     }
 }
 
+/* Rough per-entry cost of a GHashTable slot: key, value and hash */
+#define HASH_ENTRY_SIZE (sizeof (gpointer) * 2 + sizeof (guint))
+
+static void
+cockpit_dbus_cache_stats (gpointer source,
+                          CockpitDBusCacheStats *stats)
+{
+  CockpitDBusCache *self = source;
+  GHashTableIter paths;
+  GHashTableIter interfaces;
+  GHashTableIter properties;
+  gpointer key, value;
+  guint i;
+
+  /*
+   * This is only called when someone asks for statistics, so walking
+   * the whole cache here is fine. The memory figure is an estimate:
+   * value sizes plus hash table slots and interned strings.
+   */
+
+  g_hash_table_iter_init (&paths, self->cache);
+  while (g_hash_table_iter_next (&paths, NULL, &value))
+    {
+      stats->objects++;
+      stats->bytes += HASH_ENTRY_SIZE;
+
+      g_hash_table_iter_init (&interfaces, value);
+      while (g_hash_table_iter_next (&interfaces, NULL, &value))
+        {
+          stats->interfaces++;
+          stats->bytes += HASH_ENTRY_SIZE;
+
+          g_hash_table_iter_init (&properties, value);
+          while (g_hash_table_iter_next (&properties, NULL, &value))
+            {
+              stats->properties++;
+              stats->bytes += HASH_ENTRY_SIZE + g_variant_get_size (value);
+            }
+        }
+    }
+
+  g_hash_table_iter_init (&paths, self->interned);
+  while (g_hash_table_iter_next (&paths, &key, NULL))
+    stats->bytes += HASH_ENTRY_SIZE + strlen (key) + 1;
+
+  stats->introspects = self->introspects->length;
+  stats->calls = self->calls;
+  stats->batches = self->batches->length;
+  stats->barriers = self->barriers->length;
+  stats->barriers_done = self->barriers_done;
+  stats->barrier_usec = self->barrier_usec;
+  stats->barrier_max_usec = self->barrier_max_usec;
+  for (i = 0; i < COCKPIT_DBUS_CACHE_DEPTH_BUCKETS; i++)
+    stats->depth[i] = self->depth[i];
+}
+
 static void
 cockpit_dbus_cache_constructed (GObject *object)
 {
@@ -1288,6 +1374,8 @@ cockpit_dbus_cache_constructed (GObject *object)
                                                                 self, NULL);
 
   self->subscribed = TRUE;
+
+  cockpit_dbus_cache_stats_register (self, self->logname, cockpit_dbus_cache_stats);
 }
 
 static void
@@ -1325,6 +1413,8 @@ cockpit_dbus_cache_dispose (GObject *object)
 
   g_cancellable_cancel (self->cancellable);
 
+  cockpit_dbus_cache_stats_unregister (self);
+
   if (self->subscribed)
     {
       g_dbus_connection_signal_unsubscribe (self->connection, self->subscribe_properties);
@@ -1620,6 +1710,8 @@ on_get_all_reply (GObject *source,
   GError *error = NULL;
   GVariant *retval;
 
+  self->calls--;
+
   retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
   if (error)
     {
@@ -1690,6 +1782,7 @@ retrieve_properties (CockpitDBusCache *self,
   gad->path = path;
   gad->iface = iface;
 
+  self->calls++;
   g_dbus_connection_call (self->connection, self->name, path,
                           "org.freedesktop.DBus.Properties", "GetAll",
                           g_variant_new ("(s)", iface->name), G_VARIANT_TYPE ("(a{sv})"),
@@ -1776,6 +1869,8 @@ on_get_managed_objects_reply (GObject *source,
   GError *error = NULL;
   GVariant *retval;
 
+  self->calls--;
+
   retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
   if (error)
     {
@@ -1838,6 +1933,7 @@ retrieve_managed_objects (CockpitDBusCache *self,
 
   g_debug ("%s: calling GetManagedObjects() on %s", self->logname, namespace_path);
 
+  self->calls++;
   g_dbus_connection_call (self->connection, self->name, namespace_path,
                           "org.freedesktop.DBus.ObjectManager", "GetManagedObjects",
                           g_variant_new ("()"), G_VARIANT_TYPE ("(a{oa{sa{sv}}})"),
@@ -1930,12 +2026,14 @@ cockpit_dbus_cache_barrier (CockpitDBusCache *self,
     {
       barrier = g_slice_new0 (BarrierData);
       barrier->number = batch->number;
+      barrier->queued = g_get_monotonic_time ();
       barrier->callback = callback;
       barrier->user_data = user_data;
       g_queue_push_tail (self->barriers, barrier);
     }
   else
     {
+      self->barriers_done++;
       (callback) (self, user_data);
     }
 }
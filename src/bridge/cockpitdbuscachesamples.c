@@ -0,0 +1,222 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitdbuscachesamples.h"
+
+#include <string.h>
+
+/*
+ * Each live CockpitDBusCache registers itself here. Nothing is computed
+ * until someone actually asks for samples or statistics, at which point
+ * we walk the registered caches and sum up their numbers by name.
+ *
+ * The counters of a cache that goes away are kept in retired_stats by
+ * name, so that the totals never go backwards.
+ */
+
+typedef struct {
+  gpointer source;
+  gchar *name;
+  CockpitDBusCacheStatsFunc func;
+} StatsSource;
+
+static GList *stats_sources = NULL;
+
+static GHashTable *retired_stats = NULL;
+
+static const gchar *depth_metrics[COCKPIT_DBUS_CACHE_DEPTH_BUCKETS] = {
+  "dbus.cache.depth.1",
+  "dbus.cache.depth.4",
+  "dbus.cache.depth.16",
+  "dbus.cache.depth.64",
+  "dbus.cache.depth.256",
+  "dbus.cache.depth.more",
+};
+
+void
+cockpit_dbus_cache_stats_register (gpointer source,
+                                   const gchar *name,
+                                   CockpitDBusCacheStatsFunc func)
+{
+  StatsSource *ss;
+
+  g_return_if_fail (source != NULL);
+  g_return_if_fail (func != NULL);
+
+  ss = g_slice_new0 (StatsSource);
+  ss->source = source;
+  ss->name = g_strdup (name ? name : "internal");
+  ss->func = func;
+  stats_sources = g_list_prepend (stats_sources, ss);
+}
+
+static void
+retire_stats (StatsSource *ss)
+{
+  CockpitDBusCacheStats stats;
+  CockpitDBusCacheStats *retired;
+  guint i;
+
+  memset (&stats, 0, sizeof (stats));
+  (ss->func) (ss->source, &stats);
+
+  if (!retired_stats)
+    retired_stats = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  retired = g_hash_table_lookup (retired_stats, ss->name);
+  if (!retired)
+    {
+      retired = g_new0 (CockpitDBusCacheStats, 1);
+      g_hash_table_insert (retired_stats, g_strdup (ss->name), retired);
+    }
+
+  /* Only the counters, the rest describes what is in the cache right now */
+  retired->barriers_done += stats.barriers_done;
+  retired->barrier_usec += stats.barrier_usec;
+  retired->barrier_max_usec = MAX (retired->barrier_max_usec, stats.barrier_max_usec);
+  for (i = 0; i < COCKPIT_DBUS_CACHE_DEPTH_BUCKETS; i++)
+    retired->depth[i] += stats.depth[i];
+}
+
+void
+cockpit_dbus_cache_stats_unregister (gpointer source)
+{
+  StatsSource *ss;
+  GList *l;
+
+  for (l = stats_sources; l != NULL; l = g_list_next (l))
+    {
+      ss = l->data;
+      if (ss->source == source)
+        {
+          retire_stats (ss);
+          stats_sources = g_list_delete_link (stats_sources, l);
+          g_free (ss->name);
+          g_slice_free (StatsSource, ss);
+          return;
+        }
+    }
+}
+
+guint
+cockpit_dbus_cache_stats_bucket (guint depth)
+{
+  guint bucket = 0;
+  guint limit = 1;
+
+  while (depth > limit && bucket < COCKPIT_DBUS_CACHE_DEPTH_BUCKETS - 1)
+    {
+      limit *= 4;
+      bucket++;
+    }
+
+  return bucket;
+}
+
+GHashTable *
+cockpit_dbus_cache_stats_collect (void)
+{
+  CockpitDBusCacheStats stats;
+  CockpitDBusCacheStats *total;
+  GHashTableIter iter;
+  GHashTable *result;
+  gpointer key, value;
+  StatsSource *ss;
+  GList *l;
+  guint i;
+
+  result = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  if (retired_stats)
+    {
+      g_hash_table_iter_init (&iter, retired_stats);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        g_hash_table_insert (result, g_strdup (key), g_memdup (value, sizeof (CockpitDBusCacheStats)));
+    }
+
+  for (l = stats_sources; l != NULL; l = g_list_next (l))
+    {
+      ss = l->data;
+
+      memset (&stats, 0, sizeof (stats));
+      (ss->func) (ss->source, &stats);
+
+      total = g_hash_table_lookup (result, ss->name);
+      if (!total)
+        {
+          total = g_new0 (CockpitDBusCacheStats, 1);
+          g_hash_table_insert (result, g_strdup (ss->name), total);
+        }
+
+      total->objects += stats.objects;
+      total->interfaces += stats.interfaces;
+      total->properties += stats.properties;
+      total->bytes += stats.bytes;
+      total->introspects += stats.introspects;
+      total->calls += stats.calls;
+      total->batches += stats.batches;
+      total->barriers += stats.barriers;
+      total->barriers_done += stats.barriers_done;
+      total->barrier_usec += stats.barrier_usec;
+      total->barrier_max_usec = MAX (total->barrier_max_usec, stats.barrier_max_usec);
+      for (i = 0; i < COCKPIT_DBUS_CACHE_DEPTH_BUCKETS; i++)
+        total->depth[i] += stats.depth[i];
+    }
+
+  return result;
+}
+
+void
+cockpit_dbus_cache_samples (CockpitSamples *samples)
+{
+  CockpitDBusCacheStats *stats;
+  GHashTableIter iter;
+  GHashTable *collected;
+  gpointer key, value;
+  const gchar *name;
+  guint i;
+
+  /* Nobody has ever had a cache open, don't bother */
+  if (!stats_sources && !retired_stats)
+    return;
+
+  collected = cockpit_dbus_cache_stats_collect ();
+
+  g_hash_table_iter_init (&iter, collected);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      name = key;
+      stats = value;
+
+      cockpit_samples_sample (samples, "dbus.cache.objects", name, stats->objects);
+      cockpit_samples_sample (samples, "dbus.cache.properties", name, stats->properties);
+      cockpit_samples_sample (samples, "dbus.cache.memory", name, stats->bytes);
+      cockpit_samples_sample (samples, "dbus.cache.introspects", name, stats->introspects);
+      cockpit_samples_sample (samples, "dbus.cache.calls", name, stats->calls);
+      cockpit_samples_sample (samples, "dbus.cache.barriers", name, stats->barriers);
+      cockpit_samples_sample (samples, "dbus.cache.barrier-count", name, stats->barriers_done);
+      cockpit_samples_sample (samples, "dbus.cache.barrier-time", name, stats->barrier_usec / 1000);
+      for (i = 0; i < COCKPIT_DBUS_CACHE_DEPTH_BUCKETS; i++)
+        cockpit_samples_sample (samples, depth_metrics[i], name, stats->depth[i]);
+    }
+
+  g_hash_table_unref (collected);
+}
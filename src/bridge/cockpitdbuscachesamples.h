@@ -0,0 +1,62 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COCKPIT_DBUS_CACHE_SAMPLES_H__
+#define COCKPIT_DBUS_CACHE_SAMPLES_H__
+
+#include "cockpitsamples.h"
+
+G_BEGIN_DECLS
+
+/* Introspect queue depth histogram buckets: <= 1, 4, 16, 64, 256, more */
+#define COCKPIT_DBUS_CACHE_DEPTH_BUCKETS 6
+
+typedef struct {
+  gint64 objects;
+  gint64 interfaces;
+  gint64 properties;
+  gint64 bytes;
+  gint64 introspects;
+  gint64 calls;
+  gint64 batches;
+  gint64 barriers;
+  gint64 barriers_done;
+  gint64 barrier_usec;
+  gint64 barrier_max_usec;
+  gint64 depth[COCKPIT_DBUS_CACHE_DEPTH_BUCKETS];
+} CockpitDBusCacheStats;
+
+typedef void    (* CockpitDBusCacheStatsFunc)         (gpointer source,
+                                                       CockpitDBusCacheStats *stats);
+
+void            cockpit_dbus_cache_stats_register     (gpointer source,
+                                                       const gchar *name,
+                                                       CockpitDBusCacheStatsFunc func);
+
+void            cockpit_dbus_cache_stats_unregister   (gpointer source);
+
+GHashTable *    cockpit_dbus_cache_stats_collect      (void);
+
+guint           cockpit_dbus_cache_stats_bucket       (guint depth);
+
+void            cockpit_dbus_cache_samples            (CockpitSamples *samples);
+
+G_END_DECLS
+
+#endif /* COCKPIT_DBUS_CACHE_SAMPLES_H__ */
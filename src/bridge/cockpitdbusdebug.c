@@ -0,0 +1,144 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitdbusinternal.h"
+
+#include "cockpitdbuscachesamples.h"
+
+/*
+ * A debugging interface on the internal bus. Everything here is computed
+ * on demand when a method is called, so it costs nothing otherwise.
+ */
+
+static GVariant *
+build_dbus_cache_statistics (void)
+{
+  CockpitDBusCacheStats *stats;
+  GVariantBuilder builder;
+  GVariantBuilder inner;
+  GHashTableIter iter;
+  GHashTable *collected;
+  gpointer key, value;
+  gchar *name;
+  guint i;
+
+  collected = cockpit_dbus_cache_stats_collect ();
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sx}}"));
+  g_hash_table_iter_init (&iter, collected);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      stats = value;
+
+      g_variant_builder_init (&inner, G_VARIANT_TYPE ("a{sx}"));
+      g_variant_builder_add (&inner, "{sx}", "objects", stats->objects);
+      g_variant_builder_add (&inner, "{sx}", "interfaces", stats->interfaces);
+      g_variant_builder_add (&inner, "{sx}", "properties", stats->properties);
+      g_variant_builder_add (&inner, "{sx}", "memory", stats->bytes);
+      g_variant_builder_add (&inner, "{sx}", "introspects", stats->introspects);
+      g_variant_builder_add (&inner, "{sx}", "calls", stats->calls);
+      g_variant_builder_add (&inner, "{sx}", "batches", stats->batches);
+      g_variant_builder_add (&inner, "{sx}", "barriers", stats->barriers);
+      g_variant_builder_add (&inner, "{sx}", "barrier-count", stats->barriers_done);
+      g_variant_builder_add (&inner, "{sx}", "barrier-usec", stats->barrier_usec);
+      g_variant_builder_add (&inner, "{sx}", "barrier-max-usec", stats->barrier_max_usec);
+      for (i = 0; i < COCKPIT_DBUS_CACHE_DEPTH_BUCKETS; i++)
+        {
+          name = g_strdup_printf ("depth-%u", i);
+          g_variant_builder_add (&inner, "{sx}", name, stats->depth[i]);
+          g_free (name);
+        }
+
+      g_variant_builder_add (&builder, "{s@a{sx}}", key, g_variant_builder_end (&inner));
+    }
+
+  g_hash_table_unref (collected);
+  return g_variant_builder_end (&builder);
+}
+
+static void
+debug_method_call (GDBusConnection *connection,
+                   const gchar *sender,
+                   const gchar *object_path,
+                   const gchar *interface_name,
+                   const gchar *method_name,
+                   GVariant *parameters,
+                   GDBusMethodInvocation *invocation,
+                   gpointer user_data)
+{
+  if (g_str_equal (method_name, "DBusCaches"))
+    {
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(@a{sa{sx}})",
+                                                            build_dbus_cache_statistics ()));
+    }
+  else
+    {
+      g_return_if_reached ();
+    }
+}
+
+static GDBusInterfaceVTable debug_vtable = {
+  .method_call = debug_method_call,
+};
+
+static GDBusArgInfo debug_caches_arg = {
+  -1, "caches", "a{sa{sx}}", NULL
+};
+
+static GDBusArgInfo *debug_caches_out_args[] = {
+  &debug_caches_arg,
+  NULL
+};
+
+static GDBusMethodInfo debug_dbus_caches_method = {
+  -1, "DBusCaches", NULL, debug_caches_out_args, NULL
+};
+
+static GDBusMethodInfo *debug_methods[] = {
+  &debug_dbus_caches_method,
+  NULL
+};
+
+static GDBusInterfaceInfo debug_interface = {
+  -1, "cockpit.Debug", debug_methods, NULL, NULL, NULL
+};
+
+void
+cockpit_dbus_debug_startup (void)
+{
+  GDBusConnection *connection;
+  GError *error = NULL;
+
+  connection = cockpit_dbus_internal_server ();
+  g_return_if_fail (connection != NULL);
+
+  g_dbus_connection_register_object (connection, "/debug", &debug_interface,
+                                     &debug_vtable, NULL, NULL, &error);
+
+  if (error != NULL)
+    {
+      g_critical ("couldn't register DBus cockpit.Debug object: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_object_unref (connection);
+}
@@ -0,0 +1,550 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitdbusgeneration.h"
+
+#include "cockpitpaths.h"
+
+#include <string.h>
+
+/*
+ * Tracks what a dbus-json client has been sent for its watches, so that
+ * a client which comes back with a generation token (after a page reload
+ * or a reconnect) only gets sent what changed since then.
+ *
+ * Each interface at each path remembers the generation number at which
+ * it last changed, and the property values the client has. Once a
+ * client is resumed from generation N, interfaces that changed after N
+ * are treated as unknown ("dirty") and sent in full again. Removals are
+ * remembered as tombstones so they can be replayed, up to a limit after
+ * which resuming from older generations is refused.
+ *
+ * The updates passed in and returned have the same layout as the
+ * CockpitDBusCache "update" signal: path -> interface -> property ->
+ * GVariant, where a NULL interface value means the interface was removed.
+ */
+
+/* How long a released generation can still be resumed */
+#define GENERATION_EXPIRE_SECONDS 60
+
+/* Number of released generations to keep around */
+#define MAX_GENERATIONS 32
+
+/* Removed interfaces to remember before forgetting them all */
+#define MAX_TOMBSTONES 1024
+
+typedef struct {
+  guint64 number;
+  gboolean seen;
+  gboolean dirty;
+  GHashTable *properties;
+} InterfaceState;
+
+struct _CockpitDBusGeneration {
+  gchar *id;
+  gchar *scope;
+  guint64 number;
+  guint64 horizon;
+  guint tombstones;
+  GHashTable *paths;
+  gboolean released;
+  guint expire_tag;
+};
+
+/* All the generations by id, both active and released */
+static GHashTable *generations = NULL;
+
+static void
+interface_state_free (gpointer data)
+{
+  InterfaceState *is = data;
+  if (is->properties)
+    g_hash_table_unref (is->properties);
+  g_slice_free (InterfaceState, is);
+}
+
+static void
+hash_table_unref_or_null (gpointer data)
+{
+  if (data)
+    g_hash_table_unref (data);
+}
+
+static GHashTable *
+properties_new (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                (GDestroyNotify)g_variant_unref);
+}
+
+static GHashTable *
+interfaces_new (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, interface_state_free);
+}
+
+static void
+generation_free (gpointer data)
+{
+  CockpitDBusGeneration *self = data;
+
+  if (self->expire_tag)
+    g_source_remove (self->expire_tag);
+  g_hash_table_unref (self->paths);
+  g_free (self->scope);
+  g_free (self->id);
+  g_slice_free (CockpitDBusGeneration, self);
+}
+
+static CockpitDBusGeneration *
+generation_create (const gchar *scope)
+{
+  CockpitDBusGeneration *self;
+
+  if (!generations)
+    generations = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, generation_free);
+
+  self = g_slice_new0 (CockpitDBusGeneration);
+  self->scope = g_strdup (scope ? scope : "");
+  self->paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify)g_hash_table_unref);
+
+  do
+    {
+      g_free (self->id);
+      self->id = g_strdup_printf ("%08x%08x", g_random_int (), g_random_int ());
+    }
+  while (g_hash_table_lookup (generations, self->id));
+
+  return self;
+}
+
+static void
+generation_register (CockpitDBusGeneration *self)
+{
+  CockpitDBusGeneration *other;
+  GHashTableIter iter;
+  gpointer value;
+
+  /* Only released generations are evicted, active ones are in use */
+  if (g_hash_table_size (generations) >= MAX_GENERATIONS)
+    {
+      g_hash_table_iter_init (&iter, generations);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          other = value;
+          if (other->released)
+            {
+              g_hash_table_iter_remove (&iter);
+              break;
+            }
+        }
+    }
+
+  g_hash_table_replace (generations, self->id, self);
+}
+
+CockpitDBusGeneration *
+cockpit_dbus_generation_new (const gchar *scope)
+{
+  CockpitDBusGeneration *self;
+
+  self = generation_create (scope);
+  generation_register (self);
+  return self;
+}
+
+static GHashTable *
+copy_properties (GHashTable *properties)
+{
+  GHashTable *copy;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  copy = properties_new ();
+  g_hash_table_iter_init (&iter, properties);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_hash_table_insert (copy, g_strdup (key), g_variant_ref (value));
+
+  return copy;
+}
+
+CockpitDBusGeneration *
+cockpit_dbus_generation_resume (const gchar *scope,
+                                const gchar *token)
+{
+  CockpitDBusGeneration *previous;
+  CockpitDBusGeneration *self;
+  GHashTableIter paths;
+  GHashTableIter interfaces;
+  GHashTable *copy;
+  InterfaceState *is;
+  InterfaceState *ns;
+  gpointer path, interface, value;
+  const gchar *dot;
+  gchar *end = NULL;
+  guint64 number;
+  gchar *id;
+
+  g_return_val_if_fail (token != NULL, NULL);
+
+  if (!generations)
+    return NULL;
+
+  dot = strrchr (token, '.');
+  if (!dot || dot[1] == '\0')
+    return NULL;
+
+  number = g_ascii_strtoull (dot + 1, &end, 10);
+  if (!end || *end != '\0')
+    return NULL;
+
+  id = g_strndup (token, dot - token);
+  previous = g_hash_table_lookup (generations, id);
+  g_free (id);
+
+  if (!previous || !g_str_equal (previous->scope, scope ? scope : ""))
+    return NULL;
+
+  /* We no longer know everything that was removed before the horizon */
+  if (number > previous->number || number < previous->horizon)
+    return NULL;
+
+  self = generation_create (scope);
+
+  g_hash_table_iter_init (&paths, previous->paths);
+  while (g_hash_table_iter_next (&paths, &path, &value))
+    {
+      copy = NULL;
+
+      g_hash_table_iter_init (&interfaces, value);
+      while (g_hash_table_iter_next (&interfaces, &interface, &value))
+        {
+          is = value;
+
+          /* The client already knows this is gone */
+          if (!is->properties && is->number <= number)
+            continue;
+
+          ns = g_slice_new0 (InterfaceState);
+          if (is->properties && is->number <= number && !is->dirty)
+            {
+              ns->properties = copy_properties (is->properties);
+            }
+          else
+            {
+              /* The client may or may not have this, with unknown values */
+              ns->properties = properties_new ();
+              ns->dirty = TRUE;
+            }
+
+          if (!copy)
+            {
+              copy = interfaces_new ();
+              g_hash_table_insert (self->paths, g_strdup (path), copy);
+            }
+          g_hash_table_insert (copy, g_strdup (interface), ns);
+        }
+    }
+
+  g_debug ("resumed dbus generation %s as %s", token, self->id);
+
+  generation_register (self);
+  return self;
+}
+
+static gboolean
+on_generation_expire (gpointer user_data)
+{
+  CockpitDBusGeneration *self = user_data;
+
+  self->expire_tag = 0;
+  g_hash_table_remove (generations, self->id);
+  return FALSE;
+}
+
+void
+cockpit_dbus_generation_release (CockpitDBusGeneration *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (!self->released);
+
+  self->released = TRUE;
+  self->expire_tag = g_timeout_add_seconds (GENERATION_EXPIRE_SECONDS,
+                                            on_generation_expire, self);
+}
+
+gchar *
+cockpit_dbus_generation_token (CockpitDBusGeneration *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  return g_strdup_printf ("%s.%" G_GUINT64_FORMAT, self->id, self->number);
+}
+
+static InterfaceState *
+lookup_interface (CockpitDBusGeneration *self,
+                  const gchar *path,
+                  const gchar *interface,
+                  gboolean create)
+{
+  GHashTable *interfaces;
+  InterfaceState *is;
+
+  interfaces = g_hash_table_lookup (self->paths, path);
+  if (!interfaces)
+    {
+      if (!create)
+        return NULL;
+      interfaces = interfaces_new ();
+      g_hash_table_insert (self->paths, g_strdup (path), interfaces);
+    }
+
+  is = g_hash_table_lookup (interfaces, interface);
+  if (!is && create)
+    {
+      is = g_slice_new0 (InterfaceState);
+      g_hash_table_insert (interfaces, g_strdup (interface), is);
+    }
+
+  return is;
+}
+
+static void
+prune_tombstones (CockpitDBusGeneration *self)
+{
+  GHashTableIter paths;
+  GHashTableIter interfaces;
+  InterfaceState *is;
+  gpointer value;
+
+  if (self->tombstones < MAX_TOMBSTONES)
+    return;
+
+  g_hash_table_iter_init (&paths, self->paths);
+  while (g_hash_table_iter_next (&paths, NULL, &value))
+    {
+      g_hash_table_iter_init (&interfaces, value);
+      while (g_hash_table_iter_next (&interfaces, NULL, (gpointer *)&is))
+        {
+          if (!is->properties)
+            g_hash_table_iter_remove (&interfaces);
+        }
+      if (g_hash_table_size (value) == 0)
+        g_hash_table_iter_remove (&paths);
+    }
+
+  self->horizon = self->number;
+  self->tombstones = 0;
+}
+
+static void
+result_add (GHashTable **result,
+            const gchar *path,
+            const gchar *interface,
+            GHashTable *properties)
+{
+  GHashTable *interfaces;
+
+  if (!*result)
+    {
+      *result = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                       g_free, hash_table_unref_or_null);
+    }
+
+  interfaces = g_hash_table_lookup (*result, path);
+  if (!interfaces)
+    {
+      interfaces = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, hash_table_unref_or_null);
+      g_hash_table_insert (*result, g_strdup (path), interfaces);
+    }
+
+  g_hash_table_replace (interfaces, g_strdup (interface), properties);
+}
+
+static gboolean
+update_interface (CockpitDBusGeneration *self,
+                  guint64 number,
+                  const gchar *path,
+                  const gchar *interface,
+                  GHashTable *properties,
+                  GHashTable **changed)
+{
+  InterfaceState *is;
+  GHashTableIter iter;
+  gpointer property, value, prev;
+  gboolean emit = FALSE;
+
+  *changed = NULL;
+
+  /* Don't tell the client about removing things it never had */
+  is = lookup_interface (self, path, interface, properties != NULL);
+  if (!is)
+    return FALSE;
+
+  is->seen = TRUE;
+
+  if (!properties)
+    {
+      if (!is->properties)
+        return FALSE;
+      g_hash_table_unref (is->properties);
+      is->properties = NULL;
+      is->dirty = FALSE;
+      is->number = number;
+      self->tombstones++;
+      return TRUE;
+    }
+
+  /* Client doesn't have this interface, or we don't know what it has */
+  if (!is->properties || is->dirty)
+    {
+      if (is->properties)
+        g_hash_table_unref (is->properties);
+      is->properties = properties_new ();
+      is->dirty = FALSE;
+      emit = TRUE;
+    }
+
+  *changed = properties_new ();
+  g_hash_table_iter_init (&iter, properties);
+  while (g_hash_table_iter_next (&iter, &property, &value))
+    {
+      prev = g_hash_table_lookup (is->properties, property);
+      if (prev && g_variant_equal (prev, value))
+        continue;
+
+      g_hash_table_replace (is->properties, g_strdup (property), g_variant_ref (value));
+      g_hash_table_replace (*changed, g_strdup (property), g_variant_ref (value));
+      emit = TRUE;
+    }
+
+  if (!emit)
+    {
+      g_hash_table_unref (*changed);
+      *changed = NULL;
+      return FALSE;
+    }
+
+  is->number = number;
+  return TRUE;
+}
+
+GHashTable *
+cockpit_dbus_generation_update (CockpitDBusGeneration *self,
+                                GHashTable *update)
+{
+  GHashTable *result = NULL;
+  GHashTable *changed;
+  GHashTableIter paths;
+  GHashTableIter interfaces;
+  gpointer path, interface, value;
+  guint64 number;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (update != NULL, NULL);
+
+  prune_tombstones (self);
+
+  number = self->number + 1;
+
+  g_hash_table_iter_init (&paths, update);
+  while (g_hash_table_iter_next (&paths, &path, &value))
+    {
+      g_hash_table_iter_init (&interfaces, value);
+      while (g_hash_table_iter_next (&interfaces, &interface, &value))
+        {
+          if (update_interface (self, number, path, interface, value, &changed))
+            result_add (&result, path, interface, changed);
+        }
+    }
+
+  if (result)
+    self->number = number;
+
+  return result;
+}
+
+GHashTable *
+cockpit_dbus_generation_sweep (CockpitDBusGeneration *self,
+                               const gchar *path,
+                               gboolean is_namespace,
+                               const gchar *interface)
+{
+  GHashTable *result = NULL;
+  GHashTableIter paths;
+  GHashTableIter interfaces;
+  InterfaceState *is;
+  gpointer key, name, value;
+  guint64 number;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  if (!path)
+    {
+      path = "/";
+      is_namespace = TRUE;
+    }
+
+  number = self->number + 1;
+
+  /*
+   * Anything the client had from before it was resumed, and that the
+   * watch didn't come across again, is no longer there.
+   */
+  g_hash_table_iter_init (&paths, self->paths);
+  while (g_hash_table_iter_next (&paths, &key, &value))
+    {
+      if (is_namespace ? !cockpit_path_equal_or_ancestor (key, path) : !g_str_equal (key, path))
+        continue;
+
+      g_hash_table_iter_init (&interfaces, value);
+      while (g_hash_table_iter_next (&interfaces, &name, (gpointer *)&is))
+        {
+          if (interface && !g_str_equal (interface, name))
+            continue;
+          if (is->seen || !is->properties)
+            continue;
+
+          g_hash_table_unref (is->properties);
+          is->properties = NULL;
+          is->dirty = FALSE;
+          is->seen = TRUE;
+          is->number = number;
+          self->tombstones++;
+
+          result_add (&result, key, name, NULL);
+        }
+    }
+
+  if (result)
+    self->number = number;
+
+  return result;
+}
+
+void
+cockpit_dbus_generation_cleanup (void)
+{
+  if (generations)
+    g_hash_table_destroy (generations);
+  generations = NULL;
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COCKPIT_DBUS_GENERATION_H
+#define COCKPIT_DBUS_GENERATION_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _CockpitDBusGeneration CockpitDBusGeneration;
+
+CockpitDBusGeneration *  cockpit_dbus_generation_new      (const gchar *scope);
+
+CockpitDBusGeneration *  cockpit_dbus_generation_resume   (const gchar *scope,
+                                                           const gchar *token);
+
+void                     cockpit_dbus_generation_release  (CockpitDBusGeneration *self);
+
+gchar *                  cockpit_dbus_generation_token    (CockpitDBusGeneration *self);
+
+GHashTable *             cockpit_dbus_generation_update   (CockpitDBusGeneration *self,
+                                                           GHashTable *update);
+
+GHashTable *             cockpit_dbus_generation_sweep    (CockpitDBusGeneration *self,
+                                                           const gchar *path,
+                                                           gboolean is_namespace,
+                                                           const gchar *interface);
+
+void                     cockpit_dbus_generation_cleanup  (void);
+
+G_END_DECLS
+
+#endif /* COCKPIT_DBUS_GENERATION_H */
@@ -47,6 +47,8 @@ void                  cockpit_dbus_machines_cleanup      (void);
 
 void                  cockpit_dbus_config_startup        (void);
 
+void                  cockpit_dbus_debug_startup         (void);
+
 void cockpit_dbus_login_messages_startup (void);
 
 G_END_DECLS
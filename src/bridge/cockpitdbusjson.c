@@ -23,6 +23,7 @@
 
 #include "cockpitpipechannel.h"
 #include "cockpitdbuscache.h"
+#include "cockpitdbusgeneration.h"
 #include "cockpitdbusinternal.h"
 #include "cockpitdbusmeta.h"
 #include "cockpitdbusrules.h"
@@ -93,6 +94,10 @@ typedef struct {
   CockpitDBusCache *cache;
   gulong meta_sig;
   gulong update_sig;
+
+  /* What the client has been sent, when it asked for generations */
+  CockpitDBusGeneration *generation;
+  gboolean notified;
 } CockpitDBusPeer;
 
 typedef struct {
@@ -2032,18 +2037,128 @@ build_json_update (GHashTable *paths)
 }
 
 static void
-on_cache_update (CockpitDBusCache *cache,
-                 GHashTable *update,
-                 gpointer user_data)
+send_notify (CockpitDBusPeer *peer,
+             GHashTable *update)
 {
-  CockpitDBusPeer *peer = user_data;
   JsonObject *object = json_object_new ();
+  gchar *token;
+
   maybe_include_name (peer->dbus_json, object, peer->name);
   json_object_set_object_member (object, "notify", build_json_update (update));
+  if (peer->generation)
+    {
+      token = cockpit_dbus_generation_token (peer->generation);
+      json_object_set_string_member (object, "generation", token);
+      g_free (token);
+    }
   send_json_object (peer->dbus_json, object);
   json_object_unref (object);
 }
 
+static void
+on_cache_update (CockpitDBusCache *cache,
+                 GHashTable *update,
+                 gpointer user_data)
+{
+  CockpitDBusPeer *peer = user_data;
+  GHashTable *changed;
+
+  peer->notified = TRUE;
+
+  if (!peer->generation)
+    {
+      send_notify (peer, update);
+      return;
+    }
+
+  /* Only send what the client doesn't already have */
+  changed = cockpit_dbus_generation_update (peer->generation, update);
+  if (changed)
+    {
+      send_notify (peer, changed);
+      g_hash_table_unref (changed);
+    }
+}
+
+static gboolean
+ensure_generation (CockpitDBusJson *self,
+                   CockpitDBusPeer *peer,
+                   const gchar *token,
+                   gboolean *resumed)
+{
+  gchar *scope;
+
+  *resumed = FALSE;
+
+  if (peer->generation)
+    return TRUE;
+
+  /*
+   * Once notify messages have gone out without tracking them, we no
+   * longer know what the client has.
+   */
+  if (peer->notified)
+    return FALSE;
+
+  scope = g_strdup_printf ("%d:%s:%s", self->bus_type, self->logname,
+                           peer->name ? peer->name : "");
+  if (token)
+    peer->generation = cockpit_dbus_generation_resume (scope, token);
+  if (peer->generation)
+    *resumed = TRUE;
+  else
+    peer->generation = cockpit_dbus_generation_new (scope);
+  g_free (scope);
+
+  return TRUE;
+}
+
+typedef struct {
+  CockpitDBusPeer *peer;
+  CockpitDBusJson *dbus_json;
+  JsonObject *reply;
+  gchar *path;
+  gboolean is_namespace;
+  gchar *interface;
+} WatchData;
+
+static void
+on_watch_complete (CockpitDBusCache *cache,
+                   gpointer user_data)
+{
+  WatchData *wd = user_data;
+  CockpitDBusJson *self = wd->dbus_json;
+  GHashTable *removed;
+  gchar *token;
+
+  /* The peer and its generation are only valid while not cancelled */
+  if (!g_cancellable_is_cancelled (self->cancellable))
+    {
+      removed = cockpit_dbus_generation_sweep (wd->peer->generation, wd->path,
+                                               wd->is_namespace, wd->interface);
+      if (removed)
+        {
+          send_notify (wd->peer, removed);
+          g_hash_table_unref (removed);
+        }
+
+      if (wd->reply)
+        {
+          token = cockpit_dbus_generation_token (wd->peer->generation);
+          json_object_set_string_member (wd->reply, "generation", token);
+          send_json_object (self, wd->reply);
+          g_free (token);
+        }
+    }
+
+  if (wd->reply)
+    json_object_unref (wd->reply);
+  g_object_unref (wd->dbus_json);
+  g_free (wd->path);
+  g_free (wd->interface);
+  g_slice_free (WatchData, wd);
+}
+
 static void
 handle_dbus_watch (CockpitDBusJson *self,
                    JsonObject *object)
@@ -2054,7 +2169,11 @@ handle_dbus_watch (CockpitDBusJson *self,
   const gchar *path_namespace;
   const gchar *interface;
   gboolean is_namespace = FALSE;
+  gboolean tracking = FALSE;
+  gboolean resumed = FALSE;
+  const gchar *generation = NULL;
   const gchar *cookie;
+  WatchData *wd;
   JsonNode *node;
 
   node = json_object_get_member (object, "watch");
@@ -2063,6 +2182,13 @@ handle_dbus_watch (CockpitDBusJson *self,
   if (!parse_json_rule (self, node, &name, &path, &path_namespace, &interface, NULL, NULL))
     return;
 
+  if (!cockpit_json_get_string (object, "generation", NULL, &generation))
+    {
+      cockpit_channel_fail (COCKPIT_CHANNEL (self), "protocol-error",
+                            "invalid \"generation\" field in dbus watch");
+      return;
+    }
+
   if (path_namespace)
     {
       path = path_namespace;
@@ -2070,13 +2196,40 @@ handle_dbus_watch (CockpitDBusJson *self,
     }
 
   peer = ensure_peer (self, name);
+
+  /* A "generation" field, even a null one, asks us to track what was sent */
+  if (json_object_has_member (object, "generation"))
+    tracking = ensure_generation (self, peer, generation, &resumed);
+
   cockpit_dbus_cache_watch (peer->cache, path, is_namespace, interface);
 
   if (!path)
     path = "/";
 
+  if (tracking)
+    {
+      wd = g_slice_new0 (WatchData);
+      wd->peer = peer;
+      wd->dbus_json = g_object_ref (self);
+      wd->path = g_strdup (path);
+      wd->is_namespace = is_namespace;
+      wd->interface = g_strdup (interface);
+
+      if (cockpit_json_get_string (object, "id", NULL, &cookie))
+        {
+          wd->reply = json_object_new ();
+          json_object_set_array_member (wd->reply, "reply", json_array_new ());
+          json_object_set_string_member (wd->reply, "id", cookie);
+          if (generation)
+            json_object_set_boolean_member (wd->reply, "resumed", resumed);
+        }
+
+      cockpit_dbus_cache_poke (peer->cache, path, NULL);
+      cockpit_dbus_cache_barrier (peer->cache, on_watch_complete, wd);
+    }
+
   /* Send back a reply when this has completed */
-  if (cockpit_json_get_string (object, "id", NULL, &cookie))
+  else if (cockpit_json_get_string (object, "id", NULL, &cookie))
     {
       object = json_object_new ();
       json_object_set_array_member (object, "reply", json_array_new ());
@@ -3108,6 +3261,9 @@ cockpit_dbus_json_dispose (GObject *object)
 
       cockpit_dbus_rules_free (peer->rules);
 
+      if (peer->generation)
+        cockpit_dbus_generation_release (peer->generation);
+
       if (self->connection)
         g_dbus_connection_signal_unsubscribe (self->connection, peer->subscribe_id);
       g_free (peer);
@@ -25,20 +25,55 @@
 
 #define MACHINES_SIG "a{sa{sv}}"
 
-/* counts the number of file change events that have not yet gotten a PropertiesChanged signal */
+/* set when an update is queued, but not yet sent out as signals */
 static guint pending_updates;
 
+/* machines that changed since the last signals were sent */
+static GHashTable *pending_updated;
+static GHashTable *pending_removed;
+
+static CockpitMachinesIndex *machines_index;
+static gboolean machines_primed;
+
 GFileMonitor *machines_monitor;
 
+static gboolean notify_properties (gpointer user_data);
+
+/* nobody can have seen a change before the first time the index is read */
+static gboolean
+refresh_index (void)
+{
+  if (!machines_primed)
+    {
+      cockpit_machines_index_refresh (machines_index, NULL, NULL);
+      machines_primed = TRUE;
+      return FALSE;
+    }
+
+  return cockpit_machines_index_refresh (machines_index, pending_updated, pending_removed);
+}
+
+/* brings the index up to date, and queues signals if anything changed */
+static void
+refresh_machines (GDBusConnection *connection)
+{
+  if (refresh_index () && pending_updates++ == 0)
+    {
+      g_timeout_add_full (G_PRIORITY_DEFAULT, 100, notify_properties,
+                          g_object_ref (connection), g_object_unref);
+    }
+}
+
 /* returns a floating GVariant */
 static GVariant *
-get_machines (void)
+build_machines (JsonObject *object)
 {
   JsonNode *machines;
   GError *error = NULL;
   GVariant *variant;
 
-  machines = read_machines_json ();
+  machines = json_node_new (JSON_NODE_OBJECT);
+  json_node_set_object (machines, object);
   variant = json_gvariant_deserialize (machines, MACHINES_SIG, &error);
   /* if the signature does not match, we screwed up in the parser already */
   g_assert (variant != NULL);
@@ -46,6 +81,14 @@ get_machines (void)
   return variant;
 }
 
+/* returns a floating GVariant */
+static GVariant *
+get_machines (GDBusConnection *connection)
+{
+  refresh_machines (connection);
+  return build_machines (cockpit_machines_index_get (machines_index));
+}
+
 static GVariant *
 machines_get_property (GDBusConnection *connection,
                        const gchar *sender,
@@ -58,7 +101,7 @@ machines_get_property (GDBusConnection *connection,
   g_return_val_if_fail (property_name != NULL, NULL);
 
   if (g_str_equal (property_name, "Machines"))
-    return get_machines ();
+    return get_machines (connection);
   else
     g_return_val_if_reached (NULL);
 }
@@ -95,46 +138,89 @@ machines_method_call (GDBusConnection *connection,
     g_return_if_reached ();
 }
 
+static void
+emit_signal (GDBusConnection *connection,
+             const gchar *interface,
+             const gchar *member,
+             GVariant *parameters)
+{
+  GError *error = NULL;
+
+  g_dbus_connection_emit_signal (connection, NULL, "/machines", interface, member, parameters, &error);
+  if (error != NULL)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CLOSED))
+        g_critical ("failed to send %s signal: %s", member, error->message);
+      g_error_free (error);
+    }
+}
+
 /**
  * notify_properties:
  * @user_data: GDBusConnection to which updates get sent
  *
- * Send a PropertiesChanged signal for invalidating the Machines property. This
- * avoids parsing files and constructing the property when nobody is listening.
- * This gets called in reaction to changed *.json configuration files.
+ * Send out the machines that changed since last time. PropertiesChanged
+ * carries the whole new Machines property, so that listeners don't
+ * have to come back and Get it. The Changed signal carries only the
+ * machines that were added, changed or removed.
+ *
+ * Only the files that changed are parsed again, and if nothing in the
+ * merged view actually changed, no signals are sent at all.
  */
 static gboolean
 notify_properties (gpointer user_data)
 {
   GDBusConnection *connection = user_data;
-  GVariant *signal_value;
-  GVariantBuilder builder;
-  GError *error = NULL;
+  GVariantBuilder changed;
+  GVariantBuilder removed;
+  GHashTableIter iter;
+  JsonObject *machines;
+  JsonObject *updates;
+  gpointer key;
+
+  if (!machines_index)
+    return G_SOURCE_REMOVE;
+
+  refresh_index ();
 
   /* reset pending counter before we do any actual work, to avoid races */
   pending_updates = 0;
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
-  g_variant_builder_add (&builder, "s", "Machines");
-  signal_value = g_variant_ref_sink (g_variant_new ("(sa{sv}as)", "cockpit.Machines", NULL, &builder));
-
-  g_dbus_connection_emit_signal (connection,
-                                 NULL,
-                                 "/machines",
-                                 "org.freedesktop.DBus.Properties",
-                                 "PropertiesChanged",
-                                 signal_value,
-                                 &error);
-  if (error != NULL)
+
+  if (g_hash_table_size (pending_updated) == 0 && g_hash_table_size (pending_removed) == 0)
     {
-      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CLOSED))
-        g_critical ("failed to send PropertiesChanged signal: %s", error->message);
-      g_error_free (error);
+      g_debug ("machines: no changes to announce");
+      return G_SOURCE_REMOVE;
+    }
+
+  machines = cockpit_machines_index_get (machines_index);
+
+  g_variant_builder_init (&changed, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&changed, "{sv}", "Machines", build_machines (machines));
+  emit_signal (connection, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+               g_variant_new ("(sa{sv}as)", "cockpit.Machines", &changed, NULL));
+
+  updates = json_object_new ();
+  g_hash_table_iter_init (&iter, pending_updated);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (json_object_has_member (machines, key))
+        json_object_set_member (updates, key, json_object_dup_member (machines, key));
     }
-  g_variant_unref (signal_value);
+
+  g_variant_builder_init (&removed, G_VARIANT_TYPE ("as"));
+  g_hash_table_iter_init (&iter, pending_removed);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_variant_builder_add (&removed, "s", key);
+
+  emit_signal (connection, "cockpit.Machines", "Changed",
+               g_variant_new ("(@" MACHINES_SIG "as)", build_machines (updates), &removed));
+
+  json_object_unref (updates);
+  g_hash_table_remove_all (pending_updated);
+  g_hash_table_remove_all (pending_removed);
   return G_SOURCE_REMOVE;
 }
 
-
 static void
 on_machines_changed (GFileMonitor *monitor,
                      GFile *file,
@@ -156,7 +242,10 @@ on_machines_changed (GFileMonitor *monitor,
        * files and sending PropertiesChanged; if we already have queued up an
        * update, don't queue it again */
       if (pending_updates++ == 0)
-        g_timeout_add (100, notify_properties, user_data);
+        {
+          g_timeout_add_full (G_PRIORITY_DEFAULT, 100, notify_properties,
+                              g_object_ref (user_data), g_object_unref);
+        }
     }
   else
     {
@@ -207,8 +296,31 @@ static GDBusMethodInfo *machines_methods[] = {
   NULL
 };
 
+static GDBusArgInfo machines_changed_updated_arg = {
+  -1, "updated", MACHINES_SIG, NULL
+};
+
+static GDBusArgInfo machines_changed_removed_arg = {
+  -1, "removed", "as", NULL
+};
+
+static GDBusArgInfo *machines_changed_args[] = {
+  &machines_changed_updated_arg,
+  &machines_changed_removed_arg,
+  NULL
+};
+
+static GDBusSignalInfo machines_changed_signal = {
+  -1, "Changed", machines_changed_args, NULL
+};
+
+static GDBusSignalInfo *machines_signals[] = {
+  &machines_changed_signal,
+  NULL
+};
+
 static GDBusInterfaceInfo machines_interface = {
-  -1, "cockpit.Machines", machines_methods, NULL, machines_properties, NULL
+  -1, "cockpit.Machines", machines_methods, machines_signals, machines_properties, NULL
 };
 
 void
@@ -221,6 +333,10 @@ cockpit_dbus_machines_startup (void)
   connection = cockpit_dbus_internal_server ();
   g_return_if_fail (connection != NULL);
 
+  machines_index = cockpit_machines_index_new (NULL);
+  pending_updated = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  pending_removed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
   g_dbus_connection_register_object (connection, "/machines", &machines_interface,
                                      &machines_vtable, NULL, NULL, &error);
 
@@ -249,5 +365,10 @@ cockpit_dbus_machines_startup (void)
 void
 cockpit_dbus_machines_cleanup (void)
 {
-  g_object_unref (machines_monitor);
+  g_clear_object (&machines_monitor);
+  cockpit_machines_index_free (machines_index);
+  machines_index = NULL;
+  machines_primed = FALSE;
+  g_clear_pointer (&pending_updated, g_hash_table_unref);
+  g_clear_pointer (&pending_removed, g_hash_table_unref);
 }
@@ -0,0 +1,402 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitdnscache.h"
+#include "cockpitdnscachesamples.h"
+
+/**
+ * CockpitDnsCache:
+ *
+ * A bridge wide cache of host name lookups. Channels that connect
+ * to the same host over and over shouldn't each pay for a trip
+ * through the resolver.
+ *
+ * GResolver doesn't tell us the TTL of the records it looked up,
+ * so answers are kept for a fixed time. Failures are cached too,
+ * but only briefly. An answer that is used when it's close to
+ * expiring is refreshed in the background, while the caller gets
+ * the cached addresses right away.
+ *
+ * Callers that ask while a lookup for the same name is in progress
+ * wait for that lookup rather than starting another.
+ */
+
+#define DNS_CACHE_TTL            60
+#define DNS_CACHE_NEGATIVE_TTL   5
+#define DNS_CACHE_MAX_ENTRIES    256
+
+typedef struct {
+  gchar *hostname;
+  GList *addresses;
+  GError *error;
+  gint64 resolved;
+  gint64 started;
+  gboolean resolving;
+  GQueue waiters;
+} DnsEntry;
+
+static GHashTable *dns_entries;
+
+static void
+dns_entry_free (gpointer data)
+{
+  DnsEntry *entry = data;
+  g_assert (!entry->resolving);
+  g_assert (g_queue_is_empty (&entry->waiters));
+  g_resolver_free_addresses (entry->addresses);
+  g_clear_error (&entry->error);
+  g_free (entry->hostname);
+  g_slice_free (DnsEntry, entry);
+}
+
+static gint64
+dns_entry_ttl (DnsEntry *entry)
+{
+  return (entry->error ? DNS_CACHE_NEGATIVE_TTL : DNS_CACHE_TTL) * G_USEC_PER_SEC;
+}
+
+static gboolean
+dns_entry_fresh (DnsEntry *entry,
+                 gint64 now)
+{
+  return entry->resolved != 0 && now < entry->resolved + dns_entry_ttl (entry);
+}
+
+static void
+dns_entries_expire (void)
+{
+  GHashTableIter iter;
+  DnsEntry *oldest = NULL;
+  DnsEntry *entry;
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+
+  g_hash_table_iter_init (&iter, dns_entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    {
+      if (entry->resolving)
+        continue;
+      if (!dns_entry_fresh (entry, now))
+        g_hash_table_iter_remove (&iter);
+      else if (!oldest || entry->resolved < oldest->resolved)
+        oldest = entry;
+    }
+
+  if (g_hash_table_size (dns_entries) > DNS_CACHE_MAX_ENTRIES && oldest)
+    g_hash_table_remove (dns_entries, oldest->hostname);
+
+  cockpit_dns_cache_stats ()->entries = g_hash_table_size (dns_entries);
+}
+
+static DnsEntry *
+dns_entry_ensure (const gchar *hostname)
+{
+  DnsEntry *entry;
+
+  if (!dns_entries)
+    dns_entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, dns_entry_free);
+
+  entry = g_hash_table_lookup (dns_entries, hostname);
+  if (!entry)
+    {
+      if (g_hash_table_size (dns_entries) >= DNS_CACHE_MAX_ENTRIES)
+        dns_entries_expire ();
+
+      entry = g_slice_new0 (DnsEntry);
+      entry->hostname = g_strdup (hostname);
+      g_queue_init (&entry->waiters);
+      g_hash_table_insert (dns_entries, entry->hostname, entry);
+      cockpit_dns_cache_stats ()->entries = g_hash_table_size (dns_entries);
+    }
+
+  return entry;
+}
+
+static void
+dns_entry_store (DnsEntry *entry,
+                 GList *addresses,
+                 GError *error)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  g_resolver_free_addresses (entry->addresses);
+  g_clear_error (&entry->error);
+
+  entry->addresses = addresses;
+  entry->error = error;
+  entry->resolved = now;
+
+  if (entry->started)
+    cockpit_dns_cache_stats ()->lookup_usec += now - entry->started;
+  entry->started = 0;
+}
+
+static void
+dns_task_return (GTask *task,
+                 DnsEntry *entry)
+{
+  if (g_task_return_error_if_cancelled (task))
+    return;
+  else if (entry->error)
+    g_task_return_error (task, g_error_copy (entry->error));
+  else
+    g_task_return_pointer (task, g_list_copy_deep (entry->addresses, (GCopyFunc)g_object_ref, NULL),
+                           (GDestroyNotify)g_resolver_free_addresses);
+}
+
+static void
+on_lookup_by_name (GObject *object,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+  DnsEntry *entry = user_data;
+  GError *error = NULL;
+  GList *addresses;
+  GTask *task;
+
+  addresses = g_resolver_lookup_by_name_finish (G_RESOLVER (object), result, &error);
+  if (error)
+    g_debug ("%s: couldn't resolve: %s", entry->hostname, error->message);
+  else
+    g_debug ("%s: resolved %u addresses", entry->hostname, g_list_length (addresses));
+
+  entry->resolving = FALSE;
+  dns_entry_store (entry, addresses, error);
+
+  while ((task = g_queue_pop_head (&entry->waiters)))
+    {
+      dns_task_return (task, entry);
+      g_object_unref (task);
+    }
+}
+
+static void
+dns_entry_resolve (DnsEntry *entry)
+{
+  GResolver *resolver;
+
+  if (entry->resolving)
+    return;
+
+  entry->resolving = TRUE;
+  entry->started = g_get_monotonic_time ();
+
+  /* Not cancellable, other callers may be waiting on the answer */
+  resolver = g_resolver_get_default ();
+  g_resolver_lookup_by_name_async (resolver, entry->hostname, NULL, on_lookup_by_name, entry);
+  g_object_unref (resolver);
+}
+
+static GList *
+lookup_literal (const gchar *hostname)
+{
+  GInetAddress *inet;
+
+  inet = g_inet_address_new_from_string (hostname);
+  if (!inet)
+    return NULL;
+
+  return g_list_prepend (NULL, inet);
+}
+
+/*
+ * Returns TRUE when the entry answers the lookup without waiting
+ * for the resolver. Kicks off a background refresh when the answer
+ * is about to expire.
+ */
+static gboolean
+dns_entry_check (DnsEntry *entry)
+{
+  CockpitDnsCacheStats *stats = cockpit_dns_cache_stats ();
+  gint64 now = g_get_monotonic_time ();
+
+  if (!dns_entry_fresh (entry, now))
+    {
+      g_debug ("%s: dns cache miss", entry->hostname);
+      stats->misses++;
+      return FALSE;
+    }
+
+  if (entry->error)
+    {
+      g_debug ("%s: dns cache negative hit", entry->hostname);
+      stats->negative_hits++;
+      return TRUE;
+    }
+
+  g_debug ("%s: dns cache hit", entry->hostname);
+  stats->hits++;
+
+  if (!entry->resolving && now > entry->resolved + dns_entry_ttl (entry) * 3 / 4)
+    {
+      g_debug ("%s: refreshing dns cache entry", entry->hostname);
+      stats->refreshes++;
+      dns_entry_resolve (entry);
+    }
+
+  return TRUE;
+}
+
+/**
+ * cockpit_dns_cache_lookup_async:
+ * @hostname: The host name to look up
+ * @cancellable: Optional cancellable
+ * @callback: Called when complete
+ * @user_data: Data for @callback
+ *
+ * Look up the addresses for @hostname, using a cached answer
+ * when there is one. IP address literals are returned as is.
+ */
+void
+cockpit_dns_cache_lookup_async (const gchar *hostname,
+                                GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                gpointer user_data)
+{
+  DnsEntry *entry;
+  GList *addresses;
+  GTask *task;
+
+  g_return_if_fail (hostname != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, cockpit_dns_cache_lookup_async);
+
+  addresses = lookup_literal (hostname);
+  if (addresses)
+    {
+      g_task_return_pointer (task, addresses, (GDestroyNotify)g_resolver_free_addresses);
+    }
+  else
+    {
+      entry = dns_entry_ensure (hostname);
+      if (dns_entry_check (entry))
+        {
+          dns_task_return (task, entry);
+        }
+      else
+        {
+          g_queue_push_tail (&entry->waiters, g_object_ref (task));
+          dns_entry_resolve (entry);
+        }
+    }
+
+  g_object_unref (task);
+}
+
+/**
+ * cockpit_dns_cache_lookup_finish:
+ * @result: The result passed to the callback
+ * @error: Location to place an error
+ *
+ * Returns: (transfer full): A list of GInetAddress, free with
+ *          g_resolver_free_addresses(), or NULL with @error set
+ */
+GList *
+cockpit_dns_cache_lookup_finish (GAsyncResult *result,
+                                 GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * cockpit_dns_cache_lookup:
+ * @hostname: The host name to look up
+ * @cancellable: Optional cancellable
+ * @error: Location to place an error
+ *
+ * The synchronous version of cockpit_dns_cache_lookup_async().
+ * Only blocks when there is no fresh cached answer.
+ *
+ * Returns: (transfer full): A list of GInetAddress, free with
+ *          g_resolver_free_addresses(), or NULL with @error set
+ */
+GList *
+cockpit_dns_cache_lookup (const gchar *hostname,
+                          GCancellable *cancellable,
+                          GError **error)
+{
+  GResolver *resolver;
+  GError *local_error = NULL;
+  GList *addresses;
+  DnsEntry *entry;
+
+  g_return_val_if_fail (hostname != NULL, NULL);
+
+  addresses = lookup_literal (hostname);
+  if (addresses)
+    return addresses;
+
+  entry = dns_entry_ensure (hostname);
+  if (!dns_entry_check (entry))
+    {
+      entry->started = g_get_monotonic_time ();
+
+      resolver = g_resolver_get_default ();
+      addresses = g_resolver_lookup_by_name (resolver, hostname, cancellable, &local_error);
+      g_object_unref (resolver);
+
+      /* A cancelled lookup says nothing about the host */
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_propagate_error (error, local_error);
+          return NULL;
+        }
+
+      dns_entry_store (entry, addresses, local_error);
+    }
+
+  if (entry->error)
+    {
+      g_propagate_error (error, g_error_copy (entry->error));
+      return NULL;
+    }
+
+  return g_list_copy_deep (entry->addresses, (GCopyFunc)g_object_ref, NULL);
+}
+
+/**
+ * cockpit_dns_cache_flush:
+ *
+ * Forget all cached answers. Lookups that are in progress
+ * still complete and are cached.
+ */
+void
+cockpit_dns_cache_flush (void)
+{
+  GHashTableIter iter;
+  DnsEntry *entry;
+
+  if (!dns_entries)
+    return;
+
+  g_hash_table_iter_init (&iter, dns_entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    {
+      if (!entry->resolving)
+        g_hash_table_iter_remove (&iter);
+    }
+
+  cockpit_dns_cache_stats ()->entries = g_hash_table_size (dns_entries);
+}
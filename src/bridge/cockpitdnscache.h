@@ -0,0 +1,43 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COCKPIT_DNS_CACHE_H__
+#define COCKPIT_DNS_CACHE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void        cockpit_dns_cache_lookup_async     (const gchar *hostname,
+                                                GCancellable *cancellable,
+                                                GAsyncReadyCallback callback,
+                                                gpointer user_data);
+
+GList *     cockpit_dns_cache_lookup_finish    (GAsyncResult *result,
+                                                GError **error);
+
+GList *     cockpit_dns_cache_lookup           (const gchar *hostname,
+                                                GCancellable *cancellable,
+                                                GError **error);
+
+void        cockpit_dns_cache_flush            (void);
+
+G_END_DECLS
+
+#endif /* COCKPIT_DNS_CACHE_H__ */
@@ -0,0 +1,51 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitdnscachesamples.h"
+
+/*
+ * CockpitDnsCache updates these counters in place. They live here
+ * so that the metrics code doesn't depend on the cache itself.
+ */
+
+static CockpitDnsCacheStats dns_cache_stats;
+
+/**
+ * cockpit_dns_cache_stats:
+ *
+ * Returns: (transfer none): The bridge wide DNS cache counters
+ */
+CockpitDnsCacheStats *
+cockpit_dns_cache_stats (void)
+{
+  return &dns_cache_stats;
+}
+
+void
+cockpit_dns_cache_samples (CockpitSamples *samples)
+{
+  cockpit_samples_sample (samples, "dns.cache.entries", NULL, dns_cache_stats.entries);
+  cockpit_samples_sample (samples, "dns.cache.hits", NULL, dns_cache_stats.hits);
+  cockpit_samples_sample (samples, "dns.cache.negative-hits", NULL, dns_cache_stats.negative_hits);
+  cockpit_samples_sample (samples, "dns.cache.misses", NULL, dns_cache_stats.misses);
+  cockpit_samples_sample (samples, "dns.cache.refreshes", NULL, dns_cache_stats.refreshes);
+  cockpit_samples_sample (samples, "dns.cache.lookup-time", NULL, dns_cache_stats.lookup_usec / 1000);
+}
@@ -0,0 +1,762 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+
+#include "cockpitfsarchive.h"
+
+#include "common/cockpitflow.h"
+#include "common/cockpitjson.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * CockpitFsarchive:
+ *
+ * A #CockpitChannel that sends a directory as a tar archive, optionally
+ * gzip compressed. The directory is walked with openat() and fstatat()
+ * in sorted order, so that the same tree always produces the same
+ * archive, and an interrupted download can continue at an offset.
+ *
+ * The payload type for this channel is 'fsarchive1'.
+ */
+
+#define COCKPIT_FSARCHIVE(o)    (G_TYPE_CHECK_INSTANCE_CAST ((o), COCKPIT_TYPE_FSARCHIVE, CockpitFsarchive))
+
+/* How much output to produce each time round the main loop */
+#define CHUNK_SIZE (256 * 1024)
+
+#define BLOCK_SIZE 512
+
+/* How often to send "progress" messages */
+#define PROGRESS_INTERVAL (1 * G_USEC_PER_SEC)
+
+typedef struct {
+  int fd;
+  gchar *name;
+  GPtrArray *entries;
+  guint next;
+  gboolean follow;
+} ArchiveDir;
+
+typedef struct {
+  CockpitChannel parent;
+  gboolean closing;
+
+  /* Directories being walked, innermost last */
+  GPtrArray *stack;
+
+  /* The regular file whose content is being sent */
+  int file_fd;
+  gint64 file_offset;
+  gint64 file_size;
+
+  /* Uncompressed position in the archive, and where to start sending */
+  gint64 position;
+  gint64 offset;
+
+  GConverter *compressor;
+  GByteArray *buffer;
+
+  guint idle;
+  gboolean pressure;
+  gulong sig_pressure;
+
+  guint64 files;
+  guint64 skipped;
+  gint64 last_progress;
+} CockpitFsarchive;
+
+typedef struct {
+  CockpitChannelClass parent_class;
+} CockpitFsarchiveClass;
+
+G_DEFINE_TYPE (CockpitFsarchive, cockpit_fsarchive, COCKPIT_TYPE_CHANNEL);
+
+static void
+archive_dir_free (gpointer data)
+{
+  ArchiveDir *dir = data;
+
+  if (dir->fd >= 0)
+    close (dir->fd);
+  g_ptr_array_unref (dir->entries);
+  g_free (dir->name);
+  g_free (dir);
+}
+
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return strcmp (*(const gchar **)a, *(const gchar **)b);
+}
+
+static ArchiveDir *
+archive_dir_new (int fd,
+                 const gchar *name)
+{
+  ArchiveDir *dir;
+  struct dirent *ent;
+  DIR *dp;
+  int dfd;
+
+  dfd = dup (fd);
+  if (dfd < 0)
+    return NULL;
+  dp = fdopendir (dfd);
+  if (!dp)
+    {
+      close (dfd);
+      return NULL;
+    }
+
+  dir = g_new0 (ArchiveDir, 1);
+  dir->fd = fd;
+  dir->name = g_strdup (name);
+  dir->entries = g_ptr_array_new_with_free_func (g_free);
+
+  while ((ent = readdir (dp)) != NULL)
+    {
+      if (!g_str_equal (ent->d_name, ".") && !g_str_equal (ent->d_name, ".."))
+        g_ptr_array_add (dir->entries, g_strdup (ent->d_name));
+    }
+  closedir (dp);
+
+  g_ptr_array_sort (dir->entries, compare_names);
+  return dir;
+}
+
+static void
+write_compressed (CockpitFsarchive *self,
+                  const guchar *data,
+                  gsize length,
+                  gboolean end)
+{
+  GConverterFlags flags = end ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS;
+  GConverterResult res;
+  GError *error = NULL;
+  gsize space = length + 4096;
+  gsize bytes_read;
+  gsize written;
+  guint len;
+
+  for (;;)
+    {
+      len = self->buffer->len;
+      g_byte_array_set_size (self->buffer, len + space);
+      res = g_converter_convert (self->compressor, data, length,
+                                 self->buffer->data + len, space,
+                                 flags, &bytes_read, &written, &error);
+      if (res == G_CONVERTER_ERROR)
+        {
+          g_byte_array_set_size (self->buffer, len);
+          if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE))
+            {
+              cockpit_channel_fail (COCKPIT_CHANNEL (self), "internal-error",
+                                    "couldn't compress archive: %s", error->message);
+              g_error_free (error);
+              return;
+            }
+          g_clear_error (&error);
+          space *= 2;
+          continue;
+        }
+
+      g_byte_array_set_size (self->buffer, len + written);
+      data += bytes_read;
+      length -= bytes_read;
+
+      if (end ? res == G_CONVERTER_FINISHED : length == 0)
+        return;
+    }
+}
+
+/* All output goes through here, uncompressed */
+static void
+write_output (CockpitFsarchive *self,
+              const guchar *data,
+              gsize length)
+{
+  gsize skip = 0;
+
+  /* Leave out what the caller already has */
+  if (self->position < self->offset)
+    skip = MIN (length, self->offset - self->position);
+  self->position += length;
+
+  if (skip == length)
+    return;
+  if (self->compressor)
+    write_compressed (self, data + skip, length - skip, FALSE);
+  else
+    g_byte_array_append (self->buffer, data + skip, length - skip);
+}
+
+static void
+write_padding (CockpitFsarchive *self,
+               gint64 size)
+{
+  static const guchar zeros[BLOCK_SIZE] = { 0, };
+
+  if (size % BLOCK_SIZE)
+    write_output (self, zeros, BLOCK_SIZE - (size % BLOCK_SIZE));
+}
+
+static void
+set_octal (gchar *field,
+           gsize length,
+           guint64 value)
+{
+  /* Fields that overflow get the real value in a pax header */
+  if (value >> (3 * (length - 1)))
+    value = 0;
+  g_snprintf (field, length, "%0*" G_GINT64_MODIFIER "o", (int)length - 1, value);
+}
+
+static void
+add_pax_record (GString *pax,
+                const gchar *keyword,
+                const gchar *value)
+{
+  gsize length;
+  gsize digits;
+
+  /* The length includes its own digits */
+  length = strlen (keyword) + strlen (value) + 3;
+  for (digits = 1; ; digits++)
+    {
+      gchar *total = g_strdup_printf ("%" G_GSIZE_FORMAT, length + digits);
+      gboolean fits = strlen (total) == digits;
+      g_free (total);
+      if (fits)
+        break;
+    }
+
+  g_string_append_printf (pax, "%" G_GSIZE_FORMAT " %s=%s\n", length + digits, keyword, value);
+}
+
+static void
+write_header_block (CockpitFsarchive *self,
+                    const gchar *name,
+                    const gchar *linkname,
+                    struct stat *st,
+                    gchar type,
+                    gint64 size)
+{
+  guchar block[BLOCK_SIZE] = { 0, };
+  guint checksum = 0;
+  gint i;
+
+  strncpy ((gchar *)block, name, 100);
+  set_octal ((gchar *)block + 100, 8, st->st_mode & 07777);
+  set_octal ((gchar *)block + 108, 8, st->st_uid);
+  set_octal ((gchar *)block + 116, 8, st->st_gid);
+  set_octal ((gchar *)block + 124, 12, size);
+  set_octal ((gchar *)block + 136, 12, st->st_mtim.tv_sec > 0 ? st->st_mtim.tv_sec : 0);
+  block[156] = type;
+  if (linkname)
+    strncpy ((gchar *)block + 157, linkname, 100);
+  memcpy (block + 257, "ustar", 6);
+  memcpy (block + 263, "00", 2);
+
+  memset (block + 148, ' ', 8);
+  for (i = 0; i < BLOCK_SIZE; i++)
+    checksum += block[i];
+  g_snprintf ((gchar *)block + 148, 8, "%06o", checksum);
+
+  write_output (self, block, BLOCK_SIZE);
+}
+
+static void
+write_header (CockpitFsarchive *self,
+              const gchar *name,
+              const gchar *linkname,
+              struct stat *st,
+              gchar type,
+              gint64 size)
+{
+  struct stat pax_st = { 0, };
+  GString *pax;
+  gchar *value;
+
+  pax = g_string_new ("");
+  if (strlen (name) > 100)
+    add_pax_record (pax, "path", name);
+  if (linkname && strlen (linkname) > 100)
+    add_pax_record (pax, "linkpath", linkname);
+  if (size >> 33)
+    {
+      value = g_strdup_printf ("%" G_GINT64_FORMAT, size);
+      add_pax_record (pax, "size", value);
+      g_free (value);
+    }
+  if (st->st_uid >> 21 || st->st_gid >> 21)
+    {
+      value = g_strdup_printf ("%u", (guint)st->st_uid);
+      add_pax_record (pax, "uid", value);
+      g_free (value);
+      value = g_strdup_printf ("%u", (guint)st->st_gid);
+      add_pax_record (pax, "gid", value);
+      g_free (value);
+    }
+
+  if (pax->len > 0)
+    {
+      pax_st.st_mode = 0644;
+      write_header_block (self, "././@PaxHeader", NULL, &pax_st, 'x', pax->len);
+      write_output (self, (guchar *)pax->str, pax->len);
+      write_padding (self, pax->len);
+    }
+
+  write_header_block (self, name, linkname, st, type, size);
+  g_string_free (pax, TRUE);
+}
+
+/* Returns FALSE when the file is done */
+static gboolean
+write_file_content (CockpitFsarchive *self,
+                    gsize max)
+{
+  static const guchar zeros[BLOCK_SIZE] = { 0, };
+  guchar *data;
+  gint64 remaining = self->file_size - self->file_offset;
+  gint64 skip;
+  gssize res;
+
+  /* Parts that lie before the resume offset are not read at all */
+  if (self->position < self->offset)
+    {
+      skip = MIN (remaining, self->offset - self->position);
+      self->position += skip;
+      self->file_offset += skip;
+      remaining -= skip;
+    }
+
+  if (remaining > 0)
+    {
+      data = g_malloc (MIN (remaining, (gint64)max));
+      res = pread (self->file_fd, data, MIN (remaining, (gint64)max), self->file_offset);
+      if (res < 0 && errno == EINTR)
+        res = 0;
+      else if (res <= 0)
+        {
+          /* The file shrank or can't be read: the header promised the size, so pad with zeros */
+          if (res < 0)
+            g_debug ("couldn't read file for archive: %s", g_strerror (errno));
+          while (remaining > 0)
+            {
+              res = MIN (remaining, BLOCK_SIZE);
+              write_output (self, zeros, res);
+              remaining -= res;
+              self->file_offset += res;
+            }
+          res = 0;
+        }
+      if (res > 0)
+        {
+          write_output (self, data, res);
+          self->file_offset += res;
+        }
+      g_free (data);
+    }
+
+  if (self->file_offset < self->file_size)
+    return TRUE;
+
+  write_padding (self, self->file_size);
+  close (self->file_fd);
+  self->file_fd = -1;
+  return FALSE;
+}
+
+/* Returns FALSE when the archive is complete */
+static gboolean
+write_next_entry (CockpitFsarchive *self)
+{
+  static const guchar zeros[BLOCK_SIZE * 2] = { 0, };
+  ArchiveDir *dir;
+  ArchiveDir *child;
+  const gchar *entry;
+  gchar target[PATH_MAX];
+  struct stat st;
+  gchar *name;
+  gssize len;
+  int fd;
+
+  if (self->stack->len == 0)
+    return FALSE;
+
+  dir = g_ptr_array_index (self->stack, self->stack->len - 1);
+  if (dir->next >= dir->entries->len)
+    {
+      g_ptr_array_remove_index (self->stack, self->stack->len - 1);
+
+      /* Two empty blocks end the archive */
+      if (self->stack->len == 0)
+        write_output (self, zeros, sizeof (zeros));
+      return TRUE;
+    }
+
+  entry = g_ptr_array_index (dir->entries, dir->next++);
+  name = g_strconcat (dir->name, entry, NULL);
+
+  if (fstatat (dir->fd, entry, &st, dir->follow ? 0 : AT_SYMLINK_NOFOLLOW) < 0)
+    {
+      g_debug ("%s: couldn't stat: %s", name, g_strerror (errno));
+      self->skipped++;
+    }
+  else if (S_ISDIR (st.st_mode))
+    {
+      fd = openat (dir->fd, entry, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (dir->follow ? 0 : O_NOFOLLOW));
+      child = NULL;
+      if (fd >= 0)
+        {
+          g_free (name);
+          name = g_strconcat (dir->name, entry, "/", NULL);
+          child = archive_dir_new (fd, name);
+          if (!child)
+            close (fd);
+        }
+
+      if (child)
+        {
+          write_header (self, name, NULL, &st, '5', 0);
+          g_ptr_array_add (self->stack, child);
+          self->files++;
+        }
+      else
+        {
+          g_debug ("%s: couldn't open directory: %s", name, g_strerror (errno));
+          self->skipped++;
+        }
+    }
+  else if (S_ISREG (st.st_mode))
+    {
+      fd = openat (dir->fd, entry, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK | (dir->follow ? 0 : O_NOFOLLOW));
+      if (fd >= 0)
+        {
+          write_header (self, name, NULL, &st, '0', st.st_size);
+          self->file_fd = fd;
+          self->file_offset = 0;
+          self->file_size = st.st_size;
+          self->files++;
+        }
+      else
+        {
+          g_debug ("%s: couldn't open: %s", name, g_strerror (errno));
+          self->skipped++;
+        }
+    }
+  else if (S_ISLNK (st.st_mode))
+    {
+      len = readlinkat (dir->fd, entry, target, sizeof (target) - 1);
+      if (len >= 0)
+        {
+          target[len] = '\0';
+          write_header (self, name, target, &st, '2', 0);
+          self->files++;
+        }
+      else
+        {
+          g_debug ("%s: couldn't read link: %s", name, g_strerror (errno));
+          self->skipped++;
+        }
+    }
+  else
+    {
+      /* Devices, sockets and fifos are left out */
+      self->skipped++;
+    }
+
+  g_free (name);
+  return TRUE;
+}
+
+static void
+send_progress (CockpitFsarchive *self)
+{
+  JsonObject *object;
+
+  object = json_object_new ();
+  json_object_set_int_member (object, "files", self->files);
+  json_object_set_int_member (object, "skipped", self->skipped);
+  json_object_set_int_member (object, "bytes", self->position);
+  cockpit_channel_control (COCKPIT_CHANNEL (self), "progress", object);
+  json_object_unref (object);
+}
+
+static gboolean
+on_idle_produce (gpointer user_data)
+{
+  CockpitFsarchive *self = COCKPIT_FSARCHIVE (user_data);
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+  gint64 start = self->position;
+  gboolean complete = FALSE;
+  GBytes *bytes;
+  gint64 now;
+
+  /* Also bound the input, for data that compresses well or is skipped */
+  while (!complete && self->buffer->len < CHUNK_SIZE && self->position - start < 4 * CHUNK_SIZE)
+    {
+      if (self->file_fd >= 0)
+        write_file_content (self, CHUNK_SIZE - self->buffer->len);
+      else
+        complete = !write_next_entry (self);
+    }
+
+  if (complete && self->compressor)
+    write_compressed (self, NULL, 0, TRUE);
+
+  /* Compression may have failed */
+  if (self->closing)
+    {
+      self->idle = 0;
+      return FALSE;
+    }
+
+  if (self->buffer->len > 0)
+    {
+      bytes = g_byte_array_free_to_bytes (self->buffer);
+      self->buffer = g_byte_array_new ();
+      cockpit_channel_send (channel, bytes, FALSE);
+      g_bytes_unref (bytes);
+    }
+
+  now = g_get_monotonic_time ();
+  if (complete || now - self->last_progress >= PROGRESS_INTERVAL)
+    {
+      send_progress (self);
+      self->last_progress = now;
+    }
+
+  if (complete)
+    {
+      self->idle = 0;
+      cockpit_channel_control (channel, "done", NULL);
+      cockpit_channel_close (channel, NULL);
+      return FALSE;
+    }
+
+  /* Sending made the channel push back, wait for it to drain */
+  if (self->pressure)
+    {
+      self->idle = 0;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+on_channel_pressure (CockpitFlow *flow,
+                     gboolean pressure,
+                     gpointer user_data)
+{
+  CockpitFsarchive *self = COCKPIT_FSARCHIVE (user_data);
+
+  self->pressure = pressure;
+  if (!pressure && !self->idle && !self->closing)
+    self->idle = g_idle_add (on_idle_produce, self);
+}
+
+static void
+cockpit_fsarchive_recv (CockpitChannel *channel,
+                        GBytes *message)
+{
+  cockpit_channel_fail (channel, "protocol-error", "received unexpected message in fsarchive channel");
+}
+
+static void
+cockpit_fsarchive_close (CockpitChannel *channel,
+                         const gchar *problem)
+{
+  CockpitFsarchive *self = COCKPIT_FSARCHIVE (channel);
+
+  self->closing = TRUE;
+  if (self->idle)
+    g_source_remove (self->idle);
+  self->idle = 0;
+
+  COCKPIT_CHANNEL_CLASS (cockpit_fsarchive_parent_class)->close (channel, problem);
+}
+
+static void
+cockpit_fsarchive_init (CockpitFsarchive *self)
+{
+  self->file_fd = -1;
+  self->stack = g_ptr_array_new_with_free_func (archive_dir_free);
+  self->buffer = g_byte_array_new ();
+}
+
+static void
+cockpit_fsarchive_prepare (CockpitChannel *channel)
+{
+  CockpitFsarchive *self = COCKPIT_FSARCHIVE (channel);
+  const gchar *compression;
+  const gchar *binary;
+  const gchar *path;
+  gboolean flow_control;
+  JsonObject *options;
+  ArchiveDir *root;
+  struct stat st;
+  gchar *parent;
+  gchar *base;
+  int err;
+  int fd;
+
+  COCKPIT_CHANNEL_CLASS (cockpit_fsarchive_parent_class)->prepare (channel);
+  if (self->closing)
+    return;
+
+  options = cockpit_channel_get_options (channel);
+
+  if (!cockpit_json_get_string (options, "path", NULL, &path))
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"path\" option for fsarchive channel");
+      return;
+    }
+  if (path == NULL || path[0] != '/')
+    {
+      cockpit_channel_fail (channel, "protocol-error", "missing or relative \"path\" option for fsarchive channel");
+      return;
+    }
+  if (!cockpit_json_get_string (options, "binary", NULL, &binary) || binary == NULL)
+    {
+      cockpit_channel_fail (channel, "protocol-error", "fsarchive channel must be binary");
+      return;
+    }
+
+  /* Without pings and pongs, nothing would stop us from queueing the whole archive */
+  if (!cockpit_json_get_bool (options, "flow-control", FALSE, &flow_control) || !flow_control)
+    {
+      cockpit_channel_fail (channel, "protocol-error", "fsarchive channel must use flow control");
+      return;
+    }
+  if (!cockpit_json_get_string (options, "compression", NULL, &compression) ||
+      (compression && !g_str_equal (compression, "gzip")))
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"compression\" option for fsarchive channel");
+      return;
+    }
+  if (!cockpit_json_get_int (options, "offset", 0, &self->offset) || self->offset < 0 ||
+      (self->offset > 0 && compression))
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"offset\" option for fsarchive channel");
+      return;
+    }
+
+  /*
+   * Walk a pretend parent that only contains the path, so the archive
+   * has the base name of the path at the top.
+   */
+  parent = g_path_get_dirname (path);
+  base = g_path_get_basename (path);
+  if (g_str_equal (base, "/"))
+    {
+      g_free (base);
+      base = g_strdup (".");
+    }
+
+  fd = open (parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0 || fstatat (fd, base, &st, 0) < 0)
+    {
+      err = errno;
+      if (fd >= 0)
+        close (fd);
+      if (err == ENOENT || err == ENOTDIR)
+        cockpit_channel_close (channel, "not-found");
+      else if (err == EPERM || err == EACCES)
+        cockpit_channel_close (channel, "access-denied");
+      else
+        cockpit_channel_fail (channel, "internal-error", "%s: couldn't open: %s", path, g_strerror (err));
+      goto out;
+    }
+
+  root = g_new0 (ArchiveDir, 1);
+  root->fd = fd;
+  root->name = g_strdup ("");
+  root->entries = g_ptr_array_new_with_free_func (g_free);
+  root->follow = TRUE;
+  g_ptr_array_add (root->entries, g_strdup (base));
+  g_ptr_array_add (self->stack, root);
+
+  if (compression)
+    self->compressor = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+
+  self->sig_pressure = g_signal_connect (self, "pressure", G_CALLBACK (on_channel_pressure), self);
+  self->last_progress = g_get_monotonic_time ();
+
+  cockpit_channel_ready (channel, NULL);
+  self->idle = g_idle_add (on_idle_produce, self);
+
+out:
+  g_free (parent);
+  g_free (base);
+}
+
+static void
+cockpit_fsarchive_dispose (GObject *object)
+{
+  CockpitFsarchive *self = COCKPIT_FSARCHIVE (object);
+
+  if (self->idle)
+    g_source_remove (self->idle);
+  self->idle = 0;
+
+  if (self->sig_pressure)
+    g_signal_handler_disconnect (self, self->sig_pressure);
+  self->sig_pressure = 0;
+
+  G_OBJECT_CLASS (cockpit_fsarchive_parent_class)->dispose (object);
+}
+
+static void
+cockpit_fsarchive_finalize (GObject *object)
+{
+  CockpitFsarchive *self = COCKPIT_FSARCHIVE (object);
+
+  if (self->file_fd >= 0)
+    close (self->file_fd);
+  g_ptr_array_unref (self->stack);
+  g_byte_array_unref (self->buffer);
+  g_clear_object (&self->compressor);
+
+  G_OBJECT_CLASS (cockpit_fsarchive_parent_class)->finalize (object);
+}
+
+static void
+cockpit_fsarchive_class_init (CockpitFsarchiveClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  CockpitChannelClass *channel_class = COCKPIT_CHANNEL_CLASS (klass);
+
+  gobject_class->dispose = cockpit_fsarchive_dispose;
+  gobject_class->finalize = cockpit_fsarchive_finalize;
+
+  channel_class->prepare = cockpit_fsarchive_prepare;
+  channel_class->recv = cockpit_fsarchive_recv;
+  channel_class->close = cockpit_fsarchive_close;
+}
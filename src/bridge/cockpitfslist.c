@@ -22,23 +22,42 @@
 #include "cockpitfslist.h"
 #include "cockpitfswatch.h"
 
+#include "common/cockpitflow.h"
 #include "common/cockpitjson.h"
 
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
+#include <unistd.h>
 
 /**
  * CockpitFslist:
  *
  * A #CockpitChannel that lists and optionally watches a directory.
  *
+ * With the "page-size" option the listing is read with getdents64()
+ * and sent in pages, with one array per attribute.
+ *
  * The payload type for this channel is 'fslist1'.
  */
 
+/* Big enough for a few thousand entries per getdents64() call */
+#define DIRENT_BUFFER_SIZE (64 * 1024)
+
+struct linux_dirent64 {
+  guint64 d_ino;
+  gint64 d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
 #define COCKPIT_FSLIST(o)    (G_TYPE_CHECK_INSTANCE_CAST ((o), COCKPIT_TYPE_FSLIST, CockpitFslist))
 
 typedef struct {
@@ -47,6 +66,17 @@ typedef struct {
   GFileMonitor *monitor;
   guint sig_changed;
   GCancellable *cancellable;
+
+  /* Paged listing */
+  gint64 page_size;
+  GPtrArray *attrs;
+  int dir_fd;
+  gchar *dirents;
+  glong dirents_len;
+  glong dirents_pos;
+  guint idle;
+  gboolean pressure;
+  gulong sig_pressure;
 } CockpitFslist;
 
 typedef struct {
@@ -65,6 +95,7 @@ cockpit_fslist_recv (CockpitChannel *channel,
 static void
 cockpit_fslist_init (CockpitFslist *self)
 {
+  self->dir_fd = -1;
 }
 
 static const gchar *
@@ -192,6 +223,286 @@ out:
   g_object_unref (user_data);
 }
 
+static const gchar *
+dirent_type_to_string (unsigned char type)
+{
+  switch (type) {
+  case DT_REG:
+    return "file";
+  case DT_DIR:
+    return "directory";
+  case DT_LNK:
+    return "link";
+  case DT_UNKNOWN:
+    return "unknown";
+  default:
+    return "special";
+  }
+}
+
+static const gchar *
+stat_type_to_string (mode_t mode)
+{
+  if (S_ISREG (mode))
+    return "file";
+  else if (S_ISDIR (mode))
+    return "directory";
+  else if (S_ISLNK (mode))
+    return "link";
+  else
+    return "special";
+}
+
+static const gchar *supported_attrs[] = { "size", "modified", "mode", "owner", "group", "target", NULL };
+
+static void
+add_entry_attr (JsonArray *column,
+                const gchar *attr,
+                int dir_fd,
+                const gchar *name,
+                struct stat *st)
+{
+  gchar target[PATH_MAX];
+  gssize len;
+
+  if (st == NULL)
+    json_array_add_null_element (column);
+  else if (g_str_equal (attr, "size"))
+    json_array_add_int_element (column, st->st_size);
+  else if (g_str_equal (attr, "modified"))
+    json_array_add_int_element (column, st->st_mtim.tv_sec);
+  else if (g_str_equal (attr, "mode"))
+    json_array_add_int_element (column, st->st_mode & 07777);
+  else if (g_str_equal (attr, "owner"))
+    json_array_add_int_element (column, st->st_uid);
+  else if (g_str_equal (attr, "group"))
+    json_array_add_int_element (column, st->st_gid);
+  else if (g_str_equal (attr, "target") && S_ISLNK (st->st_mode))
+    {
+      len = readlinkat (dir_fd, name, target, sizeof (target) - 1);
+      if (len >= 0)
+        {
+          target[len] = '\0';
+          json_array_add_string_element (column, target);
+        }
+      else
+        {
+          json_array_add_null_element (column);
+        }
+    }
+  else
+    json_array_add_null_element (column);
+}
+
+/* Returns FALSE at the end of the directory */
+static gboolean
+send_page (CockpitFslist *self)
+{
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+  struct linux_dirent64 *ent;
+  JsonArray *columns[G_N_ELEMENTS (supported_attrs)];
+  JsonArray *names;
+  JsonArray *types;
+  JsonObject *page;
+  GBytes *bytes;
+  struct stat st;
+  struct stat target_st;
+  gboolean have_stat;
+  gboolean is_link;
+  gboolean more = TRUE;
+  gint64 count = 0;
+  const gchar *type;
+  guint i;
+
+  names = json_array_new ();
+  types = json_array_new ();
+  for (i = 0; i < self->attrs->len; i++)
+    columns[i] = json_array_new ();
+
+  while (count < self->page_size)
+    {
+      if (self->dirents_pos >= self->dirents_len)
+        {
+          self->dirents_len = syscall (SYS_getdents64, self->dir_fd, self->dirents, DIRENT_BUFFER_SIZE);
+          self->dirents_pos = 0;
+          if (self->dirents_len < 0)
+            {
+              cockpit_channel_fail (channel, "internal-error", "%s: couldn't list directory: %s",
+                                    self->path, g_strerror (errno));
+              close (self->dir_fd);
+              self->dir_fd = -1;
+              more = FALSE;
+              break;
+            }
+          if (self->dirents_len == 0)
+            {
+              more = FALSE;
+              break;
+            }
+        }
+
+      ent = (struct linux_dirent64 *)(self->dirents + self->dirents_pos);
+      self->dirents_pos += ent->d_reclen;
+
+      if (g_str_equal (ent->d_name, ".") || g_str_equal (ent->d_name, ".."))
+        continue;
+
+      /* Only stat when the caller asked for more than names and types */
+      have_stat = FALSE;
+      if (self->attrs->len > 0 || ent->d_type == DT_UNKNOWN)
+        have_stat = fstatat (self->dir_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) >= 0;
+
+      type = have_stat ? stat_type_to_string (st.st_mode) : dirent_type_to_string (ent->d_type);
+
+      /* As in the unpaged listing, a symbolic link has the type of what it
+       * points to, unless that is gone.  The attributes stay the link's own.
+       */
+      is_link = have_stat ? S_ISLNK (st.st_mode) : ent->d_type == DT_LNK;
+      if (is_link && fstatat (self->dir_fd, ent->d_name, &target_st, 0) >= 0)
+        type = stat_type_to_string (target_st.st_mode);
+
+      json_array_add_string_element (names, ent->d_name);
+      json_array_add_string_element (types, type);
+      for (i = 0; i < self->attrs->len; i++)
+        add_entry_attr (columns[i], g_ptr_array_index (self->attrs, i), self->dir_fd, ent->d_name, have_stat ? &st : NULL);
+      count++;
+    }
+
+  page = json_object_new ();
+  if (count > 0 && self->dir_fd >= 0)
+    {
+      json_object_set_string_member (page, "event", "present");
+      json_object_set_array_member (page, "path", names);
+      json_object_set_array_member (page, "type", types);
+      for (i = 0; i < self->attrs->len; i++)
+        json_object_set_array_member (page, g_ptr_array_index (self->attrs, i), columns[i]);
+
+      bytes = cockpit_json_write_bytes (page);
+      cockpit_channel_send (channel, bytes, FALSE);
+      g_bytes_unref (bytes);
+    }
+  else
+    {
+      json_array_unref (names);
+      json_array_unref (types);
+      for (i = 0; i < self->attrs->len; i++)
+        json_array_unref (columns[i]);
+    }
+  json_object_unref (page);
+
+  return more;
+}
+
+static gboolean
+on_idle_list (gpointer user_data)
+{
+  CockpitFslist *self = COCKPIT_FSLIST (user_data);
+  CockpitChannel *channel = COCKPIT_CHANNEL (user_data);
+
+  if (send_page (self))
+    {
+      /* Continue once the peer caught up */
+      if (!self->pressure)
+        return TRUE;
+      self->idle = 0;
+      return FALSE;
+    }
+
+  self->idle = 0;
+
+  /* Listing failed and the channel is closed */
+  if (self->dir_fd < 0)
+    return FALSE;
+
+  close (self->dir_fd);
+  self->dir_fd = -1;
+
+  cockpit_channel_ready (channel, NULL);
+  if (self->monitor == NULL)
+    {
+      cockpit_channel_control (channel, "done", NULL);
+      cockpit_channel_close (channel, NULL);
+    }
+
+  return FALSE;
+}
+
+static void
+on_channel_pressure (CockpitFlow *flow,
+                     gboolean pressure,
+                     gpointer user_data)
+{
+  CockpitFslist *self = COCKPIT_FSLIST (user_data);
+
+  self->pressure = pressure;
+  if (!pressure && !self->idle && self->dir_fd >= 0)
+    self->idle = g_idle_add (on_idle_list, self);
+}
+
+static gboolean
+parse_attrs (CockpitFslist *self,
+             JsonObject *options)
+{
+  JsonArray *array;
+  JsonNode *node;
+  const gchar *attr;
+  guint i, j;
+
+  self->attrs = g_ptr_array_new_with_free_func (g_free);
+
+  node = json_object_get_member (options, "attrs");
+  if (node == NULL)
+    return TRUE;
+  if (!JSON_NODE_HOLDS_ARRAY (node))
+    return FALSE;
+
+  array = json_node_get_array (node);
+  for (i = 0; i < json_array_get_length (array); i++)
+    {
+      node = json_array_get_element (array, i);
+      if (!JSON_NODE_HOLDS_VALUE (node) || json_node_get_value_type (node) != G_TYPE_STRING)
+        return FALSE;
+      attr = json_node_get_string (node);
+      if (!g_strv_contains (supported_attrs, attr))
+        return FALSE;
+      for (j = 0; j < self->attrs->len; j++)
+        {
+          if (g_str_equal (g_ptr_array_index (self->attrs, j), attr))
+            return FALSE;
+        }
+      g_ptr_array_add (self->attrs, g_strdup (attr));
+    }
+
+  return TRUE;
+}
+
+static void
+prepare_paged (CockpitFslist *self)
+{
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+  JsonObject *options;
+  int err;
+
+  self->dir_fd = open (self->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (self->dir_fd < 0)
+    {
+      err = errno;
+      options = cockpit_channel_close_options (channel);
+      json_object_set_string_member (options, "message", g_strerror (err));
+      if (err == EPERM || err == EACCES)
+        cockpit_channel_close (channel, "access-denied");
+      else if (err == ENOENT || err == ENOTDIR)
+        cockpit_channel_close (channel, "not-found");
+      else
+        cockpit_channel_fail (channel, "internal-error", "%s: couldn't list directory: %s", self->path, g_strerror (err));
+      return;
+    }
+
+  self->dirents = g_malloc (DIRENT_BUFFER_SIZE);
+  self->sig_pressure = g_signal_connect (self, "pressure", G_CALLBACK (on_channel_pressure), self);
+  self->idle = g_idle_add (on_idle_list, self);
+}
+
 static void
 on_changed (GFileMonitor      *monitor,
             GFile             *file,
@@ -232,6 +543,18 @@ cockpit_fslist_prepare (CockpitChannel *channel)
       goto out;
     }
 
+  if (!cockpit_json_get_int (options, "page-size", 0, &self->page_size) || self->page_size < 0)
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"page-size\" option for fslist1 channel");
+      goto out;
+    }
+
+  if (!parse_attrs (self, options))
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"attrs\" option for fslist1 channel");
+      goto out;
+    }
+
   self->cancellable = g_cancellable_new ();
 
   file = g_file_new_for_path (self->path);
@@ -249,6 +572,12 @@ cockpit_fslist_prepare (CockpitChannel *channel)
       self->sig_changed = g_signal_connect (self->monitor, "changed", G_CALLBACK (on_changed), self);
     }
 
+  if (self->page_size > 0)
+    {
+      prepare_paged (self);
+      goto out;
+    }
+
   g_file_enumerate_children_async (file,
                                    G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE,
                                    G_FILE_QUERY_INFO_NONE,
@@ -270,6 +599,14 @@ cockpit_fslist_dispose (GObject *object)
   if (self->cancellable)
     g_cancellable_cancel (self->cancellable);
 
+  if (self->idle)
+    g_source_remove (self->idle);
+  self->idle = 0;
+
+  if (self->sig_pressure)
+    g_signal_handler_disconnect (self, self->sig_pressure);
+  self->sig_pressure = 0;
+
   if (self->monitor)
     {
       if (self->sig_changed)
@@ -292,6 +629,11 @@ cockpit_fslist_finalize (GObject *object)
 
   g_clear_object (&self->cancellable);
   g_clear_object (&self->monitor);
+  if (self->dir_fd >= 0)
+    close (self->dir_fd);
+  g_free (self->dirents);
+  if (self->attrs)
+    g_ptr_array_unref (self->attrs);
 
   G_OBJECT_CLASS (cockpit_fslist_parent_class)->finalize (object);
 }
@@ -25,21 +25,30 @@
 #include "common/cockpitjson.h"
 #include "common/cockpitpipe.h"
 
+#include <gio/gio.h>
+
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 #define DEFAULT_MAX_READ_SIZE (16*1024*1024)
 
+/* How long to wait for a burst of file monitor events to settle */
+#define WATCH_SETTLE_MS 100
+
 /**
  * CockpitFsread:
  *
  * A #CockpitChannel that reads the content of a file.
  *
  * The payload type for this channel is 'fsread1'.
+ *
+ * With the "watch" option the channel stays open after sending the
+ * content, and sends the differences each time the file changes.
  */
 
 #define COCKPIT_FSREAD(o)    (G_TYPE_CHECK_INSTANCE_CAST ((o), COCKPIT_TYPE_FSREAD, CockpitFsread))
@@ -55,6 +64,18 @@ typedef struct {
   gboolean closing;
   guint sig_read;
   guint sig_close;
+
+  /* Watch mode */
+  gboolean watch;
+  gboolean binary;
+  gint64 max_read_size;
+  GFileMonitor *monitor;
+  guint sig_changed;
+  guint watch_timeout;
+  gboolean watch_reading;
+  gboolean watch_again;
+  GBytes *watch_content;
+  gchar *watch_tag;
 } CockpitFsread;
 
 typedef struct {
@@ -114,6 +135,10 @@ cockpit_fsread_close (CockpitChannel *channel,
 
   self->closing = TRUE;
 
+  if (self->watch_timeout)
+    g_source_remove (self->watch_timeout);
+  self->watch_timeout = 0;
+
   /*
    * If closed, call base class handler directly. Otherwise ask
    * our pipe to close first, which will come back here.
@@ -188,11 +213,330 @@ on_pipe_close (CockpitPipe *pipe,
   cockpit_channel_close (channel, problem);
 }
 
+/* One read of the whole file in watch mode, done in a worker thread */
+typedef struct {
+  GWeakRef channel;
+  gchar *path;
+  gint64 max_read_size;
+  GBytes *content;
+  gchar *tag;
+  const gchar *problem;
+  gchar *message;
+} WatchRead;
+
+static void
+watch_read_free (gpointer data)
+{
+  WatchRead *job = data;
+
+  g_weak_ref_clear (&job->channel);
+  g_free (job->path);
+  if (job->content)
+    g_bytes_unref (job->content);
+  g_free (job->tag);
+  g_free (job->message);
+  g_free (job);
+}
+
+/*
+ * Sets @problem if the channel should be closed. Leaves @tag NULL if the
+ * file changed while reading it.
+ */
+static void
+read_watched_file (GTask *task,
+                   gpointer source_object,
+                   gpointer task_data,
+                   GCancellable *cancellable)
+{
+  WatchRead *job = task_data;
+  GByteArray *buffer = NULL;
+  struct stat statbuf;
+  gchar *start_tag = NULL;
+  gchar *end_tag;
+  gsize len;
+  gssize res;
+  int fd;
+
+  fd = open (job->path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+  if (fd < 0)
+    {
+      int err = errno;
+      if (err == ENOENT)
+        {
+          job->tag = g_strdup ("-");
+        }
+      else if (err == EPERM || err == EACCES)
+        {
+          g_debug ("%s: couldn't open: %s", job->path, strerror (err));
+          job->problem = "access-denied";
+        }
+      else
+        {
+          job->problem = "internal-error";
+          job->message = g_strdup_printf ("%s: couldn't open: %s", job->path, strerror (err));
+        }
+      goto out;
+    }
+
+  if (fstat (fd, &statbuf) < 0)
+    {
+      job->problem = "internal-error";
+      job->message = g_strdup_printf ("%s: couldn't stat: %s", job->path, strerror (errno));
+      goto out;
+    }
+  if (!S_ISREG (statbuf.st_mode))
+    {
+      job->problem = "internal-error";
+      job->message = g_strdup_printf ("%s: not a readable file", job->path);
+      goto out;
+    }
+  if (statbuf.st_size > job->max_read_size)
+    {
+      job->problem = "too-large";
+      goto out;
+    }
+
+  start_tag = file_tag_from_stat (0, 0, &statbuf);
+
+  buffer = g_byte_array_sized_new (statbuf.st_size + 1);
+  for (;;)
+    {
+      len = buffer->len;
+      g_byte_array_set_size (buffer, len + 4096);
+      res = read (fd, buffer->data + len, 4096);
+      if (res < 0)
+        {
+          g_byte_array_set_size (buffer, len);
+          if (errno == EINTR)
+            continue;
+          job->problem = "internal-error";
+          job->message = g_strdup_printf ("%s: couldn't read: %s", job->path, strerror (errno));
+          goto out;
+        }
+      g_byte_array_set_size (buffer, len + res);
+      if (res == 0)
+        break;
+      if (buffer->len > job->max_read_size)
+        {
+          job->problem = "too-large";
+          goto out;
+        }
+    }
+
+  end_tag = cockpit_get_file_tag_from_fd (fd);
+  if (g_strcmp0 (start_tag, end_tag) == 0)
+    {
+      job->content = g_byte_array_free_to_bytes (buffer);
+      job->tag = end_tag;
+      buffer = NULL;
+    }
+  else
+    {
+      g_free (end_tag);
+    }
+
+out:
+  if (buffer)
+    g_byte_array_free (buffer, TRUE);
+  g_free (start_tag);
+  if (fd >= 0)
+    close (fd);
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+send_watch_change (CockpitFsread *self,
+                   GBytes *content,
+                   const gchar *tag)
+{
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+  const guchar *old_data = NULL;
+  const guchar *data = NULL;
+  gsize old_len = 0;
+  gsize len = 0;
+  gsize prefix = 0;
+  gsize suffix = 0;
+  JsonObject *object;
+  GBytes *middle;
+
+  if (self->watch_content)
+    old_data = g_bytes_get_data (self->watch_content, &old_len);
+  if (content)
+    data = g_bytes_get_data (content, &len);
+
+  /*
+   * Only send what lies between the common head and tail of the old and
+   * the new content. A growing file just sends the appended bytes.
+   */
+  if (old_len <= len && old_len > 0 && memcmp (old_data, data, old_len) == 0)
+    {
+      prefix = old_len;
+    }
+  else
+    {
+      while (prefix < old_len && prefix < len && old_data[prefix] == data[prefix])
+        prefix++;
+      while (suffix < old_len - prefix && suffix < len - prefix &&
+             old_data[old_len - suffix - 1] == data[len - suffix - 1])
+        suffix++;
+    }
+
+  /* Text channels must not split characters */
+  if (!self->binary)
+    {
+      while (prefix > 0 && prefix < len && (data[prefix] & 0xC0) == 0x80)
+        prefix--;
+      while (suffix > 0 && (data[len - suffix] & 0xC0) == 0x80)
+        suffix--;
+    }
+
+  object = json_object_new ();
+  json_object_set_string_member (object, "tag", tag);
+  if (self->watch_tag)
+    json_object_set_string_member (object, "base", self->watch_tag);
+  else
+    json_object_set_null_member (object, "base");
+  json_object_set_int_member (object, "prefix", prefix);
+  json_object_set_int_member (object, "suffix", suffix);
+  json_object_set_int_member (object, "size", len);
+  cockpit_channel_control (channel, "change", object);
+  json_object_unref (object);
+
+  if (len - prefix - suffix > 0)
+    {
+      middle = g_bytes_new_from_bytes (content, prefix, len - prefix - suffix);
+      cockpit_channel_send (channel, middle, FALSE);
+      g_bytes_unref (middle);
+    }
+
+  if (self->watch_content)
+    g_bytes_unref (self->watch_content);
+  self->watch_content = content ? g_bytes_ref (content) : NULL;
+  g_free (self->watch_tag);
+  self->watch_tag = g_strdup (tag);
+}
+
+static gboolean   on_watch_timeout   (gpointer user_data);
+
+static void
+on_watch_read (GObject *source_object,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+  WatchRead *job = g_task_get_task_data (G_TASK (result));
+  CockpitChannel *channel;
+  CockpitFsread *self;
+
+  self = g_weak_ref_get (&job->channel);
+  if (!self)
+    return;
+
+  channel = COCKPIT_CHANNEL (self);
+  self->watch_reading = FALSE;
+  if (self->closing)
+    goto out;
+
+  if (g_strcmp0 (job->problem, "internal-error") == 0)
+    {
+      cockpit_channel_fail (channel, "internal-error", "%s", job->message);
+      goto out;
+    }
+  else if (job->problem)
+    {
+      cockpit_channel_close (channel, job->problem);
+      goto out;
+    }
+
+  if (job->tag && g_strcmp0 (job->tag, self->watch_tag) != 0)
+    send_watch_change (self, job->content, job->tag);
+
+  /* Changed while or since reading, look again once things settle */
+  if ((job->tag == NULL || self->watch_again) && !self->watch_timeout)
+    self->watch_timeout = g_timeout_add (WATCH_SETTLE_MS, on_watch_timeout, self);
+  self->watch_again = FALSE;
+
+out:
+  g_object_unref (self);
+}
+
+static gboolean
+on_watch_timeout (gpointer user_data)
+{
+  CockpitFsread *self = COCKPIT_FSREAD (user_data);
+  WatchRead *job;
+  GTask *task;
+
+  self->watch_timeout = 0;
+
+  /* Only one read at a time, the next one follows when it is done */
+  if (self->watch_reading)
+    {
+      self->watch_again = TRUE;
+      return FALSE;
+    }
+
+  job = g_new0 (WatchRead, 1);
+  g_weak_ref_init (&job->channel, self);
+  job->path = g_strdup (self->path);
+  job->max_read_size = self->max_read_size;
+
+  /* Large files take a while, keep the main loop going meanwhile */
+  task = g_task_new (NULL, NULL, on_watch_read, NULL);
+  g_task_set_task_data (task, job, watch_read_free);
+  g_task_run_in_thread (task, read_watched_file);
+  g_object_unref (task);
+
+  self->watch_reading = TRUE;
+  return FALSE;
+}
+
+static void
+on_watch_changed (GFileMonitor *monitor,
+                  GFile *file,
+                  GFile *other_file,
+                  GFileMonitorEvent event_type,
+                  gpointer user_data)
+{
+  CockpitFsread *self = COCKPIT_FSREAD (user_data);
+
+  if (self->closing || self->watch_timeout)
+    return;
+
+  self->watch_timeout = g_timeout_add (WATCH_SETTLE_MS, on_watch_timeout, self);
+}
+
+static void
+prepare_watch (CockpitFsread *self)
+{
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+  GError *error = NULL;
+  GFile *file;
+
+  file = g_file_new_for_path (self->path);
+  self->monitor = g_file_monitor (file, 0, NULL, &error);
+  g_object_unref (file);
+
+  if (self->monitor == NULL)
+    {
+      cockpit_channel_fail (channel, "internal-error", "%s: %s", self->path, error->message);
+      g_error_free (error);
+      return;
+    }
+
+  self->sig_changed = g_signal_connect (self->monitor, "changed", G_CALLBACK (on_watch_changed), self);
+
+  cockpit_channel_ready (channel, NULL);
+
+  /* The initial content is sent as the first change */
+  on_watch_timeout (self);
+}
+
 static void
 cockpit_fsread_prepare (CockpitChannel *channel)
 {
   CockpitFsread *self = COCKPIT_FSREAD (channel);
   JsonObject *options;
+  const gchar *binary;
   gint64 max_read_size;
   struct stat statbuf;
   mode_t ifmt;
@@ -219,9 +563,25 @@ cockpit_fsread_prepare (CockpitChannel *channel)
       return;
     }
 
+  if (!cockpit_json_get_bool (options, "watch", FALSE, &self->watch))
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"watch\" option for fsread channel");
+      return;
+    }
+
   if (self->closing)
     return;
 
+  if (self->watch)
+    {
+      if (!cockpit_json_get_string (options, "binary", NULL, &binary))
+        binary = NULL;
+      self->binary = (binary != NULL);
+      self->max_read_size = max_read_size;
+      prepare_watch (self);
+      return;
+    }
+
   fd = open (self->path, O_RDONLY);
   if (fd < 0)
     {
@@ -305,6 +665,25 @@ cockpit_fsread_dispose (GObject *object)
       self->sig_read = self->sig_close = 0;
     }
 
+  if (self->watch_timeout)
+    g_source_remove (self->watch_timeout);
+  self->watch_timeout = 0;
+
+  if (self->monitor)
+    {
+      if (self->sig_changed)
+        g_signal_handler_disconnect (self->monitor, self->sig_changed);
+      self->sig_changed = 0;
+
+      /* HACK - It is not generally safe to just unref a GFileMonitor:
+       * https://gitlab.gnome.org/GNOME/glib/issues/1941
+       */
+      g_file_monitor_cancel (self->monitor);
+
+      g_object_unref (self->monitor);
+      self->monitor = NULL;
+    }
+
   G_OBJECT_CLASS (cockpit_fsread_parent_class)->dispose (object);
 }
 
@@ -315,6 +694,9 @@ cockpit_fsread_finalize (GObject *object)
 
   g_free (self->start_tag);
   g_clear_object (&self->pipe);
+  g_free (self->watch_tag);
+  if (self->watch_content)
+    g_bytes_unref (self->watch_content);
 
   G_OBJECT_CLASS (cockpit_fsread_parent_class)->finalize (object);
 }
@@ -0,0 +1,418 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+
+#include "cockpitfsreadmulti.h"
+
+#include "cockpitfsread.h"
+
+#include "common/cockpitjson.h"
+#include "common/cockpitunicode.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * CockpitFsreadMulti:
+ *
+ * A #CockpitChannel that reads the content of many small files at
+ * once, such as files in /proc, /sys or /etc. The files are read in
+ * a worker thread, and the results are sent as one JSON object with
+ * the path of each file as its key.
+ *
+ * The payload type for this channel is 'fsread-multi1'.
+ */
+
+#define COCKPIT_FSREAD_MULTI(o)    (G_TYPE_CHECK_INSTANCE_CAST ((o), COCKPIT_TYPE_FSREAD_MULTI, CockpitFsreadMulti))
+
+/* Per file, unless the caller asks otherwise */
+#define DEFAULT_MAX_READ_SIZE (1024 * 1024)
+
+/* For all the files in a channel together */
+#define MAX_TOTAL_SIZE (16 * 1024 * 1024)
+
+/* Number of times to read a file that keeps changing under us */
+#define MAX_ATTEMPTS 3
+
+/* Threads for reading, shared by all channels */
+#define MAX_READ_THREADS 4
+
+typedef struct {
+  CockpitChannel parent;
+  gboolean closing;
+} CockpitFsreadMulti;
+
+typedef struct {
+  CockpitChannelClass parent_class;
+} CockpitFsreadMultiClass;
+
+G_DEFINE_TYPE (CockpitFsreadMulti, cockpit_fsread_multi, COCKPIT_TYPE_CHANNEL);
+
+typedef struct {
+  gchar *path;
+  gint64 max_read_size;
+} ReadFile;
+
+typedef struct {
+  GWeakRef channel;
+  GMainContext *context;
+  GArray *files;
+  GBytes *result;
+} ReadJob;
+
+static GThreadPool *read_pool = NULL;
+
+static void
+read_job_free (gpointer data)
+{
+  ReadJob *job = data;
+  guint i;
+
+  g_weak_ref_clear (&job->channel);
+  g_main_context_unref (job->context);
+  for (i = 0; i < job->files->len; i++)
+    g_free (g_array_index (job->files, ReadFile, i).path);
+  g_array_free (job->files, TRUE);
+  if (job->result)
+    g_bytes_unref (job->result);
+  g_free (job);
+}
+
+static void
+set_problem (JsonObject *object,
+             const gchar *problem,
+             const gchar *path,
+             const gchar *message,
+             int errn)
+{
+  gchar *text;
+
+  json_object_set_string_member (object, "problem", problem);
+  if (message)
+    {
+      text = g_strdup_printf ("%s: %s: %s", path, message, g_strerror (errn));
+      json_object_set_string_member (object, "message", text);
+      g_free (text);
+    }
+}
+
+static gboolean
+read_fd (int fd,
+         gint64 limit,
+         GByteArray *buffer)
+{
+  gssize ret;
+  gsize len;
+
+  for (;;)
+    {
+      len = buffer->len;
+      g_byte_array_set_size (buffer, len + 4096);
+      ret = read (fd, buffer->data + len, 4096);
+      if (ret < 0)
+        {
+          g_byte_array_set_size (buffer, len);
+          if (errno == EINTR)
+            continue;
+          return FALSE;
+        }
+
+      g_byte_array_set_size (buffer, len + ret);
+      if (ret == 0 || buffer->len > limit)
+        return TRUE;
+    }
+}
+
+static JsonObject *
+read_file (const ReadFile *file,
+           gint64 *budget)
+{
+  JsonObject *object;
+  GByteArray *buffer = NULL;
+  struct stat sb;
+  gchar *start_tag = NULL;
+  gchar *end_tag = NULL;
+  GBytes *bytes;
+  GBytes *clean;
+  gint64 limit;
+  gint attempt;
+  int fd = -1;
+  int errn;
+
+  object = json_object_new ();
+  limit = MIN (file->max_read_size, *budget);
+
+  for (attempt = 0; attempt < MAX_ATTEMPTS; attempt++)
+    {
+      fd = openat (AT_FDCWD, file->path, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+      if (fd < 0)
+        {
+          errn = errno;
+          if (errn == ENOENT)
+            json_object_set_string_member (object, "tag", "-");
+          else if (errn == EPERM || errn == EACCES)
+            set_problem (object, "access-denied", file->path, NULL, 0);
+          else
+            set_problem (object, "internal-error", file->path, "couldn't open", errn);
+          goto out;
+        }
+
+      if (fstat (fd, &sb) < 0)
+        {
+          set_problem (object, "internal-error", file->path, "couldn't stat", errno);
+          goto out;
+        }
+
+      if (!S_ISREG (sb.st_mode))
+        {
+          json_object_set_string_member (object, "problem", "internal-error");
+          json_object_set_string_member (object, "message", "not a readable file");
+          goto out;
+        }
+
+      start_tag = cockpit_get_file_tag_from_fd (fd);
+
+      /* Don't trust st_size, it's wrong for most files in /proc and /sys */
+      buffer = g_byte_array_new ();
+      if (!read_fd (fd, limit, buffer))
+        {
+          set_problem (object, "internal-error", file->path, "couldn't read", errno);
+          goto out;
+        }
+
+      if (buffer->len > limit)
+        {
+          json_object_set_string_member (object, "problem", "too-large");
+          goto out;
+        }
+
+      end_tag = cockpit_get_file_tag_from_fd (fd);
+      if (g_strcmp0 (start_tag, end_tag) == 0)
+        break;
+
+      g_byte_array_unref (buffer);
+      buffer = NULL;
+      g_free (start_tag);
+      g_free (end_tag);
+      start_tag = end_tag = NULL;
+      close (fd);
+      fd = -1;
+    }
+
+  if (!buffer)
+    {
+      json_object_set_string_member (object, "problem", "change-conflict");
+      goto out;
+    }
+
+  *budget -= buffer->len;
+
+  /* Null terminate for the JSON string */
+  g_byte_array_append (buffer, (const guint8 *)"", 1);
+  bytes = g_byte_array_free_to_bytes (buffer);
+  buffer = NULL;
+  clean = cockpit_unicode_force_utf8 (bytes);
+  g_bytes_unref (bytes);
+
+  json_object_set_string_member (object, "content", g_bytes_get_data (clean, NULL));
+  json_object_set_string_member (object, "tag", end_tag);
+  g_bytes_unref (clean);
+
+out:
+  if (buffer)
+    g_byte_array_unref (buffer);
+  if (fd >= 0)
+    close (fd);
+  g_free (start_tag);
+  g_free (end_tag);
+  return object;
+}
+
+static gboolean  on_read_done     (gpointer user_data);
+
+static void
+read_thread (gpointer data,
+             gpointer user_data)
+{
+  ReadJob *job = data;
+  gint64 budget = MAX_TOTAL_SIZE;
+  JsonObject *result;
+  ReadFile *file;
+  guint i;
+
+  result = json_object_new ();
+  for (i = 0; i < job->files->len; i++)
+    {
+      file = &g_array_index (job->files, ReadFile, i);
+      json_object_set_object_member (result, file->path, read_file (file, &budget));
+    }
+
+  job->result = cockpit_json_write_bytes (result);
+  json_object_unref (result);
+
+  g_main_context_invoke_full (job->context, G_PRIORITY_DEFAULT, on_read_done, job, read_job_free);
+}
+
+static gboolean
+on_read_done (gpointer user_data)
+{
+  ReadJob *job = user_data;
+  CockpitFsreadMulti *self;
+  CockpitChannel *channel;
+
+  self = g_weak_ref_get (&job->channel);
+  if (!self)
+    return FALSE;
+
+  /* Closed while the files were being read */
+  channel = COCKPIT_CHANNEL (self);
+  if (!self->closing)
+    {
+      cockpit_channel_send (channel, job->result, TRUE);
+      cockpit_channel_control (channel, "done", NULL);
+      cockpit_channel_close (channel, NULL);
+    }
+
+  g_object_unref (self);
+  return FALSE;
+}
+
+static void
+cockpit_fsread_multi_recv (CockpitChannel *channel,
+                           GBytes *message)
+{
+  cockpit_channel_fail (channel, "protocol-error", "received unexpected message in fsread-multi channel");
+}
+
+static void
+cockpit_fsread_multi_close (CockpitChannel *channel,
+                            const gchar *problem)
+{
+  CockpitFsreadMulti *self = COCKPIT_FSREAD_MULTI (channel);
+
+  self->closing = TRUE;
+  COCKPIT_CHANNEL_CLASS (cockpit_fsread_multi_parent_class)->close (channel, problem);
+}
+
+static void
+cockpit_fsread_multi_init (CockpitFsreadMulti *self)
+{
+
+}
+
+static gboolean
+parse_file (JsonNode *node,
+            gint64 max_read_size,
+            ReadFile *file)
+{
+  const gchar *path = NULL;
+  JsonObject *object;
+
+  if (JSON_NODE_HOLDS_OBJECT (node))
+    {
+      object = json_node_get_object (node);
+      if (!cockpit_json_get_string (object, "path", NULL, &path) ||
+          !cockpit_json_get_int (object, "max_read_size", max_read_size, &max_read_size))
+        return FALSE;
+    }
+  else if (JSON_NODE_HOLDS_VALUE (node) && json_node_get_value_type (node) == G_TYPE_STRING)
+    {
+      path = json_node_get_string (node);
+    }
+
+  if (path == NULL || path[0] != '/' || max_read_size < 0)
+    return FALSE;
+
+  file->path = g_strdup (path);
+  file->max_read_size = max_read_size;
+  return TRUE;
+}
+
+static void
+cockpit_fsread_multi_prepare (CockpitChannel *channel)
+{
+  CockpitFsreadMulti *self = COCKPIT_FSREAD_MULTI (channel);
+  GError *error = NULL;
+  JsonObject *options;
+  JsonArray *paths;
+  JsonNode *node;
+  gint64 max_read_size;
+  ReadFile file;
+  ReadJob *job;
+  guint i;
+
+  COCKPIT_CHANNEL_CLASS (cockpit_fsread_multi_parent_class)->prepare (channel);
+  if (self->closing)
+    return;
+
+  options = cockpit_channel_get_options (channel);
+
+  if (!cockpit_json_get_int (options, "max_read_size", DEFAULT_MAX_READ_SIZE, &max_read_size) ||
+      max_read_size < 0)
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"max_read_size\" option for fsread-multi channel");
+      return;
+    }
+
+  node = json_object_get_member (options, "paths");
+  if (!node || !JSON_NODE_HOLDS_ARRAY (node))
+    {
+      cockpit_channel_fail (channel, "protocol-error", "missing or invalid \"paths\" option for fsread-multi channel");
+      return;
+    }
+
+  job = g_new0 (ReadJob, 1);
+  g_weak_ref_init (&job->channel, channel);
+  job->context = g_main_context_ref_thread_default ();
+  job->files = g_array_new (FALSE, FALSE, sizeof (ReadFile));
+
+  paths = json_node_get_array (node);
+  for (i = 0; i < json_array_get_length (paths); i++)
+    {
+      if (!parse_file (json_array_get_element (paths, i), max_read_size, &file))
+        {
+          cockpit_channel_fail (channel, "protocol-error", "invalid \"paths\" option for fsread-multi channel");
+          read_job_free (job);
+          return;
+        }
+      g_array_append_val (job->files, file);
+    }
+
+  if (!read_pool)
+    {
+      read_pool = g_thread_pool_new (read_thread, NULL, MAX_READ_THREADS, FALSE, &error);
+      g_assert_no_error (error);
+    }
+
+  cockpit_channel_ready (channel, NULL);
+  g_thread_pool_push (read_pool, job, NULL);
+}
+
+static void
+cockpit_fsread_multi_class_init (CockpitFsreadMultiClass *klass)
+{
+  CockpitChannelClass *channel_class = COCKPIT_CHANNEL_CLASS (klass);
+
+  channel_class->prepare = cockpit_fsread_multi_prepare;
+  channel_class->recv = cockpit_fsread_multi_recv;
+  channel_class->close = cockpit_fsread_multi_close;
+}
@@ -22,6 +22,7 @@
 #include "cockpitfsreplace.h"
 #include "cockpitfsread.h"
 
+#include "common/cockpitflow.h"
 #include "common/cockpitjson.h"
 
 #include <sys/wait.h>
@@ -31,12 +32,20 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 /**
  * CockpitFsreplace:
  *
  * A #CockpitChannel that writes/replaces the content of a file.
  *
+ * With the "upload" option the content arrives in chunks with explicit
+ * offsets, which are checked and written in worker threads. Several
+ * channels can write to the same upload, and an interrupted upload can
+ * be continued later. Once one of the channels has put the file in place,
+ * the others finish with the same tag. The peer is throttled while too
+ * much data waits to be written.
+ *
  * The payload type for this channel is 'fsreplace1'.
  */
 
@@ -50,6 +59,14 @@ typedef struct {
   gboolean got_content;
   const gchar *expected_tag;
   guint sig_close;
+
+  /* Upload mode */
+  struct _CockpitUpload *upload;
+  gint64 chunk_offset;
+  gchar *chunk_checksum;
+  guint pending;
+  gint64 pending_bytes;
+  gboolean done;
 } CockpitFsreplace;
 
 typedef struct {
@@ -58,6 +75,43 @@ typedef struct {
 
 G_DEFINE_TYPE (CockpitFsreplace, cockpit_fsreplace, COCKPIT_TYPE_CHANNEL);
 
+/* Threads for checking and writing upload chunks, shared by all channels */
+#define MAX_UPLOAD_THREADS 4
+
+/* Throttle the peer while this much chunk data waits for the threads */
+#define UPLOAD_PRESSURE (4 * 1024 * 1024)
+
+typedef struct _CockpitUpload {
+  gint refs;
+  gchar *tmp_path;
+  gchar *state_path;
+  int fd;
+  gint64 size;
+
+  /* Sorted and merged ranges of written chunks, pairs of start and end */
+  GArray *ranges;
+
+  /* Set once the file has been put in place */
+  gchar *tag;
+} CockpitUpload;
+
+typedef struct {
+  CockpitUpload *upload;
+  GWeakRef channel;
+  GMainContext *context;
+  GBytes *data;
+  gint64 offset;
+  gint64 length;
+  gchar *checksum;
+  const gchar *problem;
+  gchar *message;
+} UploadChunk;
+
+/* Uploads in progress by their temporary file, not owned */
+static GHashTable *uploads = NULL;
+
+static GThreadPool *upload_pool = NULL;
+
 static void
 close_with_errno (CockpitFsreplace *self,
                   const gchar *diagnostic,
@@ -77,6 +131,581 @@ close_with_errno (CockpitFsreplace *self,
     }
 }
 
+static int
+xfsync (int fd)
+{
+  while (TRUE)
+    {
+      int res = fsync (fd);
+      if (res < 0 && errno == EINTR)
+        continue;
+
+      return res;
+    }
+}
+
+static int
+xclose (int fd)
+{
+  /* http://lkml.indiana.edu/hypermail/linux/kernel/0509.1/0877.html
+   */
+  int res = close (fd);
+  if (res < 0 && errno == EINTR)
+    return 0;
+  else
+    return res;
+}
+
+static void
+upload_unref (CockpitUpload *upload)
+{
+  if (--upload->refs > 0)
+    return;
+
+  if (g_hash_table_lookup (uploads, upload->tmp_path) == upload)
+    g_hash_table_remove (uploads, upload->tmp_path);
+  if (upload->fd >= 0)
+    xclose (upload->fd);
+  g_array_free (upload->ranges, TRUE);
+  g_free (upload->tag);
+  g_free (upload->tmp_path);
+  g_free (upload->state_path);
+  g_free (upload);
+}
+
+/* The end of the contiguous data from the start of the file */
+static gint64
+upload_committed (CockpitUpload *upload)
+{
+  if (upload->ranges->len > 0 && g_array_index (upload->ranges, gint64, 0) == 0)
+    return g_array_index (upload->ranges, gint64, 1);
+  return 0;
+}
+
+static void
+upload_add_range (CockpitUpload *upload,
+                  gint64 start,
+                  gint64 end)
+{
+  GArray *ranges = upload->ranges;
+  gint64 *pair;
+  guint i;
+
+  /* Find the first range that ends at or after this one starts */
+  for (i = 0; i < ranges->len; i += 2)
+    {
+      if (g_array_index (ranges, gint64, i + 1) >= start)
+        break;
+    }
+
+  /* Swallow all the ranges that overlap or touch */
+  while (i < ranges->len && g_array_index (ranges, gint64, i) <= end)
+    {
+      pair = &g_array_index (ranges, gint64, i);
+      start = MIN (start, pair[0]);
+      end = MAX (end, pair[1]);
+      g_array_remove_range (ranges, i, 2);
+    }
+
+  g_array_insert_val (ranges, i, end);
+  g_array_insert_val (ranges, i, start);
+}
+
+/*
+ * Makes the committed part of the upload durable, and records how far
+ * it got, so a later channel can continue from there.
+ */
+static void
+upload_checkpoint (CockpitUpload *upload)
+{
+  GError *error = NULL;
+  gchar *state;
+
+  if (fdatasync (upload->fd) < 0)
+    {
+      g_message ("%s: couldn't sync: %s", upload->tmp_path, g_strerror (errno));
+      return;
+    }
+
+  state = g_strdup_printf ("%" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+                           upload->size, upload_committed (upload));
+  if (!g_file_set_contents (upload->state_path, state, -1, &error))
+    {
+      g_message ("%s", error->message);
+      g_error_free (error);
+    }
+  g_free (state);
+}
+
+static CockpitUpload *
+upload_open (CockpitFsreplace *self,
+             const gchar *id,
+             gint64 size)
+{
+  CockpitUpload *upload;
+  gchar *tmp_path;
+  gchar *state = NULL;
+  gint64 state_size;
+  gint64 committed;
+  gboolean resume;
+  struct stat st;
+  int err;
+
+  tmp_path = g_strdup_printf ("%s.upload-%s", self->path, id);
+
+  if (!uploads)
+    uploads = g_hash_table_new (g_str_hash, g_str_equal);
+
+  upload = g_hash_table_lookup (uploads, tmp_path);
+  if (upload)
+    {
+      g_free (tmp_path);
+      if (upload->size != size)
+        {
+          cockpit_channel_fail (COCKPIT_CHANNEL (self), "protocol-error",
+                                "%s: upload in progress has a different size", self->path);
+          return NULL;
+        }
+      upload->refs++;
+      return upload;
+    }
+
+  upload = g_new0 (CockpitUpload, 1);
+  upload->refs = 1;
+  upload->tmp_path = tmp_path;
+  upload->state_path = g_strdup_printf ("%s.state", tmp_path);
+  upload->size = size;
+  upload->ranges = g_array_new (FALSE, FALSE, sizeof (gint64));
+  g_hash_table_insert (uploads, upload->tmp_path, upload);
+
+  /* An earlier attempt at the same upload that we can continue */
+  resume = g_file_get_contents (upload->state_path, &state, NULL, NULL) &&
+           sscanf (state, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT, &state_size, &committed) == 2 &&
+           state_size == size && committed >= 0 && committed <= size;
+
+  /*
+   * The name of the upload file is predictable and lives in a directory
+   * that others may be able to write to. So never follow links, and only
+   * create it fresh, unless continuing an upload that we started.
+   */
+  upload->fd = -1;
+  if (resume)
+    {
+      upload->fd = open (upload->tmp_path, O_RDWR | O_CLOEXEC | O_NOFOLLOW);
+      if (upload->fd < 0 && errno == ENOENT)
+        resume = FALSE;
+    }
+  if (!resume)
+    upload->fd = open (upload->tmp_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW, 0666);
+
+  if (upload->fd < 0)
+    {
+      close_with_errno (self, "couldn't open upload file", errno);
+      upload_unref (upload);
+      upload = NULL;
+      goto out;
+    }
+
+  if (fstat (upload->fd, &st) < 0)
+    {
+      close_with_errno (self, "couldn't stat upload file", errno);
+      upload_unref (upload);
+      upload = NULL;
+      goto out;
+    }
+
+  if (!S_ISREG (st.st_mode) || st.st_nlink != 1 || st.st_uid != geteuid ())
+    {
+      cockpit_channel_fail (COCKPIT_CHANNEL (self), "internal-error",
+                            "%s: upload file is not a regular file owned by us", upload->tmp_path);
+      upload_unref (upload);
+      upload = NULL;
+      goto out;
+    }
+
+  /*
+   * Only trust the committed range when the file still has the expected
+   * size. Otherwise start over with a file that is one big hole, so
+   * all-zero chunks cost nothing.
+   */
+  if (resume && st.st_size == size)
+    {
+      if (committed > 0)
+        upload_add_range (upload, 0, committed);
+    }
+  else if (ftruncate (upload->fd, 0) < 0 || ftruncate (upload->fd, size) < 0)
+    {
+      err = errno;
+      close_with_errno (self, "couldn't resize upload file", err);
+      upload_unref (upload);
+      upload = NULL;
+    }
+  else
+    {
+      /* Forget about any stale state, that no longer matches the file */
+      upload_checkpoint (upload);
+    }
+
+out:
+  g_free (state);
+  return upload;
+}
+
+static void
+upload_chunk_free (gpointer data)
+{
+  UploadChunk *chunk = data;
+
+  upload_unref (chunk->upload);
+  g_weak_ref_clear (&chunk->channel);
+  g_main_context_unref (chunk->context);
+  if (chunk->data)
+    g_bytes_unref (chunk->data);
+  g_free (chunk->checksum);
+  g_free (chunk->message);
+  g_free (chunk);
+}
+
+static gboolean
+is_all_zeros (const guchar *data,
+              gsize length)
+{
+  return length == 0 || (data[0] == 0 && memcmp (data, data + 1, length - 1) == 0);
+}
+
+static gboolean
+write_chunk (UploadChunk *chunk)
+{
+  static const guchar zeros[64 * 1024] = { 0, };
+  const guchar *data = NULL;
+  gsize done = 0;
+  gssize res;
+  int fd = chunk->upload->fd;
+
+  if (chunk->data)
+    data = g_bytes_get_data (chunk->data, NULL);
+
+  /* All zeros become a hole in the file */
+  if (data == NULL || is_all_zeros (data, chunk->length))
+    {
+      if (chunk->length == 0 ||
+          fallocate (fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, chunk->offset, chunk->length) == 0)
+        return TRUE;
+      if (errno != EOPNOTSUPP && errno != ENOSYS)
+        return FALSE;
+    }
+
+  while (done < chunk->length)
+    {
+      if (data)
+        res = pwrite (fd, data + done, chunk->length - done, chunk->offset + done);
+      else
+        res = pwrite (fd, zeros, MIN (sizeof (zeros), chunk->length - done), chunk->offset + done);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res < 0)
+        return FALSE;
+      done += res;
+    }
+
+  return TRUE;
+}
+
+static gboolean on_chunk_written (gpointer user_data);
+
+static void
+upload_thread (gpointer data,
+               gpointer user_data)
+{
+  UploadChunk *chunk = data;
+  const gchar *expected;
+  gchar *actual;
+  int err;
+
+  if (chunk->checksum)
+    {
+      expected = chunk->checksum + strlen ("sha256:");
+      actual = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, chunk->data);
+      if (!g_str_equal (actual, expected))
+        {
+          chunk->problem = "protocol-error";
+          chunk->message = g_strdup_printf ("%s: chunk at offset %" G_GINT64_FORMAT " has the wrong checksum",
+                                            chunk->upload->tmp_path, chunk->offset);
+        }
+      g_free (actual);
+    }
+
+  if (!chunk->problem && !write_chunk (chunk))
+    {
+      err = errno;
+      chunk->problem = (err == EPERM || err == EACCES) ? "access-denied" : "internal-error";
+      chunk->message = g_strdup_printf ("%s: couldn't write: %s", chunk->upload->tmp_path, g_strerror (err));
+    }
+
+  g_main_context_invoke_full (chunk->context, G_PRIORITY_DEFAULT, on_chunk_written, chunk, upload_chunk_free);
+}
+
+static void
+finish_upload (CockpitFsreplace *self)
+{
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+  CockpitUpload *upload = self->upload;
+  gchar *actual_tag = NULL;
+  gchar *new_tag = NULL;
+  JsonObject *options;
+
+  options = cockpit_channel_close_options (channel);
+
+  /* Another channel of this upload already put the file in place */
+  if (upload->tag)
+    {
+      json_object_set_string_member (options, "tag", upload->tag);
+      cockpit_channel_close (channel, NULL);
+      return;
+    }
+
+  /* Other chunks are still on their way, perhaps in other channels */
+  if (upload_committed (upload) < upload->size)
+    {
+      upload_checkpoint (upload);
+      json_object_set_int_member (options, "offset", upload_committed (upload));
+      cockpit_channel_close (channel, NULL);
+      return;
+    }
+
+  actual_tag = cockpit_get_file_tag (self->path);
+  if (self->expected_tag && g_strcmp0 (self->expected_tag, actual_tag))
+    {
+      cockpit_channel_close (channel, "out-of-date");
+    }
+  else if (xfsync (upload->fd) < 0)
+    {
+      close_with_errno (self, "couldn't sync", errno);
+    }
+  else
+    {
+      new_tag = cockpit_get_file_tag_from_fd (upload->fd);
+      if (rename (upload->tmp_path, self->path) < 0)
+        {
+          close_with_errno (self, "couldn't rename", errno);
+        }
+      else
+        {
+          if (unlink (upload->state_path) < 0 && errno != ENOENT)
+            g_message ("%s: couldn't remove upload state: %s", upload->state_path, g_strerror (errno));
+          g_hash_table_remove (uploads, upload->tmp_path);
+          upload->tag = new_tag;
+          new_tag = NULL;
+          json_object_set_string_member (options, "tag", upload->tag);
+          cockpit_channel_close (channel, NULL);
+        }
+    }
+
+  g_free (actual_tag);
+  g_free (new_tag);
+}
+
+static gboolean
+on_chunk_written (gpointer user_data)
+{
+  UploadChunk *chunk = user_data;
+  CockpitFsreplace *self;
+
+  if (!chunk->problem)
+    upload_add_range (chunk->upload, chunk->offset, chunk->offset + chunk->length);
+
+  self = g_weak_ref_get (&chunk->channel);
+  if (!self)
+    return FALSE;
+
+  /* Let the peer send more once enough has been written */
+  if (chunk->data)
+    {
+      if (self->pending_bytes >= UPLOAD_PRESSURE &&
+          self->pending_bytes - (gint64)g_bytes_get_size (chunk->data) < UPLOAD_PRESSURE)
+        cockpit_flow_emit_pressure (COCKPIT_FLOW (self), FALSE);
+      self->pending_bytes -= g_bytes_get_size (chunk->data);
+    }
+
+  /* Nothing more to do when the channel already closed */
+  self->pending--;
+  if (!self->upload)
+    ;
+  else if (chunk->problem)
+    cockpit_channel_fail (COCKPIT_CHANNEL (self), chunk->problem, "%s", chunk->message);
+  else if (self->done && self->pending == 0)
+    finish_upload (self);
+
+  g_object_unref (self);
+  return FALSE;
+}
+
+static void
+push_chunk (CockpitFsreplace *self,
+            GBytes *data,
+            gint64 offset,
+            gint64 length)
+{
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+  GError *error = NULL;
+  UploadChunk *chunk;
+
+  /* Careful not to overflow */
+  if (offset < 0 || length < 0 || offset > self->upload->size ||
+      length > self->upload->size - offset)
+    {
+      cockpit_channel_fail (channel, "protocol-error",
+                            "%s: upload chunk is outside of the file", self->path);
+      return;
+    }
+
+  /* Don't touch the file once it's in place */
+  if (self->upload->tag)
+    return;
+
+  chunk = g_new0 (UploadChunk, 1);
+  chunk->upload = self->upload;
+  chunk->upload->refs++;
+  g_weak_ref_init (&chunk->channel, self);
+  chunk->context = g_main_context_ref_thread_default ();
+  chunk->data = data ? g_bytes_ref (data) : NULL;
+  chunk->offset = offset;
+  chunk->length = length;
+  chunk->checksum = self->chunk_checksum;
+  self->chunk_checksum = NULL;
+
+  if (!upload_pool)
+    {
+      upload_pool = g_thread_pool_new (upload_thread, NULL, MAX_UPLOAD_THREADS, FALSE, &error);
+      g_assert_no_error (error);
+    }
+
+  /* See on_chunk_written() */
+  if (data)
+    {
+      if (self->pending_bytes < UPLOAD_PRESSURE &&
+          self->pending_bytes + (gint64)g_bytes_get_size (data) >= UPLOAD_PRESSURE)
+        cockpit_flow_emit_pressure (COCKPIT_FLOW (self), TRUE);
+      self->pending_bytes += g_bytes_get_size (data);
+    }
+
+  self->pending++;
+  g_thread_pool_push (upload_pool, chunk, NULL);
+}
+
+static gboolean
+upload_control (CockpitFsreplace *self,
+                const gchar *command,
+                JsonObject *options)
+{
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+  const gchar *checksum;
+  gint64 offset;
+  gint64 hole;
+
+  if (g_str_equal (command, "done"))
+    {
+      self->done = TRUE;
+      if (self->pending == 0)
+        finish_upload (self);
+      return TRUE;
+    }
+
+  if (!g_str_equal (command, "chunk"))
+    return FALSE;
+
+  if (self->chunk_offset >= 0)
+    {
+      cockpit_channel_fail (channel, "protocol-error", "%s: upload chunk without data", self->path);
+    }
+  else if (!cockpit_json_get_int (options, "offset", -1, &offset) || offset < 0 ||
+           !cockpit_json_get_int (options, "hole", -1, &hole) ||
+           !cockpit_json_get_string (options, "checksum", NULL, &checksum) ||
+           (checksum && !g_str_has_prefix (checksum, "sha256:")))
+    {
+      cockpit_channel_fail (channel, "protocol-error", "%s: invalid upload \"chunk\" message", self->path);
+    }
+  else if (hole >= 0)
+    {
+      /* A hole is not followed by any data */
+      push_chunk (self, NULL, offset, hole);
+    }
+  else
+    {
+      self->chunk_offset = offset;
+      self->chunk_checksum = g_strdup (checksum);
+    }
+
+  return TRUE;
+}
+
+static void
+upload_recv (CockpitFsreplace *self,
+             GBytes *message)
+{
+  gint64 offset = self->chunk_offset;
+
+  if (offset < 0)
+    {
+      cockpit_channel_fail (COCKPIT_CHANNEL (self), "protocol-error",
+                            "%s: upload data without a \"chunk\" message", self->path);
+      return;
+    }
+
+  self->chunk_offset = -1;
+  push_chunk (self, message, offset, g_bytes_get_size (message));
+}
+
+static gboolean
+is_valid_upload_id (const gchar *id)
+{
+  const gchar *p;
+
+  if (id[0] == '\0')
+    return FALSE;
+  for (p = id; *p; p++)
+    {
+      if (!g_ascii_isalnum (*p) && *p != '-' && *p != '_')
+        return FALSE;
+    }
+  return TRUE;
+}
+
+static void
+prepare_upload (CockpitFsreplace *self,
+                const gchar *id,
+                JsonObject *options)
+{
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+  JsonObject *ready;
+  gint64 size;
+
+  if (!is_valid_upload_id (id))
+    {
+      cockpit_channel_fail (channel, "protocol-error",
+                            "%s: invalid \"upload\" option for fsreplace1 channel", self->path);
+      return;
+    }
+  if (!cockpit_json_get_int (options, "size", -1, &size) || size < 0)
+    {
+      cockpit_channel_fail (channel, "protocol-error",
+                            "%s: missing or invalid \"size\" option for fsreplace1 upload", self->path);
+      return;
+    }
+
+  self->upload = upload_open (self, id, size);
+  if (!self->upload)
+    return;
+
+  /* Stop answering pings while too much is waiting to be written, see push_chunk() */
+  cockpit_flow_throttle (COCKPIT_FLOW (self), COCKPIT_FLOW (self));
+
+  ready = json_object_new ();
+  json_object_set_int_member (ready, "offset", upload_committed (self->upload));
+  cockpit_channel_ready (channel, ready);
+  json_object_unref (ready);
+}
+
 static void
 cockpit_fsreplace_recv (CockpitChannel *channel,
                       GBytes *message)
@@ -85,6 +714,12 @@ cockpit_fsreplace_recv (CockpitChannel *channel,
   gsize size;
   const char *data = g_bytes_get_data (message, &size);
 
+  if (self->upload)
+    {
+      upload_recv (self, message);
+      return;
+    }
+
   self->got_content = TRUE;
 
   while (size > 0)
@@ -105,41 +740,19 @@ cockpit_fsreplace_recv (CockpitChannel *channel,
     }
 }
 
-static int
-xfsync (int fd)
-{
-  while (TRUE)
-    {
-      int res = fsync (fd);
-      if (res < 0 && errno == EINTR)
-        continue;
-
-      return res;
-    }
-}
-
-static int
-xclose (int fd)
-{
-  /* http://lkml.indiana.edu/hypermail/linux/kernel/0509.1/0877.html
-   */
-  int res = close (fd);
-  if (res < 0 && errno == EINTR)
-    return 0;
-  else
-    return res;
-}
-
 static gboolean
 cockpit_fsreplace_control (CockpitChannel *channel,
                            const gchar *command,
-                           JsonObject *unused)
+                           JsonObject *message)
 {
   CockpitFsreplace *self = COCKPIT_FSREPLACE (channel);
   gchar *actual_tag = NULL;
   gchar *new_tag = NULL;
   JsonObject *options;
 
+  if (self->upload)
+    return upload_control (self, command, message);
+
   if (!g_str_equal (command, "done"))
     return FALSE;
 
@@ -206,8 +819,18 @@ cockpit_fsreplace_close (CockpitChannel *channel,
     close (self->fd);
   self->fd = -1;
 
+  /* An interrupted upload is kept, so that it can be continued */
+  if (self->upload)
+    {
+      cockpit_flow_throttle (COCKPIT_FLOW (self), NULL);
+      if (problem && !self->upload->tag)
+        upload_checkpoint (self->upload);
+      upload_unref (self->upload);
+      self->upload = NULL;
+    }
+
   /* Cleanup in case of problem */
-  if (problem)
+  else if (problem)
     {
       if (self->tmp_path)
         if (unlink (self->tmp_path) < 0 && errno != ENOENT)
@@ -221,6 +844,7 @@ static void
 cockpit_fsreplace_init (CockpitFsreplace *self)
 {
   self->fd = -1;
+  self->chunk_offset = -1;
 }
 
 static void
@@ -228,6 +852,7 @@ cockpit_fsreplace_prepare (CockpitChannel *channel)
 {
   CockpitFsreplace *self = COCKPIT_FSREPLACE (channel);
   JsonObject *options;
+  const gchar *upload;
   gchar *actual_tag = NULL;
 
   COCKPIT_CHANNEL_CLASS (cockpit_fsreplace_parent_class)->prepare (channel);
@@ -253,6 +878,13 @@ cockpit_fsreplace_prepare (CockpitChannel *channel)
       goto out;
     }
 
+  if (!cockpit_json_get_string (options, "upload", NULL, &upload))
+    {
+      cockpit_channel_fail (channel, "protocol-error",
+                            "%s: invalid \"upload\" option for fsreplace1 channel", self->path);
+      goto out;
+    }
+
   actual_tag = cockpit_get_file_tag (self->path);
   if (self->expected_tag && g_strcmp0 (self->expected_tag, actual_tag))
     {
@@ -260,6 +892,12 @@ cockpit_fsreplace_prepare (CockpitChannel *channel)
       goto out;
     }
 
+  if (upload)
+    {
+      prepare_upload (self, upload, options);
+      goto out;
+    }
+
   // TODO - delay the opening until the first content message.  That
   // way, we don't create a useless temporary file (which might even
   // fail).
@@ -289,6 +927,9 @@ cockpit_fsreplace_finalize (GObject *object)
   CockpitFsreplace *self = COCKPIT_FSREPLACE (object);
 
   g_free (self->tmp_path);
+  g_free (self->chunk_checksum);
+  if (self->upload)
+    upload_unref (self->upload);
 
   G_OBJECT_CLASS (cockpit_fsreplace_parent_class)->finalize (object);
 }
@@ -42,33 +42,68 @@
  * have been given a connection name, grouping them together as
  * a client. In this mode we cache connections and reuse them
  * as well as share options and address info.
+ *
+ * Idle keep-alive connections are kept in a pool, most recently
+ * used first. Checking out takes the warmest connection, and when
+ * the pool is full the least recently used one is closed.
  */
 
+#define DEFAULT_IDLE_CONNECTIONS  4
+#define DEFAULT_IDLE_TIMEOUT      10
+
+typedef struct _CockpitHttpClient CockpitHttpClient;
+
 typedef struct {
-  gint refs;
-  gchar *name;
-  CockpitConnectable *connectable;
+  CockpitHttpClient *client;
   CockpitStream *stream;
+  gulong sig_read;
   gulong sig_close;
   guint timeout;
-} CockpitHttpClient;
+} CockpitHttpIdle;
+
+struct _CockpitHttpClient {
+  gint refs;
+  gchar *name;
+  CockpitConnectable *connectable;
+
+  /* Of CockpitHttpIdle, most recently used at the head */
+  GQueue idle;
+  guint max_idle;
+  guint idle_timeout;
+};
 
 static GHashTable *clients;
 
 static void
-cockpit_http_client_reset (CockpitHttpClient *client)
+cockpit_http_idle_free (CockpitHttpIdle *idle)
 {
-  if (client->timeout)
-    g_source_remove (client->timeout);
-  if (client->stream)
-    {
-      g_signal_handler_disconnect (client->stream, client->sig_close);
-      g_object_unref (client->stream);
-    }
+  if (idle->timeout)
+    g_source_remove (idle->timeout);
+  g_signal_handler_disconnect (idle->stream, idle->sig_read);
+  g_signal_handler_disconnect (idle->stream, idle->sig_close);
+  g_object_unref (idle->stream);
+  g_slice_free (CockpitHttpIdle, idle);
+}
 
-  client->sig_close = 0;
-  client->stream = NULL;
-  client->timeout = 0;
+static void
+cockpit_http_idle_drop (CockpitHttpIdle *idle,
+                        gboolean close)
+{
+  CockpitStream *stream = g_object_ref (idle->stream);
+
+  g_queue_remove (&idle->client->idle, idle);
+  cockpit_http_idle_free (idle);
+
+  if (close)
+    cockpit_stream_close (stream, NULL);
+  g_object_unref (stream);
+}
+
+static void
+cockpit_http_client_reset (CockpitHttpClient *client)
+{
+  while (client->idle.head)
+    cockpit_http_idle_drop (client->idle.head->data, TRUE);
 }
 
 static void
@@ -93,21 +128,39 @@ cockpit_http_client_ref (CockpitHttpClient *client)
 }
 
 static void
-on_client_close (CockpitStream *stream,
-                 const gchar *problem,
-                 gpointer data)
+on_idle_close (CockpitStream *stream,
+               const gchar *problem,
+               gpointer data)
 {
-  CockpitHttpClient *client = data;
-  g_debug ("%s: connection closed", client->name);
-  cockpit_http_client_reset (client);
+  CockpitHttpIdle *idle = data;
+  g_debug ("%s: idle connection closed", idle->client->name);
+  cockpit_http_idle_drop (idle, FALSE);
+}
+
+static void
+on_idle_read (CockpitStream *stream,
+              GByteArray *buffer,
+              gboolean end_of_data,
+              gpointer data)
+{
+  CockpitHttpIdle *idle = data;
+
+  /*
+   * Nothing should arrive on a connection that has no request
+   * outstanding. Either the server is going away, or it sent junk.
+   */
+  g_debug ("%s: idle connection %s", idle->client->name,
+           end_of_data ? "was shut down" : "received unexpected data");
+  cockpit_http_idle_drop (idle, TRUE);
 }
 
 static gboolean
-on_client_timeout (gpointer data)
+on_idle_timeout (gpointer data)
 {
-  CockpitHttpClient *client = data;
-  g_debug ("%s: connection timed out", client->name);
-  cockpit_http_client_reset (client);
+  CockpitHttpIdle *idle = data;
+  g_debug ("%s: idle connection timed out", idle->client->name);
+  idle->timeout = 0;
+  cockpit_http_idle_drop (idle, TRUE);
   return FALSE;
 }
 
@@ -127,6 +180,9 @@ cockpit_http_client_ensure (const gchar *name)
     {
       client = g_slice_new0 (CockpitHttpClient);
       client->name = g_strdup (name);
+      client->max_idle = DEFAULT_IDLE_CONNECTIONS;
+      client->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+      g_queue_init (&client->idle);
 
       if (clients && name)
         {
@@ -147,28 +203,88 @@ static void
 cockpit_http_client_checkin (CockpitHttpClient *client,
                              CockpitStream *stream)
 {
-  cockpit_http_client_reset (client);
-  client->stream = g_object_ref (stream);
-  client->sig_close = g_signal_connect (stream, "close", G_CALLBACK (on_client_close), client);
-  client->timeout = g_timeout_add_seconds (10, on_client_timeout, client);
+  CockpitHttpIdle *idle;
+
+  if (client->max_idle == 0 || client->idle_timeout == 0)
+    {
+      cockpit_stream_close (stream, NULL);
+      return;
+    }
+
+  idle = g_slice_new0 (CockpitHttpIdle);
+  idle->client = client;
+  idle->stream = g_object_ref (stream);
+  idle->sig_read = g_signal_connect (stream, "read", G_CALLBACK (on_idle_read), idle);
+  idle->sig_close = g_signal_connect (stream, "close", G_CALLBACK (on_idle_close), idle);
+  idle->timeout = g_timeout_add_seconds (client->idle_timeout, on_idle_timeout, idle);
+  g_queue_push_head (&client->idle, idle);
+
+  while (client->idle.length > client->max_idle)
+    {
+      g_debug ("%s: too many idle connections", client->name);
+      cockpit_http_idle_drop (client->idle.tail->data, TRUE);
+    }
 }
 
 static CockpitStream *
 cockpit_http_client_checkout (CockpitHttpClient *client)
 {
   CockpitStream *stream = NULL;
+  CockpitHttpIdle *idle;
 
-  if (client->stream)
+  while (!stream && client->idle.head)
     {
-      g_debug ("%s: reusing connection", client->name);
+      idle = client->idle.head->data;
 
-      stream = g_object_ref (client->stream);
-      cockpit_http_client_reset (client);
+      /* Health check: a usable connection has nothing buffered */
+      if (cockpit_stream_get_buffer (idle->stream)->len != 0)
+        {
+          g_debug ("%s: discarding stale connection", client->name);
+          cockpit_http_idle_drop (idle, TRUE);
+          continue;
+        }
+
+      g_debug ("%s: reusing connection", client->name);
+      stream = g_object_ref (idle->stream);
+      cockpit_http_idle_drop (idle, FALSE);
     }
 
   return stream;
 }
 
+static gboolean
+cockpit_http_client_configure (CockpitHttpClient *client,
+                               CockpitChannel *channel,
+                               JsonObject *options)
+{
+  gint64 max_idle;
+  gint64 idle_timeout;
+
+  if (!cockpit_json_get_int (options, "idle-connections", client->max_idle, &max_idle) ||
+      max_idle < 0 || max_idle > G_MAXUINT16)
+    {
+      cockpit_channel_fail (channel, "protocol-error",
+                            "invalid \"idle-connections\" field in HTTP stream request");
+      return FALSE;
+    }
+
+  if (!cockpit_json_get_int (options, "idle-timeout", client->idle_timeout, &idle_timeout) ||
+      idle_timeout < 0 || idle_timeout > G_MAXUINT16)
+    {
+      cockpit_channel_fail (channel, "protocol-error",
+                            "invalid \"idle-timeout\" field in HTTP stream request");
+      return FALSE;
+    }
+
+  client->max_idle = max_idle;
+  client->idle_timeout = idle_timeout;
+
+  while (client->idle.length > client->max_idle)
+    cockpit_http_idle_drop (client->idle.tail->data, TRUE);
+
+  return TRUE;
+}
+
 /**
  * CockpitHttpStream:
  *
@@ -1023,6 +1139,8 @@ cockpit_http_stream_prepare (CockpitChannel *channel)
     }
 
   self->client = cockpit_http_client_ensure (connection);
+  if (!cockpit_http_client_configure (self->client, channel, options))
+    goto out;
 
   if (!self->client->connectable ||
       json_object_has_member (options, "unix") ||
@@ -32,6 +32,10 @@
 #include "cockpitmountsamples.h"
 #include "cockpitcgroupsamples.h"
 #include "cockpitdisksamples.h"
+#include "cockpitdbuscachesamples.h"
+#include "cockpitdnscachesamples.h"
+#include "cockpitpeersamples.h"
+#include "cockpittlscachesamples.h"
 
 #include "common/cockpitjson.h"
 
@@ -53,7 +57,11 @@ typedef enum {
   NETWORK_SAMPLER = 1 << 3,
   MOUNT_SAMPLER = 1 << 4,
   CGROUP_SAMPLER = 1 << 5,
-  DISK_SAMPLER = 1 << 6
+  DISK_SAMPLER = 1 << 6,
+  DBUS_CACHE_SAMPLER = 1 << 7,
+  PEER_SAMPLER = 1 << 8,
+  DNS_CACHE_SAMPLER = 1 << 9,
+  TLS_CACHE_SAMPLER = 1 << 10
 } SamplerSet;
 
 typedef struct {
@@ -96,6 +104,39 @@ static MetricDescription metric_descriptions[] = {
   { "cgroup.cpu.usage",       "millisec", "counter", TRUE, CGROUP_SAMPLER },
   { "cgroup.cpu.shares",      "count",    "instant", TRUE, CGROUP_SAMPLER },
 
+  { "dbus.cache.objects",       "count",    "instant", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.properties",    "count",    "instant", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.memory",        "bytes",    "instant", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.introspects",   "count",    "instant", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.calls",         "count",    "instant", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.barriers",      "count",    "instant", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.barrier-count", "count",    "counter", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.barrier-time",  "millisec", "counter", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.depth.1",       "count",    "counter", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.depth.4",       "count",    "counter", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.depth.16",      "count",    "counter", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.depth.64",      "count",    "counter", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.depth.256",     "count",    "counter", TRUE, DBUS_CACHE_SAMPLER },
+  { "dbus.cache.depth.more",    "count",    "counter", TRUE, DBUS_CACHE_SAMPLER },
+
+  { "peer.running",    "count",    "instant", TRUE, PEER_SAMPLER },
+  { "peer.spawns",     "count",    "counter", TRUE, PEER_SAMPLER },
+  { "peer.spawn-time", "millisec", "counter", TRUE, PEER_SAMPLER },
+  { "peer.standby",    "count",    "counter", TRUE, PEER_SAMPLER },
+  { "peer.idle-exits", "count",    "counter", TRUE, PEER_SAMPLER },
+
+  { "dns.cache.entries",       "count",    "instant", FALSE, DNS_CACHE_SAMPLER },
+  { "dns.cache.hits",          "count",    "counter", FALSE, DNS_CACHE_SAMPLER },
+  { "dns.cache.negative-hits", "count",    "counter", FALSE, DNS_CACHE_SAMPLER },
+  { "dns.cache.misses",        "count",    "counter", FALSE, DNS_CACHE_SAMPLER },
+  { "dns.cache.refreshes",     "count",    "counter", FALSE, DNS_CACHE_SAMPLER },
+  { "dns.cache.lookup-time",   "millisec", "counter", FALSE, DNS_CACHE_SAMPLER },
+
+  { "tls.cache.entries", "count", "instant", FALSE, TLS_CACHE_SAMPLER },
+  { "tls.cache.hits",    "count", "counter", FALSE, TLS_CACHE_SAMPLER },
+  { "tls.cache.misses",  "count", "counter", FALSE, TLS_CACHE_SAMPLER },
+  { "tls.connections",   "count", "counter", FALSE, TLS_CACHE_SAMPLER },
+
   { NULL }
 };
 
@@ -331,6 +372,14 @@ cockpit_internal_metrics_tick (CockpitMetrics *metrics,
     cockpit_cgroup_samples (COCKPIT_SAMPLES (self));
   if (self->samplers & DISK_SAMPLER)
     cockpit_disk_samples (COCKPIT_SAMPLES (self));
+  if (self->samplers & DBUS_CACHE_SAMPLER)
+    cockpit_dbus_cache_samples (COCKPIT_SAMPLES (self));
+  if (self->samplers & PEER_SAMPLER)
+    cockpit_peer_samples (COCKPIT_SAMPLES (self));
+  if (self->samplers & DNS_CACHE_SAMPLER)
+    cockpit_dns_cache_samples (COCKPIT_SAMPLES (self));
+  if (self->samplers & TLS_CACHE_SAMPLER)
+    cockpit_tls_cache_samples (COCKPIT_SAMPLES (self));
 
   /* Check for disappeared instances
    */
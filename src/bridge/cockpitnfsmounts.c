@@ -0,0 +1,699 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitnfsmounts.h"
+
+#include "common/cockpitjson.h"
+
+#include <glib-unix.h>
+
+#include <sys/statvfs.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * CockpitNfsMounts:
+ *
+ * A #CockpitChannel that reports the NFS entries of /etc/fstab and of
+ * the mount table, and how full the mounted ones are.
+ *
+ * A statvfs() on an NFS mount can block for a long time when the server
+ * doesn't answer. So those run in a small pool of threads, and a round
+ * of them is reported when it is complete, or after a timeout, whichever
+ * comes first.  Mounts that didn't answer in time are reported as null.
+ *
+ * The payload type for this channel is 'nfs-mounts1'.
+ */
+
+#define COCKPIT_NFS_MOUNTS(o)    (G_TYPE_CHECK_INSTANCE_CAST ((o), COCKPIT_TYPE_NFS_MOUNTS, CockpitNfsMounts))
+
+/* Changes to fstab and the mount table come in bursts */
+#define REPORT_DELAY  100
+
+/* Threads for statvfs(), shared by all channels */
+#define MAX_STATVFS_THREADS  4
+
+/* No round waits longer than this, even when asked to wait forever */
+#define MAX_ROUND_TIMEOUT  60000
+
+/* Overridden by the tests */
+const gchar *cockpit_nfs_mounts_fstab = "/etc/fstab";
+const gchar *cockpit_nfs_mounts_table = "/proc/self/mounts";
+
+typedef struct {
+  CockpitChannel parent;
+  const gchar *fstab_path;
+  const gchar *mounts_path;
+
+  GFileMonitor *fstab_monitor;
+  guint sig_fstab;
+  GFileMonitor *mounts_monitor;
+  guint sig_mounts;
+  gint mounts_fd;
+  guint mounts_watch;
+  guint report_timeout;
+
+  /* The entries as last sent */
+  JsonNode *entries;
+
+  gint64 interval;
+  gint64 timeout;
+  guint interval_source;
+
+  /* Paths with a statvfs() in flight, possibly from an earlier round */
+  GHashTable *pending;
+
+  /* Path -> JsonNode usage as last sent */
+  GHashTable *usage;
+
+  /* The current round of statvfs() calls */
+  GHashTable *round;
+  guint round_serial;
+  guint round_outstanding;
+  guint round_timeout;
+  gboolean round_again;
+} CockpitNfsMounts;
+
+typedef struct {
+  CockpitChannelClass parent_class;
+} CockpitNfsMountsClass;
+
+G_DEFINE_TYPE (CockpitNfsMounts, cockpit_nfs_mounts, COCKPIT_TYPE_CHANNEL);
+
+typedef struct {
+  GWeakRef channel;
+  GMainContext *context;
+  guint serial;
+  gchar *path;
+  gboolean ok;
+  gint64 used;
+  gint64 total;
+} UsageJob;
+
+static GThreadPool *statvfs_pool = NULL;
+
+static void
+usage_job_free (gpointer data)
+{
+  UsageJob *job = data;
+  g_weak_ref_clear (&job->channel);
+  g_main_context_unref (job->context);
+  g_free (job->path);
+  g_free (job);
+}
+
+static gboolean   on_usage_done    (gpointer user_data);
+
+static void
+statvfs_thread (gpointer data,
+                gpointer user_data)
+{
+  UsageJob *job = data;
+  struct statvfs buf;
+  gint64 frsize;
+
+  if (statvfs (job->path, &buf) >= 0)
+    {
+      /* As with the mount.used metric, keep this 64 bit on 32 bit architectures */
+      frsize = buf.f_frsize;
+      job->total = frsize * buf.f_blocks;
+      job->used = job->total - frsize * buf.f_bfree;
+      job->ok = TRUE;
+    }
+  else
+    {
+      g_debug ("%s: couldn't get file system usage: %s", job->path, g_strerror (errno));
+    }
+
+  g_main_context_invoke_full (job->context, G_PRIORITY_DEFAULT, on_usage_done, job, usage_job_free);
+}
+
+static void
+cockpit_nfs_mounts_recv (CockpitChannel *channel,
+                         GBytes *message)
+{
+  cockpit_channel_fail (channel, "protocol-error", "Received unexpected message in nfs-mounts1 channel");
+}
+
+static void
+cockpit_nfs_mounts_init (CockpitNfsMounts *self)
+{
+  self->mounts_fd = -1;
+  self->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->usage = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)json_node_free);
+  self->round = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)json_node_free);
+}
+
+static void
+send_object (CockpitNfsMounts *self,
+             JsonObject *object)
+{
+  GBytes *bytes;
+
+  bytes = cockpit_json_write_bytes (object);
+  cockpit_channel_send (COCKPIT_CHANNEL (self), bytes, TRUE);
+  g_bytes_unref (bytes);
+}
+
+/*
+ * Parses the NFS entries of a file in fstab format, /proc/self/mounts
+ * being one of those.
+ */
+static GPtrArray *
+parse_tab (const gchar *path)
+{
+  GError *error = NULL;
+  gchar *contents = NULL;
+  gchar **lines = NULL;
+  gchar **fields;
+  GPtrArray *entries;
+  GPtrArray *parts;
+  gchar *line;
+  guint i, j;
+
+  entries = g_ptr_array_new_with_free_func ((GDestroyNotify)g_strfreev);
+
+  if (!g_file_get_contents (path, &contents, NULL, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_message ("%s: couldn't read: %s", path, error->message);
+      g_error_free (error);
+      return entries;
+    }
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      line = g_strstrip (lines[i]);
+      if (line[0] == '\0' || line[0] == '#')
+        continue;
+
+      parts = g_ptr_array_new ();
+      fields = g_strsplit_set (line, " \t", -1);
+      for (j = 0; fields[j] != NULL; j++)
+        {
+          if (fields[j][0] != '\0')
+            g_ptr_array_add (parts, g_strcompress (fields[j]));
+        }
+      g_strfreev (fields);
+      g_ptr_array_add (parts, NULL);
+      fields = (gchar **)g_ptr_array_free (parts, FALSE);
+
+      if (g_strv_length (fields) > 2 && strchr (fields[0], ':') && g_str_has_prefix (fields[2], "nfs"))
+        g_ptr_array_add (entries, fields);
+      else
+        g_strfreev (fields);
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+  return entries;
+}
+
+static gboolean
+find_in_tab (GPtrArray *tab,
+             gchar **fields)
+{
+  gchar **other;
+  guint i;
+
+  for (i = 0; i < tab->len; i++)
+    {
+      other = tab->pdata[i];
+      if (g_str_equal (other[0], fields[0]) && g_str_equal (other[1], fields[1]))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+add_entry (JsonArray *array,
+           gchar **fields,
+           gboolean fstab,
+           gboolean mounted)
+{
+  JsonObject *entry;
+  JsonArray *strings;
+  guint i;
+
+  strings = json_array_new ();
+  for (i = 0; fields[i] != NULL; i++)
+    json_array_add_string_element (strings, fields[i]);
+
+  entry = json_object_new ();
+  json_object_set_boolean_member (entry, "fstab", fstab);
+  json_object_set_array_member (entry, "fields", strings);
+  json_object_set_boolean_member (entry, "mounted", mounted);
+  json_array_add_object_element (array, entry);
+}
+
+static void   start_usage_round   (CockpitNfsMounts *self);
+
+/*
+ * Entries in both fstab and the mount table are reported once, as the
+ * fstab entry marked "mounted".
+ */
+static void
+report_entries (CockpitNfsMounts *self)
+{
+  GPtrArray *fstab;
+  GPtrArray *mtab;
+  JsonObject *object;
+  JsonArray *array;
+  JsonNode *node;
+  guint i;
+
+  fstab = parse_tab (self->fstab_path);
+  mtab = parse_tab (self->mounts_path);
+
+  array = json_array_new ();
+  for (i = 0; i < fstab->len; i++)
+    add_entry (array, fstab->pdata[i], TRUE, find_in_tab (mtab, fstab->pdata[i]));
+  for (i = 0; i < mtab->len; i++)
+    {
+      if (!find_in_tab (fstab, mtab->pdata[i]))
+        add_entry (array, mtab->pdata[i], FALSE, TRUE);
+    }
+
+  g_ptr_array_unref (fstab);
+  g_ptr_array_unref (mtab);
+
+  node = json_node_new (JSON_NODE_ARRAY);
+  json_node_take_array (node, array);
+
+  if (self->entries && cockpit_json_equal (self->entries, node))
+    {
+      json_node_free (node);
+      return;
+    }
+
+  if (self->entries)
+    json_node_free (self->entries);
+  self->entries = node;
+
+  object = json_object_new ();
+  json_object_set_member (object, "entries", json_node_copy (node));
+  send_object (self, object);
+  json_object_unref (object);
+
+  /* The client forgets all usage when the entries change */
+  g_hash_table_remove_all (self->usage);
+  start_usage_round (self);
+}
+
+static void
+finish_usage_round (CockpitNfsMounts *self)
+{
+  GHashTableIter iter;
+  JsonObject *object;
+  JsonObject *usage;
+  JsonNode *previous;
+  JsonNode *node;
+  const gchar *path;
+
+  if (self->round_timeout)
+    g_source_remove (self->round_timeout);
+  self->round_timeout = 0;
+  self->round_outstanding = 0;
+  self->round_serial++;
+
+  usage = json_object_new ();
+
+  g_hash_table_iter_init (&iter, self->round);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&path, (gpointer *)&node))
+    {
+      previous = g_hash_table_lookup (self->usage, path);
+      if (previous && cockpit_json_equal (previous, node))
+        continue;
+      json_object_set_member (usage, path, json_node_copy (node));
+      g_hash_table_replace (self->usage, g_strdup (path), json_node_copy (node));
+    }
+
+  g_hash_table_remove_all (self->round);
+
+  if (json_object_get_size (usage) > 0)
+    {
+      object = json_object_new ();
+      json_object_set_object_member (object, "usage", usage);
+      send_object (self, object);
+      json_object_unref (object);
+    }
+  else
+    {
+      json_object_unref (usage);
+    }
+
+  /* The entries changed while this round was running */
+  if (self->round_again)
+    {
+      self->round_again = FALSE;
+      start_usage_round (self);
+    }
+}
+
+static gboolean
+on_round_timeout (gpointer user_data)
+{
+  CockpitNfsMounts *self = COCKPIT_NFS_MOUNTS (user_data);
+  GHashTableIter iter;
+  const gchar *path;
+
+  self->round_timeout = 0;
+
+  /* Whatever hasn't answered yet is reported as unavailable */
+  g_hash_table_iter_init (&iter, self->pending);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&path, NULL))
+    {
+      if (!g_hash_table_contains (self->round, path))
+        g_hash_table_insert (self->round, g_strdup (path), json_node_new (JSON_NODE_NULL));
+    }
+
+  finish_usage_round (self);
+  return FALSE;
+}
+
+static gboolean
+on_usage_done (gpointer user_data)
+{
+  UsageJob *job = user_data;
+  CockpitNfsMounts *self;
+  JsonArray *array;
+  JsonNode *node;
+
+  self = g_weak_ref_get (&job->channel);
+  if (!self)
+    return FALSE;
+
+  g_hash_table_remove (self->pending, job->path);
+
+  /* Late answers are picked up by the next round */
+  if (job->serial == self->round_serial && self->round_outstanding > 0)
+    {
+      if (job->ok)
+        {
+          array = json_array_new ();
+          json_array_add_int_element (array, job->used);
+          json_array_add_int_element (array, job->total);
+          node = json_node_new (JSON_NODE_ARRAY);
+          json_node_take_array (node, array);
+        }
+      else
+        {
+          node = json_node_new (JSON_NODE_NULL);
+        }
+
+      g_hash_table_replace (self->round, g_strdup (job->path), node);
+      if (--self->round_outstanding == 0)
+        finish_usage_round (self);
+    }
+
+  g_object_unref (self);
+  return FALSE;
+}
+
+static void
+start_usage_round (CockpitNfsMounts *self)
+{
+  GError *error = NULL;
+  JsonObject *entry;
+  JsonArray *array;
+  JsonArray *fields;
+  const gchar *path;
+  UsageJob *job;
+  guint timeout;
+  guint i;
+
+  /* Let a round that is still running finish first, then go again */
+  if (self->round_outstanding > 0)
+    {
+      self->round_again = TRUE;
+      return;
+    }
+  if (!self->entries)
+    return;
+
+  if (!statvfs_pool)
+    {
+      statvfs_pool = g_thread_pool_new (statvfs_thread, NULL, MAX_STATVFS_THREADS, FALSE, &error);
+      g_assert_no_error (error);
+    }
+
+  /* Never leave a round hanging on a stuck server */
+  timeout = MAX_ROUND_TIMEOUT;
+  if (self->timeout > 0 && self->timeout < MAX_ROUND_TIMEOUT)
+    timeout = self->timeout;
+
+  array = json_node_get_array (self->entries);
+  for (i = 0; i < json_array_get_length (array); i++)
+    {
+      entry = json_array_get_object_element (array, i);
+      fields = json_object_get_array_member (entry, "fields");
+      if (!json_object_get_boolean_member (entry, "mounted"))
+        continue;
+
+      path = json_array_get_string_element (fields, 1);
+      if (g_hash_table_contains (self->round, path))
+        continue;
+
+      /* Still stuck from an earlier round, don't pile up threads */
+      if (g_hash_table_contains (self->pending, path))
+        {
+          g_hash_table_insert (self->round, g_strdup (path), json_node_new (JSON_NODE_NULL));
+          continue;
+        }
+
+      job = g_new0 (UsageJob, 1);
+      g_weak_ref_init (&job->channel, self);
+      job->context = g_main_context_ref_thread_default ();
+      job->serial = self->round_serial;
+      job->path = g_strdup (path);
+
+      g_hash_table_add (self->pending, g_strdup (path));
+      self->round_outstanding++;
+      g_thread_pool_push (statvfs_pool, job, NULL);
+    }
+
+  if (self->round_outstanding == 0)
+    finish_usage_round (self);
+  else
+    self->round_timeout = g_timeout_add (timeout, on_round_timeout, self);
+}
+
+static gboolean
+on_interval (gpointer user_data)
+{
+  start_usage_round (COCKPIT_NFS_MOUNTS (user_data));
+  return TRUE;
+}
+
+static gboolean
+on_report_timeout (gpointer user_data)
+{
+  CockpitNfsMounts *self = COCKPIT_NFS_MOUNTS (user_data);
+  self->report_timeout = 0;
+  report_entries (self);
+  return FALSE;
+}
+
+static void
+schedule_report (CockpitNfsMounts *self)
+{
+  if (!self->report_timeout)
+    self->report_timeout = g_timeout_add (REPORT_DELAY, on_report_timeout, self);
+}
+
+static void
+on_file_changed (GFileMonitor *monitor,
+                 GFile *file,
+                 GFile *other_file,
+                 GFileMonitorEvent event_type,
+                 gpointer user_data)
+{
+  schedule_report (COCKPIT_NFS_MOUNTS (user_data));
+}
+
+static gboolean
+on_mounts_changed (gint fd,
+                   GIOCondition condition,
+                   gpointer user_data)
+{
+  schedule_report (COCKPIT_NFS_MOUNTS (user_data));
+  return TRUE;
+}
+
+static GFileMonitor *
+monitor_file (CockpitNfsMounts *self,
+              const gchar *path,
+              guint *sig)
+{
+  GError *error = NULL;
+  GFileMonitor *monitor;
+  GFile *file;
+
+  file = g_file_new_for_path (path);
+  monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &error);
+  g_object_unref (file);
+
+  if (monitor)
+    {
+      *sig = g_signal_connect (monitor, "changed", G_CALLBACK (on_file_changed), self);
+    }
+  else
+    {
+      g_message ("%s: couldn't monitor file: %s", path, error->message);
+      g_error_free (error);
+    }
+
+  return monitor;
+}
+
+static void
+cockpit_nfs_mounts_prepare (CockpitChannel *channel)
+{
+  CockpitNfsMounts *self = COCKPIT_NFS_MOUNTS (channel);
+  JsonObject *options;
+
+  COCKPIT_CHANNEL_CLASS (cockpit_nfs_mounts_parent_class)->prepare (channel);
+
+  self->fstab_path = cockpit_nfs_mounts_fstab;
+  self->mounts_path = cockpit_nfs_mounts_table;
+
+  options = cockpit_channel_get_options (channel);
+  if (!cockpit_json_get_int (options, "interval", 10000, &self->interval) || self->interval < 0)
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"interval\" option for nfs-mounts1 channel");
+      return;
+    }
+  if (!cockpit_json_get_int (options, "timeout", 2000, &self->timeout) || self->timeout < 0)
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"timeout\" option for nfs-mounts1 channel");
+      return;
+    }
+
+  self->fstab_monitor = monitor_file (self, self->fstab_path, &self->sig_fstab);
+
+  /*
+   * The kernel mount table signals changes with POLLPRI. Anything else,
+   * such as a file in the tests, is monitored like fstab.
+   */
+  if (g_str_has_prefix (self->mounts_path, "/proc/"))
+    {
+      self->mounts_fd = open (self->mounts_path, O_RDONLY | O_CLOEXEC);
+      if (self->mounts_fd < 0)
+        {
+          cockpit_channel_fail (channel, "internal-error", "%s: couldn't open: %s",
+                                self->mounts_path, g_strerror (errno));
+          return;
+        }
+      self->mounts_watch = g_unix_fd_add (self->mounts_fd, G_IO_PRI | G_IO_ERR, on_mounts_changed, self);
+    }
+  else
+    {
+      self->mounts_monitor = monitor_file (self, self->mounts_path, &self->sig_mounts);
+    }
+
+  if (self->interval > 0)
+    self->interval_source = g_timeout_add (self->interval, on_interval, self);
+
+  cockpit_channel_ready (channel, NULL);
+  report_entries (self);
+}
+
+static void
+stop_watching (CockpitNfsMounts *self)
+{
+  if (self->fstab_monitor)
+    {
+      g_signal_handler_disconnect (self->fstab_monitor, self->sig_fstab);
+      g_file_monitor_cancel (self->fstab_monitor);
+      g_clear_object (&self->fstab_monitor);
+    }
+  if (self->mounts_monitor)
+    {
+      g_signal_handler_disconnect (self->mounts_monitor, self->sig_mounts);
+      g_file_monitor_cancel (self->mounts_monitor);
+      g_clear_object (&self->mounts_monitor);
+    }
+  if (self->mounts_watch)
+    g_source_remove (self->mounts_watch);
+  self->mounts_watch = 0;
+  if (self->mounts_fd >= 0)
+    close (self->mounts_fd);
+  self->mounts_fd = -1;
+
+  if (self->report_timeout)
+    g_source_remove (self->report_timeout);
+  self->report_timeout = 0;
+  if (self->interval_source)
+    g_source_remove (self->interval_source);
+  self->interval_source = 0;
+  if (self->round_timeout)
+    g_source_remove (self->round_timeout);
+  self->round_timeout = 0;
+  self->round_outstanding = 0;
+  self->round_again = FALSE;
+}
+
+static void
+cockpit_nfs_mounts_close (CockpitChannel *channel,
+                          const gchar *problem)
+{
+  stop_watching (COCKPIT_NFS_MOUNTS (channel));
+  COCKPIT_CHANNEL_CLASS (cockpit_nfs_mounts_parent_class)->close (channel, problem);
+}
+
+static void
+cockpit_nfs_mounts_dispose (GObject *object)
+{
+  stop_watching (COCKPIT_NFS_MOUNTS (object));
+  G_OBJECT_CLASS (cockpit_nfs_mounts_parent_class)->dispose (object);
+}
+
+static void
+cockpit_nfs_mounts_finalize (GObject *object)
+{
+  CockpitNfsMounts *self = COCKPIT_NFS_MOUNTS (object);
+
+  if (self->entries)
+    json_node_free (self->entries);
+  g_hash_table_unref (self->pending);
+  g_hash_table_unref (self->usage);
+  g_hash_table_unref (self->round);
+
+  G_OBJECT_CLASS (cockpit_nfs_mounts_parent_class)->finalize (object);
+}
+
+static void
+cockpit_nfs_mounts_class_init (CockpitNfsMountsClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  CockpitChannelClass *channel_class = COCKPIT_CHANNEL_CLASS (klass);
+
+  gobject_class->dispose = cockpit_nfs_mounts_dispose;
+  gobject_class->finalize = cockpit_nfs_mounts_finalize;
+
+  channel_class->prepare = cockpit_nfs_mounts_prepare;
+  channel_class->recv = cockpit_nfs_mounts_recv;
+  channel_class->close = cockpit_nfs_mounts_close;
+}
@@ -0,0 +1,35 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COCKPIT_NFS_MOUNTS_H__
+#define COCKPIT_NFS_MOUNTS_H__
+
+#include <gio/gio.h>
+
+#include "common/cockpitchannel.h"
+
+G_BEGIN_DECLS
+
+#define COCKPIT_TYPE_NFS_MOUNTS         (cockpit_nfs_mounts_get_type ())
+
+GType              cockpit_nfs_mounts_get_type     (void) G_GNUC_CONST;
+
+G_END_DECLS
+
+#endif /* COCKPIT_NFS_MOUNTS_H__ */
@@ -96,8 +96,16 @@ gint cockpit_bridge_packages_port = 0;
 
 
    In order to detect whether a package has changed or not, the bridge
-   also keeps track of per-package checksums.  These never appear in
-   the API.
+   also keeps track of per-package checksums.  These only cover the
+   files of that package, and appear in its manifest as
+   ".package-checksum".  The manifests are sent along with a list of
+   them, so that cockpit-ws can route "$<package-checksum>" URLs.
+
+   Unlike the bundle checksum, a per-package checksum changes as soon
+   as the package changes, and two hosts with the same package produce
+   the same one.  The shell should prefer it in URLs: only packages that
+   actually changed need to be fetched again, and cached files can be
+   shared between hosts.
 */
 
 struct _CockpitPackages {
@@ -759,6 +767,8 @@ build_packages (CockpitPackages *packages)
           package->bundle_checksum = g_strdup (packages->bundle_checksum);
         if (package->bundle_checksum)
           json_object_set_string_member (package->manifest, ".checksum", package->bundle_checksum);
+        if (package->own_checksum)
+          json_object_set_string_member (package->manifest, ".package-checksum", package->own_checksum);
       }
     }
 
@@ -835,6 +845,29 @@ handle_package_checksum (CockpitWebServer *server,
   return TRUE;
 }
 
+static gchar *
+build_package_checksums (CockpitPackages *packages)
+{
+  CockpitPackage *package;
+  GString *value;
+  GList *names, *l;
+
+  value = g_string_new ("");
+  names = g_list_sort (g_hash_table_get_keys (packages->listing), (GCompareFunc)strcmp);
+  for (l = names; l != NULL; l = g_list_next (l))
+    {
+      package = g_hash_table_lookup (packages->listing, l->data);
+      if (!package->manifest || !package->own_checksum)
+        continue;
+      if (value->len)
+        g_string_append_c (value, ' ');
+      g_string_append_printf (value, "%s=%s", package->name, package->own_checksum);
+    }
+  g_list_free (names);
+
+  return g_string_free (value, FALSE);
+}
+
 static void
 set_manifest_headers (CockpitWebResponse *response,
                       CockpitPackages *packages,
@@ -846,6 +879,8 @@ set_manifest_headers (CockpitWebResponse *response,
                            g_strdup (packages->checksum));
       g_hash_table_insert (out_headers, g_strdup ("ETag"),
                            g_strdup_printf ("\"$%s\"", packages->checksum));
+      g_hash_table_insert (out_headers, g_strdup (COCKPIT_PACKAGE_CHECKSUMS_HEADER),
+                           build_package_checksums (packages));
     }
   else
     {
@@ -1129,8 +1164,8 @@ out:
   return TRUE;
 }
 
-CockpitPackages *
-cockpit_packages_new (void)
+static CockpitPackages *
+packages_new_server (void)
 {
   CockpitPackages *packages = NULL;
   GError *error = NULL;
@@ -1197,9 +1232,6 @@ cockpit_packages_new (void)
   g_signal_connect (packages->web_server, "handle-resource",
                     G_CALLBACK (handle_packages), packages);
 
-  cockpit_web_server_start (packages->web_server);
-
-  build_packages (packages);
   ret = TRUE;
 
 out:
@@ -1216,6 +1248,92 @@ out:
   return packages;
 }
 
+CockpitPackages *
+cockpit_packages_new (void)
+{
+  CockpitPackages *packages;
+
+  packages = packages_new_server ();
+  if (packages)
+    {
+      build_packages (packages);
+      cockpit_web_server_start (packages->web_server);
+    }
+
+  return packages;
+}
+
+static void
+build_packages_thread (GTask *task,
+                       gpointer source_object,
+                       gpointer task_data,
+                       GCancellable *cancellable)
+{
+  CockpitPackages *packages = task_data;
+  gint64 start = g_get_monotonic_time ();
+
+  build_packages (packages);
+
+  g_debug ("package listing built in %" G_GINT64_FORMAT " ms",
+           (g_get_monotonic_time () - start) / 1000);
+  g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * cockpit_packages_new_async:
+ * @callback: called when the package listing is ready
+ * @user_data: data for @callback
+ *
+ * Like cockpit_packages_new() but walks and checksums the package
+ * directories in a worker thread, so that the caller can get on with
+ * other startup work. The package server socket is bound right away,
+ * but only starts serving once the listing is complete.
+ *
+ * The environment must not be modified until the @callback has run.
+ */
+void
+cockpit_packages_new_async (GAsyncReadyCallback callback,
+                            gpointer user_data)
+{
+  CockpitPackages *packages;
+  GTask *task;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, cockpit_packages_new_async);
+
+  packages = packages_new_server ();
+  if (!packages)
+    {
+      g_task_return_boolean (task, FALSE);
+    }
+  else
+    {
+      /* These are cached on first use, look them up on the main thread */
+      g_get_user_data_dir ();
+      g_get_system_data_dirs ();
+
+      g_task_set_task_data (task, packages, NULL);
+      g_task_run_in_thread (task, build_packages_thread);
+    }
+
+  g_object_unref (task);
+}
+
+CockpitPackages *
+cockpit_packages_new_finish (GAsyncResult *result)
+{
+  CockpitPackages *packages;
+
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+  if (!g_task_propagate_boolean (G_TASK (result), NULL))
+    return NULL;
+
+  packages = g_task_get_task_data (G_TASK (result));
+  cockpit_web_server_start (packages->web_server);
+  return packages;
+}
+
 const gchar *
 cockpit_packages_get_checksum (CockpitPackages *packages)
 {
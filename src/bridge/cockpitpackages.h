@@ -20,7 +20,7 @@
 #ifndef COCKPIT_PACKAGES_H_
 #define COCKPIT_PACKAGES_H_
 
-#include <glib.h>
+#include <gio/gio.h>
 #include "common/cockpitjson.h"
 
 typedef struct _CockpitPackage CockpitPackage;
@@ -28,6 +28,11 @@ typedef struct _CockpitPackages CockpitPackages;
 
 CockpitPackages * cockpit_packages_new              (void);
 
+void              cockpit_packages_new_async        (GAsyncReadyCallback callback,
+                                                     gpointer user_data);
+
+CockpitPackages * cockpit_packages_new_finish       (GAsyncResult *result);
+
 const gchar *     cockpit_packages_get_checksum     (CockpitPackages *packages);
 
 gchar **          cockpit_packages_get_names        (CockpitPackages *packages);
@@ -554,25 +554,24 @@ cockpit_packet_channel_flow_iface (CockpitFlowInterface *iface)
 }
 
 static void
-cockpit_packet_channel_prepare (CockpitChannel *channel)
+on_address_ready (GObject *object,
+                  GAsyncResult *result,
+                  gpointer user_data)
 {
-  CockpitPacketChannel *self = COCKPIT_PACKET_CHANNEL (channel);
+  CockpitPacketChannel *self = COCKPIT_PACKET_CHANNEL (object);
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
   GSocketAddress *address;
-  JsonObject *options;
   int sock;
 
-  COCKPIT_CHANNEL_CLASS (cockpit_packet_channel_parent_class)->prepare (channel);
-  options = cockpit_channel_get_options (channel);
-
-  /* Support our options in the open message too */
-  cockpit_packet_channel_control (channel, "options", options);
+  /* Closed while the address was being looked up */
   if (self->state >= CLOSED)
     return;
 
-  address = cockpit_connect_parse_address (channel, &self->name);
+  address = cockpit_connect_parse_address_finish (channel, result, &self->name);
   if (!address)
     {
-      cockpit_channel_close (channel, "internal-error");
+      if (self->state < CLOSED)
+        cockpit_channel_close (channel, "internal-error");
       return;
     }
 
@@ -594,6 +593,23 @@ cockpit_packet_channel_prepare (CockpitChannel *channel)
   cockpit_channel_ready (channel, NULL);
 }
 
+static void
+cockpit_packet_channel_prepare (CockpitChannel *channel)
+{
+  CockpitPacketChannel *self = COCKPIT_PACKET_CHANNEL (channel);
+  JsonObject *options;
+
+  COCKPIT_CHANNEL_CLASS (cockpit_packet_channel_parent_class)->prepare (channel);
+  options = cockpit_channel_get_options (channel);
+
+  /* Support our options in the open message too */
+  cockpit_packet_channel_control (channel, "options", options);
+  if (self->state >= CLOSED)
+    return;
+
+  cockpit_connect_parse_address_async (channel, NULL, on_address_ready, NULL);
+}
+
 static void
 cockpit_packet_channel_dispose (GObject *object)
 {
@@ -21,14 +21,16 @@
 
 #include "cockpitpeer.h"
 
+#include "cockpitpeersamples.h"
+
 #include "common/cockpitauthorize.h"
 #include "common/cockpitjson.h"
 #include "common/cockpitmemory.h"
 #include "common/cockpittransport.h"
 #include "common/cockpitpipe.h"
 #include "common/cockpitpipetransport.h"
+#include "common/cockpitspawn.h"
 
-#include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -47,6 +49,10 @@ struct _CockpitPeer {
   guint timeout;
   gboolean poisoned;  /* the bridge will never start when this is TRUE */
 
+  /* Spawn and idle accounting */
+  CockpitPeerStats *stats;
+  gint64 spawned;
+
   /* The channels we're dealing with */
   GHashTable *channels;
   GQueue *frozen;
@@ -68,6 +74,7 @@ struct _CockpitPeer {
 
   /* When open and ready */
   CockpitTransport *other;
+  gboolean relaying;
   gulong other_recv;
   gulong other_control;
   gulong other_closed;
@@ -142,6 +149,57 @@ on_other_recv (CockpitTransport *transport,
   return FALSE;
 }
 
+/*
+ * When both sides are pipe transports, which is always the case outside
+ * of tests, the frames of our channels are relayed between the two pipes
+ * as is. See cockpit_pipe_transport_add_relay(). Otherwise on_other_recv()
+ * and on_transport_recv() do the forwarding.
+ */
+static CockpitPipeTransport *
+relay_to_other (CockpitPipeTransport *transport,
+                const gchar *channel,
+                gpointer user_data)
+{
+  CockpitPeer *self = user_data;
+
+  /* Until the peer is inited our channels are frozen */
+  if (self->inited && self->other && g_hash_table_lookup (self->channels, channel))
+    return COCKPIT_PIPE_TRANSPORT (self->other);
+  return NULL;
+}
+
+static CockpitPipeTransport *
+relay_from_other (CockpitPipeTransport *transport,
+                  const gchar *channel,
+                  gpointer user_data)
+{
+  CockpitPeer *self = user_data;
+  return COCKPIT_PIPE_TRANSPORT (self->transport);
+}
+
+static void
+setup_relay (CockpitPeer *self)
+{
+  if (!COCKPIT_IS_PIPE_TRANSPORT (self->transport) || !COCKPIT_IS_PIPE_TRANSPORT (self->other))
+    return;
+
+  cockpit_pipe_transport_add_relay (COCKPIT_PIPE_TRANSPORT (self->transport), relay_to_other, self);
+  cockpit_pipe_transport_add_relay (COCKPIT_PIPE_TRANSPORT (self->other), relay_from_other, self);
+  self->relaying = TRUE;
+}
+
+static void
+teardown_relay (CockpitPeer *self)
+{
+  if (!self->relaying)
+    return;
+
+  cockpit_pipe_transport_remove_relay (COCKPIT_PIPE_TRANSPORT (self->transport), self);
+  if (self->other)
+    cockpit_pipe_transport_remove_relay (COCKPIT_PIPE_TRANSPORT (self->other), self);
+  self->relaying = FALSE;
+}
+
 static gboolean
 on_timeout_reset (gpointer user_data)
 {
@@ -151,12 +209,26 @@ on_timeout_reset (gpointer user_data)
   if (g_hash_table_size (self->channels) == 0)
     {
       g_debug ("%s: peer timed out without channels", self->name);
+      if (self->other)
+        self->stats->idle++;
       cockpit_peer_reset (self);
     }
 
   return FALSE;
 }
 
+static void
+start_idle_timeout (CockpitPeer *self)
+{
+  gint64 timeout;
+
+  if (self->timeout)
+    g_source_remove (self->timeout);
+  self->timeout = 0;
+  if (cockpit_json_get_int (self->config, "timeout", -1, &timeout) && timeout >= 0)
+    self->timeout = g_timeout_add_seconds (timeout, on_timeout_reset, self);
+}
+
 static gboolean
 on_other_control (CockpitTransport *transport,
                   const char *command,
@@ -171,7 +243,6 @@ on_other_control (CockpitTransport *transport,
   const gchar *cookie = NULL;
   const gchar *challenge = NULL;
   GBytes *reply;
-  gint64 timeout;
   gint64 version;
   char *type = NULL;
   GList *l;
@@ -219,6 +290,12 @@ on_other_control (CockpitTransport *transport,
           g_debug ("%s: received init message from peer bridge", self->name);
           self->inited = TRUE;
 
+          if (self->spawned)
+            {
+              self->stats->spawn_usec += g_get_monotonic_time () - self->spawned;
+              self->spawned = 0;
+            }
+
           if (!self->last_init)
             {
               default_init = g_strdup_printf ("{ \"command\": \"init\", \"version\": 1, \"host\": \"%s\" }",
@@ -284,11 +361,7 @@ on_other_control (CockpitTransport *transport,
           if (g_hash_table_size (self->channels) == 0)
             {
               g_debug ("%s: removed last channel for peer", self->name);
-              if (self->timeout)
-                g_source_remove (self->timeout);
-              self->timeout = 0;
-              if (cockpit_json_get_int (self->config, "timeout", -1, &timeout) && timeout >= 0)
-                self->timeout = g_timeout_add_seconds (timeout, on_timeout_reset, self);
+              start_idle_timeout (self);
             }
         }
 
@@ -387,12 +460,16 @@ on_other_closed (CockpitTransport *transport,
         }
     }
 
+  teardown_relay (self);
   g_signal_handler_disconnect (self->other, self->other_closed);
   g_signal_handler_disconnect (self->other, self->other_recv);
   g_signal_handler_disconnect (self->other, self->other_control);
   g_object_unref (self->other);
   self->other = NULL;
 
+  self->stats->running--;
+  self->spawned = 0;
+
   self->closed = TRUE;
 
   /* Handle any remaining open channels */
@@ -626,6 +703,8 @@ cockpit_peer_constructed (GObject *object)
       if (node && JSON_NODE_HOLDS_VALUE (node) && json_node_get_value_type (node) == G_TYPE_STRING)
         self->name = json_node_get_string (node);
     }
+
+  self->stats = cockpit_peer_stats_get (self->name);
 }
 
 static void
@@ -674,23 +753,6 @@ cockpit_peer_new (CockpitTransport *transport,
                        NULL);
 }
 
-static void
-spawn_setup (gpointer data)
-{
-  int fd = GPOINTER_TO_INT (data);
-
-  /* Send this signal to all direct child processes, when bridge dies */
-  prctl (PR_SET_PDEATHSIG, SIGHUP);
-
-  if (dup2 (fd, 0) < 0 || dup2 (fd, 1) < 0)
-    {
-      perror ("couldn't set peer stdin/stout file descriptors");
-      _exit (1);
-    }
-
-  close (fd);
-}
-
 static CockpitPipe *
 spawn_process_for_config (CockpitPeer *self)
 {
@@ -702,6 +764,7 @@ spawn_process_for_config (CockpitPeer *self)
   gchar **env = NULL;
   GError *error = NULL;
   GPid pid = 0;
+  int remap[3] = { -1, -1, -1 };
   int fds[2];
 
   if (socketpair (PF_LOCAL, SOCK_STREAM, 0, fds) < 0)
@@ -719,12 +782,13 @@ spawn_process_for_config (CockpitPeer *self)
       g_debug ("%s: spawning peer bridge process", self->name);
 
       env = cockpit_pipe_get_environ ((const gchar **)envset, NULL);
-      g_spawn_async_with_pipes (directory, (gchar **)argv, (gchar **)env,
-                                G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
-                                spawn_setup, GINT_TO_POINTER (fds[0]),
-                                &pid, NULL, NULL, NULL, &error);
+      remap[0] = remap[1] = fds[0];
 
-      if (error)
+      /* Send this signal to all direct child processes, when bridge dies */
+      if (!cockpit_spawn ((const gchar **)argv, (const gchar **)env, directory,
+                          remap, G_N_ELEMENTS (remap),
+                          COCKPIT_SPAWN_SEARCH_PATH | COCKPIT_SPAWN_PDEATHSIG,
+                          &pid, &error))
         {
           if (g_error_matches (error, G_SPAWN_ERROR, G_SPAWN_ERROR_NOENT) ||
               g_error_matches (error, G_SPAWN_ERROR, G_SPAWN_ERROR_PERM) ||
@@ -895,14 +959,63 @@ cockpit_peer_ensure (CockpitPeer *self)
       self->other = cockpit_pipe_transport_new (pipe);
       g_object_unref (pipe);
 
+      self->stats->spawns++;
+      self->stats->running++;
+      self->spawned = g_get_monotonic_time ();
+
       self->other_recv = g_signal_connect (self->other, "recv", G_CALLBACK (on_other_recv), self);
       self->other_closed = g_signal_connect (self->other, "closed", G_CALLBACK (on_other_closed), self);
       self->other_control = g_signal_connect (self->other, "control", G_CALLBACK (on_other_control), self);
+      setup_relay (self);
     }
 
   return self->other;
 }
 
+/**
+ * cockpit_peer_standby:
+ * @peer: The peer object
+ *
+ * Start the peer bridge ahead of its first channel, if it is
+ * configured with "standby", so that the channel doesn't wait for
+ * the process to spawn and send its "init" message.
+ *
+ * If the peer also has a "timeout" and no channel shows up before
+ * that, then the peer is shut down again.
+ *
+ * Returns: TRUE if the peer was started
+ */
+gboolean
+cockpit_peer_standby (CockpitPeer *self)
+{
+  gboolean standby = FALSE;
+
+  g_return_val_if_fail (COCKPIT_IS_PEER (self), FALSE);
+
+  if (self->other || self->closed || self->poisoned)
+    return FALSE;
+
+  if (!cockpit_json_get_bool (self->config, "standby", FALSE, &standby))
+    {
+      g_message ("%s: invalid \"standby\" field in bridge configuration", self->name);
+      return FALSE;
+    }
+
+  if (!standby)
+    return FALSE;
+
+  g_debug ("%s: starting peer bridge on standby", self->name);
+
+  if (!cockpit_peer_ensure (self))
+    return FALSE;
+
+  self->stats->standby++;
+  if (g_hash_table_size (self->channels) == 0)
+    start_idle_timeout (self);
+
+  return TRUE;
+}
+
 void
 cockpit_peer_reset (CockpitPeer *self)
 {
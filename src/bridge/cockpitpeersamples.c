@@ -0,0 +1,97 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitpeersamples.h"
+
+#include <string.h>
+
+/*
+ * Peer bridges come and go, but their counters should not. So these
+ * are kept by peer name for the lifetime of the bridge, and CockpitPeer
+ * updates them in place.
+ */
+
+static GHashTable *peer_stats = NULL;
+
+/**
+ * cockpit_peer_stats_get:
+ * @name: The peer bridge name, or NULL
+ *
+ * Returns: (transfer none): The statistics for peer bridges with
+ *          this name, created if necessary. Never NULL.
+ */
+CockpitPeerStats *
+cockpit_peer_stats_get (const gchar *name)
+{
+  CockpitPeerStats *stats;
+
+  if (!name)
+    name = "unknown";
+
+  if (!peer_stats)
+    peer_stats = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  stats = g_hash_table_lookup (peer_stats, name);
+  if (!stats)
+    {
+      stats = g_new0 (CockpitPeerStats, 1);
+      g_hash_table_insert (peer_stats, g_strdup (name), stats);
+    }
+
+  return stats;
+}
+
+/* Peers hold on to their stats, so only zero them here */
+void
+cockpit_peer_stats_reset (void)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  if (!peer_stats)
+    return;
+
+  g_hash_table_iter_init (&iter, peer_stats);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    memset (value, 0, sizeof (CockpitPeerStats));
+}
+
+void
+cockpit_peer_samples (CockpitSamples *samples)
+{
+  CockpitPeerStats *stats;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (!peer_stats)
+    return;
+
+  g_hash_table_iter_init (&iter, peer_stats);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      stats = value;
+      cockpit_samples_sample (samples, "peer.running", key, stats->running);
+      cockpit_samples_sample (samples, "peer.spawns", key, stats->spawns);
+      cockpit_samples_sample (samples, "peer.spawn-time", key, stats->spawn_usec / 1000);
+      cockpit_samples_sample (samples, "peer.standby", key, stats->standby);
+      cockpit_samples_sample (samples, "peer.idle-exits", key, stats->idle);
+    }
+}
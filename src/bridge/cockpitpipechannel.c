@@ -64,6 +64,8 @@ typedef struct {
   gint64 latency;
   guint timeout;
   gboolean pty;
+  gint64 cache;
+  struct _CachedSpawn *cached;
 } CockpitPipeChannel;
 
 typedef struct {
@@ -72,6 +74,8 @@ typedef struct {
 
 G_DEFINE_TYPE (CockpitPipeChannel, cockpit_pipe_channel, COCKPIT_TYPE_CHANNEL);
 
+static void  detach_cached_spawn   (CockpitPipeChannel *self);
+
 GHashTable *internal_fds;
 
 static gboolean
@@ -250,6 +254,7 @@ cockpit_pipe_channel_close (CockpitChannel *channel,
 
   self->closing = TRUE;
   process_pipe_buffer (self, NULL);
+  detach_cached_spawn (self);
 
   /*
    * If closed, call base class handler directly. Otherwise ask
@@ -298,10 +303,9 @@ on_pipe_read (CockpitPipe *pipe,
 }
 
 static void
-return_stderr_message (CockpitChannel *channel,
+return_stderr_message (JsonObject *options,
                        CockpitPipe *pipe)
 {
-  JsonObject *options;
   GByteArray *buffer;
   GBytes *bytes;
   GBytes *clean;
@@ -325,29 +329,19 @@ return_stderr_message (CockpitChannel *channel,
   g_assert (length > 0);
   data[length - 1] = '\0';
 
-  options = cockpit_channel_close_options (channel);
   json_object_set_string_member (options, "message", data);
   g_free (data);
 }
 
 static void
-on_pipe_close (CockpitPipe *pipe,
-               const gchar *problem,
-               gpointer user_data)
+return_exit_status (JsonObject *options,
+                    CockpitPipe *pipe)
 {
-  CockpitPipeChannel *self = user_data;
-  CockpitChannel *channel = user_data;
-  JsonObject *options;
   gint status;
   gchar *signal;
 
-  process_pipe_buffer (self, NULL);
-
-  self->open = FALSE;
-
   if (cockpit_pipe_get_pid (pipe, NULL))
     {
-      options = cockpit_channel_close_options (channel);
       status = cockpit_pipe_exit_status (pipe);
       if (WIFEXITED (status))
         {
@@ -365,7 +359,22 @@ on_pipe_close (CockpitPipe *pipe,
         }
     }
 
-  return_stderr_message (channel, pipe);
+  return_stderr_message (options, pipe);
+}
+
+static void
+on_pipe_close (CockpitPipe *pipe,
+               const gchar *problem,
+               gpointer user_data)
+{
+  CockpitPipeChannel *self = user_data;
+  CockpitChannel *channel = user_data;
+
+  process_pipe_buffer (self, NULL);
+
+  self->open = FALSE;
+
+  return_exit_status (cockpit_channel_close_options (channel), pipe);
 
   /*
    * In theory we should plumb done handling all the way through to CockpitPipe.
@@ -377,11 +386,269 @@ on_pipe_close (CockpitPipe *pipe,
   cockpit_channel_close (channel, problem);
 }
 
+/*
+ * Results of spawned processes, shared between channels that ask for the
+ * same command with the "cache" option. Identical requests that arrive
+ * while the process is running are coalesced, and a successful result
+ * is kept around for the requested number of milliseconds. Superuser
+ * channels are handled by a different bridge, with its own cache.
+ */
+
+/* Don't keep around large results */
+#define CACHED_SPAWN_MAX_SIZE (256 * 1024)
+
+typedef struct _CachedSpawn {
+  gchar *key;
+  CockpitPipe *pipe;
+  GList *waiters;
+  GBytes *output;
+  JsonObject *options;
+  gchar *problem;
+  gint64 finished;
+  gint64 ttl;
+  guint timeout;
+} CachedSpawn;
+
+static GHashTable *cached_spawns;
+
+static void
+cached_spawn_free (gpointer data)
+{
+  CachedSpawn *cached = data;
+
+  g_assert (cached->waiters == NULL);
+  g_assert (cached->pipe == NULL);
+
+  if (cached->timeout)
+    g_source_remove (cached->timeout);
+  if (cached->output)
+    g_bytes_unref (cached->output);
+  if (cached->options)
+    json_object_unref (cached->options);
+  g_free (cached->problem);
+  g_free (cached->key);
+  g_free (cached);
+}
+
+static gchar *
+cached_spawn_key (gchar **argv,
+                  gchar **env,
+                  const gchar *directory,
+                  CockpitPipeFlags flags)
+{
+  GChecksum *checksum;
+  gchar **lists[] = { argv, env };
+  guint32 value;
+  gchar *key;
+  guint i, j;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  for (i = 0; i < G_N_ELEMENTS (lists); i++)
+    {
+      value = g_strv_length (lists[i]);
+      g_checksum_update (checksum, (const guchar *)&value, sizeof (value));
+      for (j = 0; lists[i][j] != NULL; j++)
+        g_checksum_update (checksum, (const guchar *)lists[i][j], strlen (lists[i][j]) + 1);
+    }
+
+  value = flags;
+  g_checksum_update (checksum, (const guchar *)&value, sizeof (value));
+  g_checksum_update (checksum, (const guchar *)(directory ? directory : ""), -1);
+
+  key = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+  return key;
+}
+
+static void
+deliver_cached_spawn (CockpitPipeChannel *self,
+                      CachedSpawn *cached)
+{
+  CockpitChannel *channel = (CockpitChannel *)self;
+  JsonObject *options;
+  GList *members, *l;
+
+  if (cached->output && g_bytes_get_size (cached->output))
+    cockpit_channel_send (channel, cached->output, FALSE);
+
+  options = cockpit_channel_close_options (channel);
+  members = json_object_get_members (cached->options);
+  for (l = members; l != NULL; l = g_list_next (l))
+    {
+      json_object_set_member (options, l->data,
+                              json_node_copy (json_object_get_member (cached->options, l->data)));
+    }
+  g_list_free (members);
+
+  if (cached->problem == NULL)
+    cockpit_channel_control (channel, "done", NULL);
+
+  cockpit_channel_close (channel, cached->problem);
+}
+
+static gboolean
+on_cached_spawn_expired (gpointer user_data)
+{
+  CachedSpawn *cached = user_data;
+
+  cached->timeout = 0;
+  g_hash_table_remove (cached_spawns, cached->key);
+  return FALSE;
+}
+
+static void
+on_cached_spawn_close (CockpitPipe *pipe,
+                       const gchar *problem,
+                       gpointer user_data)
+{
+  CachedSpawn *cached = user_data;
+  CockpitPipeChannel *waiter;
+  GByteArray *buffer;
+  GList *waiters, *l;
+
+  buffer = cockpit_pipe_get_buffer (pipe);
+  cached->output = g_bytes_new (buffer->data, buffer->len);
+  cached->options = json_object_new ();
+  return_exit_status (cached->options, pipe);
+  cached->problem = g_strdup (problem);
+  cached->finished = g_get_monotonic_time ();
+
+  g_signal_handlers_disconnect_by_func (pipe, on_cached_spawn_close, cached);
+  cached->pipe = NULL;
+
+  /* The channels may close and go away as we deliver */
+  waiters = cached->waiters;
+  cached->waiters = NULL;
+
+  for (l = waiters; l != NULL; l = g_list_next (l))
+    {
+      waiter = l->data;
+      waiter->cached = NULL;
+      deliver_cached_spawn (waiter, cached);
+    }
+  g_list_free (waiters);
+
+  if (problem || cached->ttl <= 0 || g_bytes_get_size (cached->output) > CACHED_SPAWN_MAX_SIZE)
+    g_hash_table_remove (cached_spawns, cached->key);
+  else
+    cached->timeout = g_timeout_add (cached->ttl, on_cached_spawn_expired, cached);
+
+  g_object_unref (pipe);
+}
+
+static void
+detach_cached_spawn (CockpitPipeChannel *self)
+{
+  if (self->cached)
+    {
+      self->cached->waiters = g_list_remove (self->cached->waiters, self);
+      self->cached = NULL;
+    }
+}
+
+static void
+prepare_cached_spawn (CockpitPipeChannel *self,
+                      gchar **argv,
+                      gchar **env,
+                      const gchar *directory,
+                      CockpitPipeFlags flags)
+{
+  CachedSpawn *cached = NULL;
+  gchar *key;
+
+  if (!cached_spawns)
+    cached_spawns = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, cached_spawn_free);
+
+  key = cached_spawn_key (argv, env, directory, flags);
+  cached = g_hash_table_lookup (cached_spawns, key);
+
+  /* A finished result that is too old for this caller */
+  if (cached && !cached->pipe &&
+      g_get_monotonic_time () - cached->finished > self->cache * 1000)
+    {
+      g_hash_table_remove (cached_spawns, key);
+      cached = NULL;
+    }
+
+  if (!cached)
+    {
+      cached = g_new0 (CachedSpawn, 1);
+      cached->key = key;
+      key = NULL;
+
+      /* Output is shared between callers, so nobody gets to write input */
+      cached->pipe = cockpit_pipe_spawn ((const gchar **)argv, (const gchar **)env, directory, flags);
+      g_signal_connect (cached->pipe, "close", G_CALLBACK (on_cached_spawn_close), cached);
+      cockpit_pipe_close (cached->pipe, NULL);
+
+      g_hash_table_replace (cached_spawns, cached->key, cached);
+      g_debug ("%s: spawning process for cache", self->name);
+    }
+  else
+    {
+      g_debug ("%s: using cached process result", self->name);
+    }
+
+  g_free (key);
+
+  cockpit_channel_ready ((CockpitChannel *)self, NULL);
+
+  if (cached->pipe)
+    {
+      self->cached = cached;
+      cached->ttl = MAX (cached->ttl, self->cache);
+      cached->waiters = g_list_prepend (cached->waiters, self);
+    }
+  else
+    {
+      deliver_cached_spawn (self, cached);
+    }
+}
+
 static void
 cockpit_pipe_channel_init (CockpitPipeChannel *self)
 {
   /* Has no effect until batch is set */
   self->latency = 75;
+  self->cache = -1;
+}
+
+static void
+start_pipe (CockpitPipeChannel *self)
+{
+  CockpitChannel *channel = COCKPIT_CHANNEL (self);
+
+  /* Let the channel throttle the pipe's input flow*/
+  cockpit_flow_throttle (COCKPIT_FLOW (self->pipe), COCKPIT_FLOW (self));
+
+  /* Let the pipe throttle the channel peer's output flow */
+  cockpit_flow_throttle (COCKPIT_FLOW (channel), COCKPIT_FLOW (self->pipe));
+
+  self->sig_read = g_signal_connect (self->pipe, "read", G_CALLBACK (on_pipe_read), self);
+  self->sig_close = g_signal_connect (self->pipe, "close", G_CALLBACK (on_pipe_close), self);
+  self->open = TRUE;
+  cockpit_channel_ready (channel, NULL);
+}
+
+static void
+on_address_ready (GObject *object,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+  CockpitPipeChannel *self = COCKPIT_PIPE_CHANNEL (object);
+  GSocketAddress *address;
+
+  /* Closed while the address was being looked up */
+  if (self->closing)
+    return;
+
+  address = cockpit_connect_parse_address_finish (COCKPIT_CHANNEL (self), result, &self->name);
+  if (!address)
+    return;
+
+  self->pipe = cockpit_pipe_connect (self->name, address);
+  g_object_unref (address);
+  start_pipe (self);
 }
 
 static gchar **
@@ -407,7 +674,6 @@ static void
 cockpit_pipe_channel_prepare (CockpitChannel *channel)
 {
   CockpitPipeChannel *self = COCKPIT_PIPE_CHANNEL (channel);
-  GSocketAddress *address;
   CockpitPipeFlags flags;
   JsonObject *options;
   gchar **argv = NULL;
@@ -469,9 +735,22 @@ cockpit_pipe_channel_prepare (CockpitChannel *channel)
                                 "invalid \"pty\" option for stream channel");
           goto out;
         }
+      if (!cockpit_json_get_int (options, "cache", -1, &self->cache) ||
+          self->cache < -1 || self->cache >= G_MAXUINT ||
+          (self->cache >= 0 && self->pty))
+        {
+          cockpit_channel_fail (channel, "protocol-error",
+                                "invalid \"cache\" option for stream channel");
+          goto out;
+        }
       env = parse_environ (channel, options, dir);
       if (!env)
         goto out;
+      if (self->cache >= 0)
+        {
+          prepare_cached_spawn (self, argv, env, dir, flags);
+          goto out;
+        }
       if (self->pty)
         {
           gushort rows, cols;
@@ -495,23 +774,11 @@ cockpit_pipe_channel_prepare (CockpitChannel *channel)
     }
   else
     {
-      address = cockpit_connect_parse_address (channel, &self->name);
-      if (!address)
-        goto out;
-      self->pipe = cockpit_pipe_connect (self->name, address);
-      g_object_unref (address);
+      cockpit_connect_parse_address_async (channel, NULL, on_address_ready, NULL);
+      goto out;
     }
 
-  /* Let the channel throttle the pipe's input flow*/
-  cockpit_flow_throttle (COCKPIT_FLOW (self->pipe), COCKPIT_FLOW (self));
-
-  /* Let the pipe throttle the channel peer's output flow */
-  cockpit_flow_throttle (COCKPIT_FLOW (channel), COCKPIT_FLOW (self->pipe));
-
-  self->sig_read = g_signal_connect (self->pipe, "read", G_CALLBACK (on_pipe_read), self);
-  self->sig_close = g_signal_connect (self->pipe, "close", G_CALLBACK (on_pipe_close), self);
-  self->open = TRUE;
-  cockpit_channel_ready (channel, NULL);
+  start_pipe (self);
 
 out:
   g_free (argv);
@@ -523,6 +790,8 @@ cockpit_pipe_channel_dispose (GObject *object)
 {
   CockpitPipeChannel *self = COCKPIT_PIPE_CHANNEL (object);
 
+  detach_cached_spawn (self);
+
   if (self->pipe)
     {
       if (self->open)
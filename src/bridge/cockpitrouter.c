@@ -46,6 +46,9 @@ struct _CockpitRouter {
   /* Rules for how to open channels */
   GList *rules;
 
+  /* Set once the first channel has been opened */
+  gboolean active;
+
   /* All local channels are tracked here, value may be null */
   GHashTable *channels;
 
@@ -549,6 +552,20 @@ process_open_peer (CockpitRouter *self,
   return cockpit_peer_handle (peer, channel, options, data);
 }
 
+static void
+router_rules_standby (GList *rules)
+{
+  RouterRule *rule;
+  GList *l;
+
+  for (l = rules; l != NULL; l = g_list_next (l))
+    {
+      rule = l->data;
+      if (rule->callback == process_open_peer)
+        cockpit_peer_standby (rule->user_data);
+    }
+}
+
 static GBytes *
 substitute_json_string (const gchar *variable,
                         gpointer user_data)
@@ -737,6 +754,17 @@ process_open (CockpitRouter *self,
               break;
             }
         }
+
+      /*
+       * The first channel means that someone has loaded a page and is
+       * going to use this bridge interactively. Start any peer bridges
+       * that want to be on standby now, rather than when they're needed.
+       */
+      if (!self->active)
+        {
+          self->active = TRUE;
+          router_rules_standby (self->rules);
+        }
     }
   if (new_payload)
     g_bytes_unref (new_payload);
@@ -1204,6 +1232,10 @@ void cockpit_router_set_bridges (CockpitRouter *self,
         }
     }
   g_list_free (old_rules);
+
+  /* Newly added bridges may want to be on standby too */
+  if (self->active)
+    router_rules_standby (self->rules);
 }
 
 void
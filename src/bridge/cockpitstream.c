@@ -24,8 +24,15 @@
 #include "common/cockpitflow.h"
 #include "common/cockpitjson.h"
 
+#include <gio/gunixoutputstream.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
 /**
  * CockpitStream:
@@ -38,6 +45,10 @@
  *    from another object passed into cockpit_stream_throttle()
  *  - It can optionally control another flow, by emitting a "pressure" signal
  *    when its output queue is too large
+ *
+ * When the stream is a plain socket or unix fd, the output queue is
+ * written with a single vectored write per wake up, instead of one
+ * write per queued block.
  */
 
 enum {
@@ -63,6 +74,8 @@ struct _CockpitStreamPrivate {
   gsize out_queued;
   gsize out_partial;
   gboolean out_closed;
+  gint out_fd;
+  gboolean out_socket;
 
   gboolean in_done;
   GSource *in_source;
@@ -78,6 +91,12 @@ struct _CockpitStreamPrivate {
 /* A megabyte is when we start to consider queue full enough */
 #define QUEUE_PRESSURE 1024UL * 1024UL
 
+/* Same as CockpitPipe */
+#define DEF_PACKET_SIZE  (64UL * 1024UL)
+
+/* Most queued blocks written in one go */
+#define MAX_OUT_BLOCKS 64
+
 static guint cockpit_stream_sig_open;
 static guint cockpit_stream_sig_read;
 static guint cockpit_stream_sig_close;
@@ -96,6 +115,7 @@ cockpit_stream_init (CockpitStream *self)
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, COCKPIT_TYPE_STREAM, CockpitStreamPrivate);
   self->priv->in_buffer = g_byte_array_new ();
   self->priv->out_queue = g_queue_new ();
+  self->priv->out_fd = -1;
 
   self->priv->context = g_main_context_ref_thread_default ();
 }
@@ -401,9 +421,9 @@ dispatch_input (GPollableInputStream *is,
       g_return_val_if_fail (self->priv->in_source, FALSE);
       len = self->priv->in_buffer->len;
 
-      g_byte_array_set_size (self->priv->in_buffer, len + 1024);
+      g_byte_array_set_size (self->priv->in_buffer, len + DEF_PACKET_SIZE);
       ret = g_pollable_input_stream_read_nonblocking (is, self->priv->in_buffer->data + len,
-                                                      1024, NULL, &error);
+                                                      DEF_PACKET_SIZE, NULL, &error);
 
       if (ret < 0)
         {
@@ -436,6 +456,13 @@ dispatch_input (GPollableInputStream *is,
           g_debug ("%s: read %d bytes", self->priv->name, (int)ret);
           self->priv->received = TRUE;
           read = TRUE;
+
+          /*
+           * A short read drained the fd, no need to find that out with another
+           * read. But TLS may have decrypted more than it returned, so keep going.
+           */
+          if (ret < DEF_PACKET_SIZE && !G_IS_TLS_CONNECTION (self->priv->io))
+            break;
         }
     }
 
@@ -451,6 +478,93 @@ dispatch_input (GPollableInputStream *is,
   return TRUE;
 }
 
+static gssize
+write_vectored (CockpitStream *self,
+                GError **error)
+{
+  struct iovec iov[MAX_OUT_BLOCKS];
+  struct msghdr msg = { 0, };
+  gsize partial;
+  gssize ret;
+  gint count;
+  gint errn;
+  GList *l;
+
+  partial = self->priv->out_partial;
+  for (l = self->priv->out_queue->head, count = 0;
+       l != NULL && count < G_N_ELEMENTS (iov);
+       l = g_list_next (l), count++)
+    {
+      iov[count].iov_base = (gpointer)g_bytes_get_data (l->data, &iov[count].iov_len);
+      if (partial)
+        {
+          g_assert (partial < iov[count].iov_len);
+          iov[count].iov_base = ((gchar *)iov[count].iov_base) + partial;
+          iov[count].iov_len -= partial;
+          partial = 0;
+        }
+    }
+
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+
+  do
+    {
+      /* Sockets don't get a SIGPIPE this way */
+      if (self->priv->out_socket)
+        ret = sendmsg (self->priv->out_fd, &msg, MSG_NOSIGNAL);
+      else
+        ret = writev (self->priv->out_fd, iov, count);
+    }
+  while (ret < 0 && errno == EINTR);
+
+  if (ret < 0)
+    {
+      errn = errno;
+      g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errn), g_strerror (errn));
+    }
+
+  return ret;
+}
+
+static gboolean
+pop_output (CockpitStream *self,
+            gsize written)
+{
+  gsize len, size, before;
+  GBytes *popped;
+
+  while (written > 0)
+    {
+      len = g_bytes_get_size (self->priv->out_queue->head->data);
+      g_assert (self->priv->out_partial < len);
+
+      if (written < len - self->priv->out_partial)
+        {
+          g_debug ("%s: partial write %d of %d bytes", self->priv->name,
+                   (int)written, (int)(len - self->priv->out_partial));
+          self->priv->out_partial += written;
+          return FALSE;
+        }
+
+      written -= len - self->priv->out_partial;
+      before = self->priv->out_queued;
+
+      g_debug ("%s: wrote %d bytes", self->priv->name, (int)len);
+      popped = g_queue_pop_head (self->priv->out_queue);
+      size = g_bytes_get_size (popped);
+      g_assert (size <= self->priv->out_queued);
+      self->priv->out_queued -= size;
+      g_bytes_unref (popped);
+      self->priv->out_partial = 0;
+
+      if (before >= QUEUE_PRESSURE && self->priv->out_queued < QUEUE_PRESSURE)
+        cockpit_flow_emit_pressure (COCKPIT_FLOW (self), FALSE);
+    }
+
+  return TRUE;
+}
+
 static gboolean
 dispatch_output (GPollableOutputStream *os,
                  gpointer user_data)
@@ -458,18 +572,24 @@ dispatch_output (GPollableOutputStream *os,
   CockpitStream *self = (CockpitStream *)user_data;
   GError *error = NULL;
   const gint8 *data;
-  gsize len, size, before;
-  GBytes *popped;
+  gsize len;
   gssize ret;
 
   g_return_val_if_fail (self->priv->out_source, FALSE);
   while (self->priv->out_queue->head)
     {
-      data = g_bytes_get_data (self->priv->out_queue->head->data, &len);
-      g_assert (self->priv->out_partial <= len);
+      if (self->priv->out_fd >= 0)
+        {
+          ret = write_vectored (self, &error);
+        }
+      else
+        {
+          data = g_bytes_get_data (self->priv->out_queue->head->data, &len);
+          g_assert (self->priv->out_partial <= len);
 
-      ret = g_pollable_output_stream_write_nonblocking (os, data + self->priv->out_partial,
-                                                        len - self->priv->out_partial, NULL, &error);
+          ret = g_pollable_output_stream_write_nonblocking (os, data + self->priv->out_partial,
+                                                            len - self->priv->out_partial, NULL, &error);
+        }
 
       if (ret < 0)
         {
@@ -488,28 +608,9 @@ dispatch_output (GPollableOutputStream *os,
             }
         }
 
-      self->priv->out_partial += ret;
-      if (self->priv->out_partial >= len)
-        {
-          before = self->priv->out_queued;
-
-          g_debug ("%s: wrote %d bytes", self->priv->name, (int)len);
-          popped = g_queue_pop_head (self->priv->out_queue);
-          size = g_bytes_get_size (popped);
-          g_assert (size <= self->priv->out_queued);
-          self->priv->out_queued -= size;
-          g_bytes_unref (popped);
-          self->priv->out_partial = 0;
-
-          if (before >= QUEUE_PRESSURE && self->priv->out_queued < QUEUE_PRESSURE)
-            cockpit_flow_emit_pressure (COCKPIT_FLOW (self), FALSE);
-        }
-      else
-        {
-          if (ret > 0)
-            g_debug ("%s: partial write %d of %d bytes", self->priv->name, (int)ret, (int)len);
-          return TRUE;
-        }
+      /* Wait until there's more room after a partial write */
+      if (!pop_output (self, ret) || ret == 0)
+        return TRUE;
     }
 
   g_debug ("%s: output queue empty", self->priv->name);
@@ -560,6 +661,35 @@ start_input (CockpitStream *self)
   g_source_attach (self->priv->in_source, self->priv->context);
 }
 
+static void
+setup_vectored_output (CockpitStream *self)
+{
+  GOutputStream *os;
+  gint flags;
+  gint fd = -1;
+
+  /* TLS and other filtering streams have to be written through GIO */
+  if (G_IS_TLS_CONNECTION (self->priv->io))
+    return;
+
+  if (G_IS_SOCKET_CONNECTION (self->priv->io))
+    {
+      fd = g_socket_get_fd (g_socket_connection_get_socket (G_SOCKET_CONNECTION (self->priv->io)));
+      self->priv->out_socket = TRUE;
+    }
+  else
+    {
+      os = g_io_stream_get_output_stream (self->priv->io);
+      if (G_IS_UNIX_OUTPUT_STREAM (os))
+        fd = g_unix_output_stream_get_fd (G_UNIX_OUTPUT_STREAM (os));
+    }
+
+  /* A blocking fd could hang the main loop */
+  flags = fd >= 0 ? fcntl (fd, F_GETFL) : -1;
+  if (flags >= 0 && (flags & O_NONBLOCK))
+    self->priv->out_fd = fd;
+}
+
 static void
 initialize_io (CockpitStream *self)
 {
@@ -588,6 +718,7 @@ initialize_io (CockpitStream *self)
     }
 
   start_input (self);
+  setup_vectored_output (self);
 
   if (G_IS_TLS_CONNECTION (self->priv->io))
     {
@@ -0,0 +1,1245 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitsystemdunits.h"
+#include "cockpitdbusinternal.h"
+
+#include "common/cockpitjson.h"
+
+#include <string.h>
+
+/**
+ * CockpitSystemdUnits:
+ *
+ * A #CockpitChannel that sends a table of all systemd units and unit
+ * files, and then keeps it up to date by sending deltas.
+ *
+ * ListUnits only returns loaded units, and ListUnitFiles returns unit
+ * files by name only, some of which are aliases.  Matching them up
+ * needs the object path of every unit file that isn't loaded.  We do
+ * this here with a single ListUnitsByNames call, rather than with a
+ * LoadUnit/GetAll pair per unit file from javascript.
+ *
+ * The payload type for this channel is 'systemd-units'.
+ */
+
+#define COCKPIT_SYSTEMD_UNITS(o)    (G_TYPE_CHECK_INSTANCE_CAST ((o), COCKPIT_TYPE_SYSTEMD_UNITS, CockpitSystemdUnits))
+
+#define SYSTEMD_NAME            "org.freedesktop.systemd1"
+#define SYSTEMD_MANAGER_PATH    "/org/freedesktop/systemd1"
+#define SYSTEMD_MANAGER_IFACE   "org.freedesktop.systemd1.Manager"
+#define SYSTEMD_UNIT_IFACE      "org.freedesktop.systemd1.Unit"
+
+/* Changes are collected for this many milliseconds before being sent */
+#define BATCH_INTERVAL  100
+
+static const gchar *unit_fields[] = {
+  "id", "path", "description", "load-state", "active-state",
+  "sub-state", "following", "unit-file-state", "aliases", NULL
+};
+
+typedef struct {
+  gchar *key;
+  gchar *id;
+  gchar *path;
+  gchar *description;
+  gchar *load_state;
+  gchar *active_state;
+  gchar *sub_state;
+  gchar *following;
+  gchar *unit_file_state;
+  GPtrArray *aliases;
+} SystemdUnit;
+
+typedef struct _CockpitSystemdUnits CockpitSystemdUnits;
+
+typedef struct {
+  gint refs;
+  CockpitSystemdUnits *self;
+  GCancellable *cancellable;
+
+  /* Unit object path (or template name) -> SystemdUnit */
+  GHashTable *units;
+
+  /* Unit name or alias -> SystemdUnit, borrowed */
+  GHashTable *by_name;
+
+  /* Unit files that aren't templates, and their states */
+  GPtrArray *files;
+  GPtrArray *states;
+
+  /* Unit files that aren't loaded */
+  GPtrArray *unknown;
+  gint loading;
+} SystemdScan;
+
+struct _CockpitSystemdUnits {
+  CockpitChannel parent;
+  GDBusConnection *connection;
+  const gchar *name;
+  GCancellable *cancellable;
+  guint sig_properties;
+  guint sig_manager;
+
+  GHashTable *units;
+  GHashTable *by_name;
+
+  /* Unit key -> JsonNode row as it was last sent */
+  GHashTable *sent;
+  GHashTable *dirty;
+  gboolean primed;
+
+  SystemdScan *scan;
+  gboolean rescan;
+  guint batch_timeout;
+};
+
+typedef struct {
+  CockpitChannelClass parent_class;
+} CockpitSystemdUnitsClass;
+
+G_DEFINE_TYPE (CockpitSystemdUnits, cockpit_systemd_units, COCKPIT_TYPE_CHANNEL);
+
+static void   start_scan      (CockpitSystemdUnits *self);
+
+static void
+systemd_unit_free (gpointer data)
+{
+  SystemdUnit *unit = data;
+  g_free (unit->key);
+  g_free (unit->id);
+  g_free (unit->path);
+  g_free (unit->description);
+  g_free (unit->load_state);
+  g_free (unit->active_state);
+  g_free (unit->sub_state);
+  g_free (unit->following);
+  g_free (unit->unit_file_state);
+  g_ptr_array_unref (unit->aliases);
+  g_free (unit);
+}
+
+static GHashTable *
+systemd_units_table_new (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, NULL, systemd_unit_free);
+}
+
+static SystemdUnit *
+systemd_units_table_ensure (GHashTable *units,
+                            const gchar *key)
+{
+  SystemdUnit *unit;
+
+  unit = g_hash_table_lookup (units, key);
+  if (!unit)
+    {
+      unit = g_new0 (SystemdUnit, 1);
+      unit->key = g_strdup (key);
+      unit->aliases = g_ptr_array_new_with_free_func (g_free);
+      g_hash_table_insert (units, unit->key, unit);
+    }
+
+  return unit;
+}
+
+static gboolean
+unit_set (gchar **field,
+          const gchar *value)
+{
+  if (g_strcmp0 (*field, value) == 0)
+    return FALSE;
+
+  g_free (*field);
+  *field = g_strdup (value);
+  return TRUE;
+}
+
+static void
+unit_add_alias (SystemdUnit *unit,
+                const gchar *name)
+{
+  guint i;
+
+  for (i = 0; i < unit->aliases->len; i++)
+    {
+      if (g_str_equal (unit->aliases->pdata[i], name))
+        return;
+    }
+
+  g_ptr_array_add (unit->aliases, g_strdup (name));
+}
+
+static gboolean
+unit_update_from_properties (SystemdUnit *unit,
+                             GVariant *props)
+{
+  const gchar *value;
+  gboolean changed = FALSE;
+
+  if (g_variant_lookup (props, "Id", "&s", &value))
+    changed |= unit_set (&unit->id, value);
+  if (g_variant_lookup (props, "Description", "&s", &value))
+    changed |= unit_set (&unit->description, value);
+  if (g_variant_lookup (props, "LoadState", "&s", &value))
+    changed |= unit_set (&unit->load_state, value);
+  if (g_variant_lookup (props, "ActiveState", "&s", &value))
+    changed |= unit_set (&unit->active_state, value);
+  if (g_variant_lookup (props, "SubState", "&s", &value))
+    changed |= unit_set (&unit->sub_state, value);
+  if (g_variant_lookup (props, "Following", "&s", &value))
+    changed |= unit_set (&unit->following, value);
+
+  return changed;
+}
+
+static gboolean
+is_template (const gchar *name)
+{
+  const gchar *at = strchr (name, '@');
+  const gchar *dot = strrchr (name, '.');
+  return at && (at + 1 == dot || at[1] == '\0');
+}
+
+static void
+add_string_or_null (JsonArray *array,
+                    const gchar *value)
+{
+  if (value)
+    json_array_add_string_element (array, value);
+  else
+    json_array_add_null_element (array);
+}
+
+static gint
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (*(const gchar **)a, *(const gchar **)b);
+}
+
+static gint
+compare_units (gconstpointer a,
+               gconstpointer b)
+{
+  const SystemdUnit *ua = *(const SystemdUnit **)a;
+  const SystemdUnit *ub = *(const SystemdUnit **)b;
+  return g_strcmp0 (ua->id, ub->id);
+}
+
+static JsonNode *
+build_row (SystemdUnit *unit)
+{
+  JsonArray *row;
+  JsonArray *aliases;
+  JsonNode *node;
+  guint i;
+
+  g_ptr_array_sort (unit->aliases, compare_strings);
+  aliases = json_array_new ();
+  for (i = 0; i < unit->aliases->len; i++)
+    json_array_add_string_element (aliases, unit->aliases->pdata[i]);
+
+  /* Must match unit_fields above */
+  row = json_array_new ();
+  add_string_or_null (row, unit->id);
+  add_string_or_null (row, unit->path);
+  add_string_or_null (row, unit->description);
+  add_string_or_null (row, unit->load_state);
+  add_string_or_null (row, unit->active_state);
+  add_string_or_null (row, unit->sub_state);
+  add_string_or_null (row, unit->following);
+  add_string_or_null (row, unit->unit_file_state);
+  json_array_add_array_element (row, aliases);
+
+  node = json_node_new (JSON_NODE_ARRAY);
+  json_node_take_array (node, row);
+  return node;
+}
+
+static void
+send_object (CockpitSystemdUnits *self,
+             JsonObject *object)
+{
+  GBytes *bytes;
+
+  bytes = cockpit_json_write_bytes (object);
+  cockpit_channel_send (COCKPIT_CHANNEL (self), bytes, TRUE);
+  g_bytes_unref (bytes);
+}
+
+/*
+ * Compares the rows of all dirty units against what was sent last, and
+ * sends the ones that differ. The first time around this is the whole
+ * table, along with the field names.
+ */
+static void
+flush_changes (CockpitSystemdUnits *self)
+{
+  GHashTableIter iter;
+  GPtrArray *changed;
+  GPtrArray *removed;
+  JsonObject *object;
+  JsonArray *array;
+  SystemdUnit *unit;
+  JsonNode *previous;
+  JsonNode *row;
+  const gchar *key;
+  guint i;
+
+  if (!self->primed)
+    {
+      g_hash_table_iter_init (&iter, self->units);
+      while (g_hash_table_iter_next (&iter, (gpointer *)&key, NULL))
+        g_hash_table_add (self->dirty, g_strdup (key));
+    }
+
+  changed = g_ptr_array_new ();
+  removed = g_ptr_array_new_with_free_func (g_free);
+
+  g_hash_table_iter_init (&iter, self->dirty);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&key, NULL))
+    {
+      unit = g_hash_table_lookup (self->units, key);
+      previous = g_hash_table_lookup (self->sent, key);
+      if (!unit)
+        {
+          if (previous)
+            {
+              g_ptr_array_add (removed, g_strdup (json_array_get_string_element (json_node_get_array (previous), 0)));
+              g_hash_table_remove (self->sent, key);
+            }
+        }
+      else
+        {
+          row = build_row (unit);
+          if (previous && cockpit_json_equal (previous, row))
+            {
+              json_node_free (row);
+            }
+          else
+            {
+              g_hash_table_replace (self->sent, g_strdup (key), row);
+              g_ptr_array_add (changed, unit);
+            }
+        }
+    }
+
+  g_hash_table_remove_all (self->dirty);
+
+  if (self->primed && changed->len == 0 && removed->len == 0)
+    goto out;
+
+  g_ptr_array_sort (changed, compare_units);
+  g_ptr_array_sort (removed, compare_strings);
+
+  object = json_object_new ();
+
+  array = json_array_new ();
+  for (i = 0; i < changed->len; i++)
+    {
+      unit = changed->pdata[i];
+      json_array_add_element (array, json_node_copy (g_hash_table_lookup (self->sent, unit->key)));
+    }
+
+  if (!self->primed)
+    {
+      JsonArray *fields = json_array_new ();
+      for (i = 0; unit_fields[i] != NULL; i++)
+        json_array_add_string_element (fields, unit_fields[i]);
+      json_object_set_array_member (object, "fields", fields);
+      json_object_set_array_member (object, "units", array);
+      self->primed = TRUE;
+    }
+  else
+    {
+      json_object_set_array_member (object, "changed", array);
+      array = json_array_new ();
+      for (i = 0; i < removed->len; i++)
+        json_array_add_string_element (array, removed->pdata[i]);
+      json_object_set_array_member (object, "removed", array);
+    }
+
+  send_object (self, object);
+  json_object_unref (object);
+
+out:
+  g_ptr_array_unref (changed);
+  g_ptr_array_unref (removed);
+}
+
+static gboolean
+on_batch_timeout (gpointer user_data)
+{
+  CockpitSystemdUnits *self = COCKPIT_SYSTEMD_UNITS (user_data);
+
+  self->batch_timeout = 0;
+
+  if (self->rescan)
+    {
+      self->rescan = FALSE;
+      start_scan (self);
+    }
+  else
+    {
+      flush_changes (self);
+    }
+
+  return FALSE;
+}
+
+static void
+schedule_batch (CockpitSystemdUnits *self)
+{
+  if (!self->batch_timeout)
+    self->batch_timeout = g_timeout_add (BATCH_INTERVAL, on_batch_timeout, self);
+}
+
+static void
+mark_dirty (CockpitSystemdUnits *self,
+            SystemdUnit *unit)
+{
+  g_hash_table_add (self->dirty, g_strdup (unit->key));
+  if (self->primed)
+    schedule_batch (self);
+}
+
+static const gchar *
+error_to_problem (GError *error)
+{
+  gchar *remote;
+  const gchar *problem;
+
+  if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED))
+    return "access-denied";
+  if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) ||
+      g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER))
+    return "not-found";
+
+  problem = "internal-error";
+  remote = g_dbus_error_get_remote_error (error);
+  if (remote && g_str_equal (remote, "org.freedesktop.DBus.Error.AccessDenied"))
+    problem = "access-denied";
+  g_free (remote);
+  return problem;
+}
+
+static SystemdScan *
+scan_ref (SystemdScan *scan)
+{
+  scan->refs++;
+  return scan;
+}
+
+static void
+scan_unref (SystemdScan *scan)
+{
+  if (--scan->refs > 0)
+    return;
+
+  g_object_unref (scan->cancellable);
+  g_hash_table_unref (scan->units);
+  g_hash_table_unref (scan->by_name);
+  g_ptr_array_unref (scan->files);
+  g_ptr_array_unref (scan->states);
+  g_ptr_array_unref (scan->unknown);
+  g_free (scan);
+}
+
+/*
+ * The scan doesn't hold a reference on the channel. Instead the channel
+ * cancels the scan when it goes away, or when it starts another one.
+ * So as long as the scan isn't cancelled, scan->self is valid.
+ */
+static void
+scan_cancel (SystemdScan *scan)
+{
+  g_cancellable_cancel (scan->cancellable);
+  scan_unref (scan);
+}
+
+static void
+scan_call (SystemdScan *scan,
+           const gchar *path,
+           const gchar *interface,
+           const gchar *method,
+           GVariant *parameters,
+           const gchar *reply_type,
+           GAsyncReadyCallback callback,
+           gpointer user_data)
+{
+  g_dbus_connection_call (scan->self->connection, scan->self->name,
+                          path, interface, method, parameters,
+                          G_VARIANT_TYPE (reply_type), G_DBUS_CALL_FLAGS_NONE,
+                          -1, scan->cancellable, callback, user_data);
+}
+
+static void
+scan_failed (SystemdScan *scan,
+             const gchar *method,
+             GError *error)
+{
+  CockpitSystemdUnits *self = scan->self;
+
+  if (!self->primed)
+    {
+      cockpit_channel_fail (COCKPIT_CHANNEL (self), error_to_problem (error),
+                            "couldn't list systemd units: %s: %s", method, error->message);
+    }
+  else
+    {
+      g_message ("couldn't list systemd units: %s: %s", method, error->message);
+    }
+
+  if (self->scan == scan)
+    {
+      self->scan = NULL;
+      scan_cancel (scan);
+    }
+}
+
+static SystemdUnit *
+scan_unit_info (SystemdScan *scan,
+                GVariant *info)
+{
+  SystemdUnit *unit;
+  const gchar *id;
+  const gchar *description;
+  const gchar *load_state;
+  const gchar *active_state;
+  const gchar *sub_state;
+  const gchar *following;
+  const gchar *path;
+
+  g_variant_get (info, "(&s&s&s&s&s&s&ou&s&o)", &id, &description, &load_state,
+                 &active_state, &sub_state, &following, &path, NULL, NULL, NULL);
+
+  unit = systemd_units_table_ensure (scan->units, path);
+  unit_set (&unit->id, id);
+  unit_set (&unit->path, path);
+  unit_set (&unit->description, description);
+  unit_set (&unit->load_state, load_state);
+  unit_set (&unit->active_state, active_state);
+  unit_set (&unit->sub_state, sub_state);
+  unit_set (&unit->following, following);
+
+  g_hash_table_replace (scan->by_name, g_strdup (id), unit);
+  return unit;
+}
+
+static void
+scan_complete (SystemdScan *scan)
+{
+  CockpitSystemdUnits *self = scan->self;
+  GHashTableIter iter;
+  SystemdUnit *unit;
+  const gchar *name;
+  const gchar *key;
+  guint i;
+
+  /*
+   * The unit file state of an alias is always the same as the one of
+   * its primary unit file, so only take it from the primary.
+   */
+  for (i = 0; i < scan->files->len; i++)
+    {
+      name = scan->files->pdata[i];
+      unit = g_hash_table_lookup (scan->by_name, name);
+      if (!unit)
+        continue;
+      if (g_strcmp0 (unit->id, name) == 0)
+        unit_set (&unit->unit_file_state, scan->states->pdata[i]);
+      else
+        unit_add_alias (unit, name);
+    }
+
+  g_hash_table_iter_init (&iter, self->units);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&key, NULL))
+    g_hash_table_add (self->dirty, g_strdup (key));
+  g_hash_table_iter_init (&iter, scan->units);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&key, NULL))
+    g_hash_table_add (self->dirty, g_strdup (key));
+
+  g_hash_table_unref (self->by_name);
+  self->by_name = g_hash_table_ref (scan->by_name);
+  g_hash_table_unref (self->units);
+  self->units = g_hash_table_ref (scan->units);
+
+  g_assert (self->scan == scan);
+  self->scan = NULL;
+  scan_unref (scan);
+
+  if (self->batch_timeout && !self->rescan)
+    {
+      g_source_remove (self->batch_timeout);
+      self->batch_timeout = 0;
+    }
+
+  flush_changes (self);
+}
+
+typedef struct {
+  SystemdScan *scan;
+  gchar *name;
+  gchar *path;
+} LoadUnit;
+
+static void
+load_unit_free (LoadUnit *load)
+{
+  SystemdScan *scan = load->scan;
+
+  if (--scan->loading == 0 && !g_cancellable_is_cancelled (scan->cancellable))
+    scan_complete (scan);
+
+  scan_unref (scan);
+  g_free (load->name);
+  g_free (load->path);
+  g_free (load);
+}
+
+static void
+on_unit_properties (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+  LoadUnit *load = user_data;
+  SystemdScan *scan = load->scan;
+  SystemdUnit *unit;
+  GError *error = NULL;
+  GVariant *retval;
+  GVariant *props;
+
+  retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (retval && !g_cancellable_is_cancelled (scan->cancellable))
+    {
+      unit = systemd_units_table_ensure (scan->units, load->path);
+      unit_set (&unit->path, load->path);
+      props = g_variant_get_child_value (retval, 0);
+      unit_update_from_properties (unit, props);
+      g_variant_unref (props);
+
+      g_hash_table_replace (scan->by_name, g_strdup (load->name), unit);
+      if (unit->id)
+        g_hash_table_replace (scan->by_name, g_strdup (unit->id), unit);
+    }
+  else if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      g_debug ("couldn't get properties of %s: %s", load->name, error->message);
+    }
+
+  g_clear_error (&error);
+  if (retval)
+    g_variant_unref (retval);
+  load_unit_free (load);
+}
+
+static void
+on_load_unit (GObject *source,
+              GAsyncResult *result,
+              gpointer user_data)
+{
+  LoadUnit *load = user_data;
+  SystemdScan *scan = load->scan;
+  GError *error = NULL;
+  GVariant *retval;
+
+  retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (retval && !g_cancellable_is_cancelled (scan->cancellable))
+    {
+      g_variant_get (retval, "(o)", &load->path);
+      scan_call (scan, load->path, "org.freedesktop.DBus.Properties", "GetAll",
+                 g_variant_new ("(s)", SYSTEMD_UNIT_IFACE), "(a{sv})",
+                 on_unit_properties, load);
+      load = NULL;
+    }
+  else if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      g_debug ("couldn't load unit %s: %s", load->name, error->message);
+    }
+
+  g_clear_error (&error);
+  if (retval)
+    g_variant_unref (retval);
+  if (load)
+    load_unit_free (load);
+}
+
+/*
+ * Older versions of systemd don't have ListUnitsByNames, and there
+ * we load each unit on its own, as the services page used to.
+ */
+static void
+scan_load_units (SystemdScan *scan)
+{
+  LoadUnit *load;
+  guint i;
+
+  scan->loading++;
+  for (i = 0; i < scan->unknown->len; i++)
+    {
+      load = g_new0 (LoadUnit, 1);
+      load->scan = scan_ref (scan);
+      load->name = g_strdup (scan->unknown->pdata[i]);
+      scan->loading++;
+      scan_call (scan, SYSTEMD_MANAGER_PATH, SYSTEMD_MANAGER_IFACE, "LoadUnit",
+                 g_variant_new ("(s)", load->name), "(o)", on_load_unit, load);
+    }
+
+  /* Drop the extra count, completes the scan if nothing was pending */
+  load = g_new0 (LoadUnit, 1);
+  load->scan = scan_ref (scan);
+  load_unit_free (load);
+}
+
+static void
+on_list_units_by_names (GObject *source,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+  SystemdScan *scan = user_data;
+  GError *error = NULL;
+  GVariant *retval;
+  GVariant *infos = NULL;
+  GVariant *info;
+  guint i;
+
+  retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (g_cancellable_is_cancelled (scan->cancellable))
+    goto out;
+
+  if (retval)
+    infos = g_variant_get_child_value (retval, 0);
+
+  /* One answer per name, in order, each describing the loaded unit */
+  if (!infos || g_variant_n_children (infos) != scan->unknown->len)
+    {
+      g_debug ("couldn't list units by names, loading them one by one: %s",
+               error ? error->message : "unexpected reply");
+      scan_load_units (scan);
+      goto out;
+    }
+
+  for (i = 0; i < scan->unknown->len; i++)
+    {
+      info = g_variant_get_child_value (infos, i);
+      g_hash_table_replace (scan->by_name, g_strdup (scan->unknown->pdata[i]),
+                            scan_unit_info (scan, info));
+      g_variant_unref (info);
+    }
+
+  scan_complete (scan);
+
+out:
+  g_clear_error (&error);
+  if (infos)
+    g_variant_unref (infos);
+  if (retval)
+    g_variant_unref (retval);
+  scan_unref (scan);
+}
+
+static void
+on_list_unit_files (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+  SystemdScan *scan = user_data;
+  GError *error = NULL;
+  GVariantIter *iter;
+  GVariant *retval;
+  GHashTable *seen;
+  SystemdUnit *unit;
+  const gchar *file;
+  const gchar *state;
+  const gchar *name;
+  guint i;
+
+  retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (g_cancellable_is_cancelled (scan->cancellable))
+    goto out;
+
+  if (!retval)
+    {
+      scan_failed (scan, "ListUnitFiles", error);
+      goto out;
+    }
+
+  g_variant_get (retval, "(a(ss))", &iter);
+  while (g_variant_iter_next (iter, "(&s&s)", &file, &state))
+    {
+      name = strrchr (file, '/');
+      name = name ? name + 1 : file;
+
+      if (is_template (name))
+        {
+          unit = systemd_units_table_ensure (scan->units, name);
+          unit_set (&unit->id, name);
+          unit_set (&unit->unit_file_state, state);
+          g_hash_table_replace (scan->by_name, g_strdup (name), unit);
+        }
+      else
+        {
+          g_ptr_array_add (scan->files, g_strdup (name));
+          g_ptr_array_add (scan->states, g_strdup (state));
+        }
+    }
+  g_variant_iter_free (iter);
+
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < scan->files->len; i++)
+    {
+      name = scan->files->pdata[i];
+      if (!g_hash_table_contains (scan->by_name, name) && g_hash_table_add (seen, (gpointer)name))
+        g_ptr_array_add (scan->unknown, g_strdup (name));
+    }
+  g_hash_table_unref (seen);
+
+  if (scan->unknown->len == 0)
+    {
+      scan_complete (scan);
+    }
+  else
+    {
+      GVariantBuilder names;
+
+      g_variant_builder_init (&names, G_VARIANT_TYPE_STRING_ARRAY);
+      for (i = 0; i < scan->unknown->len; i++)
+        g_variant_builder_add (&names, "s", scan->unknown->pdata[i]);
+
+      scan_call (scan, SYSTEMD_MANAGER_PATH, SYSTEMD_MANAGER_IFACE, "ListUnitsByNames",
+                 g_variant_new ("(as)", &names), "(a(ssssssouso))",
+                 on_list_units_by_names, scan_ref (scan));
+    }
+
+out:
+  g_clear_error (&error);
+  if (retval)
+    g_variant_unref (retval);
+  scan_unref (scan);
+}
+
+static void
+on_list_units (GObject *source,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+  SystemdScan *scan = user_data;
+  GError *error = NULL;
+  GVariant *retval;
+  GVariant *infos;
+  GVariant *info;
+  GVariantIter iter;
+
+  retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (g_cancellable_is_cancelled (scan->cancellable))
+    goto out;
+
+  if (!retval)
+    {
+      scan_failed (scan, "ListUnits", error);
+      goto out;
+    }
+
+  infos = g_variant_get_child_value (retval, 0);
+  g_variant_iter_init (&iter, infos);
+  while ((info = g_variant_iter_next_value (&iter)))
+    {
+      scan_unit_info (scan, info);
+      g_variant_unref (info);
+    }
+  g_variant_unref (infos);
+
+  scan_call (scan, SYSTEMD_MANAGER_PATH, SYSTEMD_MANAGER_IFACE, "ListUnitFiles",
+             NULL, "(a(ss))", on_list_unit_files, scan_ref (scan));
+
+out:
+  g_clear_error (&error);
+  if (retval)
+    g_variant_unref (retval);
+  scan_unref (scan);
+}
+
+static void
+start_scan (CockpitSystemdUnits *self)
+{
+  SystemdScan *scan;
+
+  if (self->scan)
+    scan_cancel (self->scan);
+
+  scan = g_new0 (SystemdScan, 1);
+  scan->refs = 1;
+  scan->self = self;
+  scan->cancellable = g_cancellable_new ();
+  scan->units = systemd_units_table_new ();
+  scan->by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  scan->files = g_ptr_array_new_with_free_func (g_free);
+  scan->states = g_ptr_array_new_with_free_func (g_free);
+  scan->unknown = g_ptr_array_new_with_free_func (g_free);
+  self->scan = scan;
+
+  scan_call (scan, SYSTEMD_MANAGER_PATH, SYSTEMD_MANAGER_IFACE, "ListUnits",
+             NULL, "(a(ssssssouso))", on_list_units, scan_ref (scan));
+}
+
+typedef struct {
+  CockpitSystemdUnits *self;
+  gchar *path;
+} RefreshUnit;
+
+static void
+on_refresh_properties (GObject *source,
+                       GAsyncResult *result,
+                       gpointer user_data)
+{
+  RefreshUnit *refresh = user_data;
+  CockpitSystemdUnits *self = refresh->self;
+  SystemdUnit *unit;
+  GError *error = NULL;
+  GVariant *retval;
+  GVariant *props;
+
+  retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (retval)
+    {
+      props = g_variant_get_child_value (retval, 0);
+      unit = g_hash_table_lookup (self->units, refresh->path);
+      if (unit && unit_update_from_properties (unit, props))
+        mark_dirty (self, unit);
+      g_variant_unref (props);
+      g_variant_unref (retval);
+    }
+  else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      g_debug ("couldn't refresh properties of %s: %s", refresh->path, error->message);
+    }
+
+  g_clear_error (&error);
+  g_object_unref (refresh->self);
+  g_free (refresh->path);
+  g_free (refresh);
+}
+
+static void
+refresh_properties (CockpitSystemdUnits *self,
+                    const gchar *path)
+{
+  RefreshUnit *refresh;
+
+  refresh = g_new0 (RefreshUnit, 1);
+  refresh->self = g_object_ref (self);
+  refresh->path = g_strdup (path);
+
+  g_dbus_connection_call (self->connection, self->name, path,
+                          "org.freedesktop.DBus.Properties", "GetAll",
+                          g_variant_new ("(s)", SYSTEMD_UNIT_IFACE),
+                          G_VARIANT_TYPE ("(a{sv})"), G_DBUS_CALL_FLAGS_NONE,
+                          -1, self->cancellable, on_refresh_properties, refresh);
+}
+
+static void
+on_properties_changed (GDBusConnection *connection,
+                       const gchar *sender,
+                       const gchar *path,
+                       const gchar *interface,
+                       const gchar *member,
+                       GVariant *parameters,
+                       gpointer user_data)
+{
+  CockpitSystemdUnits *self = COCKPIT_SYSTEMD_UNITS (user_data);
+  GVariant *changed = NULL;
+  const gchar **invalidated = NULL;
+  SystemdUnit *unit;
+
+  if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+    return;
+
+  g_variant_get (parameters, "(&s@a{sv}^a&s)", NULL, &changed, &invalidated);
+
+  /* Also update a scan in progress, its answers may already be stale */
+  if (self->scan)
+    {
+      unit = g_hash_table_lookup (self->scan->units, path);
+      if (unit)
+        unit_update_from_properties (unit, changed);
+    }
+
+  unit = g_hash_table_lookup (self->units, path);
+  if (unit)
+    {
+      if (unit_update_from_properties (unit, changed))
+        mark_dirty (self, unit);
+      if (invalidated && invalidated[0])
+        refresh_properties (self, path);
+    }
+
+  g_variant_unref (changed);
+  g_free (invalidated);
+}
+
+static void
+on_manager_signal (GDBusConnection *connection,
+                   const gchar *sender,
+                   const gchar *path,
+                   const gchar *interface,
+                   const gchar *member,
+                   GVariant *parameters,
+                   gpointer user_data)
+{
+  CockpitSystemdUnits *self = COCKPIT_SYSTEMD_UNITS (user_data);
+  SystemdUnit *unit;
+  const gchar *id;
+  gboolean reloading;
+
+  if (g_str_equal (member, "UnitFilesChanged"))
+    {
+      self->rescan = TRUE;
+      schedule_batch (self);
+    }
+  else if (g_str_equal (member, "Reloading"))
+    {
+      /* A reload doesn't send PropertiesChanged for what it changed */
+      if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(b)")))
+        {
+          g_variant_get (parameters, "(b)", &reloading);
+          if (!reloading)
+            {
+              self->rescan = TRUE;
+              schedule_batch (self);
+            }
+        }
+    }
+  else if (g_str_equal (member, "JobNew") || g_str_equal (member, "JobRemoved"))
+    {
+      if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(uos)")) ||
+          g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(uoss)")))
+        {
+          g_variant_get_child (parameters, 2, "&s", &id);
+          unit = g_hash_table_lookup (self->by_name, id);
+          if (unit && unit->path)
+            refresh_properties (self, unit->path);
+        }
+    }
+}
+
+static void
+on_subscribe (GObject *source,
+              GAsyncResult *result,
+              gpointer user_data)
+{
+  GError *error = NULL;
+  GVariant *retval;
+
+  /* Another client on the same connection may have subscribed already */
+  retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (retval)
+    g_variant_unref (retval);
+  else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    g_debug ("couldn't subscribe to systemd signals: %s", error->message);
+  g_clear_error (&error);
+}
+
+static void
+process_connection (CockpitSystemdUnits *self)
+{
+  self->sig_properties = g_dbus_connection_signal_subscribe (self->connection, self->name,
+                                                             "org.freedesktop.DBus.Properties",
+                                                             "PropertiesChanged", NULL,
+                                                             SYSTEMD_UNIT_IFACE,
+                                                             G_DBUS_SIGNAL_FLAGS_NONE,
+                                                             on_properties_changed, self, NULL);
+  self->sig_manager = g_dbus_connection_signal_subscribe (self->connection, self->name,
+                                                          SYSTEMD_MANAGER_IFACE, NULL,
+                                                          SYSTEMD_MANAGER_PATH, NULL,
+                                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                                          on_manager_signal, self, NULL);
+
+  g_dbus_connection_call (self->connection, self->name, SYSTEMD_MANAGER_PATH,
+                          SYSTEMD_MANAGER_IFACE, "Subscribe", NULL, NULL,
+                          G_DBUS_CALL_FLAGS_NONE, -1, self->cancellable,
+                          on_subscribe, NULL);
+
+  cockpit_channel_ready (COCKPIT_CHANNEL (self), NULL);
+  start_scan (self);
+}
+
+static void
+on_bus_ready (GObject *source,
+              GAsyncResult *result,
+              gpointer user_data)
+{
+  CockpitSystemdUnits *self = COCKPIT_SYSTEMD_UNITS (user_data);
+  GError *error = NULL;
+
+  self->connection = g_bus_get_finish (result, &error);
+  if (g_cancellable_is_cancelled (self->cancellable))
+    {
+      g_debug ("channel closed before connecting to bus");
+    }
+  else if (self->connection)
+    {
+      process_connection (self);
+    }
+  else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      cockpit_channel_fail (COCKPIT_CHANNEL (self), "internal-error",
+                            "couldn't connect to bus: %s", error->message);
+    }
+
+  g_clear_error (&error);
+  g_object_unref (self);
+}
+
+static void
+cockpit_systemd_units_recv (CockpitChannel *channel,
+                            GBytes *message)
+{
+  cockpit_channel_fail (channel, "protocol-error", "Received unexpected message in systemd-units channel");
+}
+
+static void
+cockpit_systemd_units_init (CockpitSystemdUnits *self)
+{
+  self->units = systemd_units_table_new ();
+  self->by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->sent = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)json_node_free);
+  self->dirty = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->cancellable = g_cancellable_new ();
+}
+
+static void
+cockpit_systemd_units_prepare (CockpitChannel *channel)
+{
+  CockpitSystemdUnits *self = COCKPIT_SYSTEMD_UNITS (channel);
+  GBusType bus_type = G_BUS_TYPE_SYSTEM;
+  gboolean internal = FALSE;
+  JsonObject *options;
+  const gchar *bus;
+
+  COCKPIT_CHANNEL_CLASS (cockpit_systemd_units_parent_class)->prepare (channel);
+
+  options = cockpit_channel_get_options (channel);
+  if (!cockpit_json_get_string (options, "bus", NULL, &bus))
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"bus\" option for systemd-units channel");
+      return;
+    }
+
+  if (bus == NULL || g_str_equal (bus, "system"))
+    bus_type = G_BUS_TYPE_SYSTEM;
+  else if (g_str_equal (bus, "session") || g_str_equal (bus, "user"))
+    bus_type = G_BUS_TYPE_SESSION;
+  else if (g_str_equal (bus, "internal"))
+    internal = TRUE;
+  else
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"bus\" option for systemd-units channel: %s", bus);
+      return;
+    }
+
+  if (!cockpit_json_get_string (options, "name", internal ? NULL : SYSTEMD_NAME, &self->name) ||
+      (self->name && !g_dbus_is_name (self->name)))
+    {
+      cockpit_channel_fail (channel, "protocol-error", "invalid \"name\" option for systemd-units channel");
+      return;
+    }
+
+  if (internal)
+    {
+      self->connection = cockpit_dbus_internal_client ();
+      if (self->connection == NULL)
+        {
+          cockpit_channel_fail (channel, "internal-error", "no internal DBus connection");
+          return;
+        }
+      process_connection (self);
+    }
+  else
+    {
+      g_bus_get (bus_type, self->cancellable, on_bus_ready, g_object_ref (self));
+    }
+}
+
+static void
+stop_watching (CockpitSystemdUnits *self)
+{
+  g_cancellable_cancel (self->cancellable);
+
+  if (self->scan)
+    scan_cancel (self->scan);
+  self->scan = NULL;
+
+  if (self->batch_timeout)
+    g_source_remove (self->batch_timeout);
+  self->batch_timeout = 0;
+
+  if (self->sig_properties)
+    g_dbus_connection_signal_unsubscribe (self->connection, self->sig_properties);
+  self->sig_properties = 0;
+  if (self->sig_manager)
+    g_dbus_connection_signal_unsubscribe (self->connection, self->sig_manager);
+  self->sig_manager = 0;
+}
+
+static void
+cockpit_systemd_units_close (CockpitChannel *channel,
+                             const gchar *problem)
+{
+  stop_watching (COCKPIT_SYSTEMD_UNITS (channel));
+  COCKPIT_CHANNEL_CLASS (cockpit_systemd_units_parent_class)->close (channel, problem);
+}
+
+static void
+cockpit_systemd_units_dispose (GObject *object)
+{
+  stop_watching (COCKPIT_SYSTEMD_UNITS (object));
+  G_OBJECT_CLASS (cockpit_systemd_units_parent_class)->dispose (object);
+}
+
+static void
+cockpit_systemd_units_finalize (GObject *object)
+{
+  CockpitSystemdUnits *self = COCKPIT_SYSTEMD_UNITS (object);
+
+  g_hash_table_unref (self->units);
+  g_hash_table_unref (self->by_name);
+  g_hash_table_unref (self->sent);
+  g_hash_table_unref (self->dirty);
+  g_clear_object (&self->cancellable);
+  g_clear_object (&self->connection);
+
+  G_OBJECT_CLASS (cockpit_systemd_units_parent_class)->finalize (object);
+}
+
+static void
+cockpit_systemd_units_class_init (CockpitSystemdUnitsClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  CockpitChannelClass *channel_class = COCKPIT_CHANNEL_CLASS (klass);
+
+  gobject_class->dispose = cockpit_systemd_units_dispose;
+  gobject_class->finalize = cockpit_systemd_units_finalize;
+
+  channel_class->prepare = cockpit_systemd_units_prepare;
+  channel_class->recv = cockpit_systemd_units_recv;
+  channel_class->close = cockpit_systemd_units_close;
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpittlscachesamples.h"
+
+/*
+ * The TLS credential cache in cockpitconnect.c updates these
+ * counters in place.
+ */
+
+static CockpitTlsCacheStats tls_cache_stats;
+
+/**
+ * cockpit_tls_cache_stats:
+ *
+ * Returns: (transfer none): The bridge wide TLS credential counters
+ */
+CockpitTlsCacheStats *
+cockpit_tls_cache_stats (void)
+{
+  return &tls_cache_stats;
+}
+
+void
+cockpit_tls_cache_samples (CockpitSamples *samples)
+{
+  cockpit_samples_sample (samples, "tls.cache.entries", NULL, tls_cache_stats.entries);
+  cockpit_samples_sample (samples, "tls.cache.hits", NULL, tls_cache_stats.hits);
+  cockpit_samples_sample (samples, "tls.cache.misses", NULL, tls_cache_stats.misses);
+  cockpit_samples_sample (samples, "tls.connections", NULL, tls_cache_stats.connections);
+}
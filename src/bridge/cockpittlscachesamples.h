@@ -0,0 +1,40 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COCKPIT_TLS_CACHE_SAMPLES_H__
+#define COCKPIT_TLS_CACHE_SAMPLES_H__
+
+#include "cockpitsamples.h"
+
+G_BEGIN_DECLS
+
+typedef struct {
+  gint64 entries;
+  gint64 hits;
+  gint64 misses;
+  gint64 connections;
+} CockpitTlsCacheStats;
+
+CockpitTlsCacheStats *  cockpit_tls_cache_stats      (void);
+
+void                    cockpit_tls_cache_samples    (CockpitSamples *samples);
+
+G_END_DECLS
+
+#endif /* COCKPIT_TLS_CACHE_SAMPLES_H__ */
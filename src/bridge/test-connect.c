@@ -20,6 +20,9 @@
 #include "config.h"
 
 #include "cockpitconnect.h"
+#include "cockpitdnscache.h"
+#include "cockpitdnscachesamples.h"
+#include "cockpittlscachesamples.h"
 
 #include "common/cockpitloopback.h"
 #include "common/cockpittest.h"
@@ -287,6 +290,159 @@ test_connect_loopback (TestConnect *tc,
   g_object_unref (io);
 }
 
+static void
+test_connect_hostname (TestConnect *tc,
+                       gconstpointer user_data)
+{
+  GSocketConnectable *address;
+  GAsyncResult *result = NULL;
+  GError *error = NULL;
+  GIOStream *io;
+
+  /*
+   * Only listening on IPv4. When localhost resolves to ::1 first
+   * that attempt is refused, and the next family is tried.
+   */
+  address = g_network_address_new ("localhost", tc->port);
+  cockpit_connect_stream (address, NULL, on_ready_get_result, &result);
+  g_object_unref (address);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  io = cockpit_connect_stream_finish (result, &error);
+  g_assert_no_error (error);
+  g_object_unref (result);
+  g_assert (io != NULL);
+
+  while (tc->conn_sock == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_object_unref (io);
+}
+
+static GList *
+dns_lookup_and_wait (const gchar *hostname,
+                     GError **error)
+{
+  GAsyncResult *result = NULL;
+  GList *addresses;
+
+  cockpit_dns_cache_lookup_async (hostname, NULL, on_ready_get_result, &result);
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  addresses = cockpit_dns_cache_lookup_finish (result, error);
+  g_object_unref (result);
+  return addresses;
+}
+
+static void
+test_dns_cache (void)
+{
+  CockpitDnsCacheStats *stats = cockpit_dns_cache_stats ();
+  GError *error = NULL;
+  GList *addresses;
+  gint64 hits;
+  gint64 misses;
+
+  cockpit_dns_cache_flush ();
+  hits = stats->hits;
+  misses = stats->misses;
+
+  addresses = dns_lookup_and_wait ("localhost", &error);
+  g_assert_no_error (error);
+  g_assert (addresses != NULL);
+  g_resolver_free_addresses (addresses);
+  g_assert_cmpint (stats->misses, ==, misses + 1);
+  g_assert_cmpint (stats->hits, ==, hits);
+
+  addresses = dns_lookup_and_wait ("localhost", &error);
+  g_assert_no_error (error);
+  g_assert (addresses != NULL);
+  g_resolver_free_addresses (addresses);
+  g_assert_cmpint (stats->misses, ==, misses + 1);
+  g_assert_cmpint (stats->hits, ==, hits + 1);
+
+  addresses = cockpit_dns_cache_lookup ("localhost", NULL, &error);
+  g_assert_no_error (error);
+  g_assert (addresses != NULL);
+  g_resolver_free_addresses (addresses);
+  g_assert_cmpint (stats->misses, ==, misses + 1);
+  g_assert_cmpint (stats->hits, ==, hits + 2);
+
+  /* Literals never go near the cache */
+  addresses = dns_lookup_and_wait ("127.0.0.1", &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_length (addresses), ==, 1);
+  g_resolver_free_addresses (addresses);
+  g_assert_cmpint (stats->misses, ==, misses + 1);
+  g_assert_cmpint (stats->hits, ==, hits + 2);
+}
+
+static void
+test_dns_cache_negative (void)
+{
+  CockpitDnsCacheStats *stats = cockpit_dns_cache_stats ();
+  GError *error = NULL;
+  GList *addresses;
+  gint64 negative_hits;
+  gint64 misses;
+
+  cockpit_dns_cache_flush ();
+  negative_hits = stats->negative_hits;
+  misses = stats->misses;
+
+  /* The .invalid domain is guaranteed never to resolve */
+  addresses = dns_lookup_and_wait ("cockpit.invalid", &error);
+  g_assert (addresses == NULL);
+  g_assert (error != NULL);
+  g_clear_error (&error);
+  g_assert_cmpint (stats->misses, ==, misses + 1);
+
+  addresses = dns_lookup_and_wait ("cockpit.invalid", &error);
+  g_assert (addresses == NULL);
+  g_assert (error != NULL);
+  g_clear_error (&error);
+  g_assert_cmpint (stats->misses, ==, misses + 1);
+  g_assert_cmpint (stats->negative_hits, ==, negative_hits + 1);
+}
+
+static void
+test_dns_cache_concurrent (void)
+{
+  CockpitDnsCacheStats *stats = cockpit_dns_cache_stats ();
+  GAsyncResult *one = NULL;
+  GAsyncResult *two = NULL;
+  GList *addresses;
+  GError *error = NULL;
+  gint64 misses;
+
+  cockpit_dns_cache_flush ();
+  misses = stats->misses;
+
+  /* Both wait on the same lookup */
+  cockpit_dns_cache_lookup_async ("localhost", NULL, on_ready_get_result, &one);
+  cockpit_dns_cache_lookup_async ("localhost", NULL, on_ready_get_result, &two);
+  while (one == NULL || two == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  addresses = cockpit_dns_cache_lookup_finish (one, &error);
+  g_assert_no_error (error);
+  g_assert (addresses != NULL);
+  g_resolver_free_addresses (addresses);
+
+  addresses = cockpit_dns_cache_lookup_finish (two, &error);
+  g_assert_no_error (error);
+  g_assert (addresses != NULL);
+  g_resolver_free_addresses (addresses);
+
+  g_object_unref (one);
+  g_object_unref (two);
+
+  g_assert_cmpint (stats->misses, ==, misses + 2);
+  g_assert_cmpint (stats->entries, ==, 1);
+}
+
 static void
 test_fail_not_found (void)
 {
@@ -422,6 +578,22 @@ test_internal_null_registered (void)
   cockpit_connect_remove_internal_address ("test");
 }
 
+static GSocketAddress *
+parse_address (CockpitChannel *channel,
+               gchar **name)
+{
+  GAsyncResult *result = NULL;
+  GSocketAddress *address;
+
+  cockpit_connect_parse_address_async (channel, NULL, on_ready_get_result, &result);
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  address = cockpit_connect_parse_address_finish (channel, result, name);
+  g_object_unref (result);
+  return address;
+}
+
 static void
 test_parse_port (void)
 {
@@ -449,7 +621,7 @@ test_parse_port (void)
   connectable = cockpit_connect_parse_stream (channel);
   g_assert (connectable != NULL);
 
-  address = cockpit_connect_parse_address (channel, &name);
+  address = parse_address (channel, &name);
 
   g_assert (g_socket_address_get_family (address) == G_SOCKET_FAMILY_IPV4);
   g_assert_cmpint (g_inet_socket_address_get_port ((GInetSocketAddress *)address),
@@ -496,7 +668,7 @@ test_parse_address (void)
   connectable = cockpit_connect_parse_stream (channel);
   g_assert (connectable != NULL);
 
-  address = cockpit_connect_parse_address (channel, &name);
+  address = parse_address (channel, &name);
 
   g_assert (g_socket_address_get_family (address) == G_SOCKET_FAMILY_IPV4);
   g_assert_cmpint (g_inet_socket_address_get_port ((GInetSocketAddress *)address),
@@ -515,6 +687,124 @@ test_parse_address (void)
   cockpit_assert_expected ();
 }
 
+static void
+test_parse_hostname (void)
+{
+  JsonObject *options;
+  MockTransport *transport;
+  CockpitChannel *channel;
+  GSocketAddress *address;
+  GInetAddress *got_ip; // owned by address
+  gchar *name = NULL;
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "address", "localhost");
+  json_object_set_int_member (options, "port", 8090);
+  transport = g_object_new (mock_transport_get_type (), NULL);
+
+  channel = g_object_new (mock_echo_channel_get_type (),
+                          "transport", transport,
+                          "id", "55",
+                          "options", options,
+                          NULL);
+  json_object_unref (options);
+
+  /* Looked up without blocking the main loop */
+  address = parse_address (channel, &name);
+  g_assert (address != NULL);
+  g_assert_cmpstr (name, ==, "localhost:8090");
+  g_assert_cmpint (g_inet_socket_address_get_port ((GInetSocketAddress *)address),
+                   ==, 8090);
+  got_ip = g_inet_socket_address_get_address ((GInetSocketAddress *)address);
+  g_assert (g_inet_address_get_is_loopback (got_ip));
+
+  g_object_unref (channel);
+  g_object_unref (transport);
+  g_object_unref (address);
+  g_free (name);
+  cockpit_assert_expected ();
+}
+
+static CockpitConnectable *
+parse_tls_stream (MockTransport *transport,
+                  const gchar *tls)
+{
+  CockpitConnectable *connectable;
+  CockpitChannel *channel;
+  JsonObject *options;
+  GError *error = NULL;
+
+  options = json_object_new ();
+  json_object_set_int_member (options, "port", 8090);
+  json_object_set_object_member (options, "tls", cockpit_json_parse_object (tls, -1, &error));
+  g_assert_no_error (error);
+
+  channel = g_object_new (mock_echo_channel_get_type (),
+                          "transport", transport,
+                          "id", "55",
+                          "options", options,
+                          NULL);
+  json_object_unref (options);
+
+  connectable = cockpit_connect_parse_stream (channel);
+  g_object_unref (channel);
+  return connectable;
+}
+
+static void
+test_parse_tls_cached (void)
+{
+  CockpitTlsCacheStats *stats = cockpit_tls_cache_stats ();
+  CockpitConnectable *one;
+  CockpitConnectable *two;
+  CockpitConnectable *three;
+  MockTransport *transport;
+  gint64 hits;
+  gint64 misses;
+
+  static const gchar client_tls[] =
+    "{ \"certificate\": { \"file\": \"" SRCDIR "/src/bridge/mock-client.crt\" },"
+    "  \"key\": { \"file\": \"" SRCDIR "/src/bridge/mock-client.key\" } }";
+  static const gchar server_tls[] =
+    "{ \"authority\": { \"file\": \"" SRCDIR "/src/bridge/mock-server.crt\" } }";
+
+  transport = g_object_new (mock_transport_get_type (), NULL);
+  hits = stats->hits;
+  misses = stats->misses;
+
+  one = parse_tls_stream (transport, client_tls);
+  g_assert (one != NULL);
+  g_assert (one->tls_cert != NULL);
+  g_assert_cmpint (stats->misses, ==, misses + 1);
+
+  /* The same options share the parsed certificate */
+  two = parse_tls_stream (transport, client_tls);
+  g_assert (two != NULL);
+  g_assert (two->tls_cert == one->tls_cert);
+  g_assert_cmpint (stats->hits, ==, hits + 1);
+
+  three = parse_tls_stream (transport, server_tls);
+  g_assert (three != NULL);
+  g_assert (three->tls_cert == NULL);
+  g_assert (three->tls_database != NULL);
+  g_assert_cmpint (stats->misses, ==, misses + 2);
+
+  cockpit_connectable_unref (one);
+  cockpit_connectable_unref (two);
+  cockpit_connectable_unref (three);
+
+  /* Plain TLS has nothing to cache */
+  one = parse_tls_stream (transport, "{ }");
+  g_assert (one != NULL);
+  g_assert (one->tls);
+  g_assert_cmpint (stats->hits, ==, hits + 1);
+  g_assert_cmpint (stats->misses, ==, misses + 2);
+  cockpit_connectable_unref (one);
+
+  g_object_unref (transport);
+  cockpit_assert_expected ();
+}
+
 int
 main (int argc,
       char *argv[])
@@ -530,6 +820,13 @@ main (int argc,
   g_test_add ("/connect/loopback-ipv6", TestConnect, GINT_TO_POINTER (G_SOCKET_FAMILY_IPV6),
               setup_connect, test_connect_loopback, teardown_connect);
 
+  g_test_add ("/connect/hostname", TestConnect, NULL,
+              setup_connect, test_connect_hostname, teardown_connect);
+
+  g_test_add_func ("/connect/dns-cache", test_dns_cache);
+  g_test_add_func ("/connect/dns-cache-negative", test_dns_cache_negative);
+  g_test_add_func ("/connect/dns-cache-concurrent", test_dns_cache_concurrent);
+
   g_test_add_func ("/connect/not-found", test_fail_not_found);
   g_test_add_func ("/connect/access-denied", test_fail_access_denied);
 
@@ -540,6 +837,8 @@ main (int argc,
 
   g_test_add_func ("/channel/parse-port", test_parse_port);
   g_test_add_func ("/channel/parse-address", test_parse_address);
+  g_test_add_func ("/channel/parse-hostname", test_parse_hostname);
+  g_test_add_func ("/channel/parse-tls-cached", test_parse_tls_cached);
 
   return g_test_run ();
 }
@@ -0,0 +1,250 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitdbusgeneration.h"
+
+#include "common/cockpittest.h"
+
+#include <string.h>
+
+/* Builds an update for a single path and interface, NULL props means removed */
+static GHashTable *
+build_update (GHashTable *update,
+              const gchar *path,
+              const gchar *interface,
+              const gchar *property,
+              GVariant *value)
+{
+  GHashTable *interfaces;
+  GHashTable *properties = NULL;
+
+  if (!update)
+    {
+      update = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                      (GDestroyNotify)g_hash_table_unref);
+    }
+
+  interfaces = g_hash_table_lookup (update, path);
+  if (!interfaces)
+    {
+      interfaces = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify)g_hash_table_unref);
+      g_hash_table_insert (update, (gchar *)path, interfaces);
+    }
+
+  if (property)
+    {
+      properties = g_hash_table_lookup (interfaces, interface);
+      if (!properties)
+        {
+          properties = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                              (GDestroyNotify)g_variant_unref);
+          g_hash_table_insert (interfaces, (gchar *)interface, properties);
+        }
+      g_hash_table_replace (properties, (gchar *)property, g_variant_ref_sink (value));
+    }
+  else
+    {
+      g_hash_table_insert (interfaces, (gchar *)interface, NULL);
+    }
+
+  return update;
+}
+
+static GHashTable *
+lookup_properties (GHashTable *result,
+                   const gchar *path,
+                   const gchar *interface,
+                   gboolean *present)
+{
+  GHashTable *interfaces;
+  gpointer value = NULL;
+
+  *present = FALSE;
+  g_assert (result != NULL);
+
+  interfaces = g_hash_table_lookup (result, path);
+  if (interfaces)
+    *present = g_hash_table_lookup_extended (interfaces, interface, NULL, &value);
+  return value;
+}
+
+static void
+test_update (void)
+{
+  CockpitDBusGeneration *generation;
+  GHashTable *properties;
+  GHashTable *update;
+  GHashTable *result;
+  gboolean present;
+  gchar *token;
+
+  generation = cockpit_dbus_generation_new ("scope");
+
+  token = cockpit_dbus_generation_token (generation);
+  g_assert (g_str_has_suffix (token, ".0"));
+  g_free (token);
+
+  update = build_update (NULL, "/one", "org.Iface", "Prop", g_variant_new_string ("a"));
+  update = build_update (update, "/one", "org.Iface", "Other", g_variant_new_int32 (1));
+
+  /* Everything is new the first time */
+  result = cockpit_dbus_generation_update (generation, update);
+  g_assert (result != NULL);
+  properties = lookup_properties (result, "/one", "org.Iface", &present);
+  g_assert (present);
+  g_assert_cmpuint (g_hash_table_size (properties), ==, 2);
+  g_hash_table_unref (result);
+
+  /* Nothing changed the second time */
+  result = cockpit_dbus_generation_update (generation, update);
+  g_assert (result == NULL);
+  g_hash_table_unref (update);
+
+  /* Only the changed property */
+  update = build_update (NULL, "/one", "org.Iface", "Prop", g_variant_new_string ("a"));
+  update = build_update (update, "/one", "org.Iface", "Other", g_variant_new_int32 (2));
+  result = cockpit_dbus_generation_update (generation, update);
+  properties = lookup_properties (result, "/one", "org.Iface", &present);
+  g_assert_cmpuint (g_hash_table_size (properties), ==, 1);
+  g_assert (g_hash_table_lookup (properties, "Other") != NULL);
+  g_hash_table_unref (result);
+  g_hash_table_unref (update);
+
+  /* Removing something the client never had is not sent */
+  update = build_update (NULL, "/two", "org.Iface", NULL, NULL);
+  result = cockpit_dbus_generation_update (generation, update);
+  g_assert (result == NULL);
+  g_hash_table_unref (update);
+
+  token = cockpit_dbus_generation_token (generation);
+  g_assert (g_str_has_suffix (token, ".2"));
+  g_free (token);
+
+  cockpit_dbus_generation_release (generation);
+  cockpit_dbus_generation_cleanup ();
+}
+
+static void
+test_resume (void)
+{
+  CockpitDBusGeneration *generation;
+  CockpitDBusGeneration *resumed;
+  GHashTable *properties;
+  GHashTable *update;
+  GHashTable *result;
+  gboolean present;
+  gchar *token;
+
+  generation = cockpit_dbus_generation_new ("scope");
+
+  update = build_update (NULL, "/one", "org.Iface", "Prop", g_variant_new_string ("a"));
+  update = build_update (update, "/gone", "org.Iface", "Prop", g_variant_new_string ("x"));
+  result = cockpit_dbus_generation_update (generation, update);
+  g_hash_table_unref (result);
+  g_hash_table_unref (update);
+
+  /* The client saw up to here */
+  token = cockpit_dbus_generation_token (generation);
+
+  /* This change may have been lost on the way to the client */
+  update = build_update (NULL, "/two", "org.Iface", "Prop", g_variant_new_string ("b"));
+  result = cockpit_dbus_generation_update (generation, update);
+  g_hash_table_unref (result);
+  g_hash_table_unref (update);
+
+  cockpit_dbus_generation_release (generation);
+
+  /* Different scope can't resume */
+  g_assert (cockpit_dbus_generation_resume ("other", token) == NULL);
+
+  resumed = cockpit_dbus_generation_resume ("scope", token);
+  g_assert (resumed != NULL);
+  g_free (token);
+
+  /* The reloaded cache sends everything again */
+  update = build_update (NULL, "/one", "org.Iface", "Prop", g_variant_new_string ("a"));
+  update = build_update (update, "/two", "org.Iface", "Prop", g_variant_new_string ("b"));
+  result = cockpit_dbus_generation_update (resumed, update);
+  g_hash_table_unref (update);
+
+  /* Only the interface from after the token goes out */
+  g_assert (result != NULL);
+  lookup_properties (result, "/one", "org.Iface", &present);
+  g_assert (!present);
+  properties = lookup_properties (result, "/two", "org.Iface", &present);
+  g_assert (present);
+  g_assert_cmpuint (g_hash_table_size (properties), ==, 1);
+  g_hash_table_unref (result);
+
+  /* And what wasn't seen again is removed */
+  result = cockpit_dbus_generation_sweep (resumed, "/", TRUE, NULL);
+  g_assert (result != NULL);
+  g_assert_cmpuint (g_hash_table_size (result), ==, 1);
+  properties = lookup_properties (result, "/gone", "org.Iface", &present);
+  g_assert (present);
+  g_assert (properties == NULL);
+  g_hash_table_unref (result);
+
+  /* Only once */
+  result = cockpit_dbus_generation_sweep (resumed, "/", TRUE, NULL);
+  g_assert (result == NULL);
+
+  cockpit_dbus_generation_release (resumed);
+  cockpit_dbus_generation_cleanup ();
+}
+
+static void
+test_resume_invalid (void)
+{
+  CockpitDBusGeneration *generation;
+  gchar *token;
+  gchar *future;
+
+  generation = cockpit_dbus_generation_new ("scope");
+  token = cockpit_dbus_generation_token (generation);
+  future = g_strdup_printf ("%.*s.5", (int)(strrchr (token, '.') - token), token);
+
+  g_assert (cockpit_dbus_generation_resume ("scope", "") == NULL);
+  g_assert (cockpit_dbus_generation_resume ("scope", "blah") == NULL);
+  g_assert (cockpit_dbus_generation_resume ("scope", "blah.") == NULL);
+  g_assert (cockpit_dbus_generation_resume ("scope", "0000000000000000.0") == NULL);
+  g_assert (cockpit_dbus_generation_resume ("scope", future) == NULL);
+
+  g_free (future);
+  g_free (token);
+
+  cockpit_dbus_generation_release (generation);
+  cockpit_dbus_generation_cleanup ();
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add_func ("/dbus-generation/update", test_update);
+  g_test_add_func ("/dbus-generation/resume", test_resume);
+  g_test_add_func ("/dbus-generation/resume-invalid", test_resume_invalid);
+
+  return g_test_run ();
+}
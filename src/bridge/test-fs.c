@@ -19,7 +19,9 @@
 
 #include "config.h"
 
+#include "cockpitfsarchive.h"
 #include "cockpitfsread.h"
+#include "cockpitfsreadmulti.h"
 #include "cockpitfsreplace.h"
 #include "cockpitfswatch.h"
 #include "cockpitfslist.h"
@@ -57,6 +59,16 @@ on_channel_close (CockpitChannel *channel,
   tc->channel_closed = TRUE;
 }
 
+static void
+on_closed_set_flag (CockpitChannel *channel,
+                    const gchar *problem,
+                    gpointer user_data)
+{
+  gboolean *flag = user_data;
+  g_assert (*flag == FALSE);
+  *flag = TRUE;
+}
+
 static void
 on_transport_closed (CockpitTransport *transport,
                      const gchar *problem,
@@ -98,6 +110,29 @@ setup_fsread_channel (TestCase *tc,
   cockpit_channel_prepare (tc->channel);
 }
 
+static void
+setup_fsread_watch_channel (TestCase *tc,
+                            const gchar *path)
+{
+  JsonObject *options;
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "fsread1");
+  json_object_set_string_member (options, "path", path);
+  json_object_set_boolean_member (options, "watch", TRUE);
+
+  tc->channel = g_object_new (COCKPIT_TYPE_FSREAD,
+                              "transport", tc->transport,
+                              "id", "1234",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+
+  tc->channel_closed = FALSE;
+  g_signal_connect (tc->channel, "closed", G_CALLBACK (on_channel_close), tc);
+  cockpit_channel_prepare (tc->channel);
+}
+
 static void
 setup_fsreplace_channel (TestCase *tc,
                        const gchar *path,
@@ -109,6 +144,32 @@ setup_fsreplace_channel (TestCase *tc,
   cockpit_channel_prepare (tc->channel);
 }
 
+static void
+setup_fsreplace_upload_channel (TestCase *tc,
+                                const gchar *path,
+                                const gchar *upload,
+                                gint64 size)
+{
+  JsonObject *options;
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "fsreplace1");
+  json_object_set_string_member (options, "path", path);
+  json_object_set_string_member (options, "upload", upload);
+  json_object_set_int_member (options, "size", size);
+
+  tc->channel = g_object_new (COCKPIT_TYPE_FSREPLACE,
+                              "transport", tc->transport,
+                              "id", "1234",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+
+  tc->channel_closed = FALSE;
+  g_signal_connect (tc->channel, "closed", G_CALLBACK (on_channel_close), tc);
+  cockpit_channel_prepare (tc->channel);
+}
+
 static void
 setup_fswatch_channel (TestCase *tc,
                        const gchar *path)
@@ -147,6 +208,38 @@ send_done (TestCase *tc)
   g_bytes_unref (bytes);
 }
 
+static void
+send_chunk (TestCase *tc,
+            gint64 offset,
+            const gchar *data,
+            gsize length,
+            const gchar *checksum)
+{
+  JsonObject *object;
+  GBytes *bytes;
+
+  object = json_object_new ();
+  json_object_set_string_member (object, "command", "chunk");
+  json_object_set_string_member (object, "channel", "1234");
+  json_object_set_int_member (object, "offset", offset);
+  if (checksum)
+    json_object_set_string_member (object, "checksum", checksum);
+  if (!data)
+    json_object_set_int_member (object, "hole", length);
+
+  bytes = cockpit_json_write_bytes (object);
+  cockpit_transport_emit_recv (COCKPIT_TRANSPORT (tc->transport), NULL, bytes);
+  g_bytes_unref (bytes);
+  json_object_unref (object);
+
+  if (data)
+    {
+      bytes = g_bytes_new (data, length);
+      cockpit_transport_emit_recv (COCKPIT_TRANSPORT (tc->transport), "1234", bytes);
+      g_bytes_unref (bytes);
+    }
+}
+
 static GBytes *
 recv_bytes (TestCase *tc)
 {
@@ -465,6 +558,145 @@ test_read_non_mmappable (TestCase *tc,
   g_free (tag);
 }
 
+static JsonObject *
+recv_change (TestCase *tc,
+             const gchar *tag,
+             const gchar *base,
+             gint64 prefix,
+             gint64 suffix,
+             const gchar *data)
+{
+  JsonObject *control;
+
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "change");
+  g_assert_cmpstr (json_object_get_string_member (control, "tag"), ==, tag);
+  if (base)
+    g_assert_cmpstr (json_object_get_string_member (control, "base"), ==, base);
+  else
+    g_assert (json_object_get_null_member (control, "base"));
+  g_assert_cmpint (json_object_get_int_member (control, "prefix"), ==, prefix);
+  g_assert_cmpint (json_object_get_int_member (control, "suffix"), ==, suffix);
+  assert_received (tc, data);
+
+  return control;
+}
+
+static void
+append_contents (const gchar *path,
+                 const gchar *str)
+{
+  FILE *fp = fopen (path, "a");
+  g_assert (fp != NULL);
+  g_assert_cmpint (fputs (str, fp), >=, 0);
+  g_assert_cmpint (fclose (fp), ==, 0);
+}
+
+static void
+test_read_watch_append (TestCase *tc,
+                        gconstpointer unused)
+{
+  JsonObject *control;
+  gchar *tag;
+  gchar *tag2;
+
+  set_contents (tc->test_path, "Hello!\n");
+  tag = cockpit_get_file_tag (tc->test_path);
+
+  setup_fsread_watch_channel (tc, tc->test_path);
+
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+
+  control = recv_change (tc, tag, NULL, 0, 0, "Hello!\n");
+  g_assert_cmpint (json_object_get_int_member (control, "size"), ==, 7);
+
+  append_contents (tc->test_path, "More lines\n");
+  tag2 = cockpit_get_file_tag (tc->test_path);
+
+  control = recv_change (tc, tag2, tag, 7, 0, "More lines\n");
+  g_assert_cmpint (json_object_get_int_member (control, "size"), ==, 18);
+
+  g_assert (tc->channel_closed == FALSE);
+  close_channel (tc, NULL);
+  wait_channel_closed (tc);
+
+  g_free (tag);
+  g_free (tag2);
+}
+
+static void
+test_read_watch_replace (TestCase *tc,
+                         gconstpointer unused)
+{
+  gchar *tag;
+  gchar *tag2;
+  gchar *tag3;
+
+  set_contents (tc->test_path, "root:x:0:0\nuser:x:1000:1000\nnobody:x:99:99\n");
+  tag = cockpit_get_file_tag (tc->test_path);
+
+  setup_fsread_watch_channel (tc, tc->test_path);
+
+  recv_control (tc);
+  recv_change (tc, tag, NULL, 0, 0, "root:x:0:0\nuser:x:1000:1000\nnobody:x:99:99\n");
+
+  /* Rewritten via rename, only the changed middle is sent */
+  set_contents (tc->test_path, "root:x:0:0\nadmin:x:1000:1000\nnobody:x:99:99\n");
+  tag2 = cockpit_get_file_tag (tc->test_path);
+  recv_change (tc, tag2, tag, 11, 28, "admin");
+
+  g_assert (unlink (tc->test_path) >= 0);
+  recv_change (tc, "-", tag2, 0, 0, "");
+
+  set_contents (tc->test_path, "Back");
+  tag3 = cockpit_get_file_tag (tc->test_path);
+  recv_change (tc, tag3, "-", 0, 0, "Back");
+
+  close_channel (tc, NULL);
+  wait_channel_closed (tc);
+
+  g_free (tag);
+  g_free (tag2);
+  g_free (tag3);
+}
+
+static void
+test_read_watch_too_large (TestCase *tc,
+                           gconstpointer unused)
+{
+  JsonObject *options;
+  JsonObject *control;
+
+  set_contents (tc->test_path, "Hello!");
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "fsread1");
+  json_object_set_string_member (options, "path", tc->test_path);
+  json_object_set_boolean_member (options, "watch", TRUE);
+  json_object_set_int_member (options, "max_read_size", 10);
+
+  tc->channel = g_object_new (COCKPIT_TYPE_FSREAD,
+                              "transport", tc->transport,
+                              "id", "1234",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+  tc->channel_closed = FALSE;
+  g_signal_connect (tc->channel, "closed", G_CALLBACK (on_channel_close), tc);
+  cockpit_channel_prepare (tc->channel);
+
+  recv_control (tc);
+  recv_control (tc);
+  assert_received (tc, "Hello!");
+
+  append_contents (tc->test_path, "Goodbye!");
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "too-large");
+}
+
 static void
 test_write_simple (TestCase *tc,
                    gconstpointer unused)
@@ -728,171 +960,743 @@ test_write_expect_tag_fail (TestCase *tc,
 }
 
 static void
-test_watch_simple (TestCase *tc,
+test_write_upload (TestCase *tc,
                    gconstpointer unused)
 {
+  JsonObject *control;
+  gchar *checksum;
+  gchar *value;
   gchar *tag;
-  JsonObject *event;
 
-  setup_fswatch_channel (tc, tc->test_path);
+  setup_fsreplace_upload_channel (tc, tc->test_path, "abc", 12);
 
-  set_contents (tc->test_path, "Wake up!");
-  tag = cockpit_get_file_tag (tc->test_path);
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  g_assert_cmpint (json_object_get_int_member (control, "offset"), ==, 0);
+
+  /* Chunks can arrive in any order */
+  send_chunk (tc, 6, "World!", 6, NULL);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA256, "Hello ", -1);
+  value = g_strdup_printf ("sha256:%s", checksum);
+  send_chunk (tc, 0, "Hello ", 6, value);
+  g_free (checksum);
+  g_free (value);
+  send_done (tc);
 
-  event = recv_json (tc);
-  g_assert (event != NULL);
+  wait_channel_closed (tc);
 
-  /*
-   * HACK: https://bugzilla.redhat.com/show_bug.cgi?id=1259594
-   * Some versions of glib2 erroneously emit spurios "delete" events.
-   */
-  if (g_str_equal (json_object_get_string_member (event, "event"), "deleted"))
-    {
-      json_object_unref (event);
-      event = recv_json (tc);
-    }
+  assert_contents (tc->test_path, "Hello World!");
 
-  g_assert_cmpstr (json_object_get_string_member (event, "event"), ==, "created");
-  g_assert_cmpstr (json_object_get_string_member (event, "path"), ==, tc->test_path);
-  g_assert_cmpstr (json_object_get_string_member (event, "tag"), ==, tag);
-  g_assert_cmpstr (json_object_get_string_member (event, "type"), ==, "file");
-  json_object_unref (event);
+  control = mock_transport_pop_control (tc->transport);
+  tag = cockpit_get_file_tag (tc->test_path);
+  g_assert (json_object_get_member (control, "problem") == NULL);
+  g_assert_cmpstr (json_object_get_string_member (control, "tag"), ==, tag);
   g_free (tag);
 }
 
 static void
-test_watch_remove (TestCase *tc,
-                   gconstpointer unused)
+test_write_upload_resume (TestCase *tc,
+                          gconstpointer unused)
 {
-  JsonObject *event;
+  JsonObject *control;
 
-  set_contents (tc->test_path, "Hello!");
+  setup_fsreplace_upload_channel (tc, tc->test_path, "resume", 12);
+  send_chunk (tc, 0, "Hello ", 6, NULL);
+  send_done (tc);
+  wait_channel_closed (tc);
 
-  setup_fswatch_channel (tc, tc->test_path);
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert (json_object_get_member (control, "problem") == NULL);
+  g_assert (json_object_get_member (control, "tag") == NULL);
+  g_assert_cmpint (json_object_get_int_member (control, "offset"), ==, 6);
+  g_assert (g_file_test (tc->test_path, G_FILE_TEST_EXISTS) == FALSE);
 
-  g_assert (unlink (tc->test_path) >= 0);
+  g_object_unref (tc->channel);
 
-  event = recv_json (tc);
-  g_assert_cmpstr (json_object_get_string_member (event, "event"), ==, "deleted");
-  g_assert_cmpstr (json_object_get_string_member (event, "path"), ==, tc->test_path);
-  g_assert_cmpstr (json_object_get_string_member (event, "tag"), ==, "-");
-  json_object_unref (event);
+  /* A new channel continues where the last one stopped */
+  setup_fsreplace_upload_channel (tc, tc->test_path, "resume", 12);
+
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  g_assert_cmpint (json_object_get_int_member (control, "offset"), ==, 6);
+
+  send_chunk (tc, 6, "World!", 6, NULL);
+  send_done (tc);
+  wait_channel_closed (tc);
+
+  assert_contents (tc->test_path, "Hello World!");
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert (json_object_get_member (control, "problem") == NULL);
+  g_assert (json_object_get_member (control, "tag") != NULL);
 }
 
 static void
-test_watch_directory (TestCase *tc,
-                      gconstpointer unused)
+test_write_upload_siblings (TestCase *tc,
+                            gconstpointer unused)
 {
-  JsonObject *event;
-
-  setup_fswatch_channel (tc, tc->test_dir);
+  const gchar *message = "{ \"command\": \"done\", \"channel\": \"5678\" }";
+  CockpitChannel *sibling;
+  gboolean sibling_closed = FALSE;
+  JsonObject *options;
+  JsonObject *control;
+  GBytes *bytes;
+  gchar *tag;
 
-  set_contents (tc->test_path, "Hello!");
-  g_assert (unlink (tc->test_path) >= 0);
+  setup_fsreplace_upload_channel (tc, tc->test_path, "siblings", 12);
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "fsreplace1");
+  json_object_set_string_member (options, "path", tc->test_path);
+  json_object_set_string_member (options, "upload", "siblings");
+  json_object_set_int_member (options, "size", 12);
+  sibling = g_object_new (COCKPIT_TYPE_FSREPLACE,
+                          "transport", tc->transport,
+                          "id", "5678",
+                          "options", options,
+                          NULL);
+  json_object_unref (options);
+  g_signal_connect (sibling, "closed", G_CALLBACK (on_closed_set_flag), &sibling_closed);
+  cockpit_channel_prepare (sibling);
+
+  /* One channel gets all the data in place */
+  send_chunk (tc, 0, "Hello World!", 12, NULL);
+  send_done (tc);
+  wait_channel_closed (tc);
+  assert_contents (tc->test_path, "Hello World!");
 
-  /* We want to see at least "created" and "deleted" for the path, in
-     that order.
-   */
+  /* And the other one finishes along with it */
+  bytes = g_bytes_new_static (message, strlen (message));
+  cockpit_transport_emit_recv (COCKPIT_TRANSPORT (tc->transport), NULL, bytes);
+  g_bytes_unref (bytes);
+  while (!sibling_closed)
+    g_main_context_iteration (NULL, TRUE);
 
-  gboolean saw_created = FALSE;
-  gboolean saw_deleted = FALSE;
+  assert_contents (tc->test_path, "Hello World!");
 
-  while (!(saw_created && saw_deleted) && !tc->channel_closed)
+  tag = cockpit_get_file_tag (tc->test_path);
+  while ((control = mock_transport_pop_control (tc->transport)) != NULL)
     {
-      event = recv_json (tc);
-      if (g_strcmp0 (json_object_get_string_member (event, "path"), tc->test_path) == 0)
-        {
-          if (g_strcmp0 (json_object_get_string_member (event, "event"), "created") == 0)
-            {
-              g_assert (!saw_deleted);
-              saw_created = TRUE;
-            }
-          else if (g_strcmp0 (json_object_get_string_member (event, "event"), "deleted") == 0)
-            {
-              g_assert (saw_created);
-              saw_deleted= TRUE;
-            }
-        }
-      json_object_unref (event);
+      if (!g_str_equal (json_object_get_string_member (control, "command"), "close"))
+        continue;
+      g_assert (json_object_get_member (control, "problem") == NULL);
+      g_assert_cmpstr (json_object_get_string_member (control, "tag"), ==, tag);
     }
+  g_free (tag);
 
-  g_assert (saw_created && saw_deleted);
+  g_object_unref (sibling);
 }
 
 static void
-test_dir_simple (TestCase *tc,
-                 gconstpointer unused)
+test_write_upload_resume_deleted (TestCase *tc,
+                                  gconstpointer unused)
 {
-  JsonObject *event, *control;
-  gchar *base = g_path_get_basename (tc->test_path);
+  JsonObject *control;
+  gchar *path;
 
-  set_contents (tc->test_path, "Hello!");
+  setup_fsreplace_upload_channel (tc, tc->test_path, "deleted", 12);
+  send_chunk (tc, 0, "Hello ", 6, NULL);
+  send_done (tc);
+  wait_channel_closed (tc);
 
-  setup_fslist_channel (tc, tc->test_dir, TRUE);
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpint (json_object_get_int_member (control, "offset"), ==, 6);
 
-  event = recv_json (tc);
-  g_assert_cmpstr (json_object_get_string_member (event, "event"), ==, "present");
-  g_assert_cmpstr (json_object_get_string_member (event, "path"), ==, base);
-  g_assert_cmpstr (json_object_get_string_member (event, "type"), ==, "file");
-  json_object_unref (event);
+  g_object_unref (tc->channel);
+
+  /* The state of the upload no longer matches its file */
+  path = g_strdup_printf ("%s.upload-deleted", tc->test_path);
+  g_assert (unlink (path) >= 0);
+  g_free (path);
+
+  setup_fsreplace_upload_channel (tc, tc->test_path, "deleted", 12);
 
   control = recv_control (tc);
   g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  g_assert_cmpint (json_object_get_int_member (control, "offset"), ==, 0);
 
-  g_free (base);
-
-  close_channel (tc, NULL);
+  /* Everything has to be sent again */
+  send_chunk (tc, 0, "Hello ", 6, NULL);
+  send_chunk (tc, 6, "World!", 6, NULL);
+  send_done (tc);
   wait_channel_closed (tc);
 
+  assert_contents (tc->test_path, "Hello World!");
+
   control = mock_transport_pop_control (tc->transport);
   g_assert (json_object_get_member (control, "problem") == NULL);
+  g_assert (json_object_get_member (control, "tag") != NULL);
 }
 
 static void
-test_dir_simple_no_watch (TestCase *tc,
-                 gconstpointer unused)
+test_write_upload_symlink (TestCase *tc,
+                           gconstpointer unused)
 {
-  JsonObject *event, *control;
-  gchar *base = g_path_get_basename (tc->test_path);
-
-  set_contents (tc->test_path, "Hello!");
+  JsonObject *control;
+  gchar *victim;
+  gchar *path;
 
-  setup_fslist_channel (tc, tc->test_dir, FALSE);
+  cockpit_expect_message ("*couldn't open upload file*");
 
-  event = recv_json (tc);
-  g_assert_cmpstr (json_object_get_string_member (event, "event"), ==, "present");
-  g_assert_cmpstr (json_object_get_string_member (event, "path"), ==, base);
-  g_assert_cmpstr (json_object_get_string_member (event, "type"), ==, "file");
-  json_object_unref (event);
+  victim = g_strdup_printf ("%s.victim", tc->test_path);
+  g_assert (g_file_set_contents (victim, "Precious", -1, NULL));
+  path = g_strdup_printf ("%s.upload-link", tc->test_path);
+  g_assert (symlink (victim, path) >= 0);
 
-  control = recv_control (tc);
-  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  setup_fsreplace_upload_channel (tc, tc->test_path, "link", 6);
+  wait_channel_closed (tc);
 
-  g_free (base);
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "internal-error");
 
-  // channel should be closed
-  g_assert (tc->channel_closed);
+  /* The link target was left alone */
+  assert_contents (victim, "Precious");
 
-  control = mock_transport_pop_control (tc->transport);
-  g_assert (json_object_get_member (control, "problem") == NULL);
+  g_assert (unlink (path) >= 0);
+  g_assert (unlink (victim) >= 0);
+  g_free (path);
+  g_free (victim);
 }
 
 static void
-test_dir_early_close (TestCase *tc,
-                      gconstpointer unused)
+test_write_upload_outside (TestCase *tc,
+                           gconstpointer unused)
 {
   JsonObject *control;
 
-  set_contents (tc->test_path, "Hello!");
-
-  setup_fslist_channel (tc, tc->test_dir, TRUE);
-  close_channel (tc, NULL);
+  cockpit_expect_message ("*upload chunk is outside of the file*");
 
+  setup_fsreplace_upload_channel (tc, tc->test_path, "outside", 6);
+  send_chunk (tc, G_MAXINT64 - 2, "Hello!", 6, NULL);
   wait_channel_closed (tc);
 
   control = mock_transport_pop_control (tc->transport);
-  g_assert (json_object_get_member (control, "problem") == NULL);
-}
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "protocol-error");
+}
+
+static void
+test_write_upload_holes (TestCase *tc,
+                         gconstpointer unused)
+{
+  JsonObject *control;
+  gchar *zeros;
+  gchar *expected;
+  gchar *contents;
+  gsize length;
+
+  zeros = g_malloc0 (8192);
+  expected = g_malloc0 (2 * 8192 + 4);
+  memcpy (expected + 2 * 8192, "Tail", 4);
+
+  setup_fsreplace_upload_channel (tc, tc->test_path, "holes", 2 * 8192 + 4);
+
+  send_chunk (tc, 0, NULL, 8192, NULL);
+  send_chunk (tc, 8192, zeros, 8192, NULL);
+  send_chunk (tc, 2 * 8192, "Tail", 4, NULL);
+  send_done (tc);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert (json_object_get_member (control, "problem") == NULL);
+
+  g_assert (g_file_get_contents (tc->test_path, &contents, &length, NULL));
+  g_assert_cmpuint (length, ==, 2 * 8192 + 4);
+  g_assert (memcmp (contents, expected, length) == 0);
+
+  g_free (contents);
+  g_free (expected);
+  g_free (zeros);
+}
+
+static void
+test_write_upload_checksum (TestCase *tc,
+                            gconstpointer unused)
+{
+  JsonObject *control;
+  gchar *path;
+
+  cockpit_expect_message ("*chunk at offset 0 has the wrong checksum*");
+
+  setup_fsreplace_upload_channel (tc, tc->test_path, "bad", 6);
+  send_chunk (tc, 0, "Hello!", 6, "sha256:0000");
+  send_done (tc);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "protocol-error");
+
+  g_assert (g_file_test (tc->test_path, G_FILE_TEST_EXISTS) == FALSE);
+
+  /* The interrupted upload is kept around */
+  path = g_strdup_printf ("%s.upload-bad", tc->test_path);
+  g_assert (unlink (path) >= 0);
+  g_free (path);
+  path = g_strdup_printf ("%s.upload-bad.state", tc->test_path);
+  g_assert (unlink (path) >= 0);
+  g_free (path);
+}
+
+static void
+test_write_upload_invalid (TestCase *tc,
+                           gconstpointer unused)
+{
+  JsonObject *control;
+
+  cockpit_expect_message ("*invalid \"upload\" option*");
+
+  setup_fsreplace_upload_channel (tc, tc->test_path, "../evil", 6);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "protocol-error");
+}
+
+static void
+setup_fsarchive_channel (TestCase *tc,
+                         const gchar *path,
+                         const gchar *compression,
+                         gint64 offset)
+{
+  JsonObject *options;
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "fsarchive1");
+  json_object_set_string_member (options, "path", path);
+  json_object_set_string_member (options, "binary", "raw");
+  json_object_set_boolean_member (options, "flow-control", TRUE);
+  if (compression)
+    json_object_set_string_member (options, "compression", compression);
+  if (offset)
+    json_object_set_int_member (options, "offset", offset);
+
+  tc->channel = g_object_new (COCKPIT_TYPE_FSARCHIVE,
+                              "transport", tc->transport,
+                              "id", "1234",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+
+  tc->channel_closed = FALSE;
+  g_signal_connect (tc->channel, "closed", G_CALLBACK (on_channel_close), tc);
+  cockpit_channel_prepare (tc->channel);
+}
+
+static GBytes *
+recv_archive (TestCase *tc,
+              const gchar *path,
+              const gchar *compression,
+              gint64 offset)
+{
+  JsonObject *control;
+  GBytes *archive;
+
+  setup_fsarchive_channel (tc, path, compression, offset);
+  wait_channel_closed (tc);
+  archive = combine_output (tc, NULL);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "progress");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "done");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "close");
+  g_assert (json_object_get_member (control, "problem") == NULL);
+
+  g_object_unref (tc->channel);
+  tc->channel = NULL;
+  return archive;
+}
+
+/* Lists an uncompressed archive as "type name [content]" lines */
+static gchar *
+list_archive (GBytes *archive)
+{
+  GString *listing = g_string_new ("");
+  const gchar *data;
+  const gchar *block;
+  gchar *pax_path = NULL;
+  gchar *name;
+  gsize length;
+  gsize offset;
+  gsize size = 0;
+
+  data = g_bytes_get_data (archive, &length);
+  g_assert_cmpuint (length % 512, ==, 0);
+
+  for (offset = 0; offset + 512 <= length; offset += 512 + ((size + 511) / 512) * 512)
+    {
+      block = data + offset;
+      if (block[0] == '\0')
+        break;
+
+      g_assert (memcmp (block + 257, "ustar", 6) == 0);
+      size = g_ascii_strtoull (block + 124, NULL, 8);
+
+      if (block[156] == 'x')
+        {
+          name = g_strndup (data + offset + 512, size);
+          g_assert (g_str_has_suffix (name, "\n"));
+          pax_path = g_strdup (strstr (name, " path=") + 6);
+          pax_path[strlen (pax_path) - 1] = '\0';
+          g_free (name);
+          continue;
+        }
+
+      name = pax_path ? pax_path : g_strndup (block, 100);
+      pax_path = NULL;
+      g_string_append_printf (listing, "%c %s", block[156], name);
+      if (block[156] == '2')
+        g_string_append_printf (listing, " -> %.100s", block + 157);
+      else if (size > 0)
+        g_string_append_printf (listing, " %.*s", (int)size, data + offset + 512);
+      g_string_append_c (listing, '\n');
+      g_free (name);
+    }
+
+  /* The end of the archive is two zero blocks */
+  g_assert_cmpuint (offset + 1024, ==, length);
+  return g_string_free (listing, FALSE);
+}
+
+static void
+test_archive_simple (TestCase *tc,
+                     gconstpointer unused)
+{
+  GBytes *archive;
+  gchar *listing;
+  gchar *expected;
+  gchar *base;
+
+  set_contents (tc->test_path, "Hello!");
+  set_contents (tc->test_path_2, "Another file");
+  g_assert (symlink ("foo", tc->test_link) >= 0);
+  g_assert (mkdir (tc->test_subdir, 0700) >= 0);
+
+  archive = recv_archive (tc, tc->test_dir, NULL, 0);
+  listing = list_archive (archive);
+
+  base = g_path_get_basename (tc->test_dir);
+  expected = g_strdup_printf ("5 %s/\n"
+                              "0 %s/bar Another file\n"
+                              "0 %s/foo Hello!\n"
+                              "2 %s/foo-link -> foo\n"
+                              "5 %s/subdir/\n",
+                              base, base, base, base, base);
+  g_assert_cmpstr (listing, ==, expected);
+
+  g_free (base);
+  g_free (expected);
+  g_free (listing);
+  g_bytes_unref (archive);
+}
+
+static void
+test_archive_long_name (TestCase *tc,
+                        gconstpointer unused)
+{
+  GBytes *archive;
+  gchar *listing;
+  gchar *expected;
+  gchar *name;
+  gchar *path;
+
+  name = g_strnfill (150, 'x');
+  path = g_build_filename (tc->test_dir, name, NULL);
+  set_contents (path, "Long");
+
+  archive = recv_archive (tc, path, NULL, 0);
+  listing = list_archive (archive);
+
+  expected = g_strdup_printf ("0 %s Long\n", name);
+  g_assert_cmpstr (listing, ==, expected);
+
+  g_assert (unlink (path) >= 0);
+  g_free (expected);
+  g_free (listing);
+  g_free (path);
+  g_free (name);
+  g_bytes_unref (archive);
+}
+
+static void
+test_archive_resume (TestCase *tc,
+                     gconstpointer unused)
+{
+  GBytes *archive;
+  GBytes *rest;
+  GBytes *expected;
+
+  set_contents (tc->test_path, "Hello!");
+  set_contents (tc->test_path_2, "Another file");
+
+  archive = recv_archive (tc, tc->test_dir, NULL, 0);
+
+  /* In the middle of the content of the first file */
+  rest = recv_archive (tc, tc->test_dir, NULL, 1030);
+  expected = g_bytes_new_from_bytes (archive, 1030, g_bytes_get_size (archive) - 1030);
+  g_assert (g_bytes_equal (rest, expected));
+
+  g_bytes_unref (expected);
+  g_bytes_unref (rest);
+  g_bytes_unref (archive);
+}
+
+static void
+test_archive_gzip (TestCase *tc,
+                   gconstpointer unused)
+{
+  GBytes *archive;
+  GBytes *compressed;
+  GConverter *decompressor;
+  GInputStream *input;
+  GInputStream *stream;
+  GOutputStream *output;
+  GBytes *decompressed;
+
+  set_contents (tc->test_path, "Hello!");
+
+  archive = recv_archive (tc, tc->test_dir, NULL, 0);
+  compressed = recv_archive (tc, tc->test_dir, "gzip", 0);
+  g_assert_cmpuint (g_bytes_get_size (compressed), <, g_bytes_get_size (archive));
+
+  decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+  input = g_memory_input_stream_new_from_bytes (compressed);
+  stream = g_converter_input_stream_new (input, decompressor);
+  output = g_memory_output_stream_new_resizable ();
+  g_assert_cmpint (g_output_stream_splice (output, stream, G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET, NULL, NULL), >, 0);
+  decompressed = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output));
+  g_assert (g_bytes_equal (decompressed, archive));
+
+  g_bytes_unref (decompressed);
+  g_object_unref (output);
+  g_object_unref (stream);
+  g_object_unref (input);
+  g_object_unref (decompressor);
+  g_bytes_unref (compressed);
+  g_bytes_unref (archive);
+}
+
+static void
+test_archive_not_found (TestCase *tc,
+                        gconstpointer unused)
+{
+  JsonObject *control;
+
+  setup_fsarchive_channel (tc, "/non/existent", NULL, 0);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "not-found");
+}
+
+static void
+test_archive_no_flow_control (TestCase *tc,
+                              gconstpointer unused)
+{
+  JsonObject *options;
+  JsonObject *control;
+
+  cockpit_expect_message ("*fsarchive channel must use flow control*");
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "fsarchive1");
+  json_object_set_string_member (options, "path", tc->test_dir);
+  json_object_set_string_member (options, "binary", "raw");
+
+  tc->channel = g_object_new (COCKPIT_TYPE_FSARCHIVE,
+                              "transport", tc->transport,
+                              "id", "1234",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+
+  tc->channel_closed = FALSE;
+  g_signal_connect (tc->channel, "closed", G_CALLBACK (on_channel_close), tc);
+  cockpit_channel_prepare (tc->channel);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "protocol-error");
+}
+
+static void
+test_watch_simple (TestCase *tc,
+                   gconstpointer unused)
+{
+  gchar *tag;
+  JsonObject *event;
+
+  setup_fswatch_channel (tc, tc->test_path);
+
+  set_contents (tc->test_path, "Wake up!");
+  tag = cockpit_get_file_tag (tc->test_path);
+
+  event = recv_json (tc);
+  g_assert (event != NULL);
+
+  /*
+   * HACK: https://bugzilla.redhat.com/show_bug.cgi?id=1259594
+   * Some versions of glib2 erroneously emit spurios "delete" events.
+   */
+  if (g_str_equal (json_object_get_string_member (event, "event"), "deleted"))
+    {
+      json_object_unref (event);
+      event = recv_json (tc);
+    }
+
+  g_assert_cmpstr (json_object_get_string_member (event, "event"), ==, "created");
+  g_assert_cmpstr (json_object_get_string_member (event, "path"), ==, tc->test_path);
+  g_assert_cmpstr (json_object_get_string_member (event, "tag"), ==, tag);
+  g_assert_cmpstr (json_object_get_string_member (event, "type"), ==, "file");
+  json_object_unref (event);
+  g_free (tag);
+}
+
+static void
+test_watch_remove (TestCase *tc,
+                   gconstpointer unused)
+{
+  JsonObject *event;
+
+  set_contents (tc->test_path, "Hello!");
+
+  setup_fswatch_channel (tc, tc->test_path);
+
+  g_assert (unlink (tc->test_path) >= 0);
+
+  event = recv_json (tc);
+  g_assert_cmpstr (json_object_get_string_member (event, "event"), ==, "deleted");
+  g_assert_cmpstr (json_object_get_string_member (event, "path"), ==, tc->test_path);
+  g_assert_cmpstr (json_object_get_string_member (event, "tag"), ==, "-");
+  json_object_unref (event);
+}
+
+static void
+test_watch_directory (TestCase *tc,
+                      gconstpointer unused)
+{
+  JsonObject *event;
+
+  setup_fswatch_channel (tc, tc->test_dir);
+
+  set_contents (tc->test_path, "Hello!");
+  g_assert (unlink (tc->test_path) >= 0);
+
+  /* We want to see at least "created" and "deleted" for the path, in
+     that order.
+   */
+
+  gboolean saw_created = FALSE;
+  gboolean saw_deleted = FALSE;
+
+  while (!(saw_created && saw_deleted) && !tc->channel_closed)
+    {
+      event = recv_json (tc);
+      if (g_strcmp0 (json_object_get_string_member (event, "path"), tc->test_path) == 0)
+        {
+          if (g_strcmp0 (json_object_get_string_member (event, "event"), "created") == 0)
+            {
+              g_assert (!saw_deleted);
+              saw_created = TRUE;
+            }
+          else if (g_strcmp0 (json_object_get_string_member (event, "event"), "deleted") == 0)
+            {
+              g_assert (saw_created);
+              saw_deleted= TRUE;
+            }
+        }
+      json_object_unref (event);
+    }
+
+  g_assert (saw_created && saw_deleted);
+}
+
+static void
+test_dir_simple (TestCase *tc,
+                 gconstpointer unused)
+{
+  JsonObject *event, *control;
+  gchar *base = g_path_get_basename (tc->test_path);
+
+  set_contents (tc->test_path, "Hello!");
+
+  setup_fslist_channel (tc, tc->test_dir, TRUE);
+
+  event = recv_json (tc);
+  g_assert_cmpstr (json_object_get_string_member (event, "event"), ==, "present");
+  g_assert_cmpstr (json_object_get_string_member (event, "path"), ==, base);
+  g_assert_cmpstr (json_object_get_string_member (event, "type"), ==, "file");
+  json_object_unref (event);
+
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+
+  g_free (base);
+
+  close_channel (tc, NULL);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert (json_object_get_member (control, "problem") == NULL);
+}
+
+static void
+test_dir_simple_no_watch (TestCase *tc,
+                 gconstpointer unused)
+{
+  JsonObject *event, *control;
+  gchar *base = g_path_get_basename (tc->test_path);
+
+  set_contents (tc->test_path, "Hello!");
+
+  setup_fslist_channel (tc, tc->test_dir, FALSE);
+
+  event = recv_json (tc);
+  g_assert_cmpstr (json_object_get_string_member (event, "event"), ==, "present");
+  g_assert_cmpstr (json_object_get_string_member (event, "path"), ==, base);
+  g_assert_cmpstr (json_object_get_string_member (event, "type"), ==, "file");
+  json_object_unref (event);
+
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+
+  g_free (base);
+
+  // channel should be closed
+  g_assert (tc->channel_closed);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert (json_object_get_member (control, "problem") == NULL);
+}
+
+static void
+test_dir_early_close (TestCase *tc,
+                      gconstpointer unused)
+{
+  JsonObject *control;
+
+  set_contents (tc->test_path, "Hello!");
+
+  setup_fslist_channel (tc, tc->test_dir, TRUE);
+  close_channel (tc, NULL);
+
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert (json_object_get_member (control, "problem") == NULL);
+}
 
 static void
 test_dir_watch (TestCase *tc,
@@ -982,6 +1786,355 @@ test_dir_list_fail (TestCase *tc,
   g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "not-found");
 }
 
+static void
+setup_fslist_paged_channel (TestCase *tc,
+                            const gchar *path,
+                            gint64 page_size,
+                            const gchar **attrs,
+                            gboolean watch)
+{
+  JsonObject *options;
+  JsonArray *array;
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "fslist1");
+  json_object_set_string_member (options, "path", path);
+  json_object_set_boolean_member (options, "watch", watch);
+  json_object_set_int_member (options, "page-size", page_size);
+  array = json_array_new ();
+  while (attrs && *attrs)
+    json_array_add_string_element (array, *(attrs++));
+  json_object_set_array_member (options, "attrs", array);
+
+  tc->channel = g_object_new (COCKPIT_TYPE_FSLIST,
+                              "transport", tc->transport,
+                              "id", "1234",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+
+  tc->channel_closed = FALSE;
+  g_signal_connect (tc->channel, "closed", G_CALLBACK (on_channel_close), tc);
+  cockpit_channel_prepare (tc->channel);
+}
+
+static void
+test_dir_paged (TestCase *tc,
+                gconstpointer unused)
+{
+  const gchar *attrs[] = { "size", "target", NULL };
+  JsonObject *control;
+  JsonObject *page;
+  JsonArray *paths;
+  GBytes *bytes;
+  const gchar *name;
+  guint pages = 0;
+  guint count = 0;
+  guint i;
+
+  set_contents (tc->test_path, "Hello!");
+  set_contents (tc->test_path_2, "Another");
+  g_assert (symlink ("foo", tc->test_link) >= 0);
+  g_assert (mkdir (tc->test_subdir, 0700) >= 0);
+
+  setup_fslist_paged_channel (tc, tc->test_dir, 3, attrs, FALSE);
+  wait_channel_closed (tc);
+
+  while ((bytes = mock_transport_pop_channel (tc->transport, "1234")) != NULL)
+    {
+      page = cockpit_json_parse_bytes (bytes, NULL);
+      g_assert (page != NULL);
+      g_assert_cmpstr (json_object_get_string_member (page, "event"), ==, "present");
+
+      paths = json_object_get_array_member (page, "path");
+      g_assert_cmpuint (json_array_get_length (paths), <=, 3);
+      g_assert_cmpuint (json_array_get_length (json_object_get_array_member (page, "type")), ==,
+                        json_array_get_length (paths));
+
+      for (i = 0; i < json_array_get_length (paths); i++)
+        {
+          name = json_array_get_string_element (paths, i);
+          if (g_str_equal (name, "foo"))
+            {
+              g_assert_cmpstr (json_array_get_string_element (json_object_get_array_member (page, "type"), i), ==, "file");
+              g_assert_cmpint (json_array_get_int_element (json_object_get_array_member (page, "size"), i), ==, 6);
+              g_assert (json_array_get_null_element (json_object_get_array_member (page, "target"), i));
+            }
+          else if (g_str_equal (name, "foo-link"))
+            {
+              g_assert_cmpstr (json_array_get_string_element (json_object_get_array_member (page, "type"), i), ==, "file");
+              g_assert_cmpstr (json_array_get_string_element (json_object_get_array_member (page, "target"), i), ==, "foo");
+            }
+          else if (g_str_equal (name, "subdir"))
+            {
+              g_assert_cmpstr (json_array_get_string_element (json_object_get_array_member (page, "type"), i), ==, "directory");
+            }
+          count++;
+        }
+
+      json_object_unref (page);
+      g_bytes_unref (bytes);
+      pages++;
+    }
+
+  g_assert_cmpuint (count, ==, 4);
+  g_assert_cmpuint (pages, ==, 2);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "done");
+  control = mock_transport_pop_control (tc->transport);
+  g_assert (json_object_get_member (control, "problem") == NULL);
+}
+
+static void
+test_dir_paged_watch (TestCase *tc,
+                      gconstpointer unused)
+{
+  JsonObject *event, *control;
+  JsonArray *paths;
+  gchar *base = g_path_get_basename (tc->test_path);
+  gboolean saw_created = FALSE;
+
+  set_contents (tc->test_path, "Hello!");
+
+  setup_fslist_paged_channel (tc, tc->test_dir, 10, NULL, TRUE);
+
+  event = recv_json (tc);
+  g_assert_cmpstr (json_object_get_string_member (event, "event"), ==, "present");
+  paths = json_object_get_array_member (event, "path");
+  g_assert_cmpuint (json_array_get_length (paths), ==, 1);
+  g_assert_cmpstr (json_array_get_string_element (paths, 0), ==, base);
+  g_assert_cmpuint (json_array_get_length (json_object_get_array_member (event, "type")), ==, 1);
+  json_object_unref (event);
+
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+
+  /* Still open after the listing, and reporting changes */
+  g_assert (!tc->channel_closed);
+  set_contents (tc->test_path_2, "Another");
+
+  while (!saw_created && !tc->channel_closed)
+    {
+      event = recv_json (tc);
+      if (g_strcmp0 (json_object_get_string_member (event, "path"), tc->test_path_2) == 0 &&
+          g_strcmp0 (json_object_get_string_member (event, "event"), "created") == 0)
+        {
+          g_assert_cmpstr (json_object_get_string_member (event, "type"), ==, "file");
+          saw_created = TRUE;
+        }
+      json_object_unref (event);
+    }
+  g_assert (saw_created);
+
+  g_free (base);
+
+  close_channel (tc, NULL);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert (json_object_get_member (control, "problem") == NULL);
+}
+
+static void
+test_dir_paged_invalid (TestCase *tc,
+                        gconstpointer unused)
+{
+  const gchar *attrs[] = { "size", "color", NULL };
+  JsonObject *control;
+
+  cockpit_expect_message ("*invalid \"attrs\" option*");
+
+  setup_fslist_paged_channel (tc, tc->test_dir, 100, attrs, FALSE);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "protocol-error");
+}
+
+static void
+setup_fsread_multi_channel (TestCase *tc,
+                            JsonArray *paths,
+                            gint64 max_read_size)
+{
+  JsonObject *options;
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "fsread-multi1");
+  json_object_set_array_member (options, "paths", paths);
+  if (max_read_size >= 0)
+    json_object_set_int_member (options, "max_read_size", max_read_size);
+
+  tc->channel = g_object_new (COCKPIT_TYPE_FSREAD_MULTI,
+                              "transport", tc->transport,
+                              "id", "1234",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+
+  tc->channel_closed = FALSE;
+  g_signal_connect (tc->channel, "closed", G_CALLBACK (on_channel_close), tc);
+  cockpit_channel_prepare (tc->channel);
+}
+
+static void
+test_read_multi_simple (TestCase *tc,
+                        gconstpointer unused)
+{
+  JsonObject *result;
+  JsonObject *file;
+  JsonObject *control;
+  JsonObject *limited;
+  JsonArray *paths;
+  gchar *tag;
+
+  set_contents (tc->test_path, "Hello!");
+  set_contents (tc->test_path_2, "Another file that is too long");
+  g_assert (mkdir (tc->test_subdir, 0700) >= 0);
+
+  paths = json_array_new ();
+  json_array_add_string_element (paths, tc->test_path);
+  json_array_add_string_element (paths, tc->test_subdir);
+  json_array_add_string_element (paths, tc->test_link);
+  limited = json_object_new ();
+  json_object_set_string_member (limited, "path", tc->test_path_2);
+  json_object_set_int_member (limited, "max_read_size", 10);
+  json_array_add_object_element (paths, limited);
+
+  setup_fsread_multi_channel (tc, paths, -1);
+
+  result = recv_json (tc);
+  g_assert_cmpuint (json_object_get_size (result), ==, 4);
+
+  tag = cockpit_get_file_tag (tc->test_path);
+  file = json_object_get_object_member (result, tc->test_path);
+  g_assert_cmpstr (json_object_get_string_member (file, "content"), ==, "Hello!");
+  g_assert_cmpstr (json_object_get_string_member (file, "tag"), ==, tag);
+  g_assert (!json_object_has_member (file, "problem"));
+  g_free (tag);
+
+  file = json_object_get_object_member (result, tc->test_subdir);
+  g_assert_cmpstr (json_object_get_string_member (file, "problem"), ==, "internal-error");
+
+  file = json_object_get_object_member (result, tc->test_link);
+  g_assert_cmpstr (json_object_get_string_member (file, "tag"), ==, "-");
+  g_assert (!json_object_has_member (file, "content"));
+
+  file = json_object_get_object_member (result, tc->test_path_2);
+  g_assert_cmpstr (json_object_get_string_member (file, "problem"), ==, "too-large");
+
+  json_object_unref (result);
+
+  wait_channel_closed (tc);
+
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "done");
+  control = recv_control (tc);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "close");
+  g_assert (!json_object_has_member (control, "problem"));
+}
+
+static void
+test_read_multi_proc (TestCase *tc,
+                      gconstpointer unused)
+{
+  JsonObject *result;
+  JsonObject *file;
+  JsonArray *paths;
+
+  /* Reports a size of zero */
+  paths = json_array_new ();
+  json_array_add_string_element (paths, "/proc/self/status");
+
+  setup_fsread_multi_channel (tc, paths, 64 * 1024);
+
+  result = recv_json (tc);
+  file = json_object_get_object_member (result, "/proc/self/status");
+  cockpit_assert_strmatch (json_object_get_string_member (file, "content"), "*Name:*");
+  json_object_unref (result);
+
+  wait_channel_closed (tc);
+}
+
+static void
+test_read_multi_denied (TestCase *tc,
+                        gconstpointer unused)
+{
+  JsonObject *result;
+  JsonObject *file;
+  JsonArray *paths;
+
+  if (geteuid () == 0)
+    {
+      g_test_skip ("running as root");
+      return;
+    }
+
+  set_contents (tc->test_path, "Hello!");
+  g_assert (chmod (tc->test_path, 0) >= 0);
+  set_contents (tc->test_path_2, "Readable");
+
+  paths = json_array_new ();
+  json_array_add_string_element (paths, tc->test_path);
+  json_array_add_string_element (paths, tc->test_path_2);
+
+  setup_fsread_multi_channel (tc, paths, -1);
+
+  /* One unreadable file doesn't fail the others */
+  result = recv_json (tc);
+  file = json_object_get_object_member (result, tc->test_path);
+  g_assert_cmpstr (json_object_get_string_member (file, "problem"), ==, "access-denied");
+  file = json_object_get_object_member (result, tc->test_path_2);
+  g_assert_cmpstr (json_object_get_string_member (file, "content"), ==, "Readable");
+  json_object_unref (result);
+
+  wait_channel_closed (tc);
+}
+
+static void
+test_read_multi_invalid (TestCase *tc,
+                         gconstpointer unused)
+{
+  JsonObject *control;
+  JsonArray *paths;
+
+  cockpit_expect_message ("*invalid \"paths\" option*");
+
+  paths = json_array_new ();
+  json_array_add_string_element (paths, tc->test_path);
+  json_array_add_int_element (paths, 5);
+
+  setup_fsread_multi_channel (tc, paths, -1);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "protocol-error");
+}
+
+static void
+test_read_multi_relative (TestCase *tc,
+                          gconstpointer unused)
+{
+  JsonObject *control;
+  JsonArray *paths;
+
+  cockpit_expect_message ("*invalid \"paths\" option*");
+
+  paths = json_array_new ();
+  json_array_add_string_element (paths, tc->test_path);
+  json_array_add_string_element (paths, "etc/passwd");
+
+  setup_fsread_multi_channel (tc, paths, -1);
+  wait_channel_closed (tc);
+
+  control = mock_transport_pop_control (tc->transport);
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "protocol-error");
+}
+
 
 int
 main (int argc,
@@ -1003,6 +2156,23 @@ main (int argc,
               setup, test_read_removed, teardown);
   g_test_add ("/fsread/non-mmappable", TestCase, NULL,
               setup, test_read_non_mmappable, teardown);
+  g_test_add ("/fsread/watch-append", TestCase, NULL,
+              setup, test_read_watch_append, teardown);
+  g_test_add ("/fsread/watch-replace", TestCase, NULL,
+              setup, test_read_watch_replace, teardown);
+  g_test_add ("/fsread/watch-too-large", TestCase, NULL,
+              setup, test_read_watch_too_large, teardown);
+
+  g_test_add ("/fsread-multi/simple", TestCase, NULL,
+              setup, test_read_multi_simple, teardown);
+  g_test_add ("/fsread-multi/proc", TestCase, NULL,
+              setup, test_read_multi_proc, teardown);
+  g_test_add ("/fsread-multi/denied", TestCase, NULL,
+              setup, test_read_multi_denied, teardown);
+  g_test_add ("/fsread-multi/invalid", TestCase, NULL,
+              setup, test_read_multi_invalid, teardown);
+  g_test_add ("/fsread-multi/relative", TestCase, NULL,
+              setup, test_read_multi_relative, teardown);
 
   g_test_add ("/fsreplace/simple", TestCase, NULL,
               setup, test_write_simple, teardown);
@@ -1024,6 +2194,37 @@ main (int argc,
               setup, test_write_expect_tag, teardown);
   g_test_add ("/fsreplace/expect-tag-fail", TestCase, NULL,
               setup, test_write_expect_tag_fail, teardown);
+  g_test_add ("/fsreplace/upload", TestCase, NULL,
+              setup, test_write_upload, teardown);
+  g_test_add ("/fsreplace/upload-resume", TestCase, NULL,
+              setup, test_write_upload_resume, teardown);
+  g_test_add ("/fsreplace/upload-siblings", TestCase, NULL,
+              setup, test_write_upload_siblings, teardown);
+  g_test_add ("/fsreplace/upload-resume-deleted", TestCase, NULL,
+              setup, test_write_upload_resume_deleted, teardown);
+  g_test_add ("/fsreplace/upload-symlink", TestCase, NULL,
+              setup, test_write_upload_symlink, teardown);
+  g_test_add ("/fsreplace/upload-outside", TestCase, NULL,
+              setup, test_write_upload_outside, teardown);
+  g_test_add ("/fsreplace/upload-holes", TestCase, NULL,
+              setup, test_write_upload_holes, teardown);
+  g_test_add ("/fsreplace/upload-checksum", TestCase, NULL,
+              setup, test_write_upload_checksum, teardown);
+  g_test_add ("/fsreplace/upload-invalid", TestCase, NULL,
+              setup, test_write_upload_invalid, teardown);
+
+  g_test_add ("/fsarchive/simple", TestCase, NULL,
+              setup, test_archive_simple, teardown);
+  g_test_add ("/fsarchive/long-name", TestCase, NULL,
+              setup, test_archive_long_name, teardown);
+  g_test_add ("/fsarchive/resume", TestCase, NULL,
+              setup, test_archive_resume, teardown);
+  g_test_add ("/fsarchive/gzip", TestCase, NULL,
+              setup, test_archive_gzip, teardown);
+  g_test_add ("/fsarchive/no-flow-control", TestCase, NULL,
+              setup, test_archive_no_flow_control, teardown);
+  g_test_add ("/fsarchive/not-found", TestCase, NULL,
+              setup, test_archive_not_found, teardown);
 
   g_test_add ("/fswatch/simple", TestCase, NULL,
               setup, test_watch_simple, teardown);
@@ -1040,6 +2241,12 @@ main (int argc,
               setup, test_dir_early_close, teardown);
   g_test_add ("/fslist/watch", TestCase, NULL,
               setup, test_dir_watch, teardown);
+  g_test_add ("/fslist/paged", TestCase, NULL,
+              setup, test_dir_paged, teardown);
+  g_test_add ("/fslist/paged-watch", TestCase, NULL,
+              setup, test_dir_paged_watch, teardown);
+  g_test_add ("/fslist/paged-invalid", TestCase, NULL,
+              setup, test_dir_paged_invalid, teardown);
   g_test_add ("/fslist/list_fail", TestCase, NULL,
               setup, test_dir_list_fail, teardown);
 
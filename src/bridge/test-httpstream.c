@@ -413,6 +413,237 @@ test_http_chunked (void)
   g_slice_free (TestResult, tr);
 }
 
+/*
+ * A minimal keep-alive HTTP/1.1 server, which counts the connections
+ * it accepts. The CockpitWebServer closes after each response, so it
+ * can't be used to exercise connection reuse.
+ */
+
+typedef struct {
+  GSocketService *service;
+  guint port;
+  gint connections;
+  MockTransport *transport;
+  guint channels;
+} TestPool;
+
+static gboolean
+on_pool_incoming (GThreadedSocketService *service,
+                  GSocketConnection *connection,
+                  GObject *source_object,
+                  gpointer user_data)
+{
+  static const gchar response[] = "HTTP/1.1 200 OK\r\nContent-Length: 8\r\n\r\nDa Da Da";
+  TestPool *tp = user_data;
+  GDataInputStream *input;
+  GOutputStream *output;
+  gboolean ok = TRUE;
+  gchar *line;
+
+  g_atomic_int_inc (&tp->connections);
+
+  input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+
+  while (ok)
+    {
+      /* Read the request head, the tests never send a body */
+      line = g_data_input_stream_read_line (input, NULL, NULL, NULL);
+      if (!line)
+        break;
+
+      if (g_str_equal (g_strchomp (line), ""))
+        ok = g_output_stream_write_all (output, response, sizeof (response) - 1, NULL, NULL, NULL);
+      g_free (line);
+    }
+
+  g_object_unref (input);
+  return TRUE;
+}
+
+static void
+setup_pool (TestPool *tp,
+            gconstpointer unused)
+{
+  GError *error = NULL;
+
+  tp->service = g_threaded_socket_service_new (32);
+  tp->port = g_socket_listener_add_any_inet_port (G_SOCKET_LISTENER (tp->service), NULL, &error);
+  g_assert_no_error (error);
+  g_signal_connect (tp->service, "run", G_CALLBACK (on_pool_incoming), tp);
+  g_socket_service_start (tp->service);
+
+  tp->transport = mock_transport_new ();
+}
+
+static void
+teardown_pool (TestPool *tp,
+               gconstpointer unused)
+{
+  g_socket_service_stop (tp->service);
+  g_socket_listener_close (G_SOCKET_LISTENER (tp->service));
+  g_object_unref (tp->service);
+  g_object_unref (tp->transport);
+
+  cockpit_assert_expected ();
+}
+
+static CockpitChannel *
+pool_request (TestPool *tp,
+              const gchar *connection,
+              gint idle_connections,
+              gboolean *closed)
+{
+  CockpitChannel *channel;
+  JsonObject *options;
+  gchar *id;
+  gchar *control;
+  GBytes *bytes;
+
+  id = g_strdup_printf ("pool-%u", tp->channels++);
+
+  options = json_object_new ();
+  json_object_set_int_member (options, "port", tp->port);
+  json_object_set_string_member (options, "payload", "http-stream2");
+  json_object_set_string_member (options, "method", "GET");
+  json_object_set_string_member (options, "path", "/");
+  json_object_set_string_member (options, "connection", connection);
+  json_object_set_int_member (options, "idle-connections", idle_connections);
+
+  channel = g_object_new (COCKPIT_TYPE_HTTP_STREAM,
+                          "transport", tp->transport,
+                          "id", id,
+                          "options", options,
+                          NULL);
+  json_object_unref (options);
+
+  *closed = FALSE;
+  g_signal_connect (channel, "closed", G_CALLBACK (on_closed_set_flag), closed);
+
+  control = g_strdup_printf ("{\"command\": \"done\", \"channel\": \"%s\"}", id);
+  bytes = g_bytes_new_take (control, strlen (control));
+  cockpit_transport_emit_recv (COCKPIT_TRANSPORT (tp->transport), NULL, bytes);
+  g_bytes_unref (bytes);
+
+  g_free (id);
+  return channel;
+}
+
+static void
+pool_requests (TestPool *tp,
+               const gchar *connection,
+               gint idle_connections,
+               guint count)
+{
+  CockpitChannel *channels[8];
+  gboolean closed[8];
+  gboolean all;
+  guint i;
+
+  g_assert (count <= G_N_ELEMENTS (channels));
+
+  /* All in flight at the same time, each needs its own connection */
+  for (i = 0; i < count; i++)
+    channels[i] = pool_request (tp, connection, idle_connections, closed + i);
+
+  do
+    {
+      g_main_context_iteration (NULL, TRUE);
+      for (all = TRUE, i = 0; i < count; i++)
+        all = all && closed[i];
+    }
+  while (!all);
+
+  for (i = 0; i < count; i++)
+    g_object_unref (channels[i]);
+}
+
+static void
+test_pool_reuse (TestPool *tp,
+                 gconstpointer unused)
+{
+  pool_requests (tp, "pool-reuse", 2, 3);
+  g_assert_cmpint (g_atomic_int_get (&tp->connections), ==, 3);
+
+  /* Two were kept idle, the third was closed */
+  pool_requests (tp, "pool-reuse", 2, 3);
+  g_assert_cmpint (g_atomic_int_get (&tp->connections), ==, 4);
+
+  /* Sequential requests keep using the most recent connection */
+  pool_requests (tp, "pool-reuse", 2, 1);
+  pool_requests (tp, "pool-reuse", 2, 1);
+  pool_requests (tp, "pool-reuse", 2, 1);
+  g_assert_cmpint (g_atomic_int_get (&tp->connections), ==, 4);
+}
+
+static void
+test_pool_disabled (TestPool *tp,
+                    gconstpointer unused)
+{
+  pool_requests (tp, "pool-disabled", 0, 2);
+  pool_requests (tp, "pool-disabled", 0, 2);
+  g_assert_cmpint (g_atomic_int_get (&tp->connections), ==, 4);
+}
+
+static void
+test_pool_invalid (TestPool *tp,
+                   gconstpointer unused)
+{
+  CockpitChannel *channel;
+  gboolean closed;
+
+  cockpit_expect_message ("*invalid \"idle-connections\" field*");
+
+  channel = pool_request (tp, "pool-invalid", -1, &closed);
+  while (!closed)
+    g_main_context_iteration (NULL, TRUE);
+  g_object_unref (channel);
+
+  g_assert_cmpint (g_atomic_int_get (&tp->connections), ==, 0);
+}
+
+static gdouble
+pool_benchmark (TestPool *tp,
+                const gchar *connection,
+                gint idle_connections,
+                guint requests)
+{
+  guint i;
+
+  g_test_timer_start ();
+  for (i = 0; i < requests; i++)
+    {
+      pool_requests (tp, connection, idle_connections, 8);
+
+      /* Don't let the output of earlier rounds pile up */
+      g_object_unref (tp->transport);
+      tp->transport = mock_transport_new ();
+    }
+  return g_test_timer_elapsed ();
+}
+
+static void
+test_pool_benchmark (TestPool *tp,
+                     gconstpointer unused)
+{
+  const guint rounds = 500;
+  gdouble pooled;
+  gdouble unpooled;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("only run in perf mode, use -m perf");
+      return;
+    }
+
+  unpooled = pool_benchmark (tp, "pool-bench-off", 0, rounds);
+  pooled = pool_benchmark (tp, "pool-bench-on", 8, rounds);
+
+  g_test_message ("%u requests without pool: %.3f s, with pool: %.3f s, %d connections",
+                  rounds * 8, unpooled, pooled, g_atomic_int_get (&tp->connections));
+  g_test_maximized_result (rounds * 8 / pooled, "pooled requests per second");
+}
+
 static void
 test_parse_keep_alive (void)
 {
@@ -883,6 +1114,15 @@ main (int argc,
   g_test_add ("/http-stream/cannot-connect", TestGeneral, NULL,
               setup_general, test_cannot_connect, teardown_general);
 
+  g_test_add ("/http-stream/pool/reuse", TestPool, NULL,
+              setup_pool, test_pool_reuse, teardown_pool);
+  g_test_add ("/http-stream/pool/disabled", TestPool, NULL,
+              setup_pool, test_pool_disabled, teardown_pool);
+  g_test_add ("/http-stream/pool/invalid", TestPool, NULL,
+              setup_pool, test_pool_invalid, teardown_pool);
+  g_test_add ("/http-stream/pool/benchmark", TestPool, NULL,
+              setup_pool, test_pool_benchmark, teardown_pool);
+
   g_test_add_func  ("/http-stream/parse_keepalive", test_parse_keep_alive);
   g_test_add_func  ("/http-stream/http_chunked", test_http_chunked);
 
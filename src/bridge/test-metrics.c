@@ -23,6 +23,7 @@
 #include "cockpitmetrics.h"
 
 #include "cockpitinternalmetrics.h"
+#include "cockpitdbuscachesamples.h"
 
 #include "common/cockpittest.h"
 #include "common/cockpitjson.h"
@@ -719,6 +720,114 @@ test_deprecated_net_all (void)
   g_object_unref (transport);
 }
 
+static void
+mock_dbus_cache_stats (gpointer source,
+                       CockpitDBusCacheStats *stats)
+{
+  stats->objects = GPOINTER_TO_INT (source);
+  stats->barrier_usec = 5000;
+  stats->depth[cockpit_dbus_cache_stats_bucket (3)] = 2;
+}
+
+static void
+test_dbus_cache (void)
+{
+  MockTransport *transport = mock_transport_new ();
+  CockpitChannel *channel;
+  JsonObject *options = json_obj ("{ 'metrics': [ { 'name': 'dbus.cache.objects' },"
+                                  "               { 'name': 'dbus.cache.barrier-time' },"
+                                  "               { 'name': 'dbus.cache.depth.4' } ],"
+                                  "  'interval': 100"
+                                  "}");
+  GBytes *msg;
+  JsonObject *res, *metric;
+  JsonNode *node;
+  JsonArray *metrics, *instances, *values;
+
+  /* Two caches with the same name are added together */
+  cockpit_dbus_cache_stats_register (GINT_TO_POINTER (3), "mock", mock_dbus_cache_stats);
+  cockpit_dbus_cache_stats_register (GINT_TO_POINTER (4), "mock", mock_dbus_cache_stats);
+
+  g_signal_connect (transport, "closed", G_CALLBACK (on_transport_closed), NULL);
+
+  channel = g_object_new (cockpit_internal_metrics_get_type (),
+                          "transport", transport,
+                          "id", "1234",
+                          "options", options,
+                          NULL);
+
+  cockpit_metrics_set_compress (COCKPIT_METRICS (channel), FALSE);
+  cockpit_channel_prepare (channel);
+
+  /* receive meta information */
+  while ((msg = mock_transport_pop_channel (transport, "1234")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  res = cockpit_json_parse_bytes (msg, NULL);
+  g_assert (res != NULL);
+
+  metrics = json_object_get_array_member (res, "metrics");
+  g_assert_cmpint (json_array_get_length (metrics), ==, 3);
+  metric = json_array_get_object_element (metrics, 1);
+  g_assert_cmpstr (json_object_get_string_member (metric, "name"), ==, "dbus.cache.barrier-time");
+  g_assert_cmpstr (json_object_get_string_member (metric, "units"), ==, "millisec");
+  instances = json_object_get_array_member (metric, "instances");
+  g_assert_cmpint (json_array_get_length (instances), ==, 1);
+  g_assert_cmpstr (json_array_get_string_element (instances, 0), ==, "mock");
+
+  json_object_unref (res);
+
+  /* receive data; should have the form [[[7],[10],[4]]] */
+  while ((msg = mock_transport_pop_channel (transport, "1234")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  node = cockpit_json_parse (g_bytes_get_data (msg, NULL), g_bytes_get_size (msg), NULL);
+  g_assert (node);
+  metrics = json_node_get_array (node);
+  g_assert_cmpint (json_array_get_length (metrics), ==, 1);
+  values = json_array_get_array_element (metrics, 0);
+  g_assert_cmpint (json_array_get_length (values), ==, 3);
+  g_assert_cmpint (json_array_get_int_element (json_array_get_array_element (values, 0), 0), ==, 7);
+  g_assert_cmpint (json_array_get_int_element (json_array_get_array_element (values, 1), 0), ==, 10);
+  g_assert_cmpint (json_array_get_int_element (json_array_get_array_element (values, 2), 0), ==, 4);
+
+  json_node_free (node);
+
+  /* A cache going away doesn't take its counters along */
+  cockpit_dbus_cache_stats_unregister (GINT_TO_POINTER (3));
+  for (;;)
+    {
+      while ((msg = mock_transport_pop_channel (transport, "1234")) == NULL)
+        g_main_context_iteration (NULL, TRUE);
+      node = cockpit_json_parse (g_bytes_get_data (msg, NULL), g_bytes_get_size (msg), NULL);
+      g_assert (node);
+      values = json_array_get_array_element (json_node_get_array (node), 0);
+      if (json_array_get_int_element (json_array_get_array_element (values, 0), 0) == 4)
+        break;
+      json_node_free (node);
+    }
+  g_assert_cmpint (json_array_get_int_element (json_array_get_array_element (values, 1), 0), ==, 10);
+  g_assert_cmpint (json_array_get_int_element (json_array_get_array_element (values, 2), 0), ==, 4);
+  json_node_free (node);
+
+  cockpit_dbus_cache_stats_unregister (GINT_TO_POINTER (4));
+
+  g_object_unref (channel);
+  json_object_unref (options);
+  g_object_unref (transport);
+}
+
+static void
+test_dbus_cache_bucket (void)
+{
+  g_assert_cmpuint (cockpit_dbus_cache_stats_bucket (0), ==, 0);
+  g_assert_cmpuint (cockpit_dbus_cache_stats_bucket (1), ==, 0);
+  g_assert_cmpuint (cockpit_dbus_cache_stats_bucket (2), ==, 1);
+  g_assert_cmpuint (cockpit_dbus_cache_stats_bucket (4), ==, 1);
+  g_assert_cmpuint (cockpit_dbus_cache_stats_bucket (5), ==, 2);
+  g_assert_cmpuint (cockpit_dbus_cache_stats_bucket (256), ==, 4);
+  g_assert_cmpuint (cockpit_dbus_cache_stats_bucket (257), ==, 5);
+  g_assert_cmpuint (cockpit_dbus_cache_stats_bucket (100000), ==, 5);
+}
+
 int
 main (int argc,
       char *argv[])
@@ -746,5 +855,8 @@ main (int argc,
 
   g_test_add_func ("/metrics/deprecated-net-all", test_deprecated_net_all);
 
+  g_test_add_func ("/metrics/dbus-cache", test_dbus_cache);
+  g_test_add_func ("/metrics/dbus-cache-bucket", test_dbus_cache_bucket);
+
   return g_test_run ();
 }
@@ -0,0 +1,283 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitnfsmounts.h"
+
+#include "common/cockpitjson.h"
+#include "common/cockpittest.h"
+#include "common/mock-transport.h"
+
+#include <glib/gstdio.h>
+
+#include <string.h>
+#include <unistd.h>
+
+#define TIMEOUT 30
+
+extern const gchar *cockpit_nfs_mounts_fstab;
+extern const gchar *cockpit_nfs_mounts_table;
+
+typedef struct {
+  MockTransport *transport;
+  CockpitChannel *channel;
+  gchar *test_dir;
+  gchar *fstab;
+  gchar *mounts;
+  gchar *mount_a;
+  gchar *mount_b;
+} TestCase;
+
+static void
+write_tab (const gchar *path,
+           gchar *contents)
+{
+  GError *error = NULL;
+
+  g_file_set_contents (path, contents, -1, &error);
+  g_assert_no_error (error);
+  g_free (contents);
+}
+
+static void
+setup (TestCase *tc,
+       gconstpointer data)
+{
+  alarm (TIMEOUT);
+
+  tc->test_dir = g_dir_make_tmp ("cockpit-test-nfs-XXXXXX", NULL);
+  g_assert (tc->test_dir != NULL);
+
+  tc->fstab = g_build_filename (tc->test_dir, "fstab", NULL);
+  tc->mounts = g_build_filename (tc->test_dir, "mounts", NULL);
+  tc->mount_a = g_build_filename (tc->test_dir, "a", NULL);
+  tc->mount_b = g_build_filename (tc->test_dir, "b", NULL);
+  g_assert (g_mkdir (tc->mount_a, 0700) == 0);
+  g_assert (g_mkdir (tc->mount_b, 0700) == 0);
+
+  /* The test directory stands in for the mount points */
+  write_tab (tc->fstab, g_strdup_printf ("# A comment\n"
+                                         "UUID=1234 / xfs defaults 0 0\n"
+                                         "server:/export %s/a nfs defaults 0 0\n"
+                                         "server:/other\t%s/with\\040space  nfs4 defaults 0 0\n",
+                                         tc->test_dir, tc->test_dir));
+  write_tab (tc->mounts, g_strdup_printf ("/dev/sda1 / xfs rw 0 0\n"
+                                          "server:/export %s/a nfs rw,vers=4 0 0\n"
+                                          "server:/extra %s/b nfs4 rw 0 0\n"
+                                          "server:/gone %s/gone nfs4 rw 0 0\n",
+                                          tc->test_dir, tc->test_dir, tc->test_dir));
+
+  cockpit_nfs_mounts_fstab = tc->fstab;
+  cockpit_nfs_mounts_table = tc->mounts;
+
+  tc->transport = mock_transport_new ();
+}
+
+static void
+teardown (TestCase *tc,
+          gconstpointer data)
+{
+  cockpit_assert_expected ();
+
+  if (tc->channel)
+    {
+      g_object_add_weak_pointer (G_OBJECT (tc->channel), (gpointer *)&tc->channel);
+      g_object_unref (tc->channel);
+      g_assert (tc->channel == NULL);
+    }
+
+  g_object_unref (tc->transport);
+
+  g_assert (g_unlink (tc->fstab) == 0);
+  g_assert (g_unlink (tc->mounts) == 0);
+  g_assert (g_rmdir (tc->mount_a) == 0);
+  g_assert (g_rmdir (tc->mount_b) == 0);
+  g_assert (g_rmdir (tc->test_dir) == 0);
+
+  g_free (tc->fstab);
+  g_free (tc->mounts);
+  g_free (tc->mount_a);
+  g_free (tc->mount_b);
+  g_free (tc->test_dir);
+
+  alarm (0);
+}
+
+static void
+open_channel (TestCase *tc)
+{
+  JsonObject *options;
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "nfs-mounts1");
+  json_object_set_int_member (options, "interval", 0);
+
+  tc->channel = g_object_new (COCKPIT_TYPE_NFS_MOUNTS,
+                              "transport", tc->transport,
+                              "id", "548",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+
+  cockpit_channel_prepare (tc->channel);
+}
+
+static JsonObject *
+recv_json (TestCase *tc)
+{
+  GBytes *msg;
+  JsonObject *res;
+
+  while ((msg = mock_transport_pop_channel (tc->transport, "548")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  res = cockpit_json_parse_bytes (msg, NULL);
+  g_assert (res != NULL);
+  return res;
+}
+
+static void
+assert_usage (JsonObject *usage,
+              const gchar *path)
+{
+  JsonArray *array;
+
+  array = json_object_get_array_member (usage, path);
+  g_assert (array != NULL);
+  g_assert_cmpuint (json_array_get_length (array), ==, 2);
+  g_assert_cmpint (json_array_get_int_element (array, 1), >, 0);
+  g_assert_cmpint (json_array_get_int_element (array, 0), <=, json_array_get_int_element (array, 1));
+}
+
+static void
+test_entries (TestCase *tc,
+              gconstpointer data)
+{
+  JsonObject *object;
+  JsonObject *usage;
+  JsonArray *entries;
+  gchar *expected;
+
+  open_channel (tc);
+
+  object = recv_json (tc);
+  entries = json_object_get_array_member (object, "entries");
+  g_assert (entries != NULL);
+  expected = g_strdup_printf ("["
+                              " {\"fstab\":true,\"fields\":[\"server:/export\",\"%s/a\",\"nfs\",\"defaults\",\"0\",\"0\"],\"mounted\":true},"
+                              " {\"fstab\":true,\"fields\":[\"server:/other\",\"%s/with space\",\"nfs4\",\"defaults\",\"0\",\"0\"],\"mounted\":false},"
+                              " {\"fstab\":false,\"fields\":[\"server:/extra\",\"%s/b\",\"nfs4\",\"rw\",\"0\",\"0\"],\"mounted\":true},"
+                              " {\"fstab\":false,\"fields\":[\"server:/gone\",\"%s/gone\",\"nfs4\",\"rw\",\"0\",\"0\"],\"mounted\":true}"
+                              "]", tc->test_dir, tc->test_dir, tc->test_dir, tc->test_dir);
+  cockpit_assert_json_eq (entries, expected);
+  g_free (expected);
+  json_object_unref (object);
+
+  /* Usage of all mounted entries comes in one message */
+  object = recv_json (tc);
+  usage = json_object_get_object_member (object, "usage");
+  g_assert (usage != NULL);
+  g_assert_cmpuint (json_object_get_size (usage), ==, 3);
+  assert_usage (usage, tc->mount_a);
+  assert_usage (usage, tc->mount_b);
+
+  /* A mount point that can't be looked at */
+  expected = g_build_filename (tc->test_dir, "gone", NULL);
+  g_assert (json_object_has_member (usage, expected));
+  g_assert (json_object_get_null_member (usage, expected));
+  g_free (expected);
+
+  json_object_unref (object);
+}
+
+static void
+test_fstab_changed (TestCase *tc,
+                    gconstpointer data)
+{
+  JsonObject *object;
+  JsonObject *usage;
+  JsonArray *entries;
+
+  open_channel (tc);
+
+  object = recv_json (tc);
+  json_object_unref (object);
+  object = recv_json (tc);
+  json_object_unref (object);
+
+  write_tab (tc->fstab, g_strdup_printf ("server:/export %s/a nfs defaults 0 0\n", tc->test_dir));
+
+  object = recv_json (tc);
+  entries = json_object_get_array_member (object, "entries");
+  g_assert (entries != NULL);
+  g_assert_cmpuint (json_array_get_length (entries), ==, 3);
+  json_object_unref (object);
+
+  /* The client forgets usage on new entries, so all of it is sent again */
+  object = recv_json (tc);
+  usage = json_object_get_object_member (object, "usage");
+  g_assert (usage != NULL);
+  g_assert_cmpuint (json_object_get_size (usage), ==, 3);
+  assert_usage (usage, tc->mount_a);
+  json_object_unref (object);
+}
+
+static void
+test_bad_option (TestCase *tc,
+                 gconstpointer data)
+{
+  JsonObject *options;
+  JsonObject *control;
+
+  cockpit_expect_message ("*invalid \"timeout\" option*");
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "nfs-mounts1");
+  json_object_set_string_member (options, "timeout", "soon");
+
+  tc->channel = g_object_new (COCKPIT_TYPE_NFS_MOUNTS,
+                              "transport", tc->transport,
+                              "id", "548",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+  cockpit_channel_prepare (tc->channel);
+
+  while ((control = mock_transport_pop_control (tc->transport)) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "close");
+  g_assert_cmpstr (json_object_get_string_member (control, "problem"), ==, "protocol-error");
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add ("/nfs-mounts/entries", TestCase, NULL,
+              setup, test_entries, teardown);
+  g_test_add ("/nfs-mounts/fstab-changed", TestCase, NULL,
+              setup, test_fstab_changed, teardown);
+  g_test_add ("/nfs-mounts/bad-option", TestCase, NULL,
+              setup, test_bad_option, teardown);
+
+  return g_test_run ();
+}
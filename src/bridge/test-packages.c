@@ -735,12 +735,12 @@ test_list_bad_name (TestCase *tc,
   data = mock_transport_pop_channel (tc->transport, "444");
   object = cockpit_json_parse_bytes (data, &error);
   g_assert_no_error (error);
-  cockpit_assert_json_eq (object, "{\"status\":200,\"reason\":\"OK\",\"headers\":{" STATIC_HEADERS ",\"Content-Type\":\"application/json\",\"X-Cockpit-Pkg-Checksum\":\"" CHECKSUM_BADPACKAGE "\",\"ETag\":\"\\\"$" CHECKSUM_BADPACKAGE "\\\"\"}}");
+  cockpit_assert_json_eq (object, "{\"status\":200,\"reason\":\"OK\",\"headers\":{" STATIC_HEADERS ",\"Content-Type\":\"application/json\",\"X-Cockpit-Pkg-Checksum\":\"" CHECKSUM_BADPACKAGE "\",\"ETag\":\"\\\"$" CHECKSUM_BADPACKAGE "\\\"\",\"X-Cockpit-Pkg-Checksums\":\"ok=" CHECKSUM_BADPACKAGE "\"}}");
   json_object_unref (object);
 
   data = mock_transport_combine_output (tc->transport, "444", &count);
   g_assert_cmpint (count, ==, 1);
-  cockpit_assert_bytes_eq (data, "{\".checksum\":\"" CHECKSUM_BADPACKAGE "\",\"ok\":{\".checksum\":\"" CHECKSUM_BADPACKAGE "\"}}", -1);
+  cockpit_assert_bytes_eq (data, "{\".checksum\":\"" CHECKSUM_BADPACKAGE "\",\"ok\":{\".checksum\":\"" CHECKSUM_BADPACKAGE "\",\".package-checksum\":\"" CHECKSUM_BADPACKAGE "\"}}", -1);
   g_bytes_unref (data);
 }
 
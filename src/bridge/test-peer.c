@@ -20,9 +20,11 @@
 #include "config.h"
 
 #include "cockpitpeer.h"
+#include "cockpitpeersamples.h"
 
 #include "common/cockpitchannel.h"
 #include "common/cockpitjson.h"
+#include "common/cockpitpipetransport.h"
 #include "common/cockpittest.h"
 #include "common/mock-transport.h"
 
@@ -31,6 +33,8 @@
 #include <gio/gio.h>
 #include <glib/gstdio.h>
 
+#include <sys/socket.h>
+
 #include <string.h>
 #include <unistd.h>
 
@@ -541,6 +545,258 @@ test_timeout (TestCase *tc,
   g_object_unref (other);
 }
 
+static void
+test_standby (TestCase *tc,
+              gconstpointer unused)
+{
+  const gchar *bridge;
+  CockpitPeerStats *stats;
+  CockpitTransport *other = NULL;
+  JsonObject *control;
+  gboolean closed = FALSE;
+  GBytes *sent;
+
+  cockpit_peer_stats_reset ();
+  stats = cockpit_peer_stats_get (BUILDDIR "/mock-bridge");
+
+  bridge = "{ \"match\": { \"payload\": \"upper\" }, \"standby\": true, \"timeout\": 1, \"spawn\": [ \"" BUILDDIR "/mock-bridge" "\", \"--upper\", \"--count\" ] }";
+  tc->peer = peer_new (tc->transport, bridge);
+
+  /* Starts once, without any channel */
+  g_assert (cockpit_peer_standby (tc->peer));
+  g_assert (!cockpit_peer_standby (tc->peer));
+  g_assert_cmpint (stats->spawns, ==, 1);
+  g_assert_cmpint (stats->standby, ==, 1);
+  g_assert_cmpint (stats->running, ==, 1);
+
+  /* Nobody uses it, so the idle timeout shuts it down */
+  other = g_object_ref (cockpit_peer_ensure (tc->peer));
+  g_signal_connect (other, "closed", G_CALLBACK (on_other_closed), &closed);
+  while (!closed)
+    g_main_context_iteration (NULL, TRUE);
+  g_object_unref (other);
+
+  g_assert_cmpint (stats->idle, ==, 1);
+  g_assert_cmpint (stats->running, ==, 0);
+  g_assert_cmpint (stats->spawn_usec, >, 0);
+
+  /* Channels still work after that */
+  emit_string (tc, NULL, "{\"command\": \"open\", \"channel\": \"a\", \"payload\": \"upper\"}");
+  emit_string (tc, "a", "Oh MarmaLade");
+
+  while ((control = mock_transport_pop_control (tc->transport)) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_json_eq (control, "{\"command\":\"ready\",\"channel\":\"a\",\"count\":0}");
+
+  while ((sent = mock_transport_pop_channel (tc->transport, "a")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_bytes_eq (sent, "OH MARMALADE", -1);
+
+  g_assert_cmpint (stats->spawns, ==, 2);
+  g_assert_cmpint (stats->standby, ==, 1);
+  g_assert_cmpint (stats->running, ==, 1);
+}
+
+static void
+test_standby_not_configured (TestCase *tc,
+                             gconstpointer unused)
+{
+  tc->peer = mock_peer_simple_new (tc->transport, "upper");
+  g_assert (!cockpit_peer_standby (tc->peer));
+}
+
+/*
+ * Here both sides of the peer are real pipe transports, so channel
+ * frames are relayed verbatim rather than parsed and framed again.
+ */
+typedef struct {
+  CockpitTransport *transport;
+  CockpitTransport *test;
+  CockpitPeer *peer;
+  GString *received;
+  gsize count;
+  gboolean ready;
+} RelayCase;
+
+static gboolean
+on_relay_open (CockpitTransport *transport,
+               const char *command,
+               const gchar *channel,
+               JsonObject *options,
+               GBytes *message,
+               gpointer user_data)
+{
+  RelayCase *rc = user_data;
+
+  if (channel && g_str_equal (command, "open"))
+    return cockpit_peer_handle (rc->peer, channel, options, message);
+  return FALSE;
+}
+
+static gboolean
+on_relay_control (CockpitTransport *transport,
+                  const char *command,
+                  const gchar *channel,
+                  JsonObject *options,
+                  GBytes *message,
+                  gpointer user_data)
+{
+  RelayCase *rc = user_data;
+
+  if (g_str_equal (command, "ready"))
+    rc->ready = TRUE;
+  return TRUE;
+}
+
+static gboolean
+on_relay_recv (CockpitTransport *transport,
+               const gchar *channel,
+               GBytes *payload,
+               gpointer user_data)
+{
+  RelayCase *rc = user_data;
+  gsize length;
+  gconstpointer data;
+
+  g_assert_cmpstr (channel, ==, "a");
+  data = g_bytes_get_data (payload, &length);
+  if (rc->received)
+    g_string_append_len (rc->received, data, length);
+  rc->count += length;
+  return TRUE;
+}
+
+static void
+relay_setup (RelayCase *rc,
+             gboolean collect)
+{
+  const gchar *init = "{ \"command\": \"init\", \"version\": 1, \"host\": \"localhost\" }";
+  const gchar *bridge = "{ \"match\": { \"payload\": \"upper\" }, \"spawn\": [ \"" BUILDDIR "/mock-bridge\", \"--upper\" ] }";
+  GError *error = NULL;
+  JsonObject *config;
+  GBytes *bytes;
+  int fds[2];
+
+  g_assert (socketpair (PF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+
+  rc->transport = cockpit_pipe_transport_new_fds ("relay", fds[0], fds[0]);
+  rc->test = cockpit_pipe_transport_new_fds ("test", fds[1], fds[1]);
+
+  config = cockpit_json_parse_object (bridge, -1, &error);
+  g_assert_no_error (error);
+  rc->peer = cockpit_peer_new (rc->transport, config);
+  json_object_unref (config);
+
+  if (collect)
+    rc->received = g_string_new ("");
+
+  g_signal_connect (rc->transport, "control", G_CALLBACK (on_relay_open), rc);
+  g_signal_connect (rc->test, "control", G_CALLBACK (on_relay_control), rc);
+  g_signal_connect (rc->test, "recv", G_CALLBACK (on_relay_recv), rc);
+
+  bytes = g_bytes_new_static (init, strlen (init));
+  cockpit_transport_send (rc->test, NULL, bytes);
+  g_bytes_unref (bytes);
+
+  bytes = cockpit_transport_build_control ("command", "open", "channel", "a", "payload", "upper", NULL);
+  cockpit_transport_send (rc->test, NULL, bytes);
+  g_bytes_unref (bytes);
+
+  while (!rc->ready)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+relay_teardown (RelayCase *rc)
+{
+  g_object_add_weak_pointer (G_OBJECT (rc->peer), (gpointer *)&rc->peer);
+  g_object_unref (rc->peer);
+  g_assert (rc->peer == NULL);
+
+  g_object_unref (rc->transport);
+  g_object_unref (rc->test);
+  if (rc->received)
+    g_string_free (rc->received, TRUE);
+}
+
+static void
+test_relay (void)
+{
+  RelayCase rc = { NULL, };
+  GString *expected;
+  GBytes *bytes;
+  gchar *data;
+  gint i;
+
+  relay_setup (&rc, TRUE);
+
+  /* Lots of small frames, which get relayed in batches */
+  expected = g_string_new ("");
+  for (i = 0; i < 1000; i++)
+    {
+      data = g_strdup_printf ("frame %d;", i);
+      g_string_append (expected, data);
+      bytes = g_bytes_new_take (data, strlen (data));
+      cockpit_transport_send (rc.test, "a", bytes);
+      g_bytes_unref (bytes);
+    }
+
+  while (rc.received->len < expected->len)
+    g_main_context_iteration (NULL, TRUE);
+
+  data = g_ascii_strup (expected->str, expected->len);
+  g_assert_cmpstr (rc.received->str, ==, data);
+  g_free (data);
+
+  g_string_free (expected, TRUE);
+  relay_teardown (&rc);
+}
+
+static void
+test_relay_throughput (void)
+{
+  const gsize frame = 64 * 1024;
+  const gsize total = 256 * 1024 * 1024;
+  RelayCase rc = { NULL, };
+  GBytes *bytes;
+  gdouble elapsed;
+  gchar *data;
+  gsize sent;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("only run in perf mode, use -m perf");
+      return;
+    }
+
+  relay_setup (&rc, FALSE);
+
+  data = g_malloc (frame);
+  memset (data, 'x', frame);
+  bytes = g_bytes_new_take (data, frame);
+
+  g_test_timer_start ();
+
+  /* Keep a bounded amount of data in flight */
+  for (sent = 0; sent < total; sent += frame)
+    {
+      cockpit_transport_send (rc.test, "a", bytes);
+      while (sent + frame > rc.count + 16 * frame)
+        g_main_context_iteration (NULL, TRUE);
+    }
+  while (rc.count < total)
+    g_main_context_iteration (NULL, TRUE);
+
+  elapsed = g_test_timer_elapsed ();
+
+  g_bytes_unref (bytes);
+  relay_teardown (&rc);
+
+  g_test_maximized_result (total / elapsed / (1024 * 1024),
+                           "relayed %" G_GSIZE_FORMAT " MiB in %.2f s: %.1f MiB/s",
+                           total / (1024 * 1024), elapsed, total / elapsed / (1024 * 1024));
+}
+
 static void
 test_reopen_fail (TestCase *tc,
                   gconstpointer unused)
@@ -614,5 +870,11 @@ main (int argc,
               setup, test_reopen_fail, teardown);
   g_test_add ("/peer/timeout", TestCase, NULL,
               setup, test_timeout, teardown);
+  g_test_add ("/peer/standby", TestCase, NULL,
+              setup, test_standby, teardown);
+  g_test_add ("/peer/standby-not-configured", TestCase, NULL,
+              setup, test_standby_not_configured, teardown);
+  g_test_add_func ("/peer/relay", test_relay);
+  g_test_add_func ("/peer/relay-throughput", test_relay_throughput);
   return g_test_run ();
 }
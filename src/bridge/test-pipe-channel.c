@@ -831,6 +831,237 @@ test_recv_valid_batched (TestCase *tc,
   g_bytes_unref (received);
 }
 
+static CockpitChannel *
+open_cached_spawn (MockTransport *transport,
+                   const gchar *id,
+                   const gchar *script,
+                   gint64 cache,
+                   gchar **problem)
+{
+  CockpitChannel *channel;
+  JsonObject *options;
+  JsonArray *array;
+
+  options = json_object_new ();
+  array = json_array_new ();
+  json_array_add_string_element (array, "/bin/sh");
+  json_array_add_string_element (array, "-c");
+  json_array_add_string_element (array, script);
+  json_object_set_array_member (options, "spawn", array);
+  json_object_set_string_member (options, "payload", "stream");
+  json_object_set_int_member (options, "cache", cache);
+
+  channel = g_object_new (COCKPIT_TYPE_PIPE_CHANNEL,
+                          "options", options,
+                          "id", id,
+                          "transport", transport,
+                          NULL);
+  g_signal_connect (channel, "closed", G_CALLBACK (on_closed_get_problem), problem);
+  json_object_unref (options);
+
+  return channel;
+}
+
+static gchar *
+pop_channel_output (MockTransport *transport,
+                    const gchar *id)
+{
+  GString *string;
+  gconstpointer data;
+  GBytes *sent;
+  gsize len;
+
+  string = g_string_new ("");
+  while ((sent = mock_transport_pop_channel (transport, id)) != NULL)
+    {
+      data = g_bytes_get_data (sent, &len);
+      g_string_append_len (string, data, len);
+    }
+
+  return g_string_free (string, FALSE);
+}
+
+static void
+test_spawn_cache (void)
+{
+  MockTransport *transport;
+  CockpitChannel *channel;
+  gchar *problem = NULL;
+  JsonObject *control;
+  gchar *first;
+  gchar *second;
+  gchar *other;
+
+  const gchar *script = "cat /proc/sys/kernel/random/uuid; exit 3";
+
+  transport = g_object_new (mock_transport_get_type (), NULL);
+
+  channel = open_cached_spawn (transport, "1", script, 60 * 1000, &problem);
+  while (!problem)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpstr (problem, ==, "");
+  g_clear_pointer (&problem, g_free);
+  g_object_unref (channel);
+  first = pop_channel_output (transport, "1");
+  g_assert_cmpuint (strlen (first), >, 0);
+
+  /* Served from the cache, including the exit status */
+  channel = open_cached_spawn (transport, "2", script, 60 * 1000, &problem);
+  while (!problem)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpstr (problem, ==, "");
+  g_clear_pointer (&problem, g_free);
+  g_object_unref (channel);
+  second = pop_channel_output (transport, "2");
+  g_assert_cmpstr (first, ==, second);
+
+  while ((control = mock_transport_pop_control (transport)) != NULL)
+    {
+      if (g_str_equal (json_object_get_string_member (control, "command"), "close"))
+        g_assert_cmpint (json_object_get_int_member (control, "exit-status"), ==, 3);
+    }
+
+  /* A different command is not */
+  channel = open_cached_spawn (transport, "3", "cat /proc/sys/kernel/random/uuid", 60 * 1000, &problem);
+  while (!problem)
+    g_main_context_iteration (NULL, TRUE);
+  g_clear_pointer (&problem, g_free);
+  g_object_unref (channel);
+  other = pop_channel_output (transport, "3");
+  g_assert_cmpstr (first, !=, other);
+
+  g_free (first);
+  g_free (second);
+  g_free (other);
+  g_object_unref (transport);
+}
+
+static void
+test_spawn_cache_coalesce (void)
+{
+  MockTransport *transport;
+  CockpitChannel *one;
+  CockpitChannel *two;
+  CockpitChannel *three;
+  gchar *problem1 = NULL;
+  gchar *problem2 = NULL;
+  gchar *problem3 = NULL;
+  gchar *output1;
+  gchar *output2;
+  gchar *output3;
+
+  const gchar *script = "sleep 0.1; cat /proc/sys/kernel/random/uuid";
+
+  transport = g_object_new (mock_transport_get_type (), NULL);
+
+  /* A zero cache time only coalesces concurrent requests */
+  one = open_cached_spawn (transport, "1", script, 0, &problem1);
+  two = open_cached_spawn (transport, "2", script, 0, &problem2);
+  while (!problem1 || !problem2)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpstr (problem1, ==, "");
+  g_assert_cmpstr (problem2, ==, "");
+
+  output1 = pop_channel_output (transport, "1");
+  output2 = pop_channel_output (transport, "2");
+  g_assert_cmpuint (strlen (output1), >, 0);
+  g_assert_cmpstr (output1, ==, output2);
+
+  three = open_cached_spawn (transport, "3", script, 0, &problem3);
+  while (!problem3)
+    g_main_context_iteration (NULL, TRUE);
+  output3 = pop_channel_output (transport, "3");
+  g_assert_cmpstr (output1, !=, output3);
+
+  g_object_unref (one);
+  g_object_unref (two);
+  g_object_unref (three);
+  g_free (problem1);
+  g_free (problem2);
+  g_free (problem3);
+  g_free (output1);
+  g_free (output2);
+  g_free (output3);
+  g_object_unref (transport);
+}
+
+static void
+test_spawn_cache_early_close (void)
+{
+  MockTransport *transport;
+  CockpitChannel *one;
+  CockpitChannel *two;
+  gchar *problem1 = NULL;
+  gchar *problem2 = NULL;
+  gchar *output;
+
+  const gchar *script = "sleep 0.1; echo early";
+
+  transport = g_object_new (mock_transport_get_type (), NULL);
+
+  one = open_cached_spawn (transport, "1", script, 0, &problem1);
+  two = open_cached_spawn (transport, "2", script, 0, &problem2);
+  while (g_main_context_iteration (NULL, FALSE));
+
+  /* The other caller still gets the result */
+  cockpit_channel_close (one, "terminated");
+  g_object_unref (one);
+
+  while (!problem2)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpstr (problem1, ==, "terminated");
+  g_assert_cmpstr (problem2, ==, "");
+
+  output = pop_channel_output (transport, "2");
+  g_assert_cmpstr (output, ==, "early\n");
+
+  g_object_unref (two);
+  g_free (problem1);
+  g_free (problem2);
+  g_free (output);
+  g_object_unref (transport);
+}
+
+static void
+test_spawn_cache_pty (void)
+{
+  MockTransport *transport;
+  CockpitChannel *channel;
+  gchar *problem = NULL;
+  JsonObject *options;
+  JsonArray *array;
+
+  cockpit_expect_message ("*invalid \"cache\" option*");
+
+  transport = g_object_new (mock_transport_get_type (), NULL);
+
+  options = json_object_new ();
+  array = json_array_new ();
+  json_array_add_string_element (array, "/bin/true");
+  json_object_set_array_member (options, "spawn", array);
+  json_object_set_string_member (options, "payload", "stream");
+  json_object_set_boolean_member (options, "pty", TRUE);
+  json_object_set_int_member (options, "cache", 1000);
+
+  channel = g_object_new (COCKPIT_TYPE_PIPE_CHANNEL,
+                          "options", options,
+                          "id", "548",
+                          "transport", transport,
+                          NULL);
+  g_signal_connect (channel, "closed", G_CALLBACK (on_closed_get_problem), &problem);
+  json_object_unref (options);
+
+  while (!problem)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpstr (problem, ==, "protocol-error");
+
+  cockpit_assert_expected ();
+
+  g_free (problem);
+  g_object_unref (channel);
+  g_object_unref (transport);
+}
+
 static void
 test_fail_not_found (void)
 {
@@ -929,6 +1160,10 @@ main (int argc,
   g_test_add_func ("/pipe-channel/spawn/environ", test_spawn_environ);
   g_test_add_func ("/pipe-channel/spawn/pty", test_spawn_pty);
   g_test_add_func ("/pipe-channel/spawn/pty-resize", test_spawn_pty_resize);
+  g_test_add_func ("/pipe-channel/spawn/cache", test_spawn_cache);
+  g_test_add_func ("/pipe-channel/spawn/cache-coalesce", test_spawn_cache_coalesce);
+  g_test_add_func ("/pipe-channel/spawn/cache-early-close", test_spawn_cache_early_close);
+  g_test_add_func ("/pipe-channel/spawn/cache-pty", test_spawn_cache_pty);
 
   g_test_add_func ("/pipe-channel/fail/not-found", test_fail_not_found);
   g_test_add_func ("/pipe-channel/fail/access-denied", test_fail_access_denied);
@@ -33,6 +33,7 @@
 #include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
 
+#include <sys/socket.h>
 #include <sys/uio.h>
 #include <string.h>
 
@@ -618,6 +619,129 @@ test_read_combined (void)
   close (fds_b[0]);
 }
 
+static MockEchoStream *
+mock_echo_stream_for_socket (const gchar *name,
+                             gint fd)
+{
+  MockEchoStream *echo_stream;
+  GIOStream *io;
+
+  io = mock_io_stream_for_fds (fd, dup (fd));
+  echo_stream = g_object_new (mock_echo_stream_get_type (),
+                              "name", name,
+                              "io-stream", io,
+                              NULL);
+  g_object_unref (io);
+
+  return echo_stream;
+}
+
+static void
+test_write_many (void)
+{
+  MockEchoStream *sender;
+  MockEchoStream *receiver;
+  GByteArray *expected;
+  GBytes *sent;
+  gchar *data;
+  gsize length;
+  gint sv[2];
+  gint i;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    g_assert_not_reached ();
+
+  sender = mock_echo_stream_for_socket ("sender", sv[0]);
+  receiver = mock_echo_stream_for_socket ("receiver", sv[1]);
+
+  /* Many more blocks than are written in one go, some larger than the socket buffer */
+  expected = g_byte_array_new ();
+  for (i = 0; i < 1000; i++)
+    {
+      length = (i % 100 == 0) ? 300 * 1000 : 1 + (i * 37) % 2000;
+      data = g_strnfill (length, 'a' + (i % 26));
+      sent = g_bytes_new_take (data, length);
+      g_byte_array_append (expected, (guint8 *)data, length);
+      cockpit_stream_write (COCKPIT_STREAM (sender), sent);
+      g_bytes_unref (sent);
+    }
+
+  while (receiver->received->len < expected->len)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (receiver->received->len, ==, expected->len);
+  g_assert (memcmp (receiver->received->data, expected->data, expected->len) == 0);
+
+  g_byte_array_unref (expected);
+  g_object_unref (sender);
+  g_object_unref (receiver);
+}
+
+static void
+test_perf_concurrent (void)
+{
+  const guint streams = 256;
+  const guint blocks = 200;
+  const gsize block_size = 1024;
+  MockEchoStream **senders;
+  MockEchoStream **receivers;
+  gsize received;
+  gdouble elapsed;
+  GBytes *block;
+  gint sv[2];
+  guint i, j;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("only run in perf mode, use -m perf");
+      return;
+    }
+
+  senders = g_new0 (MockEchoStream *, streams);
+  receivers = g_new0 (MockEchoStream *, streams);
+  for (i = 0; i < streams; i++)
+    {
+      if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        g_assert_not_reached ();
+      senders[i] = mock_echo_stream_for_socket ("sender", sv[0]);
+      receivers[i] = mock_echo_stream_for_socket ("receiver", sv[1]);
+    }
+
+  block = g_bytes_new_take (g_strnfill (block_size, 'x'), block_size);
+
+  g_test_timer_start ();
+
+  /* Like many channels each sending a burst of small messages */
+  for (j = 0; j < blocks; j++)
+    {
+      for (i = 0; i < streams; i++)
+        cockpit_stream_write (COCKPIT_STREAM (senders[i]), block);
+    }
+
+  do
+    {
+      g_main_context_iteration (NULL, TRUE);
+      for (i = 0, received = 0; i < streams; i++)
+        received += receivers[i]->received->len;
+    }
+  while (received < streams * blocks * block_size);
+
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_message ("%u streams with %u blocks of %u bytes: %.3f s",
+                  streams, blocks, (guint)block_size, elapsed);
+  g_test_maximized_result (received / elapsed / (1024 * 1024), "MiB per second");
+
+  for (i = 0; i < streams; i++)
+    {
+      g_object_unref (senders[i]);
+      g_object_unref (receivers[i]);
+    }
+  g_free (senders);
+  g_free (receivers);
+  g_bytes_unref (block);
+}
+
 static void
 test_properties (void)
 {
@@ -1050,6 +1174,8 @@ main (int argc,
   g_test_add_func ("/stream/read-error", test_read_error);
   g_test_add_func ("/stream/write-error", test_write_error);
   g_test_add_func ("/stream/read-combined", test_read_combined);
+  g_test_add_func ("/stream/write-many", test_write_many);
+  g_test_add_func ("/stream/perf/concurrent", test_perf_concurrent);
 
   g_test_add ("/stream/connect/and-read", TestConnect, NULL,
               setup_connect, test_connect_and_read, teardown_connect);
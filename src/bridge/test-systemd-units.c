@@ -0,0 +1,480 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitdbusinternal.h"
+#include "cockpitsystemdunits.h"
+
+#include "common/cockpitjson.h"
+#include "common/cockpittest.h"
+#include "common/mock-transport.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define TIMEOUT 30
+
+static const gchar mock_systemd_xml[] =
+  "<node>"
+  "  <interface name='org.freedesktop.systemd1.Manager'>"
+  "    <method name='ListUnits'>"
+  "      <arg type='a(ssssssouso)' direction='out'/>"
+  "    </method>"
+  "    <method name='ListUnitFiles'>"
+  "      <arg type='a(ss)' direction='out'/>"
+  "    </method>"
+  "    <method name='ListUnitsByNames'>"
+  "      <arg type='as' direction='in'/>"
+  "      <arg type='a(ssssssouso)' direction='out'/>"
+  "    </method>"
+  "    <method name='LoadUnit'>"
+  "      <arg type='s' direction='in'/>"
+  "      <arg type='o' direction='out'/>"
+  "    </method>"
+  "    <method name='Subscribe'/>"
+  "    <signal name='UnitFilesChanged'/>"
+  "    <signal name='Reloading'>"
+  "      <arg type='b'/>"
+  "    </signal>"
+  "  </interface>"
+  "  <interface name='org.freedesktop.systemd1.Unit'>"
+  "    <property name='Id' type='s' access='read'/>"
+  "    <property name='Description' type='s' access='read'/>"
+  "    <property name='LoadState' type='s' access='read'/>"
+  "    <property name='ActiveState' type='s' access='read'/>"
+  "    <property name='SubState' type='s' access='read'/>"
+  "    <property name='Following' type='s' access='read'/>"
+  "  </interface>"
+  "</node>";
+
+typedef struct {
+  const gchar *id;
+  const gchar *path;
+  const gchar *description;
+  const gchar *active_state;
+  const gchar *sub_state;
+  const gchar *file;
+  const gchar *file_state;
+  gboolean loaded;
+  gboolean gone;
+} MockUnit;
+
+typedef struct {
+  MockTransport *transport;
+  CockpitChannel *channel;
+  GDBusConnection *server;
+  GDBusNodeInfo *node;
+  guint registrations[4];
+  MockUnit units[3];
+  gboolean no_list_by_names;
+  gint list_by_names_calls;
+  gint load_unit_calls;
+} TestCase;
+
+static const MockUnit mock_units[] = {
+  { "a.service", "/org/freedesktop/systemd1/unit/a_2eservice", "Unit A",
+    "active", "running", "/usr/lib/systemd/system/a.service", "enabled", TRUE },
+  { "b.service", "/org/freedesktop/systemd1/unit/b_2eservice", "Unit B",
+    "failed", "failed", NULL, NULL, TRUE },
+  { "c.service", "/org/freedesktop/systemd1/unit/c_2eservice", "Unit C",
+    "inactive", "dead", "/usr/lib/systemd/system/c.service", "disabled", FALSE },
+};
+
+static MockUnit *
+mock_unit_by_name (TestCase *tc,
+                   const gchar *name)
+{
+  guint i;
+
+  /* An alias for a.service */
+  if (g_str_equal (name, "alias.service"))
+    name = "a.service";
+
+  for (i = 0; i < G_N_ELEMENTS (tc->units); i++)
+    {
+      if (!tc->units[i].gone && g_str_equal (tc->units[i].id, name))
+        return tc->units + i;
+    }
+  return NULL;
+}
+
+static GVariant *
+mock_unit_info (MockUnit *unit)
+{
+  return g_variant_new ("(ssssssouso)", unit->id, unit->description, "loaded",
+                        unit->active_state, unit->sub_state, "", unit->path,
+                        (guint32)0, "", "/");
+}
+
+static void
+on_manager_method (GDBusConnection *connection,
+                   const gchar *sender,
+                   const gchar *object_path,
+                   const gchar *interface_name,
+                   const gchar *method_name,
+                   GVariant *parameters,
+                   GDBusMethodInvocation *invocation,
+                   gpointer user_data)
+{
+  TestCase *tc = user_data;
+  GVariantBuilder builder;
+  const gchar **names;
+  const gchar *name;
+  MockUnit *unit;
+  guint i;
+
+  if (g_str_equal (method_name, "ListUnits"))
+    {
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssssssouso)"));
+      for (i = 0; i < G_N_ELEMENTS (tc->units); i++)
+        {
+          if (tc->units[i].loaded && !tc->units[i].gone)
+            g_variant_builder_add_value (&builder, mock_unit_info (tc->units + i));
+        }
+      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a(ssssssouso))", &builder));
+    }
+  else if (g_str_equal (method_name, "ListUnitFiles"))
+    {
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
+      for (i = 0; i < G_N_ELEMENTS (tc->units); i++)
+        {
+          if (tc->units[i].file && !tc->units[i].gone)
+            g_variant_builder_add (&builder, "(ss)", tc->units[i].file, tc->units[i].file_state);
+        }
+      g_variant_builder_add (&builder, "(ss)", "/etc/systemd/system/alias.service", "enabled");
+      g_variant_builder_add (&builder, "(ss)", "/usr/lib/systemd/system/t@.service", "static");
+      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a(ss))", &builder));
+    }
+  else if (g_str_equal (method_name, "ListUnitsByNames"))
+    {
+      tc->list_by_names_calls++;
+      if (tc->no_list_by_names)
+        {
+          g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                                 "Unknown method ListUnitsByNames");
+          return;
+        }
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssssssouso)"));
+      g_variant_get (parameters, "(^a&s)", &names);
+      for (i = 0; names[i] != NULL; i++)
+        {
+          unit = mock_unit_by_name (tc, names[i]);
+          g_assert (unit != NULL);
+          unit->loaded = TRUE;
+          g_variant_builder_add_value (&builder, mock_unit_info (unit));
+        }
+      g_free (names);
+      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a(ssssssouso))", &builder));
+    }
+  else if (g_str_equal (method_name, "LoadUnit"))
+    {
+      tc->load_unit_calls++;
+      g_variant_get (parameters, "(&s)", &name);
+      unit = mock_unit_by_name (tc, name);
+      g_assert (unit != NULL);
+      unit->loaded = TRUE;
+      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", unit->path));
+    }
+  else if (g_str_equal (method_name, "Subscribe"))
+    {
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else
+    {
+      g_assert_not_reached ();
+    }
+}
+
+static GVariant *
+on_unit_get_property (GDBusConnection *connection,
+                      const gchar *sender,
+                      const gchar *object_path,
+                      const gchar *interface_name,
+                      const gchar *property_name,
+                      GError **error,
+                      gpointer user_data)
+{
+  TestCase *tc = user_data;
+  MockUnit *unit = NULL;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (tc->units); i++)
+    {
+      if (g_str_equal (tc->units[i].path, object_path))
+        unit = tc->units + i;
+    }
+  g_assert (unit != NULL);
+
+  if (g_str_equal (property_name, "Id"))
+    return g_variant_new_string (unit->id);
+  else if (g_str_equal (property_name, "Description"))
+    return g_variant_new_string (unit->description);
+  else if (g_str_equal (property_name, "LoadState"))
+    return g_variant_new_string ("loaded");
+  else if (g_str_equal (property_name, "ActiveState"))
+    return g_variant_new_string (unit->active_state);
+  else if (g_str_equal (property_name, "SubState"))
+    return g_variant_new_string (unit->sub_state);
+  else if (g_str_equal (property_name, "Following"))
+    return g_variant_new_string ("");
+
+  g_assert_not_reached ();
+}
+
+static const GDBusInterfaceVTable manager_vtable = {
+  on_manager_method, NULL, NULL,
+};
+
+static const GDBusInterfaceVTable unit_vtable = {
+  NULL, on_unit_get_property, NULL,
+};
+
+static void
+setup (TestCase *tc,
+       gconstpointer data)
+{
+  GError *error = NULL;
+  guint i;
+
+  alarm (TIMEOUT);
+
+  cockpit_dbus_internal_startup (FALSE);
+  tc->server = cockpit_dbus_internal_server ();
+
+  memcpy (tc->units, mock_units, sizeof (mock_units));
+  tc->no_list_by_names = GPOINTER_TO_INT (data);
+
+  tc->node = g_dbus_node_info_new_for_xml (mock_systemd_xml, &error);
+  g_assert_no_error (error);
+
+  tc->registrations[0] = g_dbus_connection_register_object (tc->server, "/org/freedesktop/systemd1",
+                                                            tc->node->interfaces[0], &manager_vtable,
+                                                            tc, NULL, &error);
+  g_assert_no_error (error);
+
+  for (i = 0; i < G_N_ELEMENTS (tc->units); i++)
+    {
+      tc->registrations[i + 1] = g_dbus_connection_register_object (tc->server, tc->units[i].path,
+                                                                    tc->node->interfaces[1], &unit_vtable,
+                                                                    tc, NULL, &error);
+      g_assert_no_error (error);
+    }
+
+  tc->transport = mock_transport_new ();
+}
+
+static void
+teardown (TestCase *tc,
+          gconstpointer data)
+{
+  guint i;
+
+  cockpit_assert_expected ();
+
+  if (tc->channel)
+    {
+      g_object_add_weak_pointer (G_OBJECT (tc->channel), (gpointer *)&tc->channel);
+      g_object_unref (tc->channel);
+      g_assert (tc->channel == NULL);
+    }
+
+  g_object_unref (tc->transport);
+
+  for (i = 0; i < G_N_ELEMENTS (tc->registrations); i++)
+    g_dbus_connection_unregister_object (tc->server, tc->registrations[i]);
+  g_dbus_node_info_unref (tc->node);
+  g_object_unref (tc->server);
+
+  cockpit_dbus_internal_cleanup ();
+
+  alarm (0);
+}
+
+static void
+open_channel (TestCase *tc)
+{
+  JsonObject *options;
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "systemd-units");
+  json_object_set_string_member (options, "bus", "internal");
+
+  tc->channel = g_object_new (COCKPIT_TYPE_SYSTEMD_UNITS,
+                              "transport", tc->transport,
+                              "id", "548",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+
+  cockpit_channel_prepare (tc->channel);
+}
+
+static JsonObject *
+recv_json (TestCase *tc)
+{
+  GBytes *msg;
+  JsonObject *res;
+
+  while ((msg = mock_transport_pop_channel (tc->transport, "548")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  res = cockpit_json_parse_bytes (msg, NULL);
+  g_assert (res != NULL);
+  return res;
+}
+
+static void
+emit_signal (TestCase *tc,
+             const gchar *path,
+             const gchar *interface,
+             const gchar *member,
+             GVariant *parameters)
+{
+  GError *error = NULL;
+
+  g_dbus_connection_emit_signal (tc->server, NULL, path, interface, member, parameters, &error);
+  g_assert_no_error (error);
+}
+
+static const gchar *expected_table =
+  "{\"fields\":[\"id\",\"path\",\"description\",\"load-state\",\"active-state\","
+  "             \"sub-state\",\"following\",\"unit-file-state\",\"aliases\"],"
+  " \"units\":["
+  "  [\"a.service\",\"/org/freedesktop/systemd1/unit/a_2eservice\",\"Unit A\","
+  "   \"loaded\",\"active\",\"running\",\"\",\"enabled\",[\"alias.service\"]],"
+  "  [\"b.service\",\"/org/freedesktop/systemd1/unit/b_2eservice\",\"Unit B\","
+  "   \"loaded\",\"failed\",\"failed\",\"\",null,[]],"
+  "  [\"c.service\",\"/org/freedesktop/systemd1/unit/c_2eservice\",\"Unit C\","
+  "   \"loaded\",\"inactive\",\"dead\",\"\",\"disabled\",[]],"
+  "  [\"t@.service\",null,null,null,null,null,null,\"static\",[]]"
+  " ]}";
+
+static void
+test_list (TestCase *tc,
+           gconstpointer data)
+{
+  JsonObject *control;
+  JsonObject *object;
+
+  open_channel (tc);
+
+  while ((control = mock_transport_pop_control (tc->transport)) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpstr (json_object_get_string_member (control, "command"), ==, "ready");
+
+  object = recv_json (tc);
+  cockpit_assert_json_eq (object, expected_table);
+  json_object_unref (object);
+
+  /* The unit files that weren't loaded were looked up in one go */
+  g_assert_cmpint (tc->list_by_names_calls, ==, 1);
+  g_assert_cmpint (tc->load_unit_calls, ==, 0);
+}
+
+static void
+test_list_fallback (TestCase *tc,
+                    gconstpointer data)
+{
+  JsonObject *object;
+
+  open_channel (tc);
+
+  object = recv_json (tc);
+  cockpit_assert_json_eq (object, expected_table);
+  json_object_unref (object);
+
+  g_assert_cmpint (tc->list_by_names_calls, ==, 1);
+  g_assert_cmpint (tc->load_unit_calls, ==, 2);
+}
+
+static void
+test_properties_changed (TestCase *tc,
+                         gconstpointer data)
+{
+  JsonObject *object;
+
+  open_channel (tc);
+
+  object = recv_json (tc);
+  json_object_unref (object);
+
+  tc->units[1].active_state = "active";
+  tc->units[1].sub_state = "running";
+  emit_signal (tc, tc->units[1].path, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+               g_variant_new_parsed ("('org.freedesktop.systemd1.Unit', "
+                                     " {'ActiveState': <'active'>, 'SubState': <'running'>}, "
+                                     " @as [])"));
+
+  /* Changes that don't change anything don't get sent */
+  emit_signal (tc, tc->units[0].path, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+               g_variant_new_parsed ("('org.freedesktop.systemd1.Unit', "
+                                     " {'ActiveState': <'active'>}, @as [])"));
+
+  object = recv_json (tc);
+  cockpit_assert_json_eq (object,
+                          "{\"changed\":[[\"b.service\",\"/org/freedesktop/systemd1/unit/b_2eservice\","
+                          "               \"Unit B\",\"loaded\",\"active\",\"running\",\"\",null,[]]],"
+                          " \"removed\":[]}");
+  json_object_unref (object);
+}
+
+static void
+test_unit_files_changed (TestCase *tc,
+                         gconstpointer data)
+{
+  JsonObject *object;
+
+  open_channel (tc);
+
+  object = recv_json (tc);
+  json_object_unref (object);
+
+  tc->units[2].gone = TRUE;
+  tc->units[0].file_state = "disabled";
+  emit_signal (tc, "/org/freedesktop/systemd1", "org.freedesktop.systemd1.Manager",
+               "UnitFilesChanged", NULL);
+
+  object = recv_json (tc);
+  cockpit_assert_json_eq (object,
+                          "{\"changed\":[[\"a.service\",\"/org/freedesktop/systemd1/unit/a_2eservice\","
+                          "               \"Unit A\",\"loaded\",\"active\",\"running\",\"\",\"disabled\","
+                          "               [\"alias.service\"]]],"
+                          " \"removed\":[\"c.service\"]}");
+  json_object_unref (object);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add ("/systemd-units/list", TestCase, GINT_TO_POINTER (FALSE),
+              setup, test_list, teardown);
+  g_test_add ("/systemd-units/list-fallback", TestCase, GINT_TO_POINTER (TRUE),
+              setup, test_list_fallback, teardown);
+  g_test_add ("/systemd-units/properties-changed", TestCase, GINT_TO_POINTER (FALSE),
+              setup, test_properties_changed, teardown);
+  g_test_add ("/systemd-units/unit-files-changed", TestCase, GINT_TO_POINTER (FALSE),
+              setup, test_unit_files_changed, teardown);
+
+  return g_test_run ();
+}
@@ -0,0 +1,707 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitassetpack.h"
+
+#include "cockpithex.h"
+#include "cockpitwebdeflate.h"
+#include "cockpitwebresponse.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <string.h>
+
+/**
+ * CockpitAssetPack:
+ *
+ * A read-only pack of all the files below a set of static roots, so
+ * that every cockpit-ws instance on a machine maps the same pages
+ * instead of opening and reading each file by itself. Compressible
+ * files are stored a second time, gzip compressed, so they can be
+ * sent as they are.
+ *
+ * The pack is named after a SHA-256 stamp over the names, sizes and
+ * modification times of the files it contains. Opening a pack walks
+ * the roots and computes the stamp, so a pack is never used once the
+ * files on disk changed. A file that changes while the pack is open
+ * is noticed on lookup, by comparing its size and modification time
+ * with the entry, and is then served from disk.
+ *
+ * The entries are sorted by path for binary search. Each entry has a
+ * checksum of its content, which is verified once per process before
+ * the entry is first used.
+ */
+
+#define ASSET_PACK_MAGIC      "CKPTAST2"
+#define ASSET_PACK_SUFFIX     ".pack"
+#define ASSET_MAX_SIZE        (16 * 1024 * 1024)
+#define ASSET_MAX_DEPTH       8
+
+typedef struct {
+  gchar magic[8];
+  guint32 n_entries;
+  guint32 reserved;
+  guint8 stamp[32];
+} PackHeader;
+
+typedef struct {
+  guint64 path_offset;
+  guint64 data_offset;
+  guint64 data_length;
+  guint64 gzip_offset;
+  guint64 gzip_length;
+  gint64 mtime;
+  guint32 path_length;
+  guint32 reserved;
+  guint8 checksum[32];
+  guint8 gzip_checksum[32];
+} PackEntry;
+
+enum {
+  VERIFIED_DATA = 1 << 0,
+  CORRUPT_DATA = 1 << 1,
+  VERIFIED_GZIP = 1 << 2,
+  CORRUPT_GZIP = 1 << 3,
+};
+
+struct _CockpitAssetPack {
+  GMappedFile *mapped;
+  const guint8 *data;
+  gsize length;
+  const PackEntry *entries;
+  guint n_entries;
+  guint8 *verified;
+};
+
+typedef struct {
+  gchar *path;
+  gint64 size;
+  gint64 mtime;
+} AssetFile;
+
+static void
+asset_file_free (gpointer data)
+{
+  AssetFile *file = data;
+  g_free (file->path);
+  g_free (file);
+}
+
+static gint
+compare_asset_files (gconstpointer a,
+                     gconstpointer b)
+{
+  const AssetFile *fa = *(const AssetFile **)a;
+  const AssetFile *fb = *(const AssetFile **)b;
+  return strcmp (fa->path, fb->path);
+}
+
+static void
+collect_directory (GPtrArray *files,
+                   const gchar *directory,
+                   guint depth)
+{
+  AssetFile *file;
+  const gchar *name;
+  struct stat st;
+  gchar *path;
+  GDir *dir;
+
+  if (depth > ASSET_MAX_DEPTH)
+    return;
+
+  dir = g_dir_open (directory, 0, NULL);
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      /* Hidden files are never served */
+      if (name[0] == '.')
+        continue;
+
+      /* Follows symlinks, just like serving the file would */
+      path = g_build_filename (directory, name, NULL);
+      if (stat (path, &st) < 0)
+        {
+          g_debug ("%s: couldn't stat asset: %s", path, g_strerror (errno));
+        }
+      else if (S_ISDIR (st.st_mode))
+        {
+          collect_directory (files, path, depth + 1);
+        }
+      else if (S_ISREG (st.st_mode) && st.st_size <= ASSET_MAX_SIZE)
+        {
+          file = g_new0 (AssetFile, 1);
+          file->path = path;
+          file->size = st.st_size;
+          file->mtime = (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + st.st_mtim.tv_nsec;
+          g_ptr_array_add (files, file);
+          path = NULL;
+        }
+      g_free (path);
+    }
+
+  g_dir_close (dir);
+}
+
+static GPtrArray *
+collect_files (const gchar **roots)
+{
+  GPtrArray *files;
+  AssetFile *prev;
+  guint i;
+
+  files = g_ptr_array_new_with_free_func (asset_file_free);
+  for (i = 0; roots && roots[i]; i++)
+    collect_directory (files, roots[i], 0);
+
+  g_ptr_array_sort (files, compare_asset_files);
+
+  /* The same root can appear more than once */
+  for (i = 1; i < files->len; )
+    {
+      prev = g_ptr_array_index (files, i - 1);
+      if (g_str_equal (prev->path, ((AssetFile *)g_ptr_array_index (files, i))->path))
+        g_ptr_array_remove_index (files, i);
+      else
+        i++;
+    }
+
+  return files;
+}
+
+static gchar *
+calculate_stamp (GPtrArray *files,
+                 const gchar *directory,
+                 guint8 *stamp)
+{
+  GChecksum *checksum;
+  AssetFile *file;
+  gchar *filename;
+  gchar *line;
+  gchar *hex;
+  gsize len = 32;
+  guint i;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (const guchar *)ASSET_PACK_MAGIC, strlen (ASSET_PACK_MAGIC));
+  for (i = 0; i < files->len; i++)
+    {
+      file = g_ptr_array_index (files, i);
+      line = g_strdup_printf ("%s\n%" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+                              file->path, file->size, file->mtime);
+      g_checksum_update (checksum, (const guchar *)line, -1);
+      g_free (line);
+    }
+
+  g_checksum_get_digest (checksum, stamp, &len);
+  g_checksum_free (checksum);
+
+  hex = cockpit_hex_encode (stamp, len);
+  filename = g_strdup_printf ("%s/%s%s", directory, hex, ASSET_PACK_SUFFIX);
+  g_free (hex);
+
+  return filename;
+}
+
+static void
+calculate_checksum (const guint8 *data,
+                    gsize length,
+                    guint8 *digest)
+{
+  GChecksum *checksum;
+  gsize len = 32;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, data, length);
+  g_checksum_get_digest (checksum, digest, &len);
+  g_checksum_free (checksum);
+}
+
+static GBytes *
+compress_gzip (GBytes *input)
+{
+  GConverter *converter;
+  GConverterResult result;
+  GByteArray *out;
+  const guint8 *in;
+  gsize inl, outl;
+  gsize read, written;
+
+  converter = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, 9));
+  out = g_byte_array_new ();
+  in = g_bytes_get_data (input, &inl);
+
+  do
+    {
+      outl = out->len;
+      g_byte_array_set_size (out, outl + inl + 1024);
+
+      result = g_converter_convert (converter, in, inl, out->data + outl, inl + 1024,
+                                    G_CONVERTER_INPUT_AT_END, &read, &written, NULL);
+      if (result == G_CONVERTER_ERROR)
+        break;
+
+      g_byte_array_set_size (out, outl + written);
+      in += read;
+      inl -= read;
+    }
+  while (result != G_CONVERTER_FINISHED);
+
+  g_object_unref (converter);
+
+  if (result != G_CONVERTER_FINISHED)
+    {
+      g_byte_array_unref (out);
+      return NULL;
+    }
+
+  return g_byte_array_free_to_bytes (out);
+}
+
+static void
+remove_stale_packs (const gchar *directory,
+                    const gchar *current)
+{
+  const gchar *name;
+  gchar *path;
+  GDir *dir;
+
+  dir = g_dir_open (directory, 0, NULL);
+  if (!dir)
+    return;
+
+  /* Instances that still have an old pack mapped keep using it */
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      if (!g_str_has_suffix (name, ASSET_PACK_SUFFIX))
+        continue;
+      path = g_build_filename (directory, name, NULL);
+      if (!g_str_equal (path, current) && g_unlink (path) < 0)
+        g_debug ("%s: couldn't remove stale asset pack: %s", path, g_strerror (errno));
+      g_free (path);
+    }
+
+  g_dir_close (dir);
+}
+
+/**
+ * cockpit_asset_pack_build:
+ * @directory: the directory to place the pack in
+ * @roots: the static roots to pack
+ * @error: location to place an error
+ *
+ * Builds a pack of the files in @roots, unless an up to date one
+ * already exists, and removes any other packs in @directory.
+ *
+ * Returns: FALSE if the pack couldn't be written
+ */
+gboolean
+cockpit_asset_pack_build (const gchar *directory,
+                          const gchar **roots,
+                          GError **error)
+{
+  PackHeader header;
+  GByteArray *paths = NULL;
+  GByteArray *blob = NULL;
+  GByteArray *output = NULL;
+  GArray *entries = NULL;
+  GPtrArray *files = NULL;
+  GError *local_error = NULL;
+  GMappedFile *mapped;
+  const gchar *content_type;
+  gboolean ret = FALSE;
+  gchar *filename = NULL;
+  PackEntry entry;
+  PackEntry *e;
+  AssetFile *file;
+  GBytes *content;
+  GBytes *gzipped;
+  gsize base;
+  guint i;
+
+  g_return_val_if_fail (directory != NULL, FALSE);
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, ASSET_PACK_MAGIC, sizeof (header.magic));
+
+  files = collect_files (roots);
+  filename = calculate_stamp (files, directory, header.stamp);
+
+  if (g_file_test (filename, G_FILE_TEST_EXISTS))
+    {
+      g_debug ("%s: asset pack is up to date", filename);
+      ret = TRUE;
+      goto out;
+    }
+
+  if (g_mkdir_with_parents (directory, 0755) < 0)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "%s: couldn't create directory: %s", directory, g_strerror (errno));
+      goto out;
+    }
+
+  entries = g_array_new (FALSE, TRUE, sizeof (PackEntry));
+  paths = g_byte_array_new ();
+  blob = g_byte_array_new ();
+
+  /* Offsets are relative to their region for now, and fixed up below */
+  for (i = 0; i < files->len; i++)
+    {
+      file = g_ptr_array_index (files, i);
+
+      mapped = g_mapped_file_new (file->path, FALSE, &local_error);
+      if (!mapped)
+        {
+          g_debug ("%s: couldn't pack asset: %s", file->path, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+      content = g_mapped_file_get_bytes (mapped);
+      g_mapped_file_unref (mapped);
+
+      memset (&entry, 0, sizeof (entry));
+      entry.path_offset = paths->len;
+      entry.path_length = strlen (file->path);
+      g_byte_array_append (paths, (const guint8 *)file->path, entry.path_length + 1);
+
+      /* If the file changed since it was collected, lookups won't match and use the disk */
+      entry.mtime = file->mtime;
+      entry.data_offset = blob->len;
+      entry.data_length = g_bytes_get_size (content);
+      g_byte_array_append (blob, g_bytes_get_data (content, NULL), entry.data_length);
+      calculate_checksum (g_bytes_get_data (content, NULL), entry.data_length, entry.checksum);
+
+      content_type = cockpit_web_response_content_type (file->path);
+      if (content_type && cockpit_web_deflate_is_compressible (content_type))
+        {
+          gzipped = compress_gzip (content);
+
+          /* Only worth it when it saves something */
+          if (gzipped && g_bytes_get_size (gzipped) < entry.data_length - entry.data_length / 10)
+            {
+              entry.gzip_offset = blob->len;
+              entry.gzip_length = g_bytes_get_size (gzipped);
+              g_byte_array_append (blob, g_bytes_get_data (gzipped, NULL), entry.gzip_length);
+              calculate_checksum (g_bytes_get_data (gzipped, NULL), entry.gzip_length, entry.gzip_checksum);
+            }
+
+          if (gzipped)
+            g_bytes_unref (gzipped);
+        }
+
+      g_bytes_unref (content);
+      g_array_append_val (entries, entry);
+    }
+
+  header.n_entries = entries->len;
+  base = sizeof (PackHeader) + entries->len * sizeof (PackEntry);
+  for (i = 0; i < entries->len; i++)
+    {
+      e = &g_array_index (entries, PackEntry, i);
+      e->path_offset += base;
+      e->data_offset += base + paths->len;
+      if (e->gzip_length > 0)
+        e->gzip_offset += base + paths->len;
+    }
+
+  output = g_byte_array_sized_new (base + paths->len + blob->len);
+  g_byte_array_append (output, (const guint8 *)&header, sizeof (header));
+  g_byte_array_append (output, (const guint8 *)entries->data, entries->len * sizeof (PackEntry));
+  g_byte_array_append (output, paths->data, paths->len);
+  g_byte_array_append (output, blob->data, blob->len);
+
+  /* Written to a temporary file and renamed, so readers never see a partial pack */
+  if (!g_file_set_contents (filename, (const gchar *)output->data, output->len, error))
+    goto out;
+
+  g_debug ("%s: packed %u assets", filename, entries->len);
+  remove_stale_packs (directory, filename);
+  ret = TRUE;
+
+out:
+  if (output)
+    g_byte_array_unref (output);
+  if (blob)
+    g_byte_array_unref (blob);
+  if (paths)
+    g_byte_array_unref (paths);
+  if (entries)
+    g_array_unref (entries);
+  g_ptr_array_unref (files);
+  g_free (filename);
+  return ret;
+}
+
+static gboolean
+valid_range (CockpitAssetPack *self,
+             guint64 offset,
+             guint64 length)
+{
+  return offset <= self->length && length <= self->length - offset;
+}
+
+static gboolean
+validate_pack (CockpitAssetPack *self,
+               const guint8 *stamp)
+{
+  const PackHeader *header;
+  const PackEntry *entry;
+  guint i;
+
+  if (self->length < sizeof (PackHeader))
+    return FALSE;
+
+  header = (const PackHeader *)self->data;
+  if (memcmp (header->magic, ASSET_PACK_MAGIC, sizeof (header->magic)) != 0 ||
+      memcmp (header->stamp, stamp, sizeof (header->stamp)) != 0)
+    return FALSE;
+
+  if (header->n_entries > (self->length - sizeof (PackHeader)) / sizeof (PackEntry))
+    return FALSE;
+
+  self->entries = (const PackEntry *)(self->data + sizeof (PackHeader));
+  self->n_entries = header->n_entries;
+
+  for (i = 0; i < self->n_entries; i++)
+    {
+      entry = self->entries + i;
+      if (!valid_range (self, entry->path_offset, (guint64)entry->path_length + 1) ||
+          self->data[entry->path_offset + entry->path_length] != '\0' ||
+          !valid_range (self, entry->data_offset, entry->data_length) ||
+          !valid_range (self, entry->gzip_offset, entry->gzip_length))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * cockpit_asset_pack_open:
+ * @directory: the directory the pack was built in
+ * @roots: the static roots the pack should contain
+ * @error: location to place an error
+ *
+ * Maps the pack for the current content of @roots, if one has been
+ * built. Returns NULL without setting @error when there is none.
+ *
+ * Returns: (transfer full): the pack, or NULL
+ */
+CockpitAssetPack *
+cockpit_asset_pack_open (const gchar *directory,
+                         const gchar **roots,
+                         GError **error)
+{
+  CockpitAssetPack *self = NULL;
+  GError *local_error = NULL;
+  GMappedFile *mapped = NULL;
+  GPtrArray *files;
+  gchar *filename;
+  guint8 stamp[32];
+
+  g_return_val_if_fail (directory != NULL, NULL);
+
+  files = collect_files (roots);
+  filename = calculate_stamp (files, directory, stamp);
+  g_ptr_array_unref (files);
+
+  mapped = g_mapped_file_new (filename, FALSE, &local_error);
+  if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+    {
+      g_debug ("%s: no asset pack for current files", filename);
+      g_clear_error (&local_error);
+      goto out;
+    }
+  else if (local_error)
+    {
+      g_propagate_error (error, local_error);
+      goto out;
+    }
+
+  self = g_new0 (CockpitAssetPack, 1);
+  self->mapped = mapped;
+  self->data = (const guint8 *)g_mapped_file_get_contents (mapped);
+  self->length = g_mapped_file_get_length (mapped);
+
+  if (!validate_pack (self, stamp))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "%s: invalid asset pack", filename);
+      cockpit_asset_pack_free (self);
+      self = NULL;
+      goto out;
+    }
+
+  self->verified = g_new0 (guint8, self->n_entries);
+
+out:
+  g_free (filename);
+  return self;
+}
+
+static const PackEntry *
+find_entry (CockpitAssetPack *self,
+            const gchar *path)
+{
+  const PackEntry *entry;
+  guint lo = 0;
+  guint hi = self->n_entries;
+  guint mid;
+  gint cmp;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      entry = self->entries + mid;
+      cmp = strcmp (path, (const gchar *)self->data + entry->path_offset);
+      if (cmp == 0)
+        return entry;
+      else if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return NULL;
+}
+
+static gboolean
+verify_entry (CockpitAssetPack *self,
+              const PackEntry *entry,
+              gboolean gzip)
+{
+  guint index = entry - self->entries;
+  guint8 verified = gzip ? VERIFIED_GZIP : VERIFIED_DATA;
+  guint8 corrupt = gzip ? CORRUPT_GZIP : CORRUPT_DATA;
+  guint8 digest[32];
+
+  if (self->verified[index] & verified)
+    return TRUE;
+  if (self->verified[index] & corrupt)
+    return FALSE;
+
+  if (gzip)
+    calculate_checksum (self->data + entry->gzip_offset, entry->gzip_length, digest);
+  else
+    calculate_checksum (self->data + entry->data_offset, entry->data_length, digest);
+
+  if (memcmp (digest, gzip ? entry->gzip_checksum : entry->checksum, sizeof (digest)) != 0)
+    {
+      g_warning ("%s: packed asset doesn't match its checksum",
+                 (const gchar *)self->data + entry->path_offset);
+      self->verified[index] |= corrupt;
+      return FALSE;
+    }
+
+  self->verified[index] |= verified;
+  return TRUE;
+}
+
+static gboolean
+entry_is_current (CockpitAssetPack *self,
+                  const PackEntry *entry,
+                  const gchar *path)
+{
+  struct stat st;
+
+  if (stat (path, &st) < 0)
+    return FALSE;
+
+  if ((guint64)st.st_size != entry->data_length ||
+      (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + st.st_mtim.tv_nsec != entry->mtime)
+    {
+      g_debug ("%s: file changed since it was packed", path);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static GBytes *
+map_bytes (CockpitAssetPack *self,
+           guint64 offset,
+           guint64 length)
+{
+  return g_bytes_new_with_free_func (self->data + offset, length,
+                                     (GDestroyNotify)g_mapped_file_unref,
+                                     g_mapped_file_ref (self->mapped));
+}
+
+/**
+ * cockpit_asset_pack_lookup:
+ * @self: the pack
+ * @path: full path of the file
+ * @gzipped: (out) (optional): location for the gzip compressed content
+ *
+ * Looks up a file in the pack. The returned bytes point directly into
+ * the mapped pack. @gzipped is set to NULL when the file isn't stored
+ * compressed.
+ *
+ * Returns: (transfer full): the content of the file, or NULL if the
+ *          file isn't in the pack or has changed on disk since
+ */
+GBytes *
+cockpit_asset_pack_lookup (CockpitAssetPack *self,
+                           const gchar *path,
+                           GBytes **gzipped)
+{
+  const PackEntry *entry;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  if (gzipped)
+    *gzipped = NULL;
+
+  entry = find_entry (self, path);
+  if (!entry || !entry_is_current (self, entry, path) || !verify_entry (self, entry, FALSE))
+    return NULL;
+
+  if (gzipped && entry->gzip_length > 0 && verify_entry (self, entry, TRUE))
+    *gzipped = map_bytes (self, entry->gzip_offset, entry->gzip_length);
+
+  return map_bytes (self, entry->data_offset, entry->data_length);
+}
+
+guint
+cockpit_asset_pack_get_n_files (CockpitAssetPack *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  return self->n_entries;
+}
+
+void
+cockpit_asset_pack_free (CockpitAssetPack *self)
+{
+  if (!self)
+    return;
+
+  if (self->mapped)
+    g_mapped_file_unref (self->mapped);
+  g_free (self->verified);
+  g_free (self);
+}
@@ -0,0 +1,47 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COCKPIT_ASSET_PACK_H__
+#define __COCKPIT_ASSET_PACK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _CockpitAssetPack CockpitAssetPack;
+
+gboolean             cockpit_asset_pack_build        (const gchar *directory,
+                                                      const gchar **roots,
+                                                      GError **error);
+
+CockpitAssetPack *   cockpit_asset_pack_open         (const gchar *directory,
+                                                      const gchar **roots,
+                                                      GError **error);
+
+GBytes *             cockpit_asset_pack_lookup       (CockpitAssetPack *self,
+                                                      const gchar *path,
+                                                      GBytes **gzipped);
+
+guint                cockpit_asset_pack_get_n_files  (CockpitAssetPack *self);
+
+void                 cockpit_asset_pack_free         (CockpitAssetPack *self);
+
+G_END_DECLS
+
+#endif /* __COCKPIT_ASSET_PACK_H__ */
@@ -19,6 +19,9 @@
 
 #include "cockpitmachinesjson.h"
 #include "common/cockpitconf.h"
+#include "common/cockpitjson.h"
+
+#include <sys/stat.h>
 
 #include <errno.h>
 #include <glob.h>
@@ -147,40 +150,240 @@ get_machines_json_dir (void)
   return path;
 }
 
-JsonNode *
-read_machines_json (void)
+/*
+ * CockpitMachinesIndex:
+ *
+ * Keeps the parsed contents of each machines.d file in memory, along
+ * with the merged view. A refresh only stats the files, and only the
+ * ones that changed since last time are parsed again. The merged view
+ * is then rebuilt from memory, and compared per host against the
+ * previous one so that callers can tell which machines changed.
+ */
+
+typedef struct {
+  guint64 ino;
+  gint64 size;
+  gint64 mtime;
+  gint64 ctime;
+  JsonNode *config;
+} MachinesFile;
+
+struct _CockpitMachinesIndex {
+  gchar *directory;
+  GHashTable *files;
+  JsonObject *machines;
+};
+
+static void
+machines_file_free (gpointer data)
 {
+  MachinesFile *file = data;
+  if (file->config)
+    json_node_free (file->config);
+  g_slice_free (MachinesFile, file);
+}
+
+CockpitMachinesIndex *
+cockpit_machines_index_new (const char *directory)
+{
+  CockpitMachinesIndex *self;
+
+  self = g_slice_new0 (CockpitMachinesIndex);
+  self->directory = g_strdup (directory ? directory : get_machines_json_dir ());
+  self->files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, machines_file_free);
+  self->machines = json_object_new ();
+  return self;
+}
+
+void
+cockpit_machines_index_free (CockpitMachinesIndex *self)
+{
+  if (!self)
+    return;
+  g_hash_table_destroy (self->files);
+  json_object_unref (self->machines);
+  g_free (self->directory);
+  g_slice_free (CockpitMachinesIndex, self);
+}
+
+/* Returns TRUE if the file was (re)parsed */
+static gboolean
+machines_index_load (CockpitMachinesIndex *self,
+                     const char *path)
+{
+  MachinesFile *file;
+  struct stat st;
+
+  if (stat (path, &st) < 0)
+    {
+      if (errno != ENOENT)
+        g_message ("%s: couldn't stat: %s", path, g_strerror (errno));
+      return g_hash_table_remove (self->files, path);
+    }
+
+  file = g_hash_table_lookup (self->files, path);
+  if (file &&
+      file->ino == st.st_ino &&
+      file->size == st.st_size &&
+      file->mtime == st.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + st.st_mtim.tv_nsec &&
+      file->ctime == st.st_ctim.tv_sec * G_GINT64_CONSTANT (1000000000) + st.st_ctim.tv_nsec)
+    return FALSE;
+
+  g_debug ("%s: parsing machines file", path);
+
+  file = g_slice_new0 (MachinesFile);
+  file->ino = st.st_ino;
+  file->size = st.st_size;
+  file->mtime = st.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + st.st_mtim.tv_nsec;
+  file->ctime = st.st_ctim.tv_sec * G_GINT64_CONSTANT (1000000000) + st.st_ctim.tv_nsec;
+  file->config = parse_json_file (path);
+  g_hash_table_replace (self->files, g_strdup (path), file);
+  return TRUE;
+}
+
+static void
+note_change (GHashTable *add_to,
+             GHashTable *remove_from,
+             const char *hostname)
+{
+  if (remove_from)
+    g_hash_table_remove (remove_from, hostname);
+  if (add_to)
+    g_hash_table_add (add_to, g_strdup (hostname));
+}
+
+/**
+ * cockpit_machines_index_refresh:
+ * @self: The index
+ * @updated: (nullable): Set to add the names of added or changed machines to
+ * @removed: (nullable): Set to add the names of removed machines to
+ *
+ * Bring the index up to date with the files on disk. The sets are
+ * string sets owning their keys, such as created by
+ * g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL). A
+ * host moves from one set to the other as its state changes, so the
+ * same sets can be used to accumulate changes over several refreshes.
+ *
+ * Returns: TRUE if any machine changed
+ */
+gboolean
+cockpit_machines_index_refresh (CockpitMachinesIndex *self,
+                                GHashTable *updated,
+                                GHashTable *removed)
+{
+  GHashTableIter iter;
+  JsonObject *machines;
+  JsonNode *previous;
+  gboolean dirty = FALSE;
+  gboolean changed = FALSE;
+  GHashTable *seen;
   gchar *glob_str;
   glob_t conf_glob;
+  GList *hosts, *l;
+  gpointer key;
   int res;
-  JsonNode *machines = NULL;
 
   /* find json config files */
-  glob_str = g_build_filename (get_machines_json_dir (), "*.json", NULL);
+  glob_str = g_build_filename (self->directory, "*.json", NULL);
   res = glob (glob_str, 0, glob_err_func, &conf_glob);
+  g_free (glob_str);
+
   if (G_UNLIKELY (res != 0 && res != GLOB_NOMATCH))
     {
-      g_critical ("glob %s failed with return code %i", glob_str, res);
+      g_critical ("glob %s failed with return code %i", self->directory, res);
       globfree (&conf_glob);
-      g_free (glob_str);
-      return NULL;
+      return FALSE;
     }
 
-  /* start with an empty object */
-  machines = new_object_node ();
-
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
   for (size_t i = 0; i < conf_glob.gl_pathc; ++i)
     {
-      JsonNode *j = parse_json_file (conf_glob.gl_pathv[i]);
-      if (j)
+      if (machines_index_load (self, conf_glob.gl_pathv[i]))
+        dirty = TRUE;
+      g_hash_table_add (seen, conf_glob.gl_pathv[i]);
+    }
+
+  /* Files that went away */
+  g_hash_table_iter_init (&iter, self->files);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (!g_hash_table_contains (seen, key))
+        {
+          g_debug ("%s: machines file removed", (gchar *)key);
+          g_hash_table_iter_remove (&iter);
+          dirty = TRUE;
+        }
+    }
+
+  if (dirty)
+    {
+      /* Merge in glob order, later files override earlier ones */
+      machines = json_object_new ();
+      for (size_t i = 0; i < conf_glob.gl_pathc; ++i)
+        {
+          MachinesFile *file = g_hash_table_lookup (self->files, conf_glob.gl_pathv[i]);
+          if (file && file->config)
+            merge_config (machines, json_node_get_object (file->config), conf_glob.gl_pathv[i]);
+        }
+
+      hosts = json_object_get_members (machines);
+      for (l = hosts; l != NULL; l = g_list_next (l))
+        {
+          previous = json_object_get_member (self->machines, l->data);
+          if (!previous || !cockpit_json_equal (previous, json_object_get_member (machines, l->data)))
+            {
+              g_debug ("%s: machine changed", (gchar *)l->data);
+              note_change (updated, removed, l->data);
+              changed = TRUE;
+            }
+        }
+      g_list_free (hosts);
+
+      hosts = json_object_get_members (self->machines);
+      for (l = hosts; l != NULL; l = g_list_next (l))
         {
-          merge_config (json_node_get_object (machines), json_node_get_object (j), conf_glob.gl_pathv[i]);
-          json_node_free (j);
+          if (!json_object_has_member (machines, l->data))
+            {
+              g_debug ("%s: machine removed", (gchar *)l->data);
+              note_change (removed, updated, l->data);
+              changed = TRUE;
+            }
         }
+      g_list_free (hosts);
+
+      json_object_unref (self->machines);
+      self->machines = machines;
     }
 
+  g_hash_table_unref (seen);
   globfree (&conf_glob);
-  g_free (glob_str);
+  return changed;
+}
+
+/**
+ * cockpit_machines_index_get:
+ * @self: The index
+ *
+ * Returns: (transfer none): The merged machines, as of the last refresh
+ */
+JsonObject *
+cockpit_machines_index_get (CockpitMachinesIndex *self)
+{
+  return self->machines;
+}
+
+JsonNode *
+read_machines_json (void)
+{
+  CockpitMachinesIndex *index;
+  JsonNode *machines;
+
+  index = cockpit_machines_index_new (NULL);
+  cockpit_machines_index_refresh (index, NULL, NULL);
+
+  machines = json_node_new (JSON_NODE_OBJECT);
+  json_node_set_object (machines, cockpit_machines_index_get (index));
+  cockpit_machines_index_free (index);
 
   return machines;
 }
@@ -25,6 +25,8 @@
 
 G_BEGIN_DECLS
 
+typedef struct _CockpitMachinesIndex CockpitMachinesIndex;
+
 const char *    get_machines_json_dir (void);
 
 JsonNode *      read_machines_json    (void);
@@ -34,6 +36,16 @@ gboolean        update_machines_json  (const char *filename,
                                        JsonNode *info,
                                        GError **error);
 
+CockpitMachinesIndex *  cockpit_machines_index_new      (const char *directory);
+
+void                    cockpit_machines_index_free     (CockpitMachinesIndex *self);
+
+gboolean                cockpit_machines_index_refresh  (CockpitMachinesIndex *self,
+                                                         GHashTable *updated,
+                                                         GHashTable *removed);
+
+JsonObject *            cockpit_machines_index_get      (CockpitMachinesIndex *self);
+
 G_END_DECLS
 
 #endif /* __COCKPIT_MACHINES_JSON_H__ */
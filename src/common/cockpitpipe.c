@@ -22,26 +22,24 @@
 #include "cockpitpipe.h"
 
 #include "cockpitflow.h"
+#include "cockpitspawn.h"
 #include "cockpitunixfd.h"
 
 #include <glib-unix.h>
 
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
 
 #include <dirent.h>
 #include <errno.h>
-#include <pty.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#ifdef __linux
-#include <sys/prctl.h>
-#endif
-
 /**
  * CockpitPipe:
  *
@@ -94,11 +92,13 @@ typedef struct {
   GQueue *out_queue;
   gsize out_queued;
   gsize out_partial;
+  GHashTable *out_fds;
 
   int in_fd;
   gboolean in_done;
   GSource *in_source;
   GByteArray *in_buffer;
+  GArray *in_fds;
 
   int err_fd;
   gboolean err_done;
@@ -120,6 +120,12 @@ typedef struct {
 /* A megabyte is when we start to consider queue full enough */
 #define QUEUE_PRESSURE 1024UL * 1024UL
 
+/* Most queued blocks written in one go, a frame is usually two blocks */
+#define MAX_OUT_BLOCKS 64
+
+/* Most file descriptors we hold onto that haven't been stolen */
+#define MAX_IN_FDS 16
+
 static guint cockpit_pipe_sig_read;
 static guint cockpit_pipe_sig_close;
 
@@ -305,6 +311,72 @@ on_child_reap (GPid pid,
     g_signal_emit (self, cockpit_pipe_sig_close, 0, priv->problem);
 }
 
+static void
+close_fds (gpointer data)
+{
+  GArray *fds = data;
+  guint i;
+
+  for (i = 0; i < fds->len; i++)
+    close (g_array_index (fds, gint, i));
+  g_array_free (fds, TRUE);
+}
+
+static gssize
+recv_with_fds (CockpitPipe *self,
+               gpointer data,
+               gsize length)
+{
+  CockpitPipePrivate *priv = cockpit_pipe_get_instance_private (self);
+  union {
+    struct cmsghdr align;
+    gchar buf[CMSG_SPACE (sizeof (gint) * MAX_IN_FDS)];
+  } control;
+  struct cmsghdr *cmsg;
+  struct msghdr msg = { 0, };
+  struct iovec iov;
+  gssize ret;
+  gint *fds;
+  gint i, n;
+
+  iov.iov_base = data;
+  iov.iov_len = length;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  ret = recvmsg (priv->in_fd, &msg, MSG_CMSG_CLOEXEC);
+  if (ret < 0)
+    return ret;
+
+  for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        continue;
+
+      fds = (gint *)CMSG_DATA (cmsg);
+      n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (gint);
+      for (i = 0; i < n; i++)
+        {
+          if (priv->in_fds->len < MAX_IN_FDS)
+            {
+              g_array_append_val (priv->in_fds, fds[i]);
+            }
+          else
+            {
+              g_message ("%s: too many unclaimed file descriptors received", priv->name);
+              close (fds[i]);
+            }
+        }
+    }
+
+  if (msg.msg_flags & MSG_CTRUNC)
+    g_message ("%s: file descriptors received were truncated", priv->name);
+
+  return ret;
+}
+
 static gboolean
 dispatch_input (gint fd,
                 GIOCondition cond,
@@ -328,7 +400,10 @@ dispatch_input (gint fd,
     {
       g_byte_array_set_size (priv->in_buffer, len + DEF_PACKET_SIZE);
       g_debug ("%s: reading input %x", priv->name, cond);
-      ret = read (priv->in_fd, priv->in_buffer->data + len, DEF_PACKET_SIZE);
+      if (priv->in_fds)
+        ret = recv_with_fds (self, priv->in_buffer->data + len, DEF_PACKET_SIZE);
+      else
+        ret = read (priv->in_fd, priv->in_buffer->data + len, DEF_PACKET_SIZE);
 
       errn = errno;
       if (ret < 0)
@@ -533,6 +608,38 @@ dispatch_connect (CockpitPipe *self)
   return FALSE;
 }
 
+static gssize
+send_with_fds (gint fd,
+               struct iovec *iov,
+               gint count,
+               GArray *fds)
+{
+  struct cmsghdr *cmsg;
+  struct msghdr msg = { 0, };
+  gsize space;
+  gssize ret;
+  gint errn;
+
+  space = CMSG_SPACE (sizeof (gint) * fds->len);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+  msg.msg_control = g_malloc0 (space);
+  msg.msg_controllen = space;
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (gint) * fds->len);
+  memcpy (CMSG_DATA (cmsg), fds->data, sizeof (gint) * fds->len);
+
+  ret = sendmsg (fd, &msg, 0);
+
+  errn = errno;
+  g_free (msg.msg_control);
+  errno = errn;
+  return ret;
+}
+
 static gboolean
 dispatch_output (gint fd,
                  GIOCondition cond,
@@ -540,8 +647,9 @@ dispatch_output (gint fd,
 {
   CockpitPipe *self = (CockpitPipe *)user_data;
   CockpitPipePrivate *priv = cockpit_pipe_get_instance_private (self);
-  struct iovec iov[4];
+  struct iovec iov[MAX_OUT_BLOCKS];
   gsize partial, size, before;
+  GArray *fds = NULL;
   GBytes *popped;
   gssize ret;
   gint i, count;
@@ -561,6 +669,10 @@ dispatch_output (gint fd,
       i < G_N_ELEMENTS (iov) && l != NULL;
       i++, l = g_list_next (l))
     {
+      /* File descriptors go with the first byte of their block, so send them separately */
+      if (i > 0 && priv->out_fds && g_hash_table_contains (priv->out_fds, l->data))
+        break;
+
       iov[i].iov_base = (gpointer)g_bytes_get_data (l->data, &iov[i].iov_len);
 
       if (partial)
@@ -573,8 +685,13 @@ dispatch_output (gint fd,
     }
   count = i;
 
+  if (count > 0 && priv->out_fds)
+    fds = g_hash_table_lookup (priv->out_fds, priv->out_queue->head->data);
+
   if (count == 0)
     ret = 0;
+  else if (fds)
+    ret = send_with_fds (priv->out_fd, iov, count, fds);
   else
     ret = writev (priv->out_fd, iov, count);
   if (ret < 0)
@@ -595,6 +712,10 @@ dispatch_output (gint fd,
       return FALSE;
     }
 
+  /* Once any of the block is written, the file descriptors went with it */
+  if (fds && ret > 0)
+    g_hash_table_remove (priv->out_fds, priv->out_queue->head->data);
+
   /* Figure out what was written */
   for (i = 0; ret > 0 && i < count; i++)
     {
@@ -833,6 +954,8 @@ cockpit_pipe_dispose (GObject *object)
   cockpit_pipe_throttle (COCKPIT_FLOW (self), NULL);
   g_assert (priv->pressure == NULL);
 
+  if (priv->out_fds)
+    g_hash_table_remove_all (priv->out_fds);
   while (priv->out_queue->head)
     g_bytes_unref (g_queue_pop_head (priv->out_queue));
   priv->out_queued = 0;
@@ -865,6 +988,10 @@ cockpit_pipe_finalize (GObject *object)
   if (priv->err_buffer)
     g_byte_array_unref (priv->err_buffer);
   g_queue_free (priv->out_queue);
+  if (priv->out_fds)
+    g_hash_table_unref (priv->out_fds);
+  if (priv->in_fds)
+    close_fds (priv->in_fds);
   g_free (priv->problem);
   g_free (priv->name);
 
@@ -1063,6 +1190,114 @@ _cockpit_pipe_write (CockpitPipe *self,
    */
 }
 
+/**
+ * cockpit_pipe_write_fds:
+ * @self: the pipe
+ * @data: the data to write
+ * @fds: file descriptors to send along with @data
+ * @n_fds: number of file descriptors
+ *
+ * Like cockpit_pipe_write() but also sends copies of @fds to the
+ * other side, along with the first byte of @data. The output of the
+ * pipe must be a unix socket. The caller keeps ownership of @fds.
+ *
+ * The other side must use cockpit_pipe_accept_fds() to receive them.
+ */
+void
+cockpit_pipe_write_fds (CockpitPipe *self,
+                        GBytes *data,
+                        const gint *fds,
+                        guint n_fds)
+{
+  CockpitPipePrivate *priv = cockpit_pipe_get_instance_private (self);
+  GArray *copies;
+  GBytes *block;
+  gint fd;
+  guint i;
+
+  g_return_if_fail (COCKPIT_IS_PIPE (self));
+  g_return_if_fail (g_bytes_get_size (data) > 0);
+  g_return_if_fail (n_fds > 0);
+
+  if (priv->closed)
+    {
+      g_debug ("%s: not sending file descriptors on closed pipe", priv->name);
+      return;
+    }
+
+  copies = g_array_sized_new (FALSE, FALSE, sizeof (gint), n_fds);
+  for (i = 0; i < n_fds; i++)
+    {
+      fd = fcntl (fds[i], F_DUPFD_CLOEXEC, 3);
+      if (fd < 0)
+        {
+          g_warning ("%s: couldn't duplicate file descriptor: %s", priv->name, g_strerror (errno));
+          close_fds (copies);
+          return;
+        }
+      g_array_append_val (copies, fd);
+    }
+
+  /* A block of our own, so that we can recognize it in the queue */
+  block = g_bytes_new_from_bytes (data, 0, g_bytes_get_size (data));
+
+  if (!priv->out_fds)
+    priv->out_fds = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, close_fds);
+  g_hash_table_insert (priv->out_fds, block, copies);
+
+  cockpit_pipe_write (self, block);
+  g_bytes_unref (block);
+}
+
+/**
+ * cockpit_pipe_accept_fds:
+ * @self: the pipe
+ *
+ * Start receiving file descriptors sent over the input of the pipe,
+ * which must be a unix socket. Without this any file descriptors
+ * sent are discarded by the kernel.
+ *
+ * Use cockpit_pipe_steal_fds() to claim them.
+ */
+void
+cockpit_pipe_accept_fds (CockpitPipe *self)
+{
+  CockpitPipePrivate *priv = cockpit_pipe_get_instance_private (self);
+
+  g_return_if_fail (COCKPIT_IS_PIPE (self));
+
+  if (!priv->in_fds)
+    priv->in_fds = g_array_new (FALSE, FALSE, sizeof (gint));
+}
+
+/**
+ * cockpit_pipe_steal_fds:
+ * @self: the pipe
+ * @fds: location to place file descriptors
+ * @n_fds: the number of file descriptors wanted
+ *
+ * Claim the @n_fds file descriptors received earliest. Either all of
+ * them are returned or none.
+ *
+ * Returns: %TRUE if enough file descriptors had been received
+ */
+gboolean
+cockpit_pipe_steal_fds (CockpitPipe *self,
+                        gint *fds,
+                        guint n_fds)
+{
+  CockpitPipePrivate *priv = cockpit_pipe_get_instance_private (self);
+
+  g_return_val_if_fail (COCKPIT_IS_PIPE (self), FALSE);
+
+  if (!priv->in_fds || priv->in_fds->len < n_fds)
+    return FALSE;
+
+  memcpy (fds, priv->in_fds->data, sizeof (gint) * n_fds);
+  g_array_remove_range (priv->in_fds, 0, n_fds);
+  return TRUE;
+}
+
 /**
  * cockpit_pipe_close:
  * @self: a pipe
@@ -1192,44 +1427,109 @@ cockpit_pipe_connect (const gchar *name,
   return pipe;
 }
 
-static GSpawnFlags
-calculate_spawn_flags (const gchar **env,
-                       CockpitPipeFlags pflags)
+static void
+close_pipe_fds (gint *fds,
+                gint n_fds)
 {
-  GSpawnFlags flags = G_SPAWN_DO_NOT_REAP_CHILD;
-  gboolean path_flag = FALSE;
+  gint i;
 
-  for (; env && env[0]; env++)
+  for (i = 0; i < n_fds; i++)
     {
-      if (g_str_has_prefix (env[0], "PATH="))
-        {
-          flags |= G_SPAWN_SEARCH_PATH_FROM_ENVP;
-          path_flag = TRUE;
-          break;
-        }
+      if (fds[i] >= 0)
+        close (fds[i]);
+      fds[i] = -1;
     }
+}
+
+static gboolean
+spawn_with_pipes (const gchar **argv,
+                  const gchar **env,
+                  const gchar *directory,
+                  CockpitPipeFlags flags,
+                  GPid *pid,
+                  gint *child_stdin,
+                  gint *child_stdout,
+                  gint *child_stderr,
+                  GError **error)
+{
+  gint in[2] = { -1, -1 };
+  gint out[2] = { -1, -1 };
+  gint err[2] = { -1, -1 };
+  gint remap[3] = { -1, -1, -1 };
+  gboolean ret = FALSE;
+
+  if (!g_unix_open_pipe (in, FD_CLOEXEC, error) ||
+      !g_unix_open_pipe (out, FD_CLOEXEC, error))
+    goto out;
 
-  if (!path_flag)
-    flags |= G_SPAWN_SEARCH_PATH;
+  remap[0] = in[0];
+  remap[1] = out[1];
 
-  if (pflags & COCKPIT_PIPE_STDERR_TO_NULL)
-    flags |= G_SPAWN_STDERR_TO_DEV_NULL;
+  if (flags & COCKPIT_PIPE_STDERR_TO_MEMORY)
+    {
+      if (!g_unix_open_pipe (err, FD_CLOEXEC, error))
+        goto out;
+      remap[2] = err[1];
+    }
+  else if (flags & COCKPIT_PIPE_STDERR_TO_STDOUT)
+    {
+      remap[2] = out[1];
+    }
+  else if (flags & COCKPIT_PIPE_STDERR_TO_NULL)
+    {
+      err[1] = open ("/dev/null", O_WRONLY | O_CLOEXEC);
+      if (err[1] < 0)
+        {
+          int errn = errno;
+          g_set_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                       "Failed to open /dev/null: %s", g_strerror (errn));
+          goto out;
+        }
+      remap[2] = err[1];
+    }
 
-  return flags;
+  /* Send SIGHUP to all direct child processes, when bridge dies */
+  if (!cockpit_spawn (argv, env, directory, remap, G_N_ELEMENTS (remap),
+                      COCKPIT_SPAWN_SEARCH_PATH | COCKPIT_SPAWN_PDEATHSIG, pid, error))
+    goto out;
+
+  *child_stdin = in[1];
+  *child_stdout = out[0];
+  *child_stderr = err[0];
+  in[1] = out[0] = err[0] = -1;
+  ret = TRUE;
+
+out:
+  close_pipe_fds (in, 2);
+  close_pipe_fds (out, 2);
+  close_pipe_fds (err, 2);
+  return ret;
 }
 
-static void
-spawn_setup (gpointer data)
+static const gchar *
+spawn_error_to_problem (const gchar *name,
+                        const gchar *program,
+                        GError *error)
 {
-  CockpitPipeFlags flags = GPOINTER_TO_INT (data);
+  const gchar *problem = NULL;
+
+  if (g_error_matches (error, G_SPAWN_ERROR, G_SPAWN_ERROR_NOENT))
+    problem = "not-found";
+  else if (g_error_matches (error, G_SPAWN_ERROR, G_SPAWN_ERROR_PERM) ||
+           g_error_matches (error, G_SPAWN_ERROR, G_SPAWN_ERROR_ACCES))
+    problem = "access-denied";
 
-  /* Send this signal to all direct child processes, when bridge dies */
-#ifdef __linux
-  prctl (PR_SET_PDEATHSIG, SIGHUP);
-#endif
+  if (problem)
+    {
+      g_debug ("%s: couldn't run %s: %s", name, program, error->message);
+    }
+  else
+    {
+      g_message ("%s: couldn't run %s: %s", name, program, error->message);
+      problem = "internal-error";
+    }
 
-  if (flags & COCKPIT_PIPE_STDERR_TO_STDOUT)
-    dup2 (1, 2);
+  return problem;
 }
 
 /**
@@ -1264,18 +1564,11 @@ cockpit_pipe_spawn (const gchar **argv,
   int session_stdout = -1;
   int session_stderr = -1;
   GError *error = NULL;
-  const gchar *problem = NULL;
-  int *with_stderr = NULL;
   gchar *name;
   GPid pid = 0;
 
-  if (flags & COCKPIT_PIPE_STDERR_TO_MEMORY)
-    with_stderr = &session_stderr;
-
-  g_spawn_async_with_pipes (directory, (gchar **)argv, (gchar **)env,
-                            calculate_spawn_flags (env, flags),
-                            spawn_setup, GINT_TO_POINTER (flags),
-                            &pid, &session_stdin, &session_stdout, with_stderr, &error);
+  spawn_with_pipes (argv, env, directory, flags, &pid,
+                    &session_stdin, &session_stdout, &session_stderr, &error);
 
   name = g_path_get_basename (argv[0]);
   if (name == NULL)
@@ -1296,22 +1589,7 @@ cockpit_pipe_spawn (const gchar **argv,
 
   if (error)
     {
-      if (g_error_matches (error, G_SPAWN_ERROR, G_SPAWN_ERROR_NOENT))
-        problem = "not-found";
-      else if (g_error_matches (error, G_SPAWN_ERROR, G_SPAWN_ERROR_PERM) ||
-               g_error_matches (error, G_SPAWN_ERROR, G_SPAWN_ERROR_ACCES))
-        problem = "access-denied";
-
-      if (problem)
-        {
-          g_debug ("%s: couldn't run %s: %s", name, argv[0], error->message);
-        }
-      else
-        {
-          g_message ("%s: couldn't run %s: %s", name, argv[0], error->message);
-          problem = "internal-error";
-        }
-      priv->problem = g_strdup (problem);
+      priv->problem = g_strdup (spawn_error_to_problem (name, argv[0], error));
       cockpit_close_later (pipe);
       g_error_free (error);
     }
@@ -1326,6 +1604,36 @@ cockpit_pipe_spawn (const gchar **argv,
 }
 
 
+static int
+open_pty (struct winsize *winsz,
+          int *tty)
+{
+  char name[64];
+  int errn;
+  int fd;
+
+  fd = posix_openpt (O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  if (grantpt (fd) < 0 || unlockpt (fd) < 0 ||
+      ptsname_r (fd, name, sizeof (name)) != 0 ||
+      ioctl (fd, TIOCSWINSZ, winsz) < 0)
+    goto fail;
+
+  *tty = open (name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (*tty < 0)
+    goto fail;
+
+  return fd;
+
+fail:
+  errn = errno;
+  close (fd);
+  errno = errn;
+  return -1;
+}
+
 /**
  * cockpit_pipe_pty:
  * @argv: null terminated string array of command arguments
@@ -1350,45 +1658,32 @@ cockpit_pipe_pty (const gchar **argv,
 {
   CockpitPipe *pipe = NULL;
   CockpitPipePrivate *priv;
-  const gchar *path = NULL;
+  const gchar *problem = "internal-error";
+  GError *error = NULL;
   GPid pid = 0;
   int fd;
+  int tty = -1;
+  int remap[3];
   struct winsize winsz = { window_rows, window_cols, 0, 0 };
 
-  if (env)
-    path = g_environ_getenv ((gchar **)env, "PATH");
-
-  pid = forkpty (&fd, NULL, NULL, &winsz);
-  if (pid == 0)
+  fd = open_pty (&winsz, &tty);
+  if (fd < 0)
     {
-      if (cockpit_unix_fd_close_all (3, -1) < 0)
-        {
-          g_printerr ("couldn't close file descriptors\n");
-          _exit (127);
-        }
-      if (directory)
-        {
-          if (chdir (directory) < 0)
-            {
-              g_printerr ("couldn't change to directory: %s\n", g_strerror (errno));
-              _exit (127);
-            }
-        }
-      /* Allow the commands below to act on $PATH */
-      if (path)
-        putenv ((gchar *)path);
-      if (env)
-        execvpe (argv[0], (char *const *)argv, (char *const *)env);
-      else
-        execvp (argv[0], (char *const *)argv);
-      g_printerr ("couldn't execute: %s: %s\n", argv[0], g_strerror (errno));
-      _exit (127);
+      g_warning ("couldn't open pty: %s", g_strerror (errno));
     }
-  else if (pid < 0)
+  else
     {
-      g_warning ("forkpty failed: %s", g_strerror (errno));
-      pid = 0;
-      fd = -1;
+      remap[0] = remap[1] = remap[2] = tty;
+      if (!cockpit_spawn (argv, env, directory, remap, G_N_ELEMENTS (remap),
+                          COCKPIT_SPAWN_SEARCH_PATH | COCKPIT_SPAWN_CONTROLLING_TTY,
+                          &pid, &error))
+        {
+          problem = spawn_error_to_problem (argv[0], argv[0], error);
+          g_error_free (error);
+          close (fd);
+          fd = -1;
+        }
+      close (tty);
     }
 
   pipe = g_object_new (COCKPIT_TYPE_PIPE,
@@ -1402,7 +1697,7 @@ cockpit_pipe_pty (const gchar **argv,
 
   if (fd < 0)
     {
-      priv->problem = g_strdup ("internal-error");
+      priv->problem = g_strdup (problem);
       cockpit_close_later (pipe);
     }
 
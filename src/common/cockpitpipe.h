@@ -76,6 +76,17 @@ void               _cockpit_pipe_write        (CockpitPipe *self,
                                               const gchar *caller,
                                               gint line);
 
+void               cockpit_pipe_write_fds    (CockpitPipe *self,
+                                              GBytes *data,
+                                              const gint *fds,
+                                              guint n_fds);
+
+void               cockpit_pipe_accept_fds   (CockpitPipe *self);
+
+gboolean           cockpit_pipe_steal_fds    (CockpitPipe *self,
+                                              gint *fds,
+                                              guint n_fds);
+
 void               cockpit_pipe_close        (CockpitPipe *self,
                                               const gchar *problem);
 
@@ -22,11 +22,15 @@
 #include "cockpitpipetransport.h"
 
 #include "cockpitframe.h"
+#include "cockpitjson.h"
 #include "cockpitpipe.h"
+#include "cockpitshmring.h"
+#include "cockpitunixfd.h"
 
 #include <glib-unix.h>
 
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
 
@@ -41,6 +45,16 @@
  * A #CockpitTransport implementation that shuttles data over a
  * #CockpitPipe. See doc/protocol.md for information on how the
  * framing looks ... including the MSB length prefix.
+ *
+ * When both ends are local processes connected by a unix socket, the
+ * frames can instead go through a pair of shared memory rings. One side
+ * calls cockpit_pipe_transport_offer_shm() and the other one
+ * cockpit_pipe_transport_accept_shm(). The socket is still used to
+ * notice when the other side goes away. If anything goes wrong while
+ * setting up the rings, the frames just keep going over the socket.
+ *
+ * Each side only looks at control messages until the offer has been
+ * answered, refused or given up on.
  */
 
 struct _CockpitPipeTransport {
@@ -50,15 +64,36 @@ struct _CockpitPipeTransport {
   gboolean closed;
   gulong read_sig;
   gulong close_sig;
+  GList *relays;
+
+  /* Shared memory rings, see cockpit_pipe_transport_offer_shm() */
+  gboolean shm_accept;
+  CockpitShmRing *shm;
+  GSource *shm_source;
+  guint shm_timeout;
+  gboolean shm_sending;
+  gboolean shm_receiving;
+  gboolean shm_closing;
+  GByteArray *shm_input;
+  GQueue *shm_queue;
+  gsize shm_partial;
 };
 
+/* How long to wait for the other side to answer a shared memory offer */
+#define SHM_ANSWER_TIMEOUT 30
+
+typedef struct {
+  CockpitPipeTransportRelayFunc func;
+  gpointer user_data;
+} PipeRelay;
+
 enum {
     PROP_0,
     PROP_NAME,
     PROP_PIPE,
 };
 
-static void      cockpit_transport_read_from_pipe      (CockpitTransport *self,
+static void      cockpit_transport_read_from_pipe      (CockpitPipeTransport *self,
                                                         const gchar *logname,
                                                         CockpitPipe *pipe,
                                                         gboolean *closed,
@@ -70,7 +105,264 @@ G_DEFINE_TYPE (CockpitPipeTransport, cockpit_pipe_transport, COCKPIT_TYPE_TRANSP
 static void
 cockpit_pipe_transport_init (CockpitPipeTransport *self)
 {
+  self->shm_queue = g_queue_new ();
+}
+
+static void
+flush_to_shm (CockpitPipeTransport *self)
+{
+  const guint8 *data;
+  GBytes *block;
+  gssize ret;
+  gsize size;
+
+  while ((block = g_queue_peek_head (self->shm_queue)) != NULL)
+    {
+      data = g_bytes_get_data (block, &size);
+      ret = cockpit_shm_ring_write (self->shm, data + self->shm_partial, size - self->shm_partial);
+      if (ret < 0)
+        {
+          cockpit_pipe_close (self->pipe, "protocol-error");
+          return;
+        }
+
+      /* The other side wakes us when there's more space */
+      self->shm_partial += ret;
+      if (self->shm_partial < size)
+        return;
+
+      g_bytes_unref (g_queue_pop_head (self->shm_queue));
+      self->shm_partial = 0;
+    }
+
+  if (self->shm_closing)
+    {
+      self->shm_closing = FALSE;
+      cockpit_pipe_close (self->pipe, NULL);
+    }
+}
+
+static void
+write_frames (CockpitPipeTransport *self,
+              GBytes *data)
+{
+  if (!self->shm_sending)
+    {
+      cockpit_pipe_write (self->pipe, data);
+      return;
+    }
+
+  g_queue_push_tail (self->shm_queue, g_bytes_ref (data));
+  if (self->shm_queue->length == 1)
+    flush_to_shm (self);
+}
+
+static void
+close_when_sent (CockpitPipeTransport *self)
+{
+  /* Don't close the pipe until the other side has everything from the ring */
+  if (g_queue_is_empty (self->shm_queue))
+    cockpit_pipe_close (self->pipe, NULL);
+  else
+    self->shm_closing = TRUE;
+}
+
+static void
+read_from_shm (CockpitPipeTransport *self,
+               gboolean end_of_data)
+{
+  if (cockpit_shm_ring_read (self->shm, self->shm_input) < 0)
+    {
+      cockpit_pipe_close (self->pipe, "protocol-error");
+      return;
+    }
+
+  cockpit_transport_read_from_pipe (self, self->name, self->pipe, &self->closed,
+                                    self->shm_input, end_of_data);
+}
+
+static gboolean
+on_shm_wake (gint fd,
+             GIOCondition cond,
+             gpointer user_data)
+{
+  CockpitPipeTransport *self = COCKPIT_PIPE_TRANSPORT (user_data);
+
+  cockpit_shm_ring_clear_wake (self->shm);
+
+  g_object_ref (self);
+
+  if (!self->closed && self->shm_receiving)
+    read_from_shm (self, FALSE);
+  if (!self->closed && self->shm_sending)
+    flush_to_shm (self);
+
+  g_object_unref (self);
+  return TRUE;
+}
+
+static void
+start_shm (CockpitPipeTransport *self,
+           CockpitShmRing *ring)
+{
+  g_assert (self->shm == NULL);
+
+  self->shm = ring;
+  self->shm_input = g_byte_array_new ();
+  self->shm_source = cockpit_unix_fd_source_new (cockpit_shm_ring_get_wake_fd (ring), G_IO_IN);
+  g_source_set_name (self->shm_source, "pipe-transport-shm");
+  g_source_set_callback (self->shm_source, (GSourceFunc)on_shm_wake, self, NULL);
+  g_source_attach (self->shm_source, NULL);
+}
+
+static void
+stop_shm (CockpitPipeTransport *self)
+{
+  g_assert (!self->shm_sending && !self->shm_receiving);
+
+  if (self->shm_timeout)
+    g_source_remove (self->shm_timeout);
+  self->shm_timeout = 0;
+  if (self->shm_source)
+    {
+      g_source_destroy (self->shm_source);
+      g_source_unref (self->shm_source);
+      self->shm_source = NULL;
+    }
+  cockpit_shm_ring_free (self->shm);
+  self->shm = NULL;
+  if (self->shm_input)
+    g_byte_array_unref (self->shm_input);
+  self->shm_input = NULL;
+}
+
+static gboolean
+on_shm_timeout (gpointer user_data)
+{
+  CockpitPipeTransport *self = COCKPIT_PIPE_TRANSPORT (user_data);
+
+  g_debug ("%s: no answer to shared memory offer", self->name);
+  self->shm_timeout = 0;
+  stop_shm (self);
+  return FALSE;
+}
+
+static void
+send_shm_refused (CockpitPipeTransport *self,
+                  const gchar *problem)
+{
+  GBytes *payload;
+
+  payload = cockpit_transport_build_control ("command", "shm-ready", "problem", problem, NULL);
+  cockpit_transport_send (COCKPIT_TRANSPORT (self), NULL, payload);
+  g_bytes_unref (payload);
+}
+
+static void
+send_shm_ready (CockpitPipeTransport *self)
+{
+  GBytes *payload;
+
+  /* The last thing we send over the pipe, everything after goes in the ring */
+  payload = cockpit_transport_build_control ("command", "shm-ready", NULL);
+  cockpit_transport_send (COCKPIT_TRANSPORT (self), NULL, payload);
+  g_bytes_unref (payload);
+
+  self->shm_sending = TRUE;
+}
+
+static void
+process_shm (CockpitPipeTransport *self)
+{
+  gint fds[COCKPIT_SHM_RING_N_FDS];
+  CockpitShmRing *ring;
+  GError *error = NULL;
+
+  self->shm_accept = FALSE;
+
+  if (!cockpit_pipe_steal_fds (self->pipe, fds, G_N_ELEMENTS (fds)))
+    {
+      g_debug ("%s: shared memory offered without file descriptors", self->name);
+      send_shm_refused (self, "not-supported");
+      return;
+    }
+
+  ring = cockpit_shm_ring_attach (fds, &error);
+  if (!ring)
+    {
+      g_message ("%s: couldn't use shared memory: %s", self->name, error->message);
+      g_error_free (error);
+      send_shm_refused (self, "internal-error");
+      return;
+    }
+
+  g_debug ("%s: sending over shared memory", self->name);
+  start_shm (self, ring);
+  send_shm_ready (self);
+}
+
+static void
+process_shm_ready (CockpitPipeTransport *self,
+                   JsonObject *options)
+{
+  const gchar *problem = NULL;
+
+  if (self->shm_timeout)
+    g_source_remove (self->shm_timeout);
+  self->shm_timeout = 0;
+
+  if (!cockpit_json_get_string (options, "problem", NULL, &problem) || problem)
+    {
+      g_debug ("%s: shared memory refused: %s", self->name, problem ? problem : "invalid");
+      if (self->shm_sending)
+        cockpit_pipe_close (self->pipe, "protocol-error");
+      else
+        stop_shm (self);
+      return;
+    }
+
+  g_debug ("%s: receiving over shared memory", self->name);
+
+  self->shm_receiving = TRUE;
+  if (!self->shm_sending)
+    send_shm_ready (self);
 
+  /* Anything already in the ring is picked up from the main loop */
+  cockpit_shm_ring_wake (self->shm);
+}
+
+/*
+ * While setting up the rings the "shm" and "shm-ready" control
+ * messages are handled here and not passed on.
+ */
+static gboolean
+intercept_shm_control (CockpitPipeTransport *self,
+                       GBytes *payload)
+{
+  const gchar *command;
+  const gchar *channel;
+  JsonObject *options;
+  gboolean ret = TRUE;
+
+  if (!self->shm_accept && (!self->shm || self->shm_receiving))
+    return FALSE;
+
+  if (!cockpit_transport_parse_command (payload, &command, &channel, &options))
+    return FALSE;
+
+  if (self->shm_accept && g_str_equal (command, "shm"))
+    process_shm (self);
+  else if (self->shm && g_str_equal (command, "shm-ready"))
+    process_shm_ready (self, options);
+  else
+    ret = FALSE;
+
+  /* An offer only ever comes right after "init", don't keep waiting for it */
+  if (self->shm_accept && !ret && !g_str_equal (command, "init"))
+    self->shm_accept = FALSE;
+
+  json_object_unref (options);
+  return ret;
 }
 
 static void
@@ -80,11 +372,20 @@ on_pipe_read (CockpitPipe *pipe,
               gpointer user_data)
 {
   CockpitPipeTransport *self = COCKPIT_PIPE_TRANSPORT (user_data);
-  cockpit_transport_read_from_pipe (COCKPIT_TRANSPORT (self), self->name,
+
+  g_object_ref (self);
+
+  cockpit_transport_read_from_pipe (self, self->name,
                                     pipe, &self->closed, input, end_of_data);
 
+  /* The other side has gone away, pick up the rest of what it sent */
+  if (end_of_data && !self->closed && self->shm_receiving)
+    read_from_shm (self, TRUE);
+
   if (end_of_data)
-    cockpit_pipe_close (self->pipe, NULL);
+    close_when_sent (self);
+
+  g_object_unref (self);
 }
 
 static void
@@ -209,6 +510,19 @@ cockpit_pipe_transport_finalize (GObject *object)
   g_signal_handler_disconnect (self->pipe, self->read_sig);
   g_signal_handler_disconnect (self->pipe, self->close_sig);
 
+  if (self->shm_timeout)
+    g_source_remove (self->shm_timeout);
+  if (self->shm_source)
+    {
+      g_source_destroy (self->shm_source);
+      g_source_unref (self->shm_source);
+    }
+  cockpit_shm_ring_free (self->shm);
+  if (self->shm_input)
+    g_byte_array_unref (self->shm_input);
+  g_queue_free_full (self->shm_queue, (GDestroyNotify)g_bytes_unref);
+
+  g_list_free_full (self->relays, g_free);
   g_free (self->name);
   g_clear_object (&self->pipe);
 
@@ -240,8 +554,8 @@ cockpit_pipe_transport_send (CockpitTransport *transport,
                                 channel_id ? channel_id : "");
   prefix = g_bytes_new_take (prefix_str, strlen (prefix_str));
 
-  cockpit_pipe_write (self->pipe, prefix);
-  cockpit_pipe_write (self->pipe, payload);
+  write_frames (self, prefix);
+  write_frames (self, payload);
   g_bytes_unref (prefix);
 
   g_debug ("%s: queued %" G_GSIZE_FORMAT " byte payload", self->name, payload_len);
@@ -252,7 +566,11 @@ cockpit_pipe_transport_close (CockpitTransport *transport,
                               const gchar *problem)
 {
   CockpitPipeTransport *self = COCKPIT_PIPE_TRANSPORT (transport);
-  cockpit_pipe_close (self->pipe, problem);
+
+  if (problem)
+    cockpit_pipe_close (self->pipe, problem);
+  else
+    close_when_sent (self);
 }
 
 static void
@@ -326,6 +644,240 @@ cockpit_pipe_transport_get_pipe (CockpitPipeTransport *self)
   return self->pipe;
 }
 
+static gboolean
+is_socket (CockpitPipe *pipe,
+           const gchar *property)
+{
+  struct stat st;
+  gint fd = -1;
+
+  g_object_get (pipe, property, &fd, NULL);
+  return fd >= 0 && fstat (fd, &st) == 0 && S_ISSOCK (st.st_mode);
+}
+
+/**
+ * cockpit_pipe_transport_offer_shm:
+ * @self: the transport
+ * @size: the size of the ring in each direction
+ *
+ * Offer the other side of the transport to send frames through
+ * shared memory rings. This only works if the other side is a local
+ * process that has called cockpit_pipe_transport_accept_shm().
+ *
+ * The frames keep going over the pipe until the other side says
+ * it's ready. If it refuses, or doesn't answer in time, the offer
+ * is dropped and nothing changes.
+ *
+ * Returns: %FALSE if shared memory can't be used with this transport
+ */
+gboolean
+cockpit_pipe_transport_offer_shm (CockpitPipeTransport *self,
+                                  gsize size)
+{
+  CockpitShmRing *ring;
+  GError *error = NULL;
+  GByteArray *buffer;
+  GBytes *payload;
+  GBytes *frame;
+  gchar *prefix;
+  gsize length;
+
+  g_return_val_if_fail (COCKPIT_IS_PIPE_TRANSPORT (self), FALSE);
+
+  if (self->closed || self->shm || self->shm_accept || !is_socket (self->pipe, "out-fd"))
+    return FALSE;
+
+  ring = cockpit_shm_ring_new (size, &error);
+  if (!ring)
+    {
+      g_message ("%s: couldn't create shared memory: %s", self->name, error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  start_shm (self, ring);
+
+  /* The file descriptors need to go with a single block that holds the whole frame */
+  payload = cockpit_transport_build_control ("command", "shm", NULL);
+  length = g_bytes_get_size (payload);
+  prefix = g_strdup_printf ("%" G_GSIZE_FORMAT "\n\n", length + 1);
+  buffer = g_byte_array_new ();
+  g_byte_array_append (buffer, (guint8 *)prefix, strlen (prefix));
+  g_byte_array_append (buffer, g_bytes_get_data (payload, NULL), length);
+  frame = g_byte_array_free_to_bytes (buffer);
+
+  cockpit_pipe_write_fds (self->pipe, frame, cockpit_shm_ring_get_fds (ring), COCKPIT_SHM_RING_N_FDS);
+  self->shm_timeout = g_timeout_add_seconds (SHM_ANSWER_TIMEOUT, on_shm_timeout, self);
+
+  g_bytes_unref (frame);
+  g_bytes_unref (payload);
+  g_free (prefix);
+  return TRUE;
+}
+
+/**
+ * cockpit_pipe_transport_accept_shm:
+ * @self: the transport
+ *
+ * Be ready to accept an offer of shared memory rings from the other
+ * side of the transport, see cockpit_pipe_transport_offer_shm(). The
+ * offer has to come before any control message other than "init".
+ *
+ * Returns: %FALSE if shared memory can't be used with this transport
+ */
+gboolean
+cockpit_pipe_transport_accept_shm (CockpitPipeTransport *self)
+{
+  g_return_val_if_fail (COCKPIT_IS_PIPE_TRANSPORT (self), FALSE);
+
+  if (self->closed || self->shm || !is_socket (self->pipe, "in-fd"))
+    return FALSE;
+
+  cockpit_pipe_accept_fds (self->pipe);
+  self->shm_accept = TRUE;
+  return TRUE;
+}
+
+/**
+ * cockpit_pipe_transport_get_shm:
+ * @self: the transport
+ *
+ * Returns: whether frames go through shared memory in both directions
+ */
+gboolean
+cockpit_pipe_transport_get_shm (CockpitPipeTransport *self)
+{
+  g_return_val_if_fail (COCKPIT_IS_PIPE_TRANSPORT (self), FALSE);
+  return self->shm_sending && self->shm_receiving;
+}
+
+/**
+ * cockpit_pipe_transport_add_relay:
+ * @self: the transport to relay frames from
+ * @func: called with the channel of each received data frame
+ * @user_data: data for @func
+ *
+ * Frames whose channel @func maps to another #CockpitPipeTransport
+ * are copied verbatim into that transport's output queue, including
+ * their length prefix and channel header. They are not parsed and
+ * no "recv" signal is emitted for them.
+ *
+ * Runs of consecutive frames for the same target are forwarded in one
+ * go. Control messages always take the normal path, which keeps the
+ * order of all messages intact.
+ *
+ * The caller is responsible for not relaying frozen channels.
+ */
+void
+cockpit_pipe_transport_add_relay (CockpitPipeTransport *self,
+                                  CockpitPipeTransportRelayFunc func,
+                                  gpointer user_data)
+{
+  PipeRelay *relay;
+
+  g_return_if_fail (COCKPIT_IS_PIPE_TRANSPORT (self));
+  g_return_if_fail (func != NULL);
+
+  relay = g_new0 (PipeRelay, 1);
+  relay->func = func;
+  relay->user_data = user_data;
+  self->relays = g_list_append (self->relays, relay);
+}
+
+void
+cockpit_pipe_transport_remove_relay (CockpitPipeTransport *self,
+                                     gpointer user_data)
+{
+  PipeRelay *relay;
+  GList *l;
+
+  g_return_if_fail (COCKPIT_IS_PIPE_TRANSPORT (self));
+
+  for (l = self->relays; l != NULL; l = g_list_next (l))
+    {
+      relay = l->data;
+      if (relay->user_data == user_data)
+        {
+          self->relays = g_list_delete_link (self->relays, l);
+          g_free (relay);
+          return;
+        }
+    }
+}
+
+static CockpitPipeTransport *
+lookup_relay (CockpitPipeTransport *self,
+              const guint8 *frame,
+              gsize length)
+{
+  CockpitPipeTransport *target;
+  const guint8 *line;
+  gchar channel[128];
+  PipeRelay *relay;
+  gsize len;
+  GList *l;
+
+  line = memchr (frame, '\n', length);
+  if (!line)
+    return NULL;
+
+  /* Control messages and odd channel ids go the normal way */
+  len = line - frame;
+  if (len == 0 || len >= sizeof (channel) || memchr (frame, '\0', len))
+    return NULL;
+
+  memcpy (channel, frame, len);
+  channel[len] = '\0';
+
+  for (l = self->relays; l != NULL; l = g_list_next (l))
+    {
+      relay = l->data;
+      target = (relay->func) (self, channel, relay->user_data);
+      if (target)
+        return target;
+    }
+
+  return NULL;
+}
+
+static gboolean
+relay_from_pipe (CockpitPipeTransport *self,
+                 GByteArray *input)
+{
+  CockpitPipeTransport *target = NULL;
+  CockpitPipeTransport *next;
+  gsize offset = 0;
+  GBytes *frames;
+  gssize size;
+  gsize i;
+
+  for (;;)
+    {
+      size = cockpit_frame_parse (input->data + offset, input->len - offset, &i);
+      if (size <= 0 || input->len - offset < i + size)
+        break;
+
+      next = lookup_relay (self, input->data + offset + i, size);
+      if (!next || (target && next != target))
+        break;
+
+      target = next;
+      offset += i + size;
+    }
+
+  if (offset == 0)
+    return FALSE;
+
+  frames = cockpit_pipe_consume (input, 0, offset, 0);
+  if (target->closed)
+    g_debug ("%s: dropping relayed frames on closed transport", self->name);
+  else
+    write_frames (target, frames);
+  g_bytes_unref (frames);
+
+  return TRUE;
+}
+
 /**
  * cockpit_transport_read_from_pipe:
  *
@@ -334,7 +886,7 @@ cockpit_pipe_transport_get_pipe (CockpitPipeTransport *self)
  * during the read and parse loop.
  */
 static void
-cockpit_transport_read_from_pipe (CockpitTransport *self,
+cockpit_transport_read_from_pipe (CockpitPipeTransport *self,
                                   const gchar *logname,
                                   CockpitPipe *pipe,
                                   gboolean *closed,
@@ -353,6 +905,9 @@ cockpit_transport_read_from_pipe (CockpitTransport *self,
 
   while (!*closed)
     {
+      if (self->relays && relay_from_pipe (self, input))
+        continue;
+
       size = cockpit_frame_parse (input->data, input->len, &i);
 
       if (size == 0)
@@ -375,10 +930,14 @@ cockpit_transport_read_from_pipe (CockpitTransport *self,
 
       message = cockpit_pipe_consume (input, i, size, 0);
       payload = cockpit_transport_parse_frame (message, &channel);
-      if (payload)
+      if (payload && !channel && intercept_shm_control (self, payload))
+        {
+          g_bytes_unref (payload);
+        }
+      else if (payload)
         {
           g_debug ("%s: received a %d byte payload", logname, (int)size);
-          cockpit_transport_emit_recv (self, channel, payload);
+          cockpit_transport_emit_recv (COCKPIT_TRANSPORT (self), channel, payload);
           g_bytes_unref (payload);
           g_free (channel);
         }
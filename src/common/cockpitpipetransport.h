@@ -38,6 +38,24 @@ CockpitTransport * cockpit_pipe_transport_new_fds    (const gchar *name,
 
 CockpitPipe *      cockpit_pipe_transport_get_pipe   (CockpitPipeTransport *self);
 
+gboolean           cockpit_pipe_transport_offer_shm  (CockpitPipeTransport *self,
+                                                      gsize size);
+
+gboolean           cockpit_pipe_transport_accept_shm (CockpitPipeTransport *self);
+
+gboolean           cockpit_pipe_transport_get_shm    (CockpitPipeTransport *self);
+
+typedef CockpitPipeTransport * (* CockpitPipeTransportRelayFunc) (CockpitPipeTransport *self,
+                                                                  const gchar *channel,
+                                                                  gpointer user_data);
+
+void               cockpit_pipe_transport_add_relay    (CockpitPipeTransport *self,
+                                                        CockpitPipeTransportRelayFunc func,
+                                                        gpointer user_data);
+
+void               cockpit_pipe_transport_remove_relay (CockpitPipeTransport *self,
+                                                        gpointer user_data);
+
 G_END_DECLS
 
 #endif /* __COCKPIT_PIPE_TRANSPORT_H__ */
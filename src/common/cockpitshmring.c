@@ -0,0 +1,514 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitshmring.h"
+
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * CockpitShmRing:
+ *
+ * A pair of single producer, single consumer byte rings in a sealed
+ * memfd, shared between two processes. The side that creates the
+ * memfd writes into the first ring and reads from the second, the side
+ * that attaches does the opposite.
+ *
+ * Each side has an eventfd that it waits on. The producer only kicks
+ * the consumer when the ring was empty before its write, and the
+ * consumer only kicks the producer when the producer asked for space.
+ * So a busy stream goes without any system calls at all.
+ *
+ * The indexes are free running 32-bit counters, and the ring sizes are
+ * powers of two. The memory is shared with a process we don't fully
+ * trust, so each side keeps its own copy of the index it owns, and
+ * validates the index it reads from the other side.
+ */
+
+#define SHM_RING_MAGIC     0x52504b43  /* "CKPR" */
+#define SHM_RING_HEADER    4096
+#define SHM_RING_MIN_SIZE  4096
+#define SHM_RING_MAX_SIZE  (16 * 1024 * 1024)
+
+/* Keep the indexes written by different sides on different cache lines */
+typedef struct {
+  guint32 head;
+  guint8 pad1[60];
+  guint32 tail;
+  guint8 pad2[60];
+  guint32 want_space;
+  guint8 pad3[60];
+} RingIndex;
+
+typedef struct {
+  guint32 magic;
+  guint32 size;
+  guint8 pad[56];
+  RingIndex rings[2];
+} RingHeader;
+
+G_STATIC_ASSERT (sizeof (RingHeader) <= SHM_RING_HEADER);
+
+struct _CockpitShmRing {
+  /* memfd, creator eventfd, peer eventfd */
+  gint fds[COCKPIT_SHM_RING_N_FDS];
+  guint side;
+
+  guint32 size;
+  guint32 mask;
+  gpointer map;
+  gsize map_size;
+  RingHeader *header;
+
+  /* Our own copies of the indexes we own */
+  guint32 tx_head;
+  guint32 rx_tail;
+};
+
+/*
+ * The wake-up protocol needs the store of our own index to be visible
+ * before we load the other side's index, so these are sequentially
+ * consistent.
+ */
+static inline guint32
+load_index (guint32 *index)
+{
+  return __atomic_load_n (index, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+store_index (guint32 *index,
+             guint32 value)
+{
+  __atomic_store_n (index, value, __ATOMIC_SEQ_CST);
+}
+
+static void
+kick (gint fd)
+{
+  if (eventfd_write (fd, 1) < 0 && errno != EAGAIN)
+    g_debug ("couldn't signal shared memory ring: %s", g_strerror (errno));
+}
+
+static gboolean
+map_ring (CockpitShmRing *self,
+          GError **error)
+{
+  self->mask = self->size - 1;
+  self->map_size = SHM_RING_HEADER + 2 * (gsize)self->size;
+  self->map = mmap (NULL, self->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fds[0], 0);
+  if (self->map == MAP_FAILED)
+    {
+      self->map = NULL;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Couldn't map shared memory ring: %s", g_strerror (errno));
+      return FALSE;
+    }
+
+  self->header = self->map;
+  return TRUE;
+}
+
+static guint8 *
+ring_data (CockpitShmRing *self,
+           guint ring)
+{
+  return (guint8 *)self->map + SHM_RING_HEADER + ring * (gsize)self->size;
+}
+
+/**
+ * cockpit_shm_ring_new:
+ * @size: size of each direction, rounded up to a power of two
+ * @error: location to place an error
+ *
+ * Create the memfd and eventfds for a new pair of rings. Pass the
+ * file descriptors from cockpit_shm_ring_get_fds() to the other
+ * process, which calls cockpit_shm_ring_attach().
+ *
+ * Returns: (transfer full): the new ring, or %NULL on failure
+ */
+CockpitShmRing *
+cockpit_shm_ring_new (gsize size,
+                      GError **error)
+{
+  CockpitShmRing *self;
+  gint seals;
+  gint i;
+
+  g_return_val_if_fail (size <= SHM_RING_MAX_SIZE, NULL);
+
+  self = g_new0 (CockpitShmRing, 1);
+  for (i = 0; i < COCKPIT_SHM_RING_N_FDS; i++)
+    self->fds[i] = -1;
+
+  self->side = 0;
+  self->size = SHM_RING_MIN_SIZE;
+  while (self->size < size)
+    self->size <<= 1;
+
+  self->fds[0] = memfd_create ("cockpit shared memory ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (self->fds[0] < 0 ||
+      ftruncate (self->fds[0], SHM_RING_HEADER + 2 * (gsize)self->size) < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Couldn't create shared memory: %s", g_strerror (errno));
+      goto out;
+    }
+
+  /* The other side maps this too, so it must never change size under it */
+  seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+  if (fcntl (self->fds[0], F_ADD_SEALS, seals) < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Couldn't seal shared memory: %s", g_strerror (errno));
+      goto out;
+    }
+
+  for (i = 1; i < COCKPIT_SHM_RING_N_FDS; i++)
+    {
+      self->fds[i] = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (self->fds[i] < 0)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Couldn't create eventfd: %s", g_strerror (errno));
+          goto out;
+        }
+    }
+
+  if (!map_ring (self, error))
+    goto out;
+
+  self->header->magic = SHM_RING_MAGIC;
+  self->header->size = self->size;
+  return self;
+
+out:
+  cockpit_shm_ring_free (self);
+  return NULL;
+}
+
+/**
+ * cockpit_shm_ring_attach:
+ * @fds: the file descriptors received from the creator
+ * @error: location to place an error
+ *
+ * Attach to rings created by another process with
+ * cockpit_shm_ring_new(). This takes ownership of the
+ * %COCKPIT_SHM_RING_N_FDS file descriptors in @fds, even on failure.
+ *
+ * Returns: (transfer full): the ring, or %NULL on failure
+ */
+CockpitShmRing *
+cockpit_shm_ring_attach (gint *fds,
+                         GError **error)
+{
+  CockpitShmRing *self;
+  const gint seals = F_SEAL_SHRINK | F_SEAL_GROW;
+  RingHeader header;
+  struct stat st;
+  gint i;
+
+  self = g_new0 (CockpitShmRing, 1);
+  for (i = 0; i < COCKPIT_SHM_RING_N_FDS; i++)
+    self->fds[i] = fds[i];
+  self->side = 1;
+
+  for (i = 1; i < COCKPIT_SHM_RING_N_FDS; i++)
+    {
+      if (!g_unix_set_fd_nonblocking (self->fds[i], TRUE, error))
+        goto out;
+    }
+
+  /* Unless the memfd can't shrink, the creator could make us SIGBUS */
+  if ((fcntl (self->fds[0], F_GET_SEALS) & seals) != seals)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Shared memory is not sealed");
+      goto out;
+    }
+
+  if (fstat (self->fds[0], &st) < 0 ||
+      pread (self->fds[0], &header, sizeof (header), 0) != sizeof (header))
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Couldn't read shared memory: %s", g_strerror (errno));
+      goto out;
+    }
+
+  if (header.magic != SHM_RING_MAGIC ||
+      header.size < SHM_RING_MIN_SIZE || header.size > SHM_RING_MAX_SIZE ||
+      (header.size & (header.size - 1)) != 0 ||
+      st.st_size != SHM_RING_HEADER + 2 * (gsize)header.size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Invalid shared memory ring");
+      goto out;
+    }
+
+  self->size = header.size;
+  if (!map_ring (self, error))
+    goto out;
+
+  /* We start where the creator left the indexes */
+  self->tx_head = load_index (&self->header->rings[1].head);
+  self->rx_tail = load_index (&self->header->rings[0].tail);
+  return self;
+
+out:
+  cockpit_shm_ring_free (self);
+  return NULL;
+}
+
+/**
+ * cockpit_shm_ring_get_fds:
+ * @self: the ring
+ *
+ * Get the %COCKPIT_SHM_RING_N_FDS file descriptors to pass to the
+ * other side. The ring still owns them.
+ */
+const gint *
+cockpit_shm_ring_get_fds (CockpitShmRing *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  return self->fds;
+}
+
+gsize
+cockpit_shm_ring_get_size (CockpitShmRing *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  return self->size;
+}
+
+/**
+ * cockpit_shm_ring_get_wake_fd:
+ * @self: the ring
+ *
+ * The eventfd that becomes readable when there is new data to
+ * read, or when space has been freed up for writing. Call
+ * cockpit_shm_ring_clear_wake() before reading and writing.
+ */
+gint
+cockpit_shm_ring_get_wake_fd (CockpitShmRing *self)
+{
+  g_return_val_if_fail (self != NULL, -1);
+  return self->fds[1 + self->side];
+}
+
+void
+cockpit_shm_ring_clear_wake (CockpitShmRing *self)
+{
+  eventfd_t value;
+
+  g_return_if_fail (self != NULL);
+
+  if (eventfd_read (self->fds[1 + self->side], &value) < 0 && errno != EAGAIN)
+    g_debug ("couldn't clear shared memory ring wake up: %s", g_strerror (errno));
+}
+
+/**
+ * cockpit_shm_ring_wake:
+ * @self: the ring
+ *
+ * Make our own wake fd readable, for when the caller wants its
+ * wake up handler to run again.
+ */
+void
+cockpit_shm_ring_wake (CockpitShmRing *self)
+{
+  g_return_if_fail (self != NULL);
+  kick (self->fds[1 + self->side]);
+}
+
+/**
+ * cockpit_shm_ring_write:
+ * @self: the ring
+ * @data: data to write
+ * @length: length of @data
+ *
+ * Write as much of @data as fits into the outgoing ring. When not all
+ * of it fits, the other side wakes us once it has made space.
+ *
+ * Returns: the number of bytes written, or -1 if the ring is corrupt
+ */
+gssize
+cockpit_shm_ring_write (CockpitShmRing *self,
+                        const guint8 *data,
+                        gsize length)
+{
+  RingIndex *index;
+  guint8 *area;
+  guint32 head;
+  guint32 tail;
+  guint32 used;
+  gsize written = 0;
+  gsize offset;
+  gsize count;
+  gsize chunk;
+
+  g_return_val_if_fail (self != NULL, -1);
+
+  index = &self->header->rings[self->side];
+  area = ring_data (self, self->side);
+
+  for (;;)
+    {
+      head = self->tx_head;
+      tail = load_index (&index->tail);
+      used = head - tail;
+      if (used > self->size)
+        {
+          g_message ("invalid tail index in shared memory ring");
+          return -1;
+        }
+
+      count = MIN (length - written, self->size - used);
+      if (count > 0)
+        {
+          offset = head & self->mask;
+          chunk = MIN (count, self->size - offset);
+          memcpy (area + offset, data + written, chunk);
+          memcpy (area, data + written + chunk, count - chunk);
+
+          self->tx_head = head + count;
+          store_index (&index->head, self->tx_head);
+          written += count;
+
+          /* If the reader had caught up with us, it may be waiting */
+          if (load_index (&index->tail) == head)
+            kick (self->fds[2 - self->side]);
+        }
+
+      if (written == length)
+        break;
+
+      /* Ask for a wake up, and check again in case space just appeared */
+      store_index (&index->want_space, 1);
+      if (load_index (&index->tail) == tail)
+        break;
+    }
+
+  return written;
+}
+
+/**
+ * cockpit_shm_ring_read:
+ * @self: the ring
+ * @buffer: buffer to append data to
+ *
+ * Move everything in the incoming ring to the end of @buffer.
+ *
+ * Returns: the number of bytes read, or -1 if the ring is corrupt
+ */
+gssize
+cockpit_shm_ring_read (CockpitShmRing *self,
+                       GByteArray *buffer)
+{
+  RingIndex *index;
+  guint8 *area;
+  guint32 tail;
+  guint32 head;
+  gsize total = 0;
+  gsize offset;
+  gsize count;
+  gsize chunk;
+  gsize len;
+
+  g_return_val_if_fail (self != NULL, -1);
+
+  index = &self->header->rings[1 - self->side];
+  area = ring_data (self, 1 - self->side);
+
+  /*
+   * The writer only kicks us when it sees that we had caught up with it.
+   * So after publishing our tail, look at the head again: anything
+   * written in between was never going to wake us.
+   */
+  for (;;)
+    {
+      tail = self->rx_tail;
+      head = load_index (&index->head);
+      count = (guint32)(head - tail);
+      if (count > self->size)
+        {
+          g_message ("invalid head index in shared memory ring");
+          return -1;
+        }
+
+      if (count == 0)
+        break;
+
+      len = buffer->len;
+      g_byte_array_set_size (buffer, len + count);
+
+      offset = tail & self->mask;
+      chunk = MIN (count, self->size - offset);
+      memcpy (buffer->data + len, area + offset, chunk);
+      memcpy (buffer->data + len + chunk, area, count - chunk);
+
+      self->rx_tail = head;
+      store_index (&index->tail, self->rx_tail);
+      total += count;
+
+      /* Don't keep a busy writer's data to ourselves forever, come back later */
+      if (total >= self->size)
+        {
+          cockpit_shm_ring_wake (self);
+          break;
+        }
+    }
+
+  /* Even with nothing read, the writer may be waiting on space we freed earlier */
+  if (load_index (&index->want_space))
+    {
+      store_index (&index->want_space, 0);
+      kick (self->fds[2 - self->side]);
+    }
+
+  return total;
+}
+
+void
+cockpit_shm_ring_free (CockpitShmRing *self)
+{
+  gint i;
+
+  if (!self)
+    return;
+
+  if (self->map)
+    munmap (self->map, self->map_size);
+  for (i = 0; i < COCKPIT_SHM_RING_N_FDS; i++)
+    {
+      if (self->fds[i] >= 0)
+        close (self->fds[i]);
+    }
+  g_free (self);
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COCKPIT_SHM_RING_H__
+#define __COCKPIT_SHM_RING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define COCKPIT_SHM_RING_N_FDS    3
+
+typedef struct _CockpitShmRing CockpitShmRing;
+
+CockpitShmRing *   cockpit_shm_ring_new           (gsize size,
+                                                   GError **error);
+
+CockpitShmRing *   cockpit_shm_ring_attach        (gint *fds,
+                                                   GError **error);
+
+const gint *       cockpit_shm_ring_get_fds       (CockpitShmRing *self);
+
+gsize              cockpit_shm_ring_get_size      (CockpitShmRing *self);
+
+gint               cockpit_shm_ring_get_wake_fd   (CockpitShmRing *self);
+
+void               cockpit_shm_ring_clear_wake    (CockpitShmRing *self);
+
+void               cockpit_shm_ring_wake          (CockpitShmRing *self);
+
+gssize             cockpit_shm_ring_write         (CockpitShmRing *self,
+                                                   const guint8 *data,
+                                                   gsize length);
+
+gssize             cockpit_shm_ring_read          (CockpitShmRing *self,
+                                                   GByteArray *buffer);
+
+void               cockpit_shm_ring_free          (CockpitShmRing *self);
+
+G_END_DECLS
+
+#endif /* __COCKPIT_SHM_RING_H__ */
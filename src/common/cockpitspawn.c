@@ -0,0 +1,416 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+
+#include "cockpitspawn.h"
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Launching child processes without fork()
+ *
+ * g_spawn_async_with_pipes() with a child setup callback always does
+ * a full fork() of the calling process, which means copying its page
+ * tables. For a bridge with a large heap that is the bulk of the cost
+ * of every spawned channel.
+ *
+ * Here we use clone (CLONE_VM | CLONE_VFORK) instead, which is what
+ * posix_spawn() does under the hood. We can't use posix_spawn() directly
+ * as it has no way to set PR_SET_PDEATHSIG or a controlling tty. The
+ * child runs on its own small stack in our address space, while the
+ * calling thread is suspended until it has called exec or exited.
+ *
+ * The child must therefore only make plain system calls: no allocation,
+ * no locks, no GLib. Everything it needs is prepared up front by the
+ * parent, including the PATH lookup.
+ */
+
+#define SPAWN_STACK_SIZE (64 * 1024)
+
+/* close_range() has the same number on all architectures but alpha */
+#if defined (__linux__) && !defined (SYS_close_range) && !defined (__alpha__)
+#define SYS_close_range 436
+#endif
+
+extern char **environ;
+
+typedef struct {
+  const gchar *path;
+  char *const *argv;
+  char *const *envp;
+  const gchar *directory;
+  gint *fds;
+  gint n_fds;
+  CockpitSpawnFlags flags;
+  sigset_t mask;
+
+  /* Filled in by the child when it fails */
+  volatile gint failed_errno;
+  volatile gboolean failed_chdir;
+} SpawnChild;
+
+static void
+close_from (gint from)
+{
+#ifndef HAVE_CLOSEFROM
+  struct rlimit rl;
+  gint fd;
+#endif
+
+#ifdef SYS_close_range
+  if (syscall (SYS_close_range, from, ~0U, 0) == 0)
+    return;
+#endif
+
+#ifdef HAVE_CLOSEFROM
+  /* Falls back to reading /proc/self/fd without allocating */
+  closefrom (from);
+#else
+  /* Last resort: walk the whole table, our own /proc listing would need malloc */
+  if (getrlimit (RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur == RLIM_INFINITY)
+    rl.rlim_cur = 4096;
+  for (fd = from; fd < (gint)rl.rlim_cur; fd++)
+    close (fd);
+#endif
+}
+
+static int
+spawn_child (void *data)
+{
+  SpawnChild *sc = data;
+  struct sigaction sa;
+  gint i;
+
+  /*
+   * We share memory with the parent, so none of its signal handlers may
+   * run in here. All signals are blocked, and we reset the handlers before
+   * unblocking them again. Other ignored signals stay ignored across exec,
+   * just like with fork().
+   */
+  for (i = 1; i < NSIG; i++)
+    {
+      if (sigaction (i, NULL, &sa) < 0)
+        continue;
+      if (sa.sa_handler == SIG_IGN || sa.sa_handler == SIG_DFL)
+        continue;
+      memset (&sa, 0, sizeof (sa));
+      sa.sa_handler = SIG_DFL;
+      sigaction (i, &sa, NULL);
+    }
+
+  /* Except for these, which children expect to work even if we ignore them */
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = SIG_DFL;
+  sigaction (SIGCHLD, &sa, NULL);
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+  sigaction (SIGHUP, &sa, NULL);
+
+  /* Send this signal to all direct child processes, when the parent dies */
+  if (sc->flags & COCKPIT_SPAWN_PDEATHSIG)
+    {
+      if (prctl (PR_SET_PDEATHSIG, SIGHUP) < 0)
+        goto failed;
+    }
+
+  if (sc->flags & COCKPIT_SPAWN_CONTROLLING_TTY)
+    {
+      if (setsid () < 0)
+        goto failed;
+    }
+
+  /*
+   * Move all the fds numerically above n_fds first, so that we don't
+   * overwrite them in the dup2() loop below, and so that dup2() is never
+   * a no-op that would leave O_CLOEXEC set.
+   */
+  for (i = 0; i < sc->n_fds; i++)
+    {
+      if (sc->fds[i] != -1 && sc->fds[i] < sc->n_fds)
+        {
+          sc->fds[i] = fcntl (sc->fds[i], F_DUPFD_CLOEXEC, sc->n_fds);
+          if (sc->fds[i] < 0)
+            goto failed;
+        }
+    }
+
+  for (i = 0; i < sc->n_fds; i++)
+    {
+      if (sc->fds[i] != -1 && dup2 (sc->fds[i], i) < 0)
+        goto failed;
+    }
+
+  close_from (sc->n_fds);
+
+  if (sc->flags & COCKPIT_SPAWN_CONTROLLING_TTY)
+    {
+      if (ioctl (0, TIOCSCTTY, 0) < 0)
+        goto failed;
+    }
+
+  if (sc->directory && chdir (sc->directory) < 0)
+    {
+      sc->failed_chdir = TRUE;
+      goto failed;
+    }
+
+  if (pthread_sigmask (SIG_SETMASK, &sc->mask, NULL) != 0)
+    goto failed;
+
+  execve (sc->path, sc->argv, sc->envp);
+
+failed:
+  sc->failed_errno = errno ? errno : EINVAL;
+  _exit (127);
+  return 0;
+}
+
+static GSpawnError
+spawn_error_from_errno (gint errn)
+{
+  switch (errn)
+    {
+    case EACCES:
+      return G_SPAWN_ERROR_ACCES;
+    case EPERM:
+      return G_SPAWN_ERROR_PERM;
+    case E2BIG:
+      return G_SPAWN_ERROR_TOO_BIG;
+    case ENOEXEC:
+      return G_SPAWN_ERROR_NOEXEC;
+    case ENAMETOOLONG:
+      return G_SPAWN_ERROR_NAMETOOLONG;
+    case ENOENT:
+      return G_SPAWN_ERROR_NOENT;
+    case ENOMEM:
+      return G_SPAWN_ERROR_NOMEM;
+    case ENOTDIR:
+      return G_SPAWN_ERROR_NOTDIR;
+    case ELOOP:
+      return G_SPAWN_ERROR_LOOP;
+    case ETXTBSY:
+      return G_SPAWN_ERROR_TXTBUSY;
+    case EIO:
+      return G_SPAWN_ERROR_IO;
+    case ENFILE:
+      return G_SPAWN_ERROR_NFILE;
+    case EMFILE:
+      return G_SPAWN_ERROR_MFILE;
+    case EINVAL:
+      return G_SPAWN_ERROR_INVAL;
+    case EISDIR:
+      return G_SPAWN_ERROR_ISDIR;
+    case ELIBBAD:
+      return G_SPAWN_ERROR_LIBBAD;
+    default:
+      return G_SPAWN_ERROR_FAILED;
+    }
+}
+
+/**
+ * cockpit_spawn_find_program:
+ * @program: the program name or path
+ * @env: optional environment to take PATH from
+ * @error: location to place an error
+ *
+ * Resolve @program the same way execvpe() would: if it contains
+ * a slash it is returned as is, otherwise the PATH in @env or
+ * the PATH of this process is searched.
+ *
+ * Returns: (transfer full): the program path or %NULL
+ */
+gchar *
+cockpit_spawn_find_program (const gchar *program,
+                            const gchar **env,
+                            GError **error)
+{
+  const gchar *path = NULL;
+  gboolean denied = FALSE;
+  gchar **dirs;
+  gchar *result = NULL;
+  struct stat sb;
+  gint i;
+
+  g_return_val_if_fail (program != NULL, NULL);
+
+  if (strchr (program, '/'))
+    return g_strdup (program);
+
+  if (env)
+    path = g_environ_getenv ((gchar **)env, "PATH");
+  if (!path)
+    path = g_getenv ("PATH");
+  if (!path)
+    path = "/bin:/usr/bin";
+
+  dirs = g_strsplit (path, ":", -1);
+  for (i = 0; result == NULL && dirs[i] != NULL; i++)
+    {
+      result = g_build_filename (dirs[i][0] ? dirs[i] : ".", program, NULL);
+      errno = 0;
+      if (stat (result, &sb) < 0 || !S_ISREG (sb.st_mode) || access (result, X_OK) < 0)
+        {
+          if (errno == EACCES)
+            denied = TRUE;
+          g_free (result);
+          result = NULL;
+        }
+    }
+  g_strfreev (dirs);
+
+  if (!result)
+    {
+      g_set_error (error, G_SPAWN_ERROR,
+                   denied ? G_SPAWN_ERROR_ACCES : G_SPAWN_ERROR_NOENT,
+                   "Failed to execute child process \"%s\" (%s)", program,
+                   g_strerror (denied ? EACCES : ENOENT));
+    }
+
+  return result;
+}
+
+/**
+ * cockpit_spawn:
+ * @argv: null terminated string array of command arguments
+ * @env: optional null terminated string array of child environment
+ * @directory: optional working directory of child process
+ * @remap_fds: fds to place in the child, or -1 to leave as is
+ * @n_remap_fds: number of entries in @remap_fds
+ * @flags: launch flags
+ * @pid: location to place child pid
+ * @error: location to place an error
+ *
+ * Launch a child process without a child setup callback. The child gets
+ * @remap_fds[i] as its fd i, and all other fds from @n_remap_fds upwards
+ * are closed. With %COCKPIT_SPAWN_CONTROLLING_TTY the child starts a
+ * new session and fd 0 becomes its controlling terminal.
+ *
+ * The child is not reaped, use a child watch on @pid. Errors up to and
+ * including exec are reported as #G_SPAWN_ERROR codes, just like
+ * g_spawn_async_with_pipes().
+ *
+ * Returns: %TRUE if the child process was started
+ */
+gboolean
+cockpit_spawn (const gchar **argv,
+               const gchar **env,
+               const gchar *directory,
+               const gint *remap_fds,
+               gint n_remap_fds,
+               CockpitSpawnFlags flags,
+               GPid *pid,
+               GError **error)
+{
+  SpawnChild sc = { 0, };
+  gchar *path = NULL;
+  sigset_t all;
+  gpointer stack;
+  gint child = -1;
+  gint errn = 0;
+
+  g_return_val_if_fail (argv != NULL && argv[0] != NULL, FALSE);
+  g_return_val_if_fail (n_remap_fds >= 0 && n_remap_fds < 1024, FALSE);
+  g_return_val_if_fail (n_remap_fds == 0 || remap_fds != NULL, FALSE);
+
+  if (flags & COCKPIT_SPAWN_SEARCH_PATH)
+    path = cockpit_spawn_find_program (argv[0], env, error);
+  else
+    path = g_strdup (argv[0]);
+  if (!path)
+    return FALSE;
+
+  stack = mmap (NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (stack == MAP_FAILED)
+    {
+      errn = errno;
+      g_set_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_FORK,
+                   "Failed to allocate child stack (%s)", g_strerror (errn));
+      g_free (path);
+      return FALSE;
+    }
+
+  sc.path = path;
+  sc.argv = (char *const *)argv;
+  sc.envp = env ? (char *const *)env : environ;
+  sc.directory = directory;
+  sc.fds = g_newa (gint, n_remap_fds ? n_remap_fds : 1);
+  if (n_remap_fds)
+    memcpy (sc.fds, remap_fds, sizeof (gint) * n_remap_fds);
+  sc.n_fds = n_remap_fds;
+  sc.flags = flags;
+
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &sc.mask);
+
+  /* Returns once the child has called exec or exited */
+  child = clone (spawn_child, (gchar *)stack + SPAWN_STACK_SIZE,
+                 CLONE_VM | CLONE_VFORK | SIGCHLD, &sc);
+  errn = errno;
+
+  pthread_sigmask (SIG_SETMASK, &sc.mask, NULL);
+  munmap (stack, SPAWN_STACK_SIZE);
+
+  if (child < 0)
+    {
+      g_set_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_FORK,
+                   "Failed to fork (%s)", g_strerror (errn));
+    }
+  else if (sc.failed_errno)
+    {
+      errn = sc.failed_errno;
+      while (waitpid (child, NULL, 0) < 0 && errno == EINTR);
+      child = -1;
+
+      if (sc.failed_chdir)
+        {
+          g_set_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_CHDIR,
+                       "Failed to change to directory \"%s\" (%s)",
+                       directory, g_strerror (errn));
+        }
+      else
+        {
+          g_set_error (error, G_SPAWN_ERROR, spawn_error_from_errno (errn),
+                       "Failed to execute child process \"%s\" (%s)",
+                       argv[0], g_strerror (errn));
+        }
+    }
+
+  g_free (path);
+
+  if (child < 0)
+    return FALSE;
+
+  if (pid)
+    *pid = child;
+  return TRUE;
+}
@@ -0,0 +1,48 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __COCKPIT_SPAWN_H__
+#define __COCKPIT_SPAWN_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  COCKPIT_SPAWN_DEFAULT = 0,
+  COCKPIT_SPAWN_SEARCH_PATH = 1 << 0,
+  COCKPIT_SPAWN_PDEATHSIG = 1 << 1,
+  COCKPIT_SPAWN_CONTROLLING_TTY = 1 << 2,
+} CockpitSpawnFlags;
+
+gboolean        cockpit_spawn                (const gchar **argv,
+                                              const gchar **env,
+                                              const gchar *directory,
+                                              const gint *remap_fds,
+                                              gint n_remap_fds,
+                                              CockpitSpawnFlags flags,
+                                              GPid *pid,
+                                              GError **error);
+
+gchar *         cockpit_spawn_find_program   (const gchar *program,
+                                              const gchar **env,
+                                              GError **error);
+
+G_END_DECLS
+
+#endif /* __COCKPIT_SPAWN_H__ */
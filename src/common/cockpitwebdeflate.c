@@ -0,0 +1,320 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitwebdeflate.h"
+
+#include <gio/gio.h>
+
+#include <string.h>
+
+/**
+ * CockpitWebDeflate
+ *
+ * This is a CockpitWebFilter which compresses the data passing
+ * through it with gzip or deflate. Each block is flushed, so that
+ * the browser can use streamed data as soon as it arrives.
+ */
+struct _CockpitWebDeflate {
+  GObject parent;
+  GConverter *converter;
+  gboolean finished;
+};
+
+static void cockpit_web_filter_deflate_iface (CockpitWebFilterInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (CockpitWebDeflate, cockpit_web_deflate, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (COCKPIT_TYPE_WEB_FILTER, cockpit_web_filter_deflate_iface)
+)
+
+static void
+cockpit_web_deflate_init (CockpitWebDeflate *self)
+{
+
+}
+
+static void
+cockpit_web_deflate_finalize (GObject *object)
+{
+  CockpitWebDeflate *self = COCKPIT_WEB_DEFLATE (object);
+
+  if (self->converter)
+    g_object_unref (self->converter);
+
+  G_OBJECT_CLASS (cockpit_web_deflate_parent_class)->finalize (object);
+}
+
+static void
+cockpit_web_deflate_class_init (CockpitWebDeflateClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = cockpit_web_deflate_finalize;
+}
+
+static void
+deflate_convert (CockpitWebDeflate *self,
+                 const guint8 *data,
+                 gsize length,
+                 GConverterFlags flags,
+                 void (* function) (gpointer, GBytes *),
+                 gpointer func_data)
+{
+  GConverterResult result;
+  GError *error = NULL;
+  gsize read, written;
+  gsize size;
+  guint8 *out;
+  GBytes *bytes;
+
+  for (;;)
+    {
+      /* Compressed output rarely exceeds the input, plus some framing */
+      size = MIN (length, 64 * 1024) + 128;
+      out = g_malloc (size);
+
+      result = g_converter_convert (self->converter, data, length, out, size,
+                                    flags, &read, &written, &error);
+      if (result == G_CONVERTER_ERROR)
+        {
+          g_warning ("couldn't compress response data: %s", error->message);
+          g_error_free (error);
+          g_free (out);
+          self->finished = TRUE;
+          return;
+        }
+
+      data += read;
+      length -= read;
+
+      if (written > 0)
+        {
+          bytes = g_bytes_new_take (out, written);
+          function (func_data, bytes);
+          g_bytes_unref (bytes);
+        }
+      else
+        {
+          g_free (out);
+        }
+
+      if (result == G_CONVERTER_FINISHED)
+        {
+          self->finished = TRUE;
+          return;
+        }
+      if (result == G_CONVERTER_FLUSHED && length == 0)
+        return;
+    }
+}
+
+static void
+cockpit_web_deflate_push (CockpitWebFilter *filter,
+                          GBytes *block,
+                          void (* function) (gpointer, GBytes *),
+                          gpointer func_data)
+{
+  CockpitWebDeflate *self = (CockpitWebDeflate *)filter;
+  gconstpointer data;
+  gsize length;
+
+  data = g_bytes_get_data (block, &length);
+  if (length == 0 || self->finished)
+    return;
+
+  /*
+   * A sync flush costs a few bytes per block, but otherwise zlib would
+   * hold back streamed data, such as a journal being followed.
+   */
+  deflate_convert (self, data, length, G_CONVERTER_FLUSH, function, func_data);
+}
+
+static void
+cockpit_web_deflate_finish (CockpitWebFilter *filter,
+                            void (* function) (gpointer, GBytes *),
+                            gpointer func_data)
+{
+  CockpitWebDeflate *self = (CockpitWebDeflate *)filter;
+
+  if (!self->finished)
+    deflate_convert (self, NULL, 0, G_CONVERTER_INPUT_AT_END, function, func_data);
+}
+
+static void
+cockpit_web_filter_deflate_iface (CockpitWebFilterInterface *iface)
+{
+  iface->push = cockpit_web_deflate_push;
+  iface->finish = cockpit_web_deflate_finish;
+}
+
+/**
+ * cockpit_web_deflate_new:
+ * @encoding: either "gzip" or "deflate"
+ * @level: zlib compression level, or -1 for the default
+ *
+ * Create a new CockpitWebFilter which compresses the response
+ * for the given HTTP Content-Encoding. Use a low @level for
+ * streamed responses: it is several times faster, and costs
+ * little in size for the text we usually send.
+ *
+ * Returns: A new CockpitWebFilter, or %NULL for an unsupported
+ *          @encoding
+ */
+CockpitWebFilter *
+cockpit_web_deflate_new (const gchar *encoding,
+                         gint level)
+{
+  CockpitWebDeflate *self;
+  GZlibCompressorFormat format;
+
+  g_return_val_if_fail (encoding != NULL, NULL);
+  g_return_val_if_fail (level >= -1 && level <= 9, NULL);
+
+  if (g_str_equal (encoding, "gzip"))
+    format = G_ZLIB_COMPRESSOR_FORMAT_GZIP;
+  else if (g_str_equal (encoding, "deflate"))
+    format = G_ZLIB_COMPRESSOR_FORMAT_ZLIB;
+  else
+    return NULL;
+
+  self = g_object_new (COCKPIT_TYPE_WEB_DEFLATE, NULL);
+  self->converter = G_CONVERTER (g_zlib_compressor_new (format, level));
+
+  return COCKPIT_WEB_FILTER (self);
+}
+
+/**
+ * cockpit_web_deflate_negotiate:
+ * @headers: the request headers
+ *
+ * Pick a Content-Encoding that both the client in its Accept-Encoding
+ * header and CockpitWebDeflate support. We prefer gzip.
+ *
+ * Returns: "gzip", "deflate" or %NULL
+ */
+const gchar *
+cockpit_web_deflate_negotiate (GHashTable *headers)
+{
+  gboolean gzip = FALSE;
+  gboolean deflate = FALSE;
+  gboolean refused_gzip = FALSE;
+  gboolean refused_deflate = FALSE;
+  gboolean any = FALSE;
+  const gchar *value;
+  const gchar *params;
+  gchar **tokens;
+  gchar *name;
+  gboolean refused;
+  gint i;
+
+  value = headers ? g_hash_table_lookup (headers, "Accept-Encoding") : NULL;
+  if (!value)
+    return NULL;
+
+  tokens = g_strsplit (value, ",", -1);
+  for (i = 0; tokens[i] != NULL; i++)
+    {
+      params = strchr (tokens[i], ';');
+      name = g_strstrip (g_strndup (tokens[i], params ? params - tokens[i] : strlen (tokens[i])));
+
+      /* A quality of zero means "not acceptable" */
+      refused = FALSE;
+      if (params)
+        {
+          params = strstr (params, "q=");
+          if (params && g_ascii_strtod (params + 2, NULL) <= 0.0)
+            refused = TRUE;
+        }
+
+      if (g_ascii_strcasecmp (name, "gzip") == 0 || g_ascii_strcasecmp (name, "x-gzip") == 0)
+        {
+          gzip = !refused;
+          refused_gzip = refused;
+        }
+      else if (g_ascii_strcasecmp (name, "deflate") == 0)
+        {
+          deflate = !refused;
+          refused_deflate = refused;
+        }
+      else if (g_str_equal (name, "*"))
+        {
+          any = !refused;
+        }
+
+      g_free (name);
+    }
+  g_strfreev (tokens);
+
+  if (gzip || (any && !refused_gzip))
+    return "gzip";
+  if (deflate || (any && !refused_deflate))
+    return "deflate";
+  return NULL;
+}
+
+/**
+ * cockpit_web_deflate_is_compressible:
+ * @content_type: a Content-Type header value, or %NULL
+ *
+ * Check whether compressing a response of the given type is
+ * worth it. Media and archives are already compressed, and an
+ * unknown type is usually binary.
+ *
+ * Returns: whether to compress
+ */
+gboolean
+cockpit_web_deflate_is_compressible (const gchar *content_type)
+{
+  static const gchar *compressed[] = {
+    "image/",
+    "audio/",
+    "video/",
+    "font/woff",
+    "application/font-woff",
+    "application/octet-stream",
+    "application/gzip",
+    "application/x-gzip",
+    "application/x-xz",
+    "application/x-bzip2",
+    "application/x-7z-compressed",
+    "application/zip",
+    "application/zstd",
+    "application/x-rpm",
+    "application/vnd.rar",
+    "application/pdf",
+    NULL
+  };
+  gint i;
+
+  if (!content_type || !content_type[0])
+    return FALSE;
+
+  /* Vector images are text */
+  if (g_ascii_strncasecmp (content_type, "image/svg+xml", 13) == 0)
+    return TRUE;
+
+  for (i = 0; compressed[i] != NULL; i++)
+    {
+      if (g_ascii_strncasecmp (content_type, compressed[i], strlen (compressed[i])) == 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
@@ -0,0 +1,39 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COCKPIT_WEB_DEFLATE_H__
+#define COCKPIT_WEB_DEFLATE_H__
+
+#include "common/cockpitwebfilter.h"
+
+G_BEGIN_DECLS
+
+#define COCKPIT_TYPE_WEB_DEFLATE         (cockpit_web_deflate_get_type ())
+G_DECLARE_FINAL_TYPE(CockpitWebDeflate, cockpit_web_deflate, COCKPIT, WEB_DEFLATE, GObject)
+
+CockpitWebFilter *  cockpit_web_deflate_new             (const gchar *encoding,
+                                                         gint level);
+
+const gchar *       cockpit_web_deflate_negotiate       (GHashTable *headers);
+
+gboolean            cockpit_web_deflate_is_compressible (const gchar *content_type);
+
+G_END_DECLS
+
+#endif /* COCKPIT_WEB_DEFLATE_H__ */
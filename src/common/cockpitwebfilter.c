@@ -61,3 +61,28 @@ cockpit_web_filter_push (CockpitWebFilter *filter,
   g_assert (iface->push);
   (iface->push) (filter, queue, function, data);
 }
+
+/**
+ * cockpit_web_filter_finish:
+ * @filter: filter to finish
+ * @function: filter calls this function with bytes generated
+ * @data: value to pass to function
+ *
+ * Called after the last block has been pushed through the
+ * filter. Filters that hold back data, such as compressors,
+ * should call @function with the rest of it. Implementing
+ * this is optional.
+ */
+void
+cockpit_web_filter_finish (CockpitWebFilter *filter,
+                           void (* function) (gpointer, GBytes *),
+                           gpointer data)
+{
+  CockpitWebFilterInterface *iface;
+
+  iface = COCKPIT_WEB_FILTER_GET_IFACE (filter);
+  g_return_if_fail (iface != NULL);
+
+  if (iface->finish)
+    (iface->finish) (filter, function, data);
+}
@@ -26,6 +26,7 @@
 #include "config.h"
 
 #include "cockpitwebresponse.h"
+#include "cockpitwebdeflate.h"
 #include "cockpitwebfilter.h"
 
 #include "common/cockpitconf.h"
@@ -43,6 +44,11 @@
  */
 const gchar *cockpit_web_failure_resource = NULL;
 
+/**
+ * A shared pack of static files, consulted before the file system.
+ */
+CockpitAssetPack *cockpit_web_asset_pack = NULL;
+
 static const gchar default_failure_template[] =
   "<html><head><title>@@message@@</title></head><body>@@message@@</body></html>\n";
 
@@ -87,6 +93,7 @@ struct _CockpitWebResponse {
   gboolean done;
   gboolean chunked;
   gboolean keep_alive;
+  gboolean accept_gzip;
 
   GList *filters;
 };
@@ -267,6 +274,7 @@ cockpit_web_response_new (GIOStream *io,
         self->keep_alive = g_str_equal (connection, "keep-alive");
       host = g_hash_table_lookup (in_headers, "Host");
     }
+  self->accept_gzip = g_strcmp0 (cockpit_web_deflate_negotiate (in_headers), "gzip") == 0;
 
   self->flags = flags;
   protocol = cockpit_web_response_get_protocol (self, in_headers);
@@ -621,6 +629,20 @@ cockpit_web_response_queue (CockpitWebResponse *self,
   return TRUE;
 }
 
+static void
+finish_filters (CockpitWebResponse *self)
+{
+  QueueStep qn = { .response = self };
+  GList *l;
+
+  /* Each filter flushes what it held back through the filters after it */
+  for (l = self->filters; l != NULL; l = g_list_next (l))
+    {
+      qn.filters = l->next;
+      cockpit_web_filter_finish (l->data, queue_filter, &qn);
+    }
+}
+
 /**
  * cockpit_web_response_complete:
  * @self: the response
@@ -642,6 +664,9 @@ cockpit_web_response_complete (CockpitWebResponse *self)
   if (self->failed)
     return;
 
+  if (self->filters && g_strcmp0 (self->method, "HEAD") != 0)
+    finish_filters (self);
+
   /* Hold a reference until cockpit_web_response_done() */
   g_object_ref (self);
   self->complete = TRUE;
@@ -1296,14 +1321,15 @@ web_response_file (CockpitWebResponse *response,
 {
   const gchar *default_policy = "default-src 'self' 'unsafe-inline';";
 
-  const gchar *headers[5] = { NULL };
+  const gchar *headers[9] = { NULL };
   GError *error = NULL;
   gchar *unescaped = NULL;
   gchar *path = NULL;
   gchar *alloc = NULL;
   GMappedFile *file = NULL;
   const gchar *root;
-  GBytes *body;
+  GBytes *body = NULL;
+  GBytes *gzipped = NULL;
   GList *output = NULL;
   GList *l = NULL;
   gint content_length = -1;
@@ -1336,15 +1362,24 @@ again:
   g_free (path);
   path = g_build_filename (root, unescaped, NULL);
 
+  /* As a double check of above behavior */
+  g_assert (path_has_prefix (path, root));
+
+  /* Served straight out of the shared pack when it's there */
+  if (cockpit_web_asset_pack)
+    {
+      body = cockpit_asset_pack_lookup (cockpit_web_asset_pack, path,
+                                        template_func ? NULL : &gzipped);
+      if (body)
+        goto found;
+    }
+
   if (g_file_test (path, G_FILE_TEST_IS_DIR))
     {
       cockpit_web_response_error (response, 403, NULL, "Directory Listing Denied");
       goto out;
     }
 
-  /* As a double check of above behavior */
-  g_assert (path_has_prefix (path, root));
-
   g_clear_error (&error);
   file = g_mapped_file_new (path, FALSE, &error);
   if (file == NULL)
@@ -1371,16 +1406,34 @@ again:
     }
 
   body = g_mapped_file_get_bytes (file);
+
+found:
   if (template_func)
     {
       output = cockpit_template_expand (body, template_func, "${", "}", user_data);
     }
+  else if (gzipped && response->accept_gzip)
+    {
+      output = g_list_prepend (output, g_bytes_ref (gzipped));
+      content_length = g_bytes_get_size (gzipped);
+      headers[at++] = "Content-Encoding";
+      headers[at++] = "gzip";
+    }
   else
     {
       output = g_list_prepend (output, g_bytes_ref (body));
       content_length = g_bytes_get_size (body);
     }
-  g_bytes_unref (body);
+
+  /* The response differs by encoding whenever a compressed copy exists */
+  if (gzipped)
+    {
+      headers[at++] = "Vary";
+      if (response->cache_type == COCKPIT_WEB_RESPONSE_CACHE_PRIVATE)
+        headers[at++] = "Cookie, Accept-Encoding";
+      else
+        headers[at++] = "Accept-Encoding";
+    }
 
   if (response->origin)
     {
@@ -1400,7 +1453,8 @@ again:
     }
 
   cockpit_web_response_headers (response, 200, "OK", content_length,
-                                headers[0], headers[1], headers[2], headers[3], NULL);
+                                headers[0], headers[1], headers[2], headers[3],
+                                headers[4], headers[5], headers[6], headers[7], NULL);
 
   for (l = output; l != NULL; l = g_list_next (l))
     {
@@ -1415,6 +1469,10 @@ out:
   g_free (unescaped);
   g_clear_error (&error);
   g_free (path);
+  if (body)
+    g_bytes_unref (body);
+  if (gzipped)
+    g_bytes_unref (gzipped);
   if (file)
     g_mapped_file_unref (file);
 
@@ -22,6 +22,7 @@
 
 #include <gio/gio.h>
 
+#include "cockpitassetpack.h"
 #include "cockpitwebfilter.h"
 
 G_BEGIN_DECLS
@@ -52,6 +53,7 @@ typedef enum {
 } CockpitCacheType;
 
 #define COCKPIT_CHECKSUM_HEADER "X-Cockpit-Pkg-Checksum"
+#define COCKPIT_PACKAGE_CHECKSUMS_HEADER "X-Cockpit-Pkg-Checksums"
 
 typedef struct _CockpitWebResponse        CockpitWebResponse;
 
@@ -59,6 +61,8 @@ extern const gchar *  cockpit_web_exception_escape_root;
 
 extern const gchar *  cockpit_web_failure_resource;
 
+extern CockpitAssetPack *  cockpit_web_asset_pack;
+
 CockpitWebResponse *  cockpit_web_response_new           (GIOStream *io,
                                                           const gchar *original_path,
                                                           const gchar *path,
@@ -0,0 +1,283 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+
+#include "cockpitspawn.h"
+
+#include "cockpittest.h"
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+static gchar *
+spawn_and_read (const gchar **argv,
+                const gchar **env,
+                const gchar *directory,
+                gint *status)
+{
+  GError *error = NULL;
+  GString *output;
+  gchar buffer[1024];
+  GPid pid = 0;
+  gint fds[2];
+  gint remap[3] = { -1, -1, -1 };
+  gssize ret;
+
+  g_assert (g_unix_open_pipe (fds, FD_CLOEXEC, &error));
+  g_assert_no_error (error);
+
+  remap[1] = fds[1];
+  g_assert (cockpit_spawn (argv, env, directory, remap, G_N_ELEMENTS (remap),
+                           COCKPIT_SPAWN_SEARCH_PATH, &pid, &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (pid, >, 0);
+  close (fds[1]);
+
+  output = g_string_new ("");
+  for (;;)
+    {
+      ret = read (fds[0], buffer, sizeof (buffer));
+      if (ret < 0 && errno == EINTR)
+        continue;
+      g_assert_cmpint (ret, >=, 0);
+      if (ret == 0)
+        break;
+      g_string_append_len (output, buffer, ret);
+    }
+  close (fds[0]);
+
+  g_assert_cmpint (waitpid (pid, status, 0), ==, pid);
+  return g_string_free (output, FALSE);
+}
+
+static void
+test_remap (void)
+{
+  const gchar *argv[] = { "/bin/sh", "-c", "echo one; echo two >&2", NULL };
+  const gchar *quiet[] = { "/bin/sh", "-c", "echo one", NULL };
+  gchar *output;
+  gint status;
+  gint fds[2];
+  gint remap[3] = { -1, -1, -1 };
+  GError *error = NULL;
+  gchar buffer[64];
+  GPid pid;
+
+  output = spawn_and_read (quiet, NULL, NULL, &status);
+  g_assert_cmpint (status, ==, 0);
+  g_assert_cmpstr (output, ==, "one\n");
+  g_free (output);
+
+  /* The same fd in several places, and in its own slot */
+  g_assert (g_unix_open_pipe (fds, FD_CLOEXEC, &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (fds[1], >, 2);
+
+  remap[1] = remap[2] = fds[1];
+  g_assert (cockpit_spawn (argv, NULL, NULL, remap, G_N_ELEMENTS (remap),
+                           COCKPIT_SPAWN_DEFAULT, &pid, &error));
+  g_assert_no_error (error);
+  close (fds[1]);
+
+  g_assert_cmpint (waitpid (pid, &status, 0), ==, pid);
+  g_assert_cmpint (status, ==, 0);
+  g_assert_cmpint (read (fds[0], buffer, sizeof (buffer)), ==, 8);
+  g_assert (memcmp (buffer, "one\ntwo\n", 8) == 0);
+  close (fds[0]);
+}
+
+static void
+test_close_fds (void)
+{
+  const gchar *argv[] = { "/bin/sh", "-c", NULL, NULL };
+  gchar *script;
+  gchar *output;
+  gint status;
+  gint fd;
+
+  /* Not close-on-exec, but still shouldn't leak into the child */
+  fd = dup (2);
+  g_assert_cmpint (fd, >, 2);
+
+  script = g_strdup_printf ("test -e /proc/self/fd/%d && echo leaked || echo closed", fd);
+  argv[2] = script;
+
+  output = spawn_and_read (argv, NULL, NULL, &status);
+  g_assert_cmpint (status, ==, 0);
+  g_assert_cmpstr (output, ==, "closed\n");
+
+  close (fd);
+  g_free (output);
+  g_free (script);
+}
+
+static void
+test_default_signals (void)
+{
+  const gchar *argv[] = { "/bin/sh", "-c", "kill -TERM $$; echo survived", NULL };
+  gchar *output;
+  gint status;
+
+  /* Ignored here, but the child must get the default action */
+  signal (SIGTERM, SIG_IGN);
+  output = spawn_and_read (argv, NULL, NULL, &status);
+  signal (SIGTERM, SIG_DFL);
+
+  g_assert (WIFSIGNALED (status));
+  g_assert_cmpint (WTERMSIG (status), ==, SIGTERM);
+  g_assert_cmpstr (output, ==, "");
+  g_free (output);
+}
+
+static void
+test_directory_and_env (void)
+{
+  const gchar *argv[] = { "sh", "-c", "pwd; echo $MARMALADE", NULL };
+  const gchar *env[] = { "MARMALADE=orange", "PATH=/usr/bin:/bin", NULL };
+  gchar *output;
+  gint status;
+
+  output = spawn_and_read (argv, env, "/", &status);
+  g_assert_cmpint (status, ==, 0);
+  g_assert_cmpstr (output, ==, "/\norange\n");
+  g_free (output);
+}
+
+static void
+test_not_found (void)
+{
+  const gchar *argv[] = { "/non-existant", NULL };
+  GError *error = NULL;
+  GPid pid = 0;
+
+  g_assert (!cockpit_spawn (argv, NULL, NULL, NULL, 0, COCKPIT_SPAWN_DEFAULT, &pid, &error));
+  g_assert_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_NOENT);
+  g_assert_cmpint (pid, ==, 0);
+  g_clear_error (&error);
+}
+
+static void
+test_search_env_path (void)
+{
+  const gchar *argv[] = { "true", NULL };
+  const gchar *env[] = { "PATH=/non-existant", NULL };
+  GError *error = NULL;
+  GPid pid = 0;
+
+  /* The PATH in the child environment is the one that is searched */
+  g_assert (!cockpit_spawn (argv, env, NULL, NULL, 0, COCKPIT_SPAWN_SEARCH_PATH, &pid, &error));
+  g_assert_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_NOENT);
+  g_clear_error (&error);
+}
+
+static void
+test_bad_directory (void)
+{
+  const gchar *argv[] = { "/bin/true", NULL };
+  GError *error = NULL;
+  GPid pid = 0;
+
+  g_assert (!cockpit_spawn (argv, NULL, "/non-existant", NULL, 0, COCKPIT_SPAWN_DEFAULT, &pid, &error));
+  g_assert_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_CHDIR);
+  g_clear_error (&error);
+}
+
+static void
+fork_setup (gpointer data)
+{
+  /* Forces g_spawn to fork(), like the child setup callbacks we used to have */
+}
+
+static void
+test_perf_latency (gconstpointer data)
+{
+  const gchar *argv[] = { "/bin/true", NULL };
+  gsize size = GPOINTER_TO_SIZE (data) * 1024 * 1024;
+  const gint iterations = 200;
+  GError *error = NULL;
+  gdouble forked;
+  gdouble cloned;
+  gpointer heap;
+  gint status;
+  GPid pid;
+  gint i;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("only run in perf mode, use -m perf");
+      return;
+    }
+
+  /* Grow to roughly the resident size of a busy bridge */
+  heap = g_malloc (size);
+  memset (heap, 0x55, size);
+
+  g_test_timer_start ();
+  for (i = 0; i < iterations; i++)
+    {
+      g_assert (g_spawn_async (NULL, (gchar **)argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                               fork_setup, NULL, &pid, &error));
+      g_assert_no_error (error);
+      g_assert_cmpint (waitpid (pid, &status, 0), ==, pid);
+    }
+  forked = g_test_timer_elapsed () / iterations;
+
+  g_test_timer_start ();
+  for (i = 0; i < iterations; i++)
+    {
+      g_assert (cockpit_spawn (argv, NULL, NULL, NULL, 0, COCKPIT_SPAWN_PDEATHSIG, &pid, &error));
+      g_assert_no_error (error);
+      g_assert_cmpint (waitpid (pid, &status, 0), ==, pid);
+    }
+  cloned = g_test_timer_elapsed () / iterations;
+
+  g_test_message ("%" G_GSIZE_FORMAT " MB heap: fork %.3f ms, clone %.3f ms per spawn",
+                  size / (1024 * 1024), forked * 1000, cloned * 1000);
+  g_test_minimized_result (cloned, "spawn latency: %.6f s", cloned);
+
+  g_free (heap);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add_func ("/spawn/remap", test_remap);
+  g_test_add_func ("/spawn/close-fds", test_close_fds);
+  g_test_add_func ("/spawn/default-signals", test_default_signals);
+  g_test_add_func ("/spawn/directory-and-env", test_directory_and_env);
+  g_test_add_func ("/spawn/not-found", test_not_found);
+  g_test_add_func ("/spawn/search-env-path", test_search_env_path);
+  g_test_add_func ("/spawn/bad-directory", test_bad_directory);
+
+  g_test_add_data_func ("/spawn/perf/latency-50mb", GSIZE_TO_POINTER (50), test_perf_latency);
+  g_test_add_data_func ("/spawn/perf/latency-500mb", GSIZE_TO_POINTER (500), test_perf_latency);
+
+  return g_test_run ();
+}
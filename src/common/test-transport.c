@@ -22,6 +22,7 @@
 #include "cockpittransport.h"
 #include "cockpitpipe.h"
 #include "cockpitpipetransport.h"
+#include "cockpitshmring.h"
 
 #include "common/cockpittest.h"
 #include "common/mock-transport.h"
@@ -31,7 +32,11 @@
 #include <glib.h>
 
 #include <string.h>
+#include <unistd.h>
 
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
@@ -554,6 +559,418 @@ test_incorrect_protocol (void)
   cockpit_assert_expected ();
 }
 
+typedef struct {
+  gint count;
+  gsize bytes;
+  gboolean control;
+} ShmReceived;
+
+static gboolean
+on_recv_shm_sequence (CockpitTransport *transport,
+                      const gchar *channel,
+                      GBytes *message,
+                      gpointer user_data)
+{
+  ShmReceived *received = user_data;
+  gchar *expected;
+  gsize length;
+
+  if (channel == NULL)
+    {
+      received->control = TRUE;
+      return FALSE;
+    }
+
+  g_assert_cmpstr (channel, ==, "77");
+
+  /* Every payload starts with its sequence number */
+  expected = g_strdup_printf ("%d:", received->count);
+  length = g_bytes_get_size (message);
+  g_assert_cmpuint (length, >=, strlen (expected));
+  g_assert (memcmp (g_bytes_get_data (message, NULL), expected, strlen (expected)) == 0);
+  g_free (expected);
+
+  received->count++;
+  received->bytes += length;
+  return TRUE;
+}
+
+static void
+send_shm_sequence (CockpitTransport *transport,
+                   gint number,
+                   gsize length)
+{
+  GBytes *sent;
+  gchar *data;
+  gchar *prefix;
+
+  prefix = g_strdup_printf ("%d:", number);
+  data = g_strnfill (MAX (length, strlen (prefix)), 'x');
+  memcpy (data, prefix, strlen (prefix));
+  sent = g_bytes_new_take (data, MAX (length, strlen (prefix)));
+  cockpit_transport_send (transport, "77", sent);
+  g_bytes_unref (sent);
+  g_free (prefix);
+}
+
+static void
+setup_shm_pair (CockpitTransport **one,
+                CockpitTransport **two)
+{
+  int sv[2];
+
+  if (socketpair (PF_LOCAL, SOCK_STREAM, 0, sv) < 0)
+    g_assert_not_reached ();
+
+  *one = cockpit_pipe_transport_new_fds ("one", sv[0], dup (sv[0]));
+  *two = cockpit_pipe_transport_new_fds ("two", sv[1], dup (sv[1]));
+}
+
+static void
+test_shm_echo (void)
+{
+  CockpitTransport *one;
+  CockpitTransport *two;
+  ShmReceived at_one = { 0, };
+  ShmReceived at_two = { 0, };
+  gboolean closed_one = FALSE;
+  gboolean closed_two = FALSE;
+  gsize sent = 0;
+  gint i;
+
+  setup_shm_pair (&one, &two);
+  g_signal_connect (one, "recv", G_CALLBACK (on_recv_shm_sequence), &at_one);
+  g_signal_connect (two, "recv", G_CALLBACK (on_recv_shm_sequence), &at_two);
+  g_signal_connect (one, "closed", G_CALLBACK (on_closed_set_flag), &closed_one);
+  g_signal_connect (two, "closed", G_CALLBACK (on_closed_set_flag), &closed_two);
+
+  g_assert (cockpit_pipe_transport_accept_shm (COCKPIT_PIPE_TRANSPORT (two)));
+  g_assert (cockpit_pipe_transport_offer_shm (COCKPIT_PIPE_TRANSPORT (one), 64 * 1024));
+
+  /* These are sent while the rings are being set up, and must stay in order */
+  for (i = 0; i < 100; i++)
+    {
+      send_shm_sequence (one, i, 10);
+      send_shm_sequence (two, i, 10);
+      sent += MAX (10, strlen ("99:"));
+      g_main_context_iteration (NULL, FALSE);
+    }
+
+  WAIT_UNTIL (cockpit_pipe_transport_get_shm (COCKPIT_PIPE_TRANSPORT (one)) &&
+              cockpit_pipe_transport_get_shm (COCKPIT_PIPE_TRANSPORT (two)));
+
+  /* Larger than the rings */
+  send_shm_sequence (one, i, 1000 * 1000);
+  send_shm_sequence (two, i, 1000 * 1000);
+  sent += 1000 * 1000;
+  i++;
+
+  send_shm_sequence (one, i, 5);
+  send_shm_sequence (two, i, 5);
+  sent += 5;
+  i++;
+
+  /* Closes only once the other side has everything */
+  cockpit_transport_close (one, NULL);
+
+  WAIT_UNTIL (closed_one && closed_two);
+  g_assert_cmpint (at_two.count, ==, i);
+  g_assert_cmpuint (at_two.bytes, ==, sent);
+  g_assert_cmpint (at_one.count, ==, i);
+  g_assert_cmpuint (at_one.bytes, ==, sent);
+
+  /* The set up messages are not passed on */
+  g_assert (!at_one.control);
+  g_assert (!at_two.control);
+
+  g_object_unref (one);
+  g_object_unref (two);
+}
+
+static void
+test_shm_not_accepted (void)
+{
+  CockpitTransport *one;
+  CockpitTransport *two;
+  ShmReceived at_two = { 0, };
+  gint i;
+
+  setup_shm_pair (&one, &two);
+  g_signal_connect (two, "recv", G_CALLBACK (on_recv_shm_sequence), &at_two);
+
+  g_assert (cockpit_pipe_transport_offer_shm (COCKPIT_PIPE_TRANSPORT (one), 64 * 1024));
+
+  for (i = 0; i < 10; i++)
+    send_shm_sequence (one, i, 1000);
+
+  /* The other side just sees an unknown control message */
+  WAIT_UNTIL (at_two.count == 10);
+  g_assert (at_two.control);
+
+  g_assert (!cockpit_pipe_transport_get_shm (COCKPIT_PIPE_TRANSPORT (one)));
+  g_assert (!cockpit_pipe_transport_get_shm (COCKPIT_PIPE_TRANSPORT (two)));
+
+  g_object_unref (one);
+  g_object_unref (two);
+}
+
+static gboolean
+on_control_refuse_shm (CockpitTransport *transport,
+                       const gchar *command,
+                       const gchar *channel,
+                       JsonObject *options,
+                       GBytes *payload,
+                       gpointer user_data)
+{
+  GBytes *reply;
+
+  if (g_str_equal (command, "shm"))
+    {
+      reply = cockpit_transport_build_control ("command", "shm-ready", "problem", "not-supported", NULL);
+      cockpit_transport_send (transport, NULL, reply);
+      g_bytes_unref (reply);
+    }
+
+  return FALSE;
+}
+
+static void
+test_shm_refused (void)
+{
+  CockpitTransport *one;
+  CockpitTransport *two;
+  ShmReceived at_one = { 0, };
+  ShmReceived at_two = { 0, };
+  GBytes *payload;
+  gint i;
+
+  setup_shm_pair (&one, &two);
+  g_signal_connect (one, "recv", G_CALLBACK (on_recv_shm_sequence), &at_one);
+  g_signal_connect (two, "recv", G_CALLBACK (on_recv_shm_sequence), &at_two);
+  g_signal_connect (two, "control", G_CALLBACK (on_control_refuse_shm), NULL);
+
+  g_assert (cockpit_pipe_transport_offer_shm (COCKPIT_PIPE_TRANSPORT (one), 64 * 1024));
+
+  for (i = 0; i < 10; i++)
+    {
+      send_shm_sequence (one, i, 1000);
+      send_shm_sequence (two, i, 1000);
+    }
+
+  WAIT_UNTIL (at_one.count == 10 && at_two.count == 10);
+
+  /* The refusal itself is swallowed, but nothing after it */
+  g_assert (!at_one.control);
+  payload = cockpit_transport_build_control ("command", "shm-ready", NULL);
+  cockpit_transport_send (two, NULL, payload);
+  g_bytes_unref (payload);
+  WAIT_UNTIL (at_one.control);
+
+  g_assert (!cockpit_pipe_transport_get_shm (COCKPIT_PIPE_TRANSPORT (one)));
+  g_assert (!cockpit_pipe_transport_get_shm (COCKPIT_PIPE_TRANSPORT (two)));
+
+  g_object_unref (one);
+  g_object_unref (two);
+}
+
+static void
+test_shm_late_offer (void)
+{
+  CockpitTransport *one;
+  CockpitTransport *two;
+  ShmReceived at_one = { 0, };
+  ShmReceived at_two = { 0, };
+  GBytes *payload;
+  gint i;
+
+  setup_shm_pair (&one, &two);
+  g_signal_connect (one, "recv", G_CALLBACK (on_recv_shm_sequence), &at_one);
+  g_signal_connect (two, "recv", G_CALLBACK (on_recv_shm_sequence), &at_two);
+
+  g_assert (cockpit_pipe_transport_accept_shm (COCKPIT_PIPE_TRANSPORT (two)));
+
+  /* Anything but "init" before the offer means it isn't coming */
+  payload = cockpit_transport_build_control ("command", "hint", NULL);
+  cockpit_transport_send (one, NULL, payload);
+  g_bytes_unref (payload);
+  WAIT_UNTIL (at_two.control);
+
+  g_assert (cockpit_pipe_transport_offer_shm (COCKPIT_PIPE_TRANSPORT (one), 64 * 1024));
+
+  for (i = 0; i < 10; i++)
+    {
+      send_shm_sequence (one, i, 1000);
+      send_shm_sequence (two, i, 1000);
+    }
+
+  WAIT_UNTIL (at_one.count == 10 && at_two.count == 10);
+
+  g_assert (!cockpit_pipe_transport_get_shm (COCKPIT_PIPE_TRANSPORT (one)));
+  g_assert (!cockpit_pipe_transport_get_shm (COCKPIT_PIPE_TRANSPORT (two)));
+
+  g_object_unref (one);
+  g_object_unref (two);
+}
+
+static void
+test_shm_not_socket (void)
+{
+  CockpitTransport *transport;
+  gint fds[2];
+
+  if (pipe (fds) < 0)
+    g_assert_not_reached ();
+
+  transport = cockpit_pipe_transport_new_fds ("test", fds[0], fds[1]);
+  g_assert (!cockpit_pipe_transport_offer_shm (COCKPIT_PIPE_TRANSPORT (transport), 64 * 1024));
+  g_assert (!cockpit_pipe_transport_accept_shm (COCKPIT_PIPE_TRANSPORT (transport)));
+  g_object_unref (transport);
+}
+
+static void
+test_shm_ring_unsealed (void)
+{
+  CockpitShmRing *ring;
+  GError *error = NULL;
+  gint fds[COCKPIT_SHM_RING_N_FDS];
+
+  fds[0] = memfd_create ("test", MFD_CLOEXEC);
+  g_assert_cmpint (fds[0], >=, 0);
+  g_assert_cmpint (ftruncate (fds[0], 4096 * 3), ==, 0);
+  fds[1] = eventfd (0, EFD_CLOEXEC);
+  fds[2] = eventfd (0, EFD_CLOEXEC);
+
+  ring = cockpit_shm_ring_attach (fds, &error);
+  g_assert (ring == NULL);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_error_free (error);
+}
+
+static void
+test_shm_ring_corrupt (void)
+{
+  CockpitShmRing *creator;
+  CockpitShmRing *peer;
+  GByteArray *buffer;
+  GError *error = NULL;
+  gint fds[COCKPIT_SHM_RING_N_FDS];
+  guint32 bad = 0x7fffffff;
+  gint i;
+
+  creator = cockpit_shm_ring_new (4096, &error);
+  g_assert_no_error (error);
+
+  for (i = 0; i < COCKPIT_SHM_RING_N_FDS; i++)
+    fds[i] = dup (cockpit_shm_ring_get_fds (creator)[i]);
+  peer = cockpit_shm_ring_attach (fds, &error);
+  g_assert_no_error (error);
+
+  buffer = g_byte_array_new ();
+  g_assert_cmpint (cockpit_shm_ring_write (creator, (guint8 *)"blah", 4), ==, 4);
+  g_assert_cmpint (cockpit_shm_ring_read (peer, buffer), ==, 4);
+  g_assert_cmpint (buffer->len, ==, 4);
+
+  /* Scribble a head index that would overrun the ring */
+  g_assert_cmpint (pwrite (cockpit_shm_ring_get_fds (creator)[0], &bad, sizeof (bad), 64), ==, sizeof (bad));
+  cockpit_expect_message ("invalid head index*");
+  g_assert_cmpint (cockpit_shm_ring_read (peer, buffer), ==, -1);
+
+  g_byte_array_unref (buffer);
+  cockpit_shm_ring_free (peer);
+  cockpit_shm_ring_free (creator);
+
+  cockpit_assert_expected ();
+}
+
+#define SHM_STRESS_TOTAL (8 * 1024 * 1024)
+
+static gboolean
+wait_for_wake (CockpitShmRing *ring)
+{
+  struct pollfd pfd = { .fd = cockpit_shm_ring_get_wake_fd (ring), .events = POLLIN };
+
+  /* A lost wake up shows as a timeout */
+  return poll (&pfd, 1, 10 * 1000) == 1;
+}
+
+static gpointer
+shm_stress_writer (gpointer data)
+{
+  CockpitShmRing *ring = data;
+  guint8 chunk[3000];
+  gsize sent = 0;
+  gsize length;
+  gsize done;
+  gssize res;
+  gsize i;
+
+  while (sent < SHM_STRESS_TOTAL)
+    {
+      length = MIN (g_random_int_range (1, sizeof (chunk)), SHM_STRESS_TOTAL - sent);
+      for (i = 0; i < length; i++)
+        chunk[i] = (sent + i) % 251;
+
+      for (done = 0; done < length; done += res)
+        {
+          cockpit_shm_ring_clear_wake (ring);
+          res = cockpit_shm_ring_write (ring, chunk + done, length - done);
+          g_assert_cmpint (res, >=, 0);
+          if (done + res < length)
+            g_assert (wait_for_wake (ring));
+        }
+
+      sent += length;
+    }
+
+  return NULL;
+}
+
+static void
+test_shm_ring_stress (void)
+{
+  CockpitShmRing *creator;
+  CockpitShmRing *peer;
+  GByteArray *buffer;
+  GError *error = NULL;
+  GThread *thread;
+  gint fds[COCKPIT_SHM_RING_N_FDS];
+  gsize received = 0;
+  gsize i;
+  gint j;
+
+  /* A small ring, so the two sides keep catching up with each other */
+  creator = cockpit_shm_ring_new (4096, &error);
+  g_assert_no_error (error);
+
+  for (j = 0; j < COCKPIT_SHM_RING_N_FDS; j++)
+    fds[j] = dup (cockpit_shm_ring_get_fds (creator)[j]);
+  peer = cockpit_shm_ring_attach (fds, &error);
+  g_assert_no_error (error);
+
+  thread = g_thread_new ("shm-writer", shm_stress_writer, creator);
+
+  buffer = g_byte_array_new ();
+  while (received < SHM_STRESS_TOTAL)
+    {
+      cockpit_shm_ring_clear_wake (peer);
+      g_assert_cmpint (cockpit_shm_ring_read (peer, buffer), >=, 0);
+
+      for (i = 0; i < buffer->len; i++)
+        g_assert_cmpuint (buffer->data[i], ==, (received + i) % 251);
+      received += buffer->len;
+      g_byte_array_set_size (buffer, 0);
+
+      if (received < SHM_STRESS_TOTAL)
+        g_assert (wait_for_wake (peer));
+    }
+
+  g_thread_join (thread);
+
+  g_byte_array_unref (buffer);
+  cockpit_shm_ring_free (peer);
+  cockpit_shm_ring_free (creator);
+}
+
 static void
 test_parse_frame (void)
 {
@@ -795,5 +1212,14 @@ main (int argc,
   g_test_add_func ("/transport/read-truncated", test_read_truncated);
   g_test_add_func ("/transport/read-incorrect", test_incorrect_protocol);
 
+  g_test_add_func ("/transport/shm/echo", test_shm_echo);
+  g_test_add_func ("/transport/shm/not-accepted", test_shm_not_accepted);
+  g_test_add_func ("/transport/shm/refused", test_shm_refused);
+  g_test_add_func ("/transport/shm/late-offer", test_shm_late_offer);
+  g_test_add_func ("/transport/shm/not-socket", test_shm_not_socket);
+  g_test_add_func ("/transport/shm/ring-unsealed", test_shm_ring_unsealed);
+  g_test_add_func ("/transport/shm/ring-corrupt", test_shm_ring_corrupt);
+  g_test_add_func ("/transport/shm/ring-stress", test_shm_ring_stress);
+
   return g_test_run ();
 }
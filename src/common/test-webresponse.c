@@ -19,6 +19,7 @@
 
 #include "config.h"
 
+#include "cockpitwebdeflate.h"
 #include "cockpitwebinject.h"
 #include "cockpitwebresponse.h"
 #include "cockpitwebserver.h"
@@ -458,6 +459,239 @@ test_cache (TestCase *tc,
   g_hash_table_unref (headers);
 }
 
+static const TestFixture asset_pack_fixture = {
+  .path = "/index.html",
+  .header = "Accept-Encoding",
+  .value = "gzip, deflate",
+};
+
+static const TestFixture asset_pack_plain_fixture = {
+  .path = "/index.html",
+};
+
+static gchar *
+build_asset_pack (gchar **root)
+{
+  GError *error = NULL;
+  GString *content;
+  gchar *directory;
+  gchar *path;
+  gint i;
+
+  directory = g_dir_make_tmp ("asset-pack-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  *root = g_build_filename (directory, "root", NULL);
+  path = g_build_filename (*root, "sub", NULL);
+  g_assert (g_mkdir_with_parents (path, 0700) == 0);
+  g_free (path);
+
+  content = g_string_new ("<html>");
+  for (i = 0; i < 100; i++)
+    g_string_append (content, "<p>Something to compress</p>\n");
+  g_string_append (content, "</html>\n");
+
+  path = g_build_filename (*root, "index.html", NULL);
+  g_file_set_contents (path, content->str, content->len, &error);
+  g_assert_no_error (error);
+  g_free (path);
+  g_string_free (content, TRUE);
+
+  path = g_build_filename (*root, "sub", "logo.png", NULL);
+  g_file_set_contents (path, "\x89PNG", 4, &error);
+  g_assert_no_error (error);
+  g_free (path);
+
+  path = g_build_filename (*root, ".hidden", NULL);
+  g_file_set_contents (path, "secret", -1, &error);
+  g_assert_no_error (error);
+  g_free (path);
+
+  return directory;
+}
+
+static void
+remove_asset_pack (gchar *directory,
+                   gchar *root)
+{
+  const gchar *name;
+  gchar *pack;
+  gchar *path;
+  GDir *dir;
+
+  path = g_build_filename (root, "sub", "logo.png", NULL);
+  g_assert (g_unlink (path) == 0);
+  g_free (path);
+  path = g_build_filename (root, "sub", NULL);
+  g_assert (g_rmdir (path) == 0);
+  g_free (path);
+  path = g_build_filename (root, "index.html", NULL);
+  g_assert (g_unlink (path) == 0);
+  g_free (path);
+  path = g_build_filename (root, ".hidden", NULL);
+  g_assert (g_unlink (path) == 0);
+  g_free (path);
+  g_assert (g_rmdir (root) == 0);
+
+  path = g_build_filename (directory, "packs", NULL);
+  dir = g_dir_open (path, 0, NULL);
+  while (dir && (name = g_dir_read_name (dir)) != NULL)
+    {
+      pack = g_build_filename (path, name, NULL);
+      g_assert (g_unlink (pack) == 0);
+      g_free (pack);
+    }
+  if (dir)
+    g_dir_close (dir);
+  g_rmdir (path);
+  g_free (path);
+
+  g_assert (g_rmdir (directory) == 0);
+  g_free (directory);
+  g_free (root);
+}
+
+static void
+test_asset_pack_lookup (void)
+{
+  const gchar *roots[] = { NULL, NULL };
+  GError *error = NULL;
+  CockpitAssetPack *pack;
+  GBytes *gzipped;
+  GBytes *bytes;
+  GBytes *unzipped;
+  gchar *directory;
+  gchar *packs;
+  gchar *root;
+  gchar *path;
+
+  directory = build_asset_pack (&root);
+  packs = g_build_filename (directory, "packs", NULL);
+  roots[0] = root;
+
+  /* Nothing built yet */
+  pack = cockpit_asset_pack_open (packs, roots, &error);
+  g_assert_no_error (error);
+  g_assert (pack == NULL);
+
+  g_assert (cockpit_asset_pack_build (packs, roots, &error));
+  g_assert_no_error (error);
+
+  pack = cockpit_asset_pack_open (packs, roots, &error);
+  g_assert_no_error (error);
+  g_assert (pack != NULL);
+  g_assert_cmpuint (cockpit_asset_pack_get_n_files (pack), ==, 2);
+
+  path = g_build_filename (root, "index.html", NULL);
+  bytes = cockpit_asset_pack_lookup (pack, path, &gzipped);
+  g_assert (bytes != NULL);
+  g_assert (gzipped != NULL);
+  g_assert_cmpuint (g_bytes_get_size (gzipped), <, g_bytes_get_size (bytes));
+  unzipped = cockpit_web_response_gunzip (gzipped, &error);
+  g_assert_no_error (error);
+  g_assert (g_bytes_equal (bytes, unzipped));
+  g_bytes_unref (unzipped);
+  g_bytes_unref (gzipped);
+  g_bytes_unref (bytes);
+  g_free (path);
+
+  /* Media isn't compressed again */
+  path = g_build_filename (root, "sub", "logo.png", NULL);
+  bytes = cockpit_asset_pack_lookup (pack, path, &gzipped);
+  g_assert (bytes != NULL);
+  g_assert (gzipped == NULL);
+  g_assert_cmpuint (g_bytes_get_size (bytes), ==, 4);
+  g_bytes_unref (bytes);
+  g_free (path);
+
+  path = g_build_filename (root, ".hidden", NULL);
+  g_assert (cockpit_asset_pack_lookup (pack, path, NULL) == NULL);
+  g_free (path);
+
+  /* A file changed after opening isn't served from the pack */
+  path = g_build_filename (root, "sub", "logo.png", NULL);
+  g_file_set_contents (path, "\x89PNG\r\n", 6, &error);
+  g_assert_no_error (error);
+  g_assert (cockpit_asset_pack_lookup (pack, path, NULL) == NULL);
+  g_free (path);
+
+  /* The others still are */
+  path = g_build_filename (root, "index.html", NULL);
+  bytes = cockpit_asset_pack_lookup (pack, path, NULL);
+  g_assert (bytes != NULL);
+  g_bytes_unref (bytes);
+  g_free (path);
+
+  cockpit_asset_pack_free (pack);
+
+  /* And a changed file makes the pack stale */
+
+  pack = cockpit_asset_pack_open (packs, roots, &error);
+  g_assert_no_error (error);
+  g_assert (pack == NULL);
+
+  g_free (packs);
+  remove_asset_pack (directory, root);
+}
+
+static void
+test_asset_pack_serve (TestCase *tc,
+                       gconstpointer user_data)
+{
+  const TestFixture *fixture = user_data;
+  const gchar *roots[] = { NULL, NULL };
+  GError *error = NULL;
+  GHashTable *headers;
+  const gchar *resp;
+  gchar *directory;
+  gchar *packs;
+  gchar *root;
+  gsize length;
+  guint status;
+  gssize off;
+
+  directory = build_asset_pack (&root);
+  packs = g_build_filename (directory, "packs", NULL);
+  roots[0] = root;
+
+  g_assert (cockpit_asset_pack_build (packs, roots, &error));
+  g_assert_no_error (error);
+  cockpit_web_asset_pack = cockpit_asset_pack_open (packs, roots, &error);
+  g_assert_no_error (error);
+  g_assert (cockpit_web_asset_pack != NULL);
+
+  cockpit_web_response_file (tc->response, NULL, roots);
+
+  resp = output_as_string (tc);
+  length = strlen (resp);
+
+  off = web_socket_util_parse_status_line (resp, length, NULL, &status, NULL);
+  g_assert_cmpuint (off, >, 0);
+  g_assert_cmpint (status, ==, 200);
+
+  off = web_socket_util_parse_headers (resp + off, length - off, &headers);
+  g_assert_cmpuint (off, >, 0);
+
+  g_assert_cmpstr (g_hash_table_lookup (headers, "Content-Type"), ==, "text/html");
+  g_assert_cmpstr (g_hash_table_lookup (headers, "Vary"), ==, "Accept-Encoding");
+  if (fixture->header)
+    {
+      g_assert_cmpstr (g_hash_table_lookup (headers, "Content-Encoding"), ==, "gzip");
+    }
+  else
+    {
+      g_assert_null (g_hash_table_lookup (headers, "Content-Encoding"));
+      g_assert (strstr (resp, "<p>Something to compress</p>") != NULL);
+    }
+  g_hash_table_unref (headers);
+
+  cockpit_asset_pack_free (cockpit_web_asset_pack);
+  cockpit_web_asset_pack = NULL;
+
+  g_free (packs);
+  remove_asset_pack (directory, root);
+}
+
 static void
 test_content_encoding (TestCase *tc,
                        gconstpointer data)
@@ -985,6 +1219,227 @@ test_web_filter_passthrough (TestCase *tc,
                    "0\r\n\r\n");
 }
 
+static GBytes *
+output_body_dechunked (TestCase *tc)
+{
+  const gchar *data;
+  const gchar *end;
+  const gchar *body;
+  GByteArray *out;
+  gchar *endptr;
+  guint64 len;
+
+  while (!tc->response_done)
+    g_main_context_iteration (NULL, TRUE);
+
+  data = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (tc->output));
+  end = data + g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (tc->output));
+
+  body = g_strstr_len (data, end - data, "\r\n\r\n");
+  g_assert (body != NULL);
+  body += 4;
+
+  out = g_byte_array_new ();
+  for (;;)
+    {
+      len = g_ascii_strtoull (body, &endptr, 16);
+      g_assert (endptr != body);
+      g_assert (endptr + 2 + len + 2 <= end);
+      body = endptr + 2;
+      if (len == 0)
+        break;
+      g_byte_array_append (out, (const guint8 *)body, len);
+      body += len + 2;
+    }
+
+  return g_byte_array_free_to_bytes (out);
+}
+
+static void
+test_web_filter_deflate (TestCase *tc,
+                         gconstpointer data)
+{
+  CockpitWebFilter *filter;
+  GError *error = NULL;
+  GBytes *compressed;
+  GBytes *content;
+  GBytes *bytes;
+  GString *expected;
+  gint i;
+
+  filter = cockpit_web_deflate_new ("gzip", 1);
+  cockpit_web_response_add_filter (tc->response, filter);
+  g_object_unref (filter);
+
+  cockpit_web_response_headers (tc->response, 200, "OK", -1, "Content-Encoding", "gzip", NULL);
+
+  expected = g_string_new ("");
+  content = bytes_static ("Cockpit is perfect for new sysadmins, ");
+  for (i = 0; i < 100; i++)
+    {
+      cockpit_web_response_queue (tc->response, content);
+      g_string_append (expected, "Cockpit is perfect for new sysadmins, ");
+    }
+  g_bytes_unref (content);
+  cockpit_web_response_complete (tc->response);
+
+  compressed = output_body_dechunked (tc);
+  g_assert_cmpuint (g_bytes_get_size (compressed), <, expected->len);
+
+  bytes = cockpit_web_response_gunzip (compressed, &error);
+  g_assert_no_error (error);
+  cockpit_assert_bytes_eq (bytes, expected->str, expected->len);
+
+  g_bytes_unref (bytes);
+  g_bytes_unref (compressed);
+  g_string_free (expected, TRUE);
+}
+
+static void
+test_web_filter_deflate_empty (TestCase *tc,
+                               gconstpointer data)
+{
+  CockpitWebFilter *filter;
+  GError *error = NULL;
+  GBytes *compressed;
+  GBytes *bytes;
+
+  filter = cockpit_web_deflate_new ("gzip", 1);
+  cockpit_web_response_add_filter (tc->response, filter);
+  g_object_unref (filter);
+
+  cockpit_web_response_headers (tc->response, 200, "OK", -1, "Content-Encoding", "gzip", NULL);
+  cockpit_web_response_complete (tc->response);
+
+  /* Even no content is a valid gzip stream */
+  compressed = output_body_dechunked (tc);
+  bytes = cockpit_web_response_gunzip (compressed, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_bytes_get_size (bytes), ==, 0);
+
+  g_bytes_unref (bytes);
+  g_bytes_unref (compressed);
+}
+
+static void
+test_deflate_negotiate (void)
+{
+  struct {
+    const gchar *accept;
+    const gchar *expected;
+  } cases[] = {
+    { NULL, NULL },
+    { "identity", NULL },
+    { "gzip", "gzip" },
+    { "gzip, deflate, br", "gzip" },
+    { "deflate", "deflate" },
+    { "gzip;q=0, deflate", "deflate" },
+    { "gzip;q=0.5, deflate;q=1.0", "gzip" },
+    { "*", "gzip" },
+    { "*;q=0", NULL },
+    { "gzip;q=0, *", "deflate" },
+  };
+  GHashTable *headers;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (cases); i++)
+    {
+      headers = cockpit_web_server_new_table ();
+      if (cases[i].accept)
+        g_hash_table_insert (headers, g_strdup ("Accept-Encoding"), g_strdup (cases[i].accept));
+      g_assert_cmpstr (cockpit_web_deflate_negotiate (headers), ==, cases[i].expected);
+      g_hash_table_unref (headers);
+    }
+}
+
+static void
+test_deflate_compressible (void)
+{
+  g_assert (cockpit_web_deflate_is_compressible ("text/plain"));
+  g_assert (cockpit_web_deflate_is_compressible ("application/json; charset=utf-8"));
+  g_assert (cockpit_web_deflate_is_compressible ("image/svg+xml"));
+  g_assert (!cockpit_web_deflate_is_compressible (NULL));
+  g_assert (!cockpit_web_deflate_is_compressible ("image/png"));
+  g_assert (!cockpit_web_deflate_is_compressible ("application/x-xz"));
+  g_assert (!cockpit_web_deflate_is_compressible ("application/octet-stream"));
+}
+
+static void
+on_deflate_output (gpointer data,
+                   GBytes *output)
+{
+  *(gsize *)data += g_bytes_get_size (output);
+}
+
+static gsize
+deflate_in_blocks (GBytes *content,
+                   gint level,
+                   gsize block)
+{
+  CockpitWebFilter *filter;
+  gsize offset, length, total = 0;
+  GBytes *bytes;
+
+  filter = cockpit_web_deflate_new ("gzip", level);
+  length = g_bytes_get_size (content);
+  for (offset = 0; offset < length; offset += block)
+    {
+      bytes = g_bytes_new_from_bytes (content, offset, MIN (block, length - offset));
+      cockpit_web_filter_push (filter, bytes, on_deflate_output, &total);
+      g_bytes_unref (bytes);
+    }
+  cockpit_web_filter_finish (filter, on_deflate_output, &total);
+  g_object_unref (filter);
+
+  return total;
+}
+
+static void
+test_deflate_perf (void)
+{
+  static const gint levels[] = { 1, 6, 9 };
+  GError *error = NULL;
+  GMappedFile *file;
+  GBytes *compressed;
+  GBytes *content;
+  GTimer *timer;
+  gsize size;
+  gdouble seconds;
+  guint i;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("only run with -m perf");
+      return;
+    }
+
+  file = g_mapped_file_new (SRCDIR "/src/common/mock-content/large.min.js.gz", FALSE, &error);
+  g_assert_no_error (error);
+  compressed = g_mapped_file_get_bytes (file);
+  g_mapped_file_unref (file);
+  content = cockpit_web_response_gunzip (compressed, &error);
+  g_assert_no_error (error);
+  g_bytes_unref (compressed);
+
+  /* Blocks of the size a channel usually delivers */
+  timer = g_timer_new ();
+  for (i = 0; i < G_N_ELEMENTS (levels); i++)
+    {
+      g_timer_start (timer);
+      size = deflate_in_blocks (content, levels[i], 4096);
+      seconds = g_timer_elapsed (timer, NULL);
+      g_test_message ("level %d: %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes (%.1f%%) in %.2f ms, %.1f MB/s",
+                      levels[i], size, g_bytes_get_size (content),
+                      100.0 * size / g_bytes_get_size (content), seconds * 1000,
+                      g_bytes_get_size (content) / seconds / (1024 * 1024));
+      if (levels[i] == 1)
+        g_test_minimized_result (seconds, "level 1 compression time: %.4f s", seconds);
+    }
+
+  g_timer_destroy (timer);
+  g_bytes_unref (content);
+}
+
 static void
 on_response_done_not_resuable (CockpitWebResponse *response,
                                gboolean reusable,
@@ -1483,6 +1938,11 @@ main (int argc,
               setup, test_template, teardown);
   g_test_add ("/web-response/content-type", TestCase, &content_type_fixture,
               setup, test_content_type, teardown);
+  g_test_add_func ("/web-response/asset-pack/lookup", test_asset_pack_lookup);
+  g_test_add ("/web-response/asset-pack/serve-gzip", TestCase, &asset_pack_fixture,
+              setup, test_asset_pack_serve, teardown);
+  g_test_add ("/web-response/asset-pack/serve-plain", TestCase, &asset_pack_plain_fixture,
+              setup, test_asset_pack_serve, teardown);
   g_test_add ("/web-response/content-encoding", TestCase, NULL,
               setup, test_content_encoding, teardown);
   g_test_add ("/web-response/stream", TestCase, NULL,
@@ -1526,6 +1986,14 @@ main (int argc,
   g_test_add ("/web-response/filter/shift_three", TestCase, NULL,
               setup, test_web_filter_shift_three, teardown);
 
+  g_test_add ("/web-response/filter/deflate", TestCase, NULL,
+              setup, test_web_filter_deflate, teardown);
+  g_test_add ("/web-response/filter/deflate-empty", TestCase, NULL,
+              setup, test_web_filter_deflate_empty, teardown);
+  g_test_add_func ("/web-response/deflate/negotiate", test_deflate_negotiate);
+  g_test_add_func ("/web-response/deflate/compressible", test_deflate_compressible);
+  g_test_add_func ("/web-response/deflate/perf", test_deflate_perf);
+
   g_test_add ("/web-response/path/pop", TestPlain, NULL,
               setup_plain, test_pop_path, teardown_plain);
   g_test_add ("/web-response/path/pop-root", TestPlain, NULL,
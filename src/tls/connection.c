@@ -39,6 +39,7 @@
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <gnutls/gnutls.h>
@@ -61,6 +62,26 @@ static struct {
   .cert_session_dir = -1
 };
 
+/* A wsinstance activation in progress.  Browsers open several connections
+ * at once, so the first connection with a new certificate asks the factory,
+ * and the others wait for that instead of starting the same unit again. */
+typedef struct Activation {
+  Fingerprint fingerprint;
+  bool done;
+  bool result;
+  unsigned waiters;
+  pthread_cond_t cond;
+  struct Activation *next;
+} Activation;
+
+static struct {
+  pthread_mutex_t mutex;
+  Activation *pending;
+  ConnectionStats stats;
+} activations = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
 typedef struct
 {
   char buffer[16u << 10]; /* 16KiB */
@@ -403,6 +424,81 @@ out:
   return status;
 }
 
+static uint64_t
+elapsed_usec (const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000ull + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static bool
+activate_wsinstance (const Fingerprint *fingerprint)
+{
+  Activation self = { .fingerprint = *fingerprint };
+  struct timespec start;
+  Activation *other;
+  Activation **link;
+  uint64_t usec;
+  bool result;
+
+  pthread_mutex_lock (&activations.mutex);
+
+  for (other = activations.pending; other != NULL; other = other->next)
+    {
+      if (strcmp (other->fingerprint.str, fingerprint->str) == 0)
+        break;
+    }
+
+  if (other)
+    {
+      debug (CONNECTION, "  -> activation of %s already in progress, waiting", fingerprint->str);
+      activations.stats.coalesced++;
+      other->waiters++;
+      while (!other->done)
+        pthread_cond_wait (&other->cond, &activations.mutex);
+      result = other->result;
+      other->waiters--;
+      pthread_cond_broadcast (&other->cond);
+      pthread_mutex_unlock (&activations.mutex);
+      return result;
+    }
+
+  pthread_cond_init (&self.cond, NULL);
+  self.next = activations.pending;
+  activations.pending = &self;
+  activations.stats.activations++;
+  pthread_mutex_unlock (&activations.mutex);
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  result = request_dynamic_wsinstance (fingerprint);
+  usec = elapsed_usec (&start);
+
+  pthread_mutex_lock (&activations.mutex);
+
+  for (link = &activations.pending; *link != &self; link = &(*link)->next)
+    ;
+  *link = self.next;
+
+  if (!result)
+    activations.stats.activation_failures++;
+  activations.stats.activation_usec += usec;
+  activations.stats.activation_max_usec = MAX (activations.stats.activation_max_usec, usec);
+
+  /* hand the result to everyone waiting, and wait until they have it */
+  self.result = result;
+  self.done = true;
+  pthread_cond_broadcast (&self.cond);
+  while (self.waiters > 0)
+    pthread_cond_wait (&self.cond, &activations.mutex);
+
+  pthread_mutex_unlock (&activations.mutex);
+  pthread_cond_destroy (&self.cond);
+
+  return result;
+}
+
 static bool
 connection_connect_to_dynamic_wsinstance (Connection *self)
 {
@@ -435,14 +531,19 @@ connection_connect_to_dynamic_wsinstance (Connection *self)
 
   /* fast path: the socket already exists, so we can just connect to it */
   if (af_unix_connectat (self->ws_fd, parameters.wsinstance_sockdir, sockname) == 0)
-    return true;
+    {
+      pthread_mutex_lock (&activations.mutex);
+      activations.stats.instance_hits++;
+      pthread_mutex_unlock (&activations.mutex);
+      return true;
+    }
 
   if (errno != ENOENT && errno != ECONNREFUSED)
     warn ("connect(%s) failed on the first attempt", sockname);
 
   debug (CONNECTION, "  -> failed (%m).  Requesting activation.");
   /* otherwise, ask for the instance to be started */
-  if (!request_dynamic_wsinstance (&self->fingerprint))
+  if (!activate_wsinstance (&self->fingerprint))
     return false;
 
   /* ... and try one more time. */
@@ -836,6 +937,19 @@ connection_set_directories (const char *wsinstance_sockdir,
     err (EXIT_FAILURE, "Unable to open certificate directory %s", cert_session_dir);
 }
 
+/**
+ * connection_get_stats: Counters about connecting to https instances
+ *
+ * Since the start of the process.
+ */
+void
+connection_get_stats (ConnectionStats *stats)
+{
+  pthread_mutex_lock (&activations.mutex);
+  *stats = activations.stats;
+  pthread_mutex_unlock (&activations.mutex);
+}
+
 void
 connection_cleanup (void)
 {
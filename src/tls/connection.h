@@ -39,3 +39,16 @@ connection_cleanup (void);
 /* handle a new connection */
 void
 connection_thread_main (int fd);
+
+/* statistics */
+typedef struct {
+  unsigned instance_hits;        /* connected to a running instance right away */
+  unsigned activations;          /* had to ask the factory to start one */
+  unsigned coalesced;            /* waited for another connection's activation */
+  unsigned activation_failures;
+  uint64_t activation_usec;      /* total time spent in activations */
+  uint64_t activation_max_usec;
+} ConnectionStats;
+
+void
+connection_get_stats (ConnectionStats *stats);
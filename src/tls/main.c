@@ -24,6 +24,7 @@
 #include <argp.h>
 #include <err.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <common/cockpitconf.h>
@@ -89,6 +90,25 @@ static const struct argp argp = {
   .doc = "cockpit-tls -- TLS terminating proxy for cockpit-ws",
 };
 
+static void
+log_connection_stats (void)
+{
+  ConnectionStats stats;
+  unsigned total;
+
+  connection_get_stats (&stats);
+  total = stats.instance_hits + stats.activations + stats.coalesced;
+  if (total == 0)
+    return;
+
+  fprintf (stderr, "cockpit-tls: https instances: %u%% running on connect (%u of %u), "
+           "%u activations (%u failed), %u waited on another, activation avg %llu ms, max %llu ms\n",
+           stats.instance_hits * 100 / total, stats.instance_hits, total,
+           stats.activations, stats.activation_failures, stats.coalesced,
+           stats.activations ? (unsigned long long) (stats.activation_usec / stats.activations / 1000) : 0ull,
+           (unsigned long long) (stats.activation_max_usec / 1000));
+}
+
 int
 main (int argc, char **argv)
 {
@@ -126,6 +146,7 @@ main (int argc, char **argv)
     }
 
   server_run ();
+  log_connection_stats ();
   server_cleanup ();
 
   return 0;
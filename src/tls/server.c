@@ -89,29 +89,50 @@ check_sd_listen_pid (void)
   return true;
 }
 
-static void *
-server_connection_thread_start_routine (void *data)
+static void
+server_connection_begin (void)
 {
-  int fd = (uintptr_t) data;
+  pthread_mutex_lock (&server.connection_mutex);
 
-  connection_thread_main (fd);
+  if (server.connection_count == 0 && server.idle_timerfd != -1)
+    {
+      const struct itimerspec zero = { { 0 }, };
+      debug (CONNECTION, "  -> clearing idle timeout.");
+      timerfd_settime (server.idle_timerfd, 0, &zero, NULL);
+    }
 
-  /* teardown */
-  {
-    pthread_mutex_lock (&server.connection_mutex);
+  server.connection_count++;
 
-    server.connection_count--;
+  debug (CONNECTION, "  -> server.connection_count is now %i", server.connection_count);
 
-    debug (CONNECTION, "Server.connection_count decreased to %i", server.connection_count);
+  pthread_mutex_unlock (&server.connection_mutex);
+}
+
+static void
+server_connection_end (void)
+{
+  pthread_mutex_lock (&server.connection_mutex);
 
-    if (server.connection_count == 0 && server.idle_timerfd != -1)
-      {
-        debug (CONNECTION, "  -> setting idle timeout");
-        timerfd_settime (server.idle_timerfd, 0, &server.idle_timeout, NULL);
-      }
+  server.connection_count--;
 
-    pthread_mutex_unlock (&server.connection_mutex);
-  }
+  debug (CONNECTION, "Server.connection_count decreased to %i", server.connection_count);
+
+  if (server.connection_count == 0 && server.idle_timerfd != -1)
+    {
+      debug (CONNECTION, "  -> setting idle timeout");
+      timerfd_settime (server.idle_timerfd, 0, &server.idle_timeout, NULL);
+    }
+
+  pthread_mutex_unlock (&server.connection_mutex);
+}
+
+static void *
+server_connection_thread_start_routine (void *data)
+{
+  int fd = (uintptr_t) data;
+
+  connection_thread_main (fd);
+  server_connection_end ();
 
   return NULL;
 }
@@ -141,22 +162,7 @@ handle_accept (int listen_fd)
 
   debug (CONNECTION, "New connection accepted, fd %i", fd);
 
-  {
-    pthread_mutex_lock (&server.connection_mutex);
-
-    if (server.connection_count == 0 && server.idle_timerfd != -1)
-      {
-        const struct itimerspec zero = { { 0 }, };
-        debug (CONNECTION, "  -> clearing idle timeout.");
-        timerfd_settime (server.idle_timerfd, 0, &zero, NULL);
-      }
-
-    server.connection_count++;
-
-    debug (CONNECTION, "  -> server.connection_count is now %i", server.connection_count);
-
-    pthread_mutex_unlock (&server.connection_mutex);
-  }
+  server_connection_begin ();
 
   pthread_attr_init (&attr);
   pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
@@ -170,6 +176,7 @@ handle_accept (int listen_fd)
       errno = r;
       warn ("pthread_create() failed.  dropping connection");
       close (fd);
+      server_connection_end ();
     }
 
   pthread_attr_destroy (&attr);
@@ -27,6 +27,7 @@
 #include <netinet/in.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 
 #include <glib.h>
@@ -36,6 +37,7 @@
 #include "connection.h"
 #include "testing.h"
 #include "server.h"
+#include "socket-io.h"
 #include "utils.h"
 #include "common/cockpittest.h"
 
@@ -186,16 +188,13 @@ assert_http (TestCase *tc)
     }
 }
 
-static void
-assert_https_outcome (TestCase *tc,
-                      const TestFixture *fixture,
-                      unsigned expected_server_certs,
-                      bool expect_tls_failure)
+static pid_t
+start_https_client (TestCase *tc,
+                    const TestFixture *fixture,
+                    unsigned expected_server_certs,
+                    bool expect_tls_failure)
 {
   pid_t pid;
-  int status = -1;
-
-  block_sigchld ();
 
   /* do the connection in a subprocess, as gnutls_handshake is synchronous */
   pid = fork ();
@@ -299,6 +298,22 @@ assert_https_outcome (TestCase *tc,
       exit (0);
     }
 
+  return pid;
+}
+
+static void
+assert_https_outcome (TestCase *tc,
+                      const TestFixture *fixture,
+                      unsigned expected_server_certs,
+                      bool expect_tls_failure)
+{
+  pid_t pid;
+  int status = -1;
+
+  block_sigchld ();
+
+  pid = start_https_client (tc, fixture, expected_server_certs, expect_tls_failure);
+
   for (int retry = 0; retry < 100 && waitpid (pid, &status, WNOHANG) <= 0; ++retry)
     server_poll_event (200);
   g_assert_cmpint (status, ==, 0);
@@ -556,6 +571,119 @@ test_tls_client_cert (TestCase *tc, gconstpointer data)
   assert_https (tc, data, 1);
 }
 
+static void
+test_tls_instance_stats (TestCase *tc, gconstpointer data)
+{
+  ConnectionStats before, after;
+
+  connection_get_stats (&before);
+
+  assert_https (tc, data, 1);
+
+  connection_get_stats (&after);
+
+  /* the socket activation helper provides all instance sockets up front */
+  g_assert_cmpuint (after.instance_hits - before.instance_hits, >=, 1);
+  g_assert_cmpuint (after.activations, ==, before.activations);
+  g_assert_cmpuint (after.coalesced, ==, before.coalesced);
+}
+
+#define N_CONCURRENT_CLIENTS 4
+
+typedef struct {
+  int listen_fd;
+  int socket_dir_fd;
+  unsigned expected_coalesced;
+} MockFactory;
+
+/* answers one activation request, once all other connections wait for it */
+static gpointer
+mock_factory_thread (gpointer data)
+{
+  MockFactory *factory = data;
+  ConnectionStats stats;
+  Fingerprint fingerprint;
+  int fd;
+
+  fd = accept4 (factory->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  g_assert_cmpint (fd, >=, 0);
+  g_assert (recv_alnum (fd, fingerprint.str, sizeof fingerprint.str, 10 * 1000000));
+  g_assert_cmpstr (fingerprint.str, ==, SHA256_NIL);
+
+  for (int retry = 0; retry < 1000; retry++)
+    {
+      connection_get_stats (&stats);
+      if (stats.coalesced >= factory->expected_coalesced)
+        break;
+      g_usleep (10000);
+    }
+
+  /* "start" the instance */
+  g_assert_cmpint (renameat (factory->socket_dir_fd, "https@" SHA256_NIL ".sock.stopped",
+                             factory->socket_dir_fd, "https@" SHA256_NIL ".sock"), ==, 0);
+  g_assert (send_all (fd, "done", 4, 10 * 1000000));
+  close (fd);
+
+  return NULL;
+}
+
+static void
+test_tls_activation_coalesced (TestCase *tc, gconstpointer data)
+{
+  ConnectionStats before, after;
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  pid_t pids[N_CONCURRENT_CLIENTS];
+  MockFactory factory;
+  GThread *thread;
+  int status;
+
+  connection_get_stats (&before);
+
+  /* hide the instance, and answer activation requests ourselves */
+  factory.socket_dir_fd = open (tc->ws_socket_dir, O_RDONLY | O_DIRECTORY);
+  g_assert_cmpint (factory.socket_dir_fd, >=, 0);
+  g_assert_cmpint (renameat (factory.socket_dir_fd, "https@" SHA256_NIL ".sock",
+                             factory.socket_dir_fd, "https@" SHA256_NIL ".sock.stopped"), ==, 0);
+  g_assert_cmpint (renameat (factory.socket_dir_fd, "https-factory.sock",
+                             factory.socket_dir_fd, "https-factory.sock.helper"), ==, 0);
+
+  factory.listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  g_assert_cmpint (factory.listen_fd, >=, 0);
+  g_snprintf (addr.sun_path, sizeof addr.sun_path, "%s/https-factory.sock", tc->ws_socket_dir);
+  g_assert_cmpint (bind (factory.listen_fd, (struct sockaddr *) &addr, sizeof addr), ==, 0);
+  g_assert_cmpint (listen (factory.listen_fd, N_CONCURRENT_CLIENTS), ==, 0);
+  factory.expected_coalesced = before.coalesced + N_CONCURRENT_CLIENTS - 1;
+
+  thread = g_thread_new ("mock-factory", mock_factory_thread, &factory);
+
+  block_sigchld ();
+  for (int i = 0; i < N_CONCURRENT_CLIENTS; i++)
+    pids[i] = start_https_client (tc, data, 1, false);
+
+  for (int i = 0; i < N_CONCURRENT_CLIENTS; i++)
+    {
+      status = -1;
+      for (int retry = 0; retry < 100 && waitpid (pids[i], &status, WNOHANG) <= 0; ++retry)
+        server_poll_event (200);
+      g_assert_cmpint (status, ==, 0);
+    }
+
+  g_thread_join (thread);
+
+  connection_get_stats (&after);
+
+  /* all connections waited for a single activation */
+  g_assert_cmpuint (after.activations - before.activations, ==, 1);
+  g_assert_cmpuint (after.coalesced - before.coalesced, ==, N_CONCURRENT_CLIENTS - 1);
+  g_assert_cmpuint (after.activation_failures, ==, before.activation_failures);
+
+  /* put the helper's factory back, for teardown */
+  close (factory.listen_fd);
+  g_assert_cmpint (renameat (factory.socket_dir_fd, "https-factory.sock.helper",
+                             factory.socket_dir_fd, "https-factory.sock"), ==, 0);
+  close (factory.socket_dir_fd);
+}
+
 static void
 test_tls_client_cert_disabled (TestCase *tc, gconstpointer data)
 {
@@ -756,6 +884,10 @@ main (int argc, char *argv[])
               setup, test_tls_no_client_cert, teardown);
   g_test_add ("/server/tls/client-cert", TestCase, &fixture_separate_crt_key_client_cert,
               setup, test_tls_client_cert, teardown);
+  g_test_add ("/server/tls/instance-stats", TestCase, &fixture_separate_crt_key,
+              setup, test_tls_instance_stats, teardown);
+  g_test_add ("/server/tls/activation-coalesced", TestCase, &fixture_separate_crt_key,
+              setup, test_tls_activation_coalesced, teardown);
   g_test_add ("/server/tls/client-cert-disabled", TestCase, &fixture_separate_crt_key,
               setup, test_tls_client_cert_disabled, teardown);
   g_test_add ("/server/tls/client-cert-expired", TestCase, &fixture_expired_client_cert,
@@ -0,0 +1,1016 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2020 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Load generator for the full cockpit-ws <-> cockpit-bridge protocol path.
+ *
+ * Each session is a real CockpitWebService, talking to its own bridge
+ * process on one side and to a WebSocket client on the other side of a
+ * socketpair, exactly as test-webservice sets things up. The channels
+ * opened on each session are described by --mix, and every request is
+ * timed from the moment the client queues it until the reply has come
+ * back through cockpit-ws.
+ */
+
+#include "config.h"
+
+#include "cockpitcreds.h"
+#include "cockpitwebservice.h"
+#include "cockpitws.h"
+
+#include "common/cockpitjson.h"
+#include "common/cockpitpipe.h"
+#include "common/cockpitpipetransport.h"
+#include "common/cockpittransport.h"
+
+#include "websocket/websocket.h"
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/* Mock override from cockpitconf.c */
+extern const gchar *cockpit_config_file;
+
+/* Requests in flight per channel, in open loop mode */
+#define MAX_OUTSTANDING 1024
+
+/* How often the open loop scheduler wakes up */
+#define TICK_INTERVAL 10
+
+typedef enum {
+  BENCH_ECHO,
+  BENCH_STREAM,
+  BENCH_DBUS,
+  BENCH_METRICS,
+  N_BENCH_KINDS
+} BenchKind;
+
+static const gchar *kind_names[N_BENCH_KINDS] = {
+  "echo",
+  "stream",
+  "dbus",
+  "metrics",
+};
+
+typedef struct {
+  guint channels;
+  guint64 requests;
+  guint64 messages;
+  guint64 bytes;
+  guint64 errors;
+  guint64 skipped;
+  GArray *latencies;
+} BenchStats;
+
+typedef struct _BenchSession BenchSession;
+
+typedef struct {
+  BenchSession *session;
+  BenchKind kind;
+  gchar *id;
+  GBytes *prefix;
+
+  gint64 sent_at[MAX_OUTSTANDING];
+  guint head;
+  guint n_pending;
+
+  guint64 sent;
+  guint64 scheduled;
+  gsize received;
+  gboolean ready;
+  gboolean closed;
+} BenchChannel;
+
+struct _BenchSession {
+  guint number;
+  CockpitTransport *transport;
+  CockpitWebService *service;
+  WebSocketConnection *ws;
+  GIOStream *io_a;
+  GIOStream *io_b;
+  GPtrArray *channels;
+  gboolean init_received;
+  gboolean closed;
+};
+
+static gint opt_sessions = 4;
+static gint opt_duration = 10;
+static gint opt_warmup = 1;
+static gint opt_rate = 0;
+static gint opt_size = 64;
+static gint opt_metrics_interval = 100;
+static gchar *opt_mix = NULL;
+static gchar *opt_bridge = NULL;
+static gboolean opt_json = FALSE;
+
+static guint mix[N_BENCH_KINDS];
+static BenchStats stats[N_BENCH_KINDS];
+static GBytes *request_payload;
+
+static gboolean running = TRUE;
+static gboolean measuring = FALSE;
+static gint64 run_start;
+static gint64 measure_start;
+static gint64 measure_end;
+
+static gboolean
+parse_mix (const gchar *spec,
+           GError **error)
+{
+  gchar **parts;
+  gchar *end;
+  gboolean ret = FALSE;
+  guint64 count;
+  gint kind;
+  gint i;
+
+  memset (mix, 0, sizeof (mix));
+
+  parts = g_strsplit (spec, ",", -1);
+  for (i = 0; parts[i] != NULL; i++)
+    {
+      gchar *name = g_strstrip (parts[i]);
+      gchar *value = strchr (name, '=');
+
+      if (name[0] == '\0')
+        continue;
+
+      count = 1;
+      if (value)
+        {
+          *(value++) = '\0';
+          count = g_ascii_strtoull (value, &end, 10);
+          if (value[0] == '\0' || end[0] != '\0' || count > 64)
+            {
+              g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                           "invalid channel count in --mix: %s", value);
+              goto out;
+            }
+        }
+
+      for (kind = 0; kind < N_BENCH_KINDS; kind++)
+        {
+          if (g_str_equal (name, kind_names[kind]))
+            break;
+        }
+
+      if (kind == N_BENCH_KINDS)
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "unknown channel type in --mix: %s", name);
+          goto out;
+        }
+
+      mix[kind] += count;
+    }
+
+  for (kind = 0; kind < N_BENCH_KINDS; kind++)
+    {
+      if (mix[kind] > 0)
+        ret = TRUE;
+    }
+
+  if (!ret)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "no channels specified in --mix");
+    }
+
+out:
+  g_strfreev (parts);
+  return ret;
+}
+
+static GBytes *
+build_control (const gchar *command,
+               const gchar *channel,
+               JsonObject *options)
+{
+  GByteArray *buffer;
+  GBytes *bytes;
+  gchar *data;
+  gsize length;
+
+  json_object_set_string_member (options, "command", command);
+  if (channel)
+    json_object_set_string_member (options, "channel", channel);
+
+  data = cockpit_json_write_object (options, &length);
+
+  /* Control messages travel on the empty channel */
+  buffer = g_byte_array_sized_new (length + 1);
+  g_byte_array_append (buffer, (const guint8 *)"\n", 1);
+  g_byte_array_append (buffer, (const guint8 *)data, length);
+  bytes = g_byte_array_free_to_bytes (buffer);
+
+  g_free (data);
+  return bytes;
+}
+
+static void
+send_control (BenchSession *session,
+              const gchar *command,
+              const gchar *channel,
+              JsonObject *options)
+{
+  GBytes *message;
+
+  message = build_control (command, channel, options);
+  web_socket_connection_send (session->ws, WEB_SOCKET_DATA_TEXT, NULL, message);
+  g_bytes_unref (message);
+}
+
+static gboolean
+channel_send_request (BenchChannel *chan)
+{
+  GBytes *message;
+  gchar *call;
+
+  /* Metrics channels only ever send us samples */
+  if (chan->kind == BENCH_METRICS)
+    return FALSE;
+  if (!chan->ready || chan->closed || chan->n_pending == MAX_OUTSTANDING)
+    return FALSE;
+  if (web_socket_connection_get_ready_state (chan->session->ws) != WEB_SOCKET_STATE_OPEN)
+    return FALSE;
+
+  if (chan->kind == BENCH_DBUS)
+    {
+      call = g_strdup_printf ("{\"call\":[\"/\",\"org.freedesktop.DBus.Peer\",\"Ping\",[]],"
+                              "\"id\":\"%" G_GUINT64_FORMAT "\"}", chan->sent);
+      message = g_bytes_new_take (call, strlen (call));
+    }
+  else
+    {
+      message = g_bytes_ref (request_payload);
+    }
+
+  chan->sent_at[(chan->head + chan->n_pending) % MAX_OUTSTANDING] = g_get_monotonic_time ();
+  chan->n_pending++;
+  chan->sent++;
+
+  web_socket_connection_send (chan->session->ws, WEB_SOCKET_DATA_TEXT, chan->prefix, message);
+  g_bytes_unref (message);
+  return TRUE;
+}
+
+static void
+channel_complete (BenchChannel *chan,
+                  gboolean failed)
+{
+  BenchStats *st = &stats[chan->kind];
+  gint64 sent_at;
+  gint64 latency;
+
+  g_return_if_fail (chan->n_pending > 0);
+
+  sent_at = chan->sent_at[chan->head];
+  chan->head = (chan->head + 1) % MAX_OUTSTANDING;
+  chan->n_pending--;
+
+  /* Only requests that were sent inside the measuring window count */
+  if (measuring && sent_at >= measure_start)
+    {
+      if (failed)
+        {
+          st->errors++;
+        }
+      else
+        {
+          latency = g_get_monotonic_time () - sent_at;
+          g_array_append_val (st->latencies, latency);
+          st->requests++;
+        }
+    }
+
+  /* Closed loop: the next request goes out as soon as the reply is in */
+  if (opt_rate == 0 && running)
+    channel_send_request (chan);
+}
+
+static void
+channel_received (BenchChannel *chan,
+                  GBytes *payload)
+{
+  BenchStats *st = &stats[chan->kind];
+  gsize length = g_bytes_get_size (payload);
+  JsonObject *object;
+
+  if (measuring)
+    {
+      st->messages++;
+      st->bytes += length;
+    }
+
+  switch (chan->kind)
+    {
+    case BENCH_ECHO:
+    case BENCH_STREAM:
+      /* A stream may split or coalesce replies, so count bytes rather than messages */
+      chan->received += length;
+      while (chan->n_pending > 0 && chan->received >= (gsize)opt_size)
+        {
+          chan->received -= opt_size;
+          channel_complete (chan, FALSE);
+        }
+      break;
+
+    case BENCH_DBUS:
+      object = cockpit_json_parse_bytes (payload, NULL);
+      if (object && json_object_has_member (object, "id") && chan->n_pending > 0)
+        channel_complete (chan, !json_object_has_member (object, "reply"));
+      if (object)
+        json_object_unref (object);
+      break;
+
+    case BENCH_METRICS:
+    default:
+      break;
+    }
+}
+
+static void
+session_control (BenchSession *session,
+                 GBytes *payload)
+{
+  const gchar *command;
+  const gchar *channel;
+  const gchar *problem;
+  JsonObject *options;
+  BenchChannel *chan = NULL;
+  guint i;
+
+  if (!cockpit_transport_parse_command (payload, &command, &channel, &options))
+    return;
+
+  if (channel)
+    {
+      for (i = 0; i < session->channels->len; i++)
+        {
+          chan = session->channels->pdata[i];
+          if (g_str_equal (chan->id, channel))
+            break;
+          chan = NULL;
+        }
+    }
+
+  if (!chan)
+    {
+      /* Nothing of interest on the session itself */
+    }
+  else if (g_str_equal (command, "ready"))
+    {
+      if (!chan->ready)
+        {
+          chan->ready = TRUE;
+          if (opt_rate == 0)
+            channel_send_request (chan);
+        }
+    }
+  else if (g_str_equal (command, "close"))
+    {
+      if (!cockpit_json_get_string (options, "problem", NULL, &problem))
+        problem = NULL;
+      if (running && !chan->closed)
+        {
+          g_printerr ("bench-protocol: session %u: %s channel closed: %s\n", session->number,
+                      kind_names[chan->kind], problem ? problem : "no problem reported");
+          stats[chan->kind].errors++;
+        }
+      chan->closed = TRUE;
+    }
+
+  json_object_unref (options);
+}
+
+static void
+on_socket_message (WebSocketConnection *ws,
+                   WebSocketDataType type,
+                   GBytes *message,
+                   gpointer user_data)
+{
+  BenchSession *session = user_data;
+  BenchChannel *chan;
+  GBytes *payload;
+  gchar *channel = NULL;
+  guint i;
+
+  payload = cockpit_transport_parse_frame (message, &channel);
+  if (!payload)
+    return;
+
+  if (!channel)
+    {
+      session_control (session, payload);
+    }
+  else
+    {
+      for (i = 0; i < session->channels->len; i++)
+        {
+          chan = session->channels->pdata[i];
+          if (g_str_equal (chan->id, channel))
+            {
+              channel_received (chan, payload);
+              break;
+            }
+        }
+    }
+
+  g_free (channel);
+  g_bytes_unref (payload);
+}
+
+static gboolean
+on_socket_error (WebSocketConnection *ws,
+                 GError *error,
+                 gpointer user_data)
+{
+  BenchSession *session = user_data;
+  if (running)
+    g_printerr ("bench-protocol: session %u: %s\n", session->number, error->message);
+  return TRUE;
+}
+
+static void
+on_socket_close (WebSocketConnection *ws,
+                 gpointer user_data)
+{
+  BenchSession *session = user_data;
+  session->closed = TRUE;
+}
+
+static gboolean
+on_transport_control (CockpitTransport *transport,
+                      const char *command,
+                      const gchar *channel,
+                      JsonObject *options,
+                      GBytes *payload,
+                      gpointer user_data)
+{
+  BenchSession *session = user_data;
+
+  if (g_str_equal (command, "init"))
+    session->init_received = TRUE;
+
+  return FALSE;
+}
+
+static void
+on_transport_closed (CockpitTransport *transport,
+                     const gchar *problem,
+                     gpointer user_data)
+{
+  BenchSession *session = user_data;
+
+  if (running)
+    {
+      g_printerr ("bench-protocol: session %u: bridge exited: %s\n", session->number,
+                  problem ? problem : "disconnected");
+    }
+
+  session->closed = TRUE;
+}
+
+static void
+bench_channel_free (gpointer data)
+{
+  BenchChannel *chan = data;
+  g_bytes_unref (chan->prefix);
+  g_free (chan->id);
+  g_free (chan);
+}
+
+static BenchSession *
+bench_session_new (guint number,
+                   CockpitCreds *creds)
+{
+  BenchSession *session;
+  CockpitPipe *pipe;
+  GSocket *socket1, *socket2;
+  GError *error = NULL;
+  gulong handler;
+  int fds[2];
+
+  const gchar *argv[] = {
+      opt_bridge,
+      NULL
+  };
+
+  session = g_new0 (BenchSession, 1);
+  session->number = number;
+  session->channels = g_ptr_array_new_with_free_func (bench_channel_free);
+
+  pipe = cockpit_pipe_spawn (argv, NULL, NULL, COCKPIT_PIPE_FLAGS_NONE);
+  session->transport = cockpit_pipe_transport_new (pipe);
+  g_object_unref (pipe);
+
+  g_signal_connect (session->transport, "closed", G_CALLBACK (on_transport_closed), session);
+
+  session->service = cockpit_web_service_new (creds, session->transport);
+
+  /* Manually created services won't be init'd yet, wait for that before sending data */
+  handler = g_signal_connect (session->transport, "control", G_CALLBACK (on_transport_control), session);
+  while (!session->init_received && !session->closed)
+    g_main_context_iteration (NULL, TRUE);
+  g_signal_handler_disconnect (session->transport, handler);
+
+  if (session->closed)
+    {
+      g_printerr ("bench-protocol: couldn't start bridge: %s\n", opt_bridge);
+      exit (1);
+    }
+
+  if (socketpair (PF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    g_error ("couldn't create socket pair: %s", g_strerror (errno));
+
+  socket1 = g_socket_new_from_fd (fds[0], &error);
+  g_assert_no_error (error);
+  socket2 = g_socket_new_from_fd (fds[1], &error);
+  g_assert_no_error (error);
+
+  session->io_a = G_IO_STREAM (g_socket_connection_factory_create_connection (socket1));
+  session->io_b = G_IO_STREAM (g_socket_connection_factory_create_connection (socket2));
+
+  g_object_unref (socket1);
+  g_object_unref (socket2);
+
+  /* This is web_socket_client_new_for_stream() */
+  session->ws = g_object_new (WEB_SOCKET_TYPE_CLIENT,
+                              "url", "ws://127.0.0.1/unused",
+                              "origin", "http://127.0.0.1",
+                              "io-stream", session->io_a,
+                              NULL);
+
+  g_signal_connect (session->ws, "message", G_CALLBACK (on_socket_message), session);
+  g_signal_connect (session->ws, "error", G_CALLBACK (on_socket_error), session);
+  g_signal_connect (session->ws, "close", G_CALLBACK (on_socket_close), session);
+
+  cockpit_web_service_socket (session->service, "/unused", session->io_b, NULL, NULL, FALSE);
+
+  return session;
+}
+
+static void
+bench_session_open (BenchSession *session)
+{
+  BenchChannel *chan;
+  JsonObject *options;
+  JsonArray *array;
+  JsonObject *metric;
+  gint kind;
+  guint i;
+
+  options = json_object_new ();
+  json_object_set_int_member (options, "version", 1);
+  send_control (session, "init", NULL, options);
+  json_object_unref (options);
+
+  for (kind = 0; kind < N_BENCH_KINDS; kind++)
+    {
+      for (i = 0; i < mix[kind]; i++)
+        {
+          chan = g_new0 (BenchChannel, 1);
+          chan->session = session;
+          chan->kind = kind;
+          chan->id = g_strdup_printf ("%u", session->channels->len + 1);
+          chan->prefix = g_bytes_new_take (g_strdup_printf ("%s\n", chan->id), strlen (chan->id) + 1);
+          g_ptr_array_add (session->channels, chan);
+          stats[kind].channels++;
+
+          options = json_object_new ();
+          switch (kind)
+            {
+            case BENCH_ECHO:
+              json_object_set_string_member (options, "payload", "echo");
+              break;
+            case BENCH_STREAM:
+              json_object_set_string_member (options, "payload", "stream");
+              array = json_array_new ();
+              json_array_add_string_element (array, "cat");
+              json_object_set_array_member (options, "spawn", array);
+              break;
+            case BENCH_DBUS:
+              json_object_set_string_member (options, "payload", "dbus-json3");
+              json_object_set_string_member (options, "bus", "internal");
+              break;
+            case BENCH_METRICS:
+              json_object_set_string_member (options, "payload", "metrics1");
+              json_object_set_string_member (options, "source", "internal");
+              json_object_set_int_member (options, "interval", opt_metrics_interval);
+              array = json_array_new ();
+              metric = json_object_new ();
+              json_object_set_string_member (metric, "name", "cpu.basic.user");
+              json_object_set_string_member (metric, "derive", "rate");
+              json_array_add_object_element (array, metric);
+              json_object_set_array_member (options, "metrics", array);
+              break;
+            default:
+              g_assert_not_reached ();
+            }
+
+          send_control (session, "open", chan->id, options);
+          json_object_unref (options);
+        }
+    }
+}
+
+static void
+bench_session_free (BenchSession *session)
+{
+  g_signal_handlers_disconnect_by_data (session->ws, session);
+  g_signal_handlers_disconnect_by_data (session->transport, session);
+
+  if (web_socket_connection_get_ready_state (session->ws) < WEB_SOCKET_STATE_CLOSING)
+    web_socket_connection_close (session->ws, WEB_SOCKET_CLOSE_GOING_AWAY, NULL);
+  g_object_unref (session->ws);
+
+  cockpit_web_service_disconnect (session->service);
+  g_object_unref (session->service);
+
+  cockpit_transport_close (session->transport, NULL);
+  g_object_unref (session->transport);
+
+  g_object_unref (session->io_a);
+  g_object_unref (session->io_b);
+  g_ptr_array_free (session->channels, TRUE);
+  g_free (session);
+}
+
+static gboolean
+on_tick (gpointer user_data)
+{
+  GPtrArray *sessions = user_data;
+  BenchSession *session;
+  BenchChannel *chan;
+  guint64 due;
+  guint i, j;
+
+  if (!running)
+    return FALSE;
+
+  /* Open loop: keep each channel on schedule regardless of replies */
+  due = (g_get_monotonic_time () - run_start) * opt_rate / G_USEC_PER_SEC;
+
+  for (i = 0; i < sessions->len; i++)
+    {
+      session = sessions->pdata[i];
+      for (j = 0; j < session->channels->len; j++)
+        {
+          chan = session->channels->pdata[j];
+          while (chan->scheduled < due)
+            {
+              /* Don't fall behind schedule when too many replies are outstanding */
+              if (chan->ready && !chan->closed && chan->n_pending == MAX_OUTSTANDING)
+                {
+                  if (measuring)
+                    stats[chan->kind].skipped++;
+                }
+              else if (!channel_send_request (chan))
+                {
+                  break;
+                }
+              chan->scheduled++;
+            }
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+on_warmup_done (gpointer user_data)
+{
+  measure_start = g_get_monotonic_time ();
+  measuring = TRUE;
+  return FALSE;
+}
+
+static gboolean
+on_run_done (gpointer user_data)
+{
+  measure_end = g_get_monotonic_time ();
+  if (!measuring)
+    measure_start = measure_end;
+  measuring = FALSE;
+  running = FALSE;
+  return FALSE;
+}
+
+static gboolean
+on_signal_done (gpointer user_data)
+{
+  if (running)
+    on_run_done (NULL);
+  return TRUE;
+}
+
+static gint
+compare_latency (gconstpointer a,
+                 gconstpointer b)
+{
+  gint64 la = *(const gint64 *)a;
+  gint64 lb = *(const gint64 *)b;
+  return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+static gint64
+percentile (GArray *sorted,
+            guint percent)
+{
+  guint index;
+
+  if (sorted->len == 0)
+    return -1;
+
+  /* Nearest rank */
+  index = (sorted->len * percent + 99) / 100;
+  if (index > 0)
+    index--;
+  return g_array_index (sorted, gint64, index);
+}
+
+static void
+print_text (gdouble seconds)
+{
+  BenchStats *st;
+  gchar latency[3][16];
+  gint64 values[3];
+  gint kind;
+  gint i;
+
+  g_print ("sessions: %d, duration: %.1fs, rate: %s, size: %d, bridge: %s\n\n",
+           opt_sessions, seconds, opt_rate ? "open loop" : "closed loop",
+           opt_size, opt_bridge);
+  g_print ("%-8s %6s %10s %10s %10s %10s %10s %9s %9s %9s %7s %8s\n",
+           "channel", "chans", "requests", "req/s", "messages", "msg/s",
+           "KiB/s", "p50 ms", "p99 ms", "max ms", "errors", "skipped");
+
+  for (kind = 0; kind < N_BENCH_KINDS; kind++)
+    {
+      st = &stats[kind];
+      if (st->channels == 0)
+        continue;
+
+      values[0] = percentile (st->latencies, 50);
+      values[1] = percentile (st->latencies, 99);
+      values[2] = percentile (st->latencies, 100);
+      for (i = 0; i < 3; i++)
+        {
+          if (values[i] < 0)
+            g_strlcpy (latency[i], "-", sizeof (latency[i]));
+          else
+            g_snprintf (latency[i], sizeof (latency[i]), "%.3f", values[i] / 1000.0);
+        }
+
+      g_print ("%-8s %6u %10" G_GUINT64_FORMAT " %10.1f %10" G_GUINT64_FORMAT " %10.1f %10.1f %9s %9s %9s %7" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT "\n",
+               kind_names[kind], st->channels,
+               st->requests, st->requests / seconds,
+               st->messages, st->messages / seconds,
+               st->bytes / seconds / 1024.0,
+               latency[0], latency[1], latency[2], st->errors, st->skipped);
+    }
+}
+
+static void
+print_json (gdouble seconds)
+{
+  JsonObject *root;
+  JsonObject *results;
+  JsonObject *object;
+  JsonObject *latency;
+  BenchStats *st;
+  gchar *output;
+  gint kind;
+
+  root = json_object_new ();
+  json_object_set_int_member (root, "sessions", opt_sessions);
+  json_object_set_double_member (root, "duration", seconds);
+  json_object_set_int_member (root, "rate", opt_rate);
+  json_object_set_int_member (root, "size", opt_size);
+  json_object_set_string_member (root, "bridge", opt_bridge);
+
+  results = json_object_new ();
+  for (kind = 0; kind < N_BENCH_KINDS; kind++)
+    {
+      st = &stats[kind];
+      if (st->channels == 0)
+        continue;
+
+      object = json_object_new ();
+      json_object_set_int_member (object, "channels", st->channels);
+      json_object_set_int_member (object, "requests", st->requests);
+      json_object_set_double_member (object, "requests_per_sec", st->requests / seconds);
+      json_object_set_int_member (object, "messages", st->messages);
+      json_object_set_double_member (object, "messages_per_sec", st->messages / seconds);
+      json_object_set_double_member (object, "bytes_per_sec", st->bytes / seconds);
+      json_object_set_int_member (object, "errors", st->errors);
+      json_object_set_int_member (object, "skipped", st->skipped);
+
+      if (st->latencies->len > 0)
+        {
+          latency = json_object_new ();
+          json_object_set_int_member (latency, "p50", percentile (st->latencies, 50));
+          json_object_set_int_member (latency, "p99", percentile (st->latencies, 99));
+          json_object_set_int_member (latency, "max", percentile (st->latencies, 100));
+          json_object_set_object_member (object, "latency_usec", latency);
+        }
+      else
+        {
+          json_object_set_null_member (object, "latency_usec");
+        }
+
+      json_object_set_object_member (results, kind_names[kind], object);
+    }
+  json_object_set_object_member (root, "results", results);
+
+  output = cockpit_json_write_object (root, NULL);
+  g_print ("%s\n", output);
+  g_free (output);
+  json_object_unref (root);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GPtrArray *sessions;
+  BenchSession *session;
+  CockpitCreds *creds;
+  gboolean pending;
+  gint64 deadline;
+  gdouble seconds;
+  gchar *data;
+  gint ret = 0;
+  guint tick = 0;
+  guint sig_term;
+  guint sig_int;
+  gint kind;
+  gint i;
+
+  GOptionEntry entries[] = {
+    { "sessions", 0, 0, G_OPTION_ARG_INT, &opt_sessions, "Number of concurrent WebSocket sessions", "N" },
+    { "duration", 0, 0, G_OPTION_ARG_INT, &opt_duration, "Seconds to measure for", "SECONDS" },
+    { "warmup", 0, 0, G_OPTION_ARG_INT, &opt_warmup, "Seconds to run before measuring", "SECONDS" },
+    { "mix", 0, 0, G_OPTION_ARG_STRING, &opt_mix,
+      "Channels per session, eg: echo=2,stream,dbus,metrics", "MIX" },
+    { "rate", 0, 0, G_OPTION_ARG_INT, &opt_rate,
+      "Requests per second per channel, or 0 to send the next request once the reply arrives", "RATE" },
+    { "size", 0, 0, G_OPTION_ARG_INT, &opt_size, "Size of echo and stream requests in bytes", "BYTES" },
+    { "metrics-interval", 0, 0, G_OPTION_ARG_INT, &opt_metrics_interval,
+      "Sampling interval of metrics channels in milliseconds", "MSEC" },
+    { "bridge", 0, 0, G_OPTION_ARG_FILENAME, &opt_bridge, "Bridge to spawn for each session", "PATH" },
+    { "json", 0, 0, G_OPTION_ARG_NONE, &opt_json, "Print results as JSON", NULL },
+    { NULL }
+  };
+
+  signal (SIGPIPE, SIG_IGN);
+  /* avoid gvfs (http://bugzilla.gnome.org/show_bug.cgi?id=526454) */
+  g_setenv ("GIO_USE_VFS", "local", TRUE);
+
+  // System cockpit configuration file should not be loaded
+  cockpit_config_file = NULL;
+
+  context = g_option_context_new ("- benchmark the cockpit-ws and cockpit-bridge protocol");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error) ||
+      !parse_mix (opt_mix ? opt_mix : "echo,stream,dbus,metrics", &error))
+    {
+      g_printerr ("bench-protocol: %s\n", error->message);
+      exit (2);
+    }
+  g_option_context_free (context);
+
+  if (opt_sessions <= 0 || opt_duration <= 0 || opt_warmup < 0 || opt_rate < 0 ||
+      opt_size <= 0 || opt_metrics_interval <= 0)
+    {
+      g_printerr ("bench-protocol: invalid option value\n");
+      exit (2);
+    }
+
+  if (!opt_bridge)
+    opt_bridge = g_strdup (BUILDDIR "/cockpit-bridge");
+
+  data = g_malloc (opt_size);
+  memset (data, 'x', opt_size);
+  request_payload = g_bytes_new_take (data, opt_size);
+
+  for (kind = 0; kind < N_BENCH_KINDS; kind++)
+    stats[kind].latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  /* Matching the origin of the sessions below */
+  cockpit_ws_default_host_header = "127.0.0.1";
+
+  creds = cockpit_creds_new ("cockpit",
+                             COCKPIT_CRED_USER, g_get_user_name (),
+                             COCKPIT_CRED_CSRF_TOKEN, "bench-csrf-token",
+                             NULL);
+
+  sessions = g_ptr_array_new ();
+  for (i = 0; i < opt_sessions; i++)
+    g_ptr_array_add (sessions, bench_session_new (i + 1, creds));
+
+  /* Wait for all the WebSockets to finish their handshake */
+  do
+    {
+      pending = FALSE;
+      for (i = 0; i < opt_sessions; i++)
+        {
+          session = sessions->pdata[i];
+          if (web_socket_connection_get_ready_state (session->ws) == WEB_SOCKET_STATE_CONNECTING)
+            pending = TRUE;
+          else if (web_socket_connection_get_ready_state (session->ws) != WEB_SOCKET_STATE_OPEN)
+            {
+              g_printerr ("bench-protocol: session %u: couldn't connect WebSocket\n", session->number);
+              exit (1);
+            }
+        }
+      if (pending)
+        g_main_context_iteration (NULL, TRUE);
+    }
+  while (pending);
+
+  sig_term = g_unix_signal_add (SIGTERM, on_signal_done, NULL);
+  sig_int = g_unix_signal_add (SIGINT, on_signal_done, NULL);
+
+  run_start = g_get_monotonic_time ();
+  for (i = 0; i < opt_sessions; i++)
+    bench_session_open (sessions->pdata[i]);
+
+  if (opt_rate > 0)
+    tick = g_timeout_add (TICK_INTERVAL, on_tick, sessions);
+  if (opt_warmup > 0)
+    g_timeout_add_seconds (opt_warmup, on_warmup_done, NULL);
+  else
+    on_warmup_done (NULL);
+  g_timeout_add_seconds (opt_warmup + opt_duration, on_run_done, NULL);
+
+  while (running)
+    g_main_context_iteration (NULL, TRUE);
+
+  if (tick)
+    g_source_remove (tick);
+  g_source_remove (sig_term);
+  g_source_remove (sig_int);
+
+  for (kind = 0; kind < N_BENCH_KINDS; kind++)
+    g_array_sort (stats[kind].latencies, compare_latency);
+
+  seconds = (measure_end - measure_start) / (gdouble)G_USEC_PER_SEC;
+  if (seconds <= 0)
+    {
+      g_printerr ("bench-protocol: interrupted before measuring started\n");
+      ret = 1;
+    }
+  else if (opt_json)
+    {
+      print_json (seconds);
+    }
+  else
+    {
+      print_text (seconds);
+    }
+
+  for (i = 0; i < opt_sessions; i++)
+    bench_session_free (sessions->pdata[i]);
+  g_ptr_array_free (sessions, TRUE);
+
+  /* Give the bridges a moment to see their pipes close */
+  deadline = g_get_monotonic_time () + G_USEC_PER_SEC;
+  while (g_main_context_pending (NULL) && g_get_monotonic_time () < deadline)
+    g_main_context_iteration (NULL, FALSE);
+
+  for (kind = 0; kind < N_BENCH_KINDS; kind++)
+    g_array_free (stats[kind].latencies, TRUE);
+
+  cockpit_creds_unref (creds);
+  g_bytes_unref (request_payload);
+  g_free (opt_bridge);
+  g_free (opt_mix);
+  return ret;
+}
@@ -35,8 +35,8 @@
 #include "common/cockpitmemory.h"
 #include "common/cockpitpipe.h"
 #include "common/cockpitpipetransport.h"
+#include "common/cockpitspawn.h"
 #include "common/cockpitsystem.h"
-#include "common/cockpitunixfd.h"
 #include "common/cockpitwebserver.h"
 
 #include <security/pam_appl.h>
@@ -83,7 +83,8 @@ get_process_idle (void)
     {
       const char *val = g_getenv ("COCKPIT_WS_PROCESS_IDLE");
 
-      seconds = 90; /* default value */
+      /* How long an instance without any session lingers */
+      seconds = cockpit_conf_uint ("WebService", "InstanceIdleTimeout", 90, G_MAXUINT, 1);
       if (val)
         {
           char *endptr;
@@ -483,31 +484,6 @@ application_cookie_name (const gchar *application)
   return cookie_name;
 }
 
-/* Struct for adding tty later */
-typedef struct {
-  int io;
-} ChildData;
-
-static void
-session_child_setup (gpointer data)
-{
-  ChildData *child = data;
-
-  if (dup2 (child->io, 0) < 0 || dup2 (child->io, 1) < 0)
-    {
-      g_printerr ("couldn't set child stdin/stout file descriptors\n");
-      _exit (127);
-    }
-
-  close (child->io);
-
-  if (cockpit_unix_fd_close_all (3, -1) < 0)
-    {
-      g_printerr ("couldn't close file descriptors: %m\n");
-      _exit (127);
-    }
-}
-
 static CockpitTransport *
 session_start_process (const gchar **argv,
                        const gchar **env)
@@ -515,9 +491,9 @@ session_start_process (const gchar **argv,
   CockpitTransport *transport = NULL;
   CockpitPipe *pipe = NULL;
   GError *error = NULL;
-  ChildData child;
   gboolean ret;
   GPid pid = 0;
+  int remap[3] = { -1, -1, -1 };
   int fds[2];
 
   g_debug ("spawning %s", argv[0]);
@@ -529,11 +505,10 @@ session_start_process (const gchar **argv,
       return NULL;
     }
 
-  child.io = fds[0];
-  ret = g_spawn_async_with_pipes (NULL, (gchar **)argv, (gchar **)env,
-                                  G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_LEAVE_DESCRIPTORS_OPEN,
-                                  session_child_setup, &child,
-                                  &pid, NULL, NULL, NULL, &error);
+  /* The socket becomes stdin and stdout, stderr is inherited */
+  remap[0] = remap[1] = fds[0];
+  ret = cockpit_spawn (argv, env, NULL, remap, G_N_ELEMENTS (remap),
+                       COCKPIT_SPAWN_DEFAULT, &pid, &error);
 
   close (fds[0]);
 
@@ -1146,6 +1121,10 @@ cockpit_session_launch (CockpitAuth *self,
 
   session = cockpit_session_create (self, argv[0], creds, transport);
 
+  /* cockpit-session runs the bridge right on the other end of the socket */
+  if (g_str_equal (command, cockpit_ws_session_program))
+    cockpit_web_service_set_offer_shm (session->service, TRUE);
+
   /* How long to wait for the auth process to send some data */
   session->authorize_timeout = timeout_option ("timeout", section, cockpit_ws_auth_process_timeout);
 
@@ -1344,6 +1323,7 @@ cockpit_auth_local_async (CockpitAuth *self,
                              NULL);
 
   session = cockpit_session_create (self, cockpit_pipe_get_name (pipe), creds, transport);
+  cockpit_web_service_set_offer_shm (session->service, TRUE);
 
   session->cookie = g_strdup (LOCAL_SESSION);
   g_hash_table_insert (self->sessions, session->cookie, session);
@@ -23,12 +23,20 @@
 
 #include "common/cockpitchannel.h"
 #include "common/cockpitflow.h"
+#include "common/cockpitwebdeflate.h"
 #include "common/cockpitwebinject.h"
 #include "common/cockpitwebserver.h"
 #include "common/cockpitwebresponse.h"
 
 #include <string.h>
 
+/*
+ * Streamed responses are compressed as they pass through, so favour
+ * speed over size. Below the minimum the framing eats the gain.
+ */
+#define DEFLATE_LEVEL    1
+#define DEFLATE_MINIMUM  1024
+
 typedef struct {
   CockpitWebService *service;
   gchar *base_path;
@@ -68,12 +76,21 @@ cockpit_channel_inject_update_checksum (CockpitChannelInject *inject,
                                         GHashTable *headers)
 {
   const gchar *checksum = g_hash_table_lookup (headers, COCKPIT_CHECKSUM_HEADER);
+  const gchar *package_checksums = g_hash_table_lookup (headers, COCKPIT_PACKAGE_CHECKSUMS_HEADER);
 
   if (checksum)
     cockpit_web_service_set_host_checksum (inject->service, inject->host, checksum);
 
   /* No need to send our custom header outside of cockpit */
   g_hash_table_remove (headers, COCKPIT_CHECKSUM_HEADER);
+
+  /* But do tell the shell which of the package checksums it can actually use */
+  if (package_checksums)
+    {
+      cockpit_web_service_set_host_package_checksums (inject->service, inject->host, package_checksums);
+      g_hash_table_replace (headers, g_strdup (COCKPIT_PACKAGE_CHECKSUMS_HEADER),
+                            cockpit_web_service_get_package_routes (inject->service, inject->host));
+    }
 }
 
 static void
@@ -144,6 +161,9 @@ typedef struct {
 
   /* Set when injecting data into response */
   CockpitChannelInject *inject;
+
+  /* Set when the client accepts a compressed response */
+  const gchar *encoding;
 } CockpitChannelResponse;
 
 typedef struct {
@@ -172,11 +192,42 @@ cockpit_channel_response_finalize (GObject *object)
   G_OBJECT_CLASS (cockpit_channel_response_parent_class)->finalize (object);
 }
 
+static void
+maybe_compress (CockpitChannelResponse *self,
+                guint status,
+                gssize *length)
+{
+  CockpitWebFilter *filter;
+  const gchar *vary;
+
+  if (status != 200)
+    return;
+  if (*length >= 0 && *length < DEFLATE_MINIMUM)
+    return;
+  if (g_hash_table_lookup (self->headers, "Content-Encoding"))
+    return;
+  if (!cockpit_web_deflate_is_compressible (g_hash_table_lookup (self->headers, "Content-Type")))
+    return;
+
+  filter = cockpit_web_deflate_new (self->encoding, DEFLATE_LEVEL);
+  g_return_if_fail (filter != NULL);
+  cockpit_web_response_add_filter (self->response, filter);
+  g_object_unref (filter);
+
+  g_hash_table_replace (self->headers, g_strdup ("Content-Encoding"), g_strdup (self->encoding));
+  vary = g_hash_table_lookup (self->headers, "Vary");
+  g_hash_table_replace (self->headers, g_strdup ("Vary"),
+                        vary ? g_strdup_printf ("%s, Accept-Encoding", vary) : g_strdup ("Accept-Encoding"));
+
+  /* The length is now unknown */
+  *length = -1;
+}
+
 static gboolean
 ensure_headers (CockpitChannelResponse *self,
                 guint status,
                 const gchar *reason,
-                gsize length)
+                gssize length)
 {
 
   if (cockpit_web_response_get_state (self->response) == COCKPIT_WEB_RESPONSE_READY)
@@ -187,6 +238,8 @@ ensure_headers (CockpitChannelResponse *self,
           cockpit_channel_inject_perform (self->inject, self->response,
                                           cockpit_channel_get_transport (COCKPIT_CHANNEL (self)));
         }
+      if (self->encoding)
+        maybe_compress (self, status, &length);
       cockpit_web_response_headers_full (self->response, status, reason, length, self->headers);
       return TRUE;
     }
@@ -505,13 +558,50 @@ is_resource_a_package_file (const gchar *path)
   return path && path[0] && strchr (path + 1, '/') != NULL;
 }
 
+static gboolean
+parse_package_checksum (CockpitWebService *service,
+                        const gchar *checksum,
+                        const gchar *path,
+                        const gchar **host,
+                        gchar **redirect)
+{
+  const gchar *expected;
+  GHashTable *checksums;
+  gchar *package;
+
+  /*
+   * A per-package checksum only describes the files of that one package.
+   * Relative links from there into other packages, such as "../base1/cockpit.js",
+   * still arrive with it, so send those on to the right checksum for the package.
+   */
+  *host = cockpit_web_service_get_package_host (service, checksum);
+  if (!*host || !is_resource_a_package_file (path))
+    return FALSE;
+
+  package = g_strndup (path + 1, strcspn (path + 1, "/"));
+  checksums = cockpit_web_service_get_package_checksums (service, *host);
+  expected = checksums ? g_hash_table_lookup (checksums, package) : NULL;
+  g_free (package);
+
+  if (g_strcmp0 (expected, checksum) != 0)
+    {
+      if (expected)
+        *redirect = g_strdup_printf ("$%s%s", expected, path);
+      else
+        *redirect = g_strdup_printf ("@%s%s", *host, path);
+    }
+
+  return TRUE;
+}
+
 static gboolean
 parse_host_and_etag (CockpitWebService *service,
                      GHashTable *headers,
                      const gchar *where,
                      const gchar *path,
                      const gchar **host,
-                     gchar **etag)
+                     gchar **etag,
+                     gchar **redirect)
 {
   gchar **languages = NULL;
   gboolean translatable;
@@ -522,16 +612,17 @@ parse_host_and_etag (CockpitWebService *service,
   if (language)
     g_hash_table_replace (headers, g_strdup ("Accept-Language"), language);
 
+  *etag = NULL;
+  *redirect = NULL;
+
   if (!where)
     {
       *host = "localhost";
-      *etag = NULL;
       return TRUE;
     }
   if (where[0] == '@')
     {
       *host = where + 1;
-      *etag = NULL;
       return TRUE;
     }
 
@@ -540,7 +631,12 @@ parse_host_and_etag (CockpitWebService *service,
 
   *host = cockpit_web_service_get_host (service, where + 1);
   if (!*host)
-    return FALSE;
+    {
+      if (!parse_package_checksum (service, where + 1, path, host, redirect))
+        return FALSE;
+      if (*redirect)
+        return TRUE;
+    }
 
   /* Top level resources (like the /manifests) are not translatable */
   translatable = is_resource_a_package_file (path);
@@ -573,6 +669,8 @@ cockpit_channel_response_serve (CockpitWebService *service,
   const gchar *host = NULL;
   const gchar *pragma;
   gchar *quoted_etag = NULL;
+  gchar *redirect = NULL;
+  gchar *location;
   GHashTable *out_headers = NULL;
   gchar *val = NULL;
   gboolean handled = FALSE;
@@ -591,19 +689,37 @@ cockpit_channel_response_serve (CockpitWebService *service,
   g_return_if_fail (path != NULL);
 
   /* Where might be NULL, but that's still valid */
-  if (!parse_host_and_etag (service, in_headers, where, path, &host, &quoted_etag))
+  if (!parse_host_and_etag (service, in_headers, where, path, &host, &quoted_etag, &redirect))
     {
       /* Did not recognize the where */
       goto out;
     }
 
+  if (redirect)
+    {
+      location = g_strdup_printf ("%s/cockpit/%s",
+                                  cockpit_web_response_get_url_root (response) ?: "",
+                                  redirect);
+      cockpit_web_response_set_cache_type (response, COCKPIT_WEB_RESPONSE_NO_CACHE);
+      cockpit_web_response_headers (response, 307, "Temporary Redirect", 0, "Location", location, NULL);
+      cockpit_web_response_complete (response);
+      g_free (location);
+      handled = TRUE;
+      goto out;
+    }
+
   if (quoted_etag)
     {
       cache_type = COCKPIT_WEB_RESPONSE_CACHE_FOREVER;
       pragma = g_hash_table_lookup (in_headers, "Pragma");
 
+      /*
+       * We learn the per-package checksums of a host from its manifests, so
+       * let those through to the bridge until we know them.
+       */
       if ((!pragma || !strstr (pragma, "no-cache")) &&
-           g_strcmp0 (g_hash_table_lookup (in_headers, "If-None-Match"), quoted_etag) == 0)
+           g_strcmp0 (g_hash_table_lookup (in_headers, "If-None-Match"), quoted_etag) == 0 &&
+          (is_resource_a_package_file (path) || cockpit_web_service_get_package_checksums (service, host)))
         {
           cockpit_web_response_headers (response, 304, "Not Modified", 0, "ETag", quoted_etag, NULL);
           cockpit_web_response_complete (response);
@@ -700,6 +816,7 @@ out:
   if (object)
     json_object_unref (object);
   g_free (quoted_etag);
+  g_free (redirect);
   if (out_headers)
     g_hash_table_unref (out_headers);
   g_free (channel);
@@ -764,6 +881,7 @@ cockpit_channel_response_open (CockpitWebService *service,
   json_object_remove_member (open, "external");
 
   self = cockpit_channel_response_new (service, response, transport, headers, open);
+  self->encoding = cockpit_web_deflate_negotiate (in_headers);
   g_hash_table_unref (headers);
 
   /* Unref when the channel closes */
@@ -36,6 +36,7 @@
 #include "common/cockpitjson.h"
 #include "common/cockpitlog.h"
 #include "common/cockpitmemory.h"
+#include "common/cockpitpipetransport.h"
 #include "common/cockpitsystem.h"
 #include "common/cockpitwebresponse.h"
 #include "common/cockpitwebserver.h"
@@ -52,6 +53,9 @@ const gchar *cockpit_ws_default_protocol_header = NULL;
 
 guint cockpit_ws_ping_interval = 5;
 
+/* Size of each direction of the shared memory with a local bridge */
+#define SHM_RING_SIZE (1024 * 1024)
+
 /* ----------------------------------------------------------------------------
  * Web Socket Info
  */
@@ -219,9 +223,12 @@ struct _CockpitWebService {
   gulong recv_sig;
   gulong closed_sig;
   gboolean sent_done;
+  gboolean offer_shm;
 
   GHashTable *checksum_by_host;
   GHashTable *host_by_checksum;
+  GHashTable *package_checksums_by_host;
+  GHashTable *host_by_package_checksum;
 };
 
 typedef struct {
@@ -291,6 +298,8 @@ cockpit_web_service_finalize (GObject *object)
 
   g_hash_table_destroy (self->host_by_checksum);
   g_hash_table_destroy (self->checksum_by_host);
+  g_hash_table_destroy (self->host_by_package_checksum);
+  g_hash_table_destroy (self->package_checksums_by_host);
 
   G_OBJECT_CLASS (cockpit_web_service_parent_class)->finalize (object);
 }
@@ -614,6 +623,21 @@ process_transport_authorize (CockpitWebService *self,
   return TRUE;
 }
 
+static gboolean
+bridge_has_capability (JsonObject *options,
+                       const gchar *capability)
+{
+  gchar **capabilities = NULL;
+  gboolean ret;
+
+  if (!cockpit_json_get_strv (options, "capabilities", NULL, &capabilities) || !capabilities)
+    return FALSE;
+
+  ret = g_strv_contains ((const gchar * const *)capabilities, capability);
+  g_free (capabilities);
+  return ret;
+}
+
 static const gchar *
 process_transport_init (CockpitWebService *self,
                         CockpitTransport *transport,
@@ -644,6 +668,11 @@ process_transport_init (CockpitWebService *self,
       json_object_unref (object);
       cockpit_transport_send (transport, NULL, payload);
       g_bytes_unref (payload);
+
+      /* A bridge on this machine can skip the socket, see cockpit_pipe_transport_offer_shm() */
+      if (self->offer_shm && COCKPIT_IS_PIPE_TRANSPORT (transport) &&
+          bridge_has_capability (options, "shm"))
+        cockpit_pipe_transport_offer_shm (COCKPIT_PIPE_TRANSPORT (transport), SHM_RING_SIZE);
     }
   else
     {
@@ -684,6 +713,12 @@ on_transport_control (CockpitTransport *transport,
         {
           valid = process_transport_authorize (self, transport, options);
         }
+      else if (g_strcmp0 (command, "shm-ready") == 0)
+        {
+          /* Only seen here when the offer was already given up on */
+          g_message ("bridge answered shared memory offer too late");
+          valid = FALSE;
+        }
       else
         {
           g_debug ("received a %s unknown control command", command);
@@ -1252,6 +1287,9 @@ cockpit_web_service_init (CockpitWebService *self)
   self->ping_timeout = g_timeout_add_seconds (cockpit_ws_ping_interval, on_ping_time, self);
   self->host_by_checksum = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
   self->checksum_by_host = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->host_by_package_checksum = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->package_checksums_by_host = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                           (GDestroyNotify)g_hash_table_unref);
 }
 
 static void
@@ -1301,6 +1339,24 @@ cockpit_web_service_new (CockpitCreds *creds,
   return self;
 }
 
+/**
+ * cockpit_web_service_set_offer_shm:
+ * @self: the web service
+ * @offer: whether to offer shared memory
+ *
+ * Set when the transport goes straight to a bridge on this
+ * machine, and the bridge may be offered shared memory rings
+ * in place of the socket. Must be set before the bridge sends
+ * its "init" message.
+ */
+void
+cockpit_web_service_set_offer_shm (CockpitWebService *self,
+                                   gboolean offer)
+{
+  g_return_if_fail (COCKPIT_IS_WEB_SERVICE (self));
+  self->offer_shm = offer;
+}
+
 WebSocketConnection *
 cockpit_web_service_create_socket (const gchar **protocols,
                                    const gchar *path,
@@ -1510,3 +1566,171 @@ cockpit_web_service_set_host_checksum (CockpitWebService *self,
 
   g_hash_table_replace (self->checksum_by_host, g_strdup (host), g_strdup (checksum));
 }
+
+const gchar *
+cockpit_web_service_get_package_host (CockpitWebService *self,
+                                      const gchar *checksum)
+{
+  return g_hash_table_lookup (self->host_by_package_checksum, checksum);
+}
+
+GHashTable *
+cockpit_web_service_get_package_checksums (CockpitWebService *self,
+                                           const gchar *host)
+{
+  return g_hash_table_lookup (self->package_checksums_by_host, host);
+}
+
+static gboolean
+same_package_checksums (GHashTable *one,
+                        GHashTable *two)
+{
+  GHashTableIter iter;
+  gpointer package;
+  gpointer checksum;
+
+  if (!one || !two || g_hash_table_size (one) != g_hash_table_size (two))
+    return FALSE;
+
+  g_hash_table_iter_init (&iter, one);
+  while (g_hash_table_iter_next (&iter, &package, &checksum))
+    {
+      if (g_strcmp0 (g_hash_table_lookup (two, package), checksum) != 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Whether "$<checksum>" URLs end up at the packages of this host. Relative
+ * URLs into other packages are resolved against the host the route points
+ * to, so hosts only share a route when all of their packages are the same.
+ */
+static gboolean
+has_package_route (CockpitWebService *self,
+                   const gchar *checksum,
+                   const gchar *host)
+{
+  const gchar *route_host = g_hash_table_lookup (self->host_by_package_checksum, checksum);
+
+  if (!route_host)
+    return FALSE;
+  if (g_str_equal (route_host, host))
+    return TRUE;
+
+  return same_package_checksums (g_hash_table_lookup (self->package_checksums_by_host, route_host),
+                                 g_hash_table_lookup (self->package_checksums_by_host, host));
+}
+
+static void
+route_package_checksum (CockpitWebService *self,
+                        const gchar *checksum,
+                        const gchar *host)
+{
+  const gchar *old_host = g_hash_table_lookup (self->host_by_package_checksum, checksum);
+
+  /* Otherwise whoever was first keeps it, but prefer localhost among identical hosts */
+  if (!old_host || (g_strcmp0 (old_host, "localhost") != 0 && g_strcmp0 (host, "localhost") == 0 &&
+                    has_package_route (self, checksum, host)))
+    g_hash_table_replace (self->host_by_package_checksum, g_strdup (checksum), g_strdup (host));
+}
+
+/*
+ * The value is the COCKPIT_PACKAGE_CHECKSUMS_HEADER sent by the bridge
+ * along with the manifests: a space separated list of package=checksum
+ */
+void
+cockpit_web_service_set_host_package_checksums (CockpitWebService *self,
+                                                const gchar *host,
+                                                const gchar *value)
+{
+  GHashTable *old_checksums;
+  GHashTable *checksums;
+  GHashTableIter iter;
+  GHashTableIter other;
+  gpointer package;
+  gpointer checksum;
+  gpointer other_host;
+  gpointer other_checksums;
+  gchar **parts;
+  gchar *eq;
+  gint i;
+
+  checksums = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  parts = g_strsplit (value, " ", -1);
+  for (i = 0; parts[i] != NULL; i++)
+    {
+      eq = strchr (parts[i], '=');
+      if (!eq || eq == parts[i] || eq[1] == '\0')
+        continue;
+      *eq = '\0';
+      g_hash_table_replace (checksums, g_strdup (parts[i]), g_strdup (eq + 1));
+    }
+  g_strfreev (parts);
+
+  /* Drop the routes of the old checksums, and let other hosts claim them */
+  old_checksums = g_hash_table_lookup (self->package_checksums_by_host, host);
+  if (old_checksums)
+    {
+      g_hash_table_iter_init (&iter, old_checksums);
+      while (g_hash_table_iter_next (&iter, &package, &checksum))
+        {
+          if (g_strcmp0 (g_hash_table_lookup (self->host_by_package_checksum, checksum), host) != 0)
+            continue;
+          g_hash_table_remove (self->host_by_package_checksum, checksum);
+
+          g_hash_table_iter_init (&other, self->package_checksums_by_host);
+          while (g_hash_table_iter_next (&other, &other_host, &other_checksums))
+            {
+              if (!g_str_equal (other_host, host) &&
+                  g_strcmp0 (g_hash_table_lookup (other_checksums, package), checksum) == 0)
+                route_package_checksum (self, checksum, other_host);
+            }
+        }
+    }
+
+  g_hash_table_replace (self->package_checksums_by_host, g_strdup (host), checksums);
+
+  g_hash_table_iter_init (&iter, checksums);
+  while (g_hash_table_iter_next (&iter, &package, &checksum))
+    route_package_checksum (self, checksum, host);
+}
+
+/**
+ * cockpit_web_service_get_package_routes:
+ * @self: the web service
+ * @host: the host the manifests came from
+ *
+ * Returns: (transfer full): the per-package checksums of @host that
+ * can be used in URLs, in the same format as the
+ * COCKPIT_PACKAGE_CHECKSUMS_HEADER from the bridge
+ */
+gchar *
+cockpit_web_service_get_package_routes (CockpitWebService *self,
+                                        const gchar *host)
+{
+  GHashTable *checksums;
+  GString *value;
+  GList *packages, *l;
+  const gchar *checksum;
+
+  value = g_string_new ("");
+  checksums = g_hash_table_lookup (self->package_checksums_by_host, host);
+  if (!checksums)
+    return g_string_free (value, FALSE);
+
+  packages = g_list_sort (g_hash_table_get_keys (checksums), (GCompareFunc)strcmp);
+  for (l = packages; l != NULL; l = g_list_next (l))
+    {
+      checksum = g_hash_table_lookup (checksums, l->data);
+      if (!has_package_route (self, checksum, host))
+        continue;
+      if (value->len)
+        g_string_append_c (value, ' ');
+      g_string_append_printf (value, "%s=%s", (gchar *)l->data, checksum);
+    }
+  g_list_free (packages);
+
+  return g_string_free (value, FALSE);
+}
@@ -43,6 +43,9 @@ CockpitWebService *  cockpit_web_service_new         (CockpitCreds *creds,
 
 void                 cockpit_web_service_disconnect  (CockpitWebService *self);
 
+void                 cockpit_web_service_set_offer_shm (CockpitWebService *self,
+                                                        gboolean offer);
+
 void                 cockpit_web_service_socket      (CockpitWebService *self,
                                                       const gchar *path,
                                                       GIOStream *io_stream,
@@ -89,6 +92,19 @@ void                    cockpit_web_service_set_host_checksum       (CockpitWebS
                                                                      const gchar *host,
                                                                      const gchar *checksum);
 
+const gchar *           cockpit_web_service_get_package_host (CockpitWebService *self,
+                                                              const gchar *checksum);
+
+GHashTable *            cockpit_web_service_get_package_checksums (CockpitWebService *self,
+                                                                   const gchar *host);
+
+void                    cockpit_web_service_set_host_package_checksums (CockpitWebService *self,
+                                                                        const gchar *host,
+                                                                        const gchar *value);
+
+gchar *                 cockpit_web_service_get_package_routes (CockpitWebService *self,
+                                                                const gchar *host);
+
 G_END_DECLS
 
 #endif /* __COCKPIT_WEB_SERVICE_H__ */
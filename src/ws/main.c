@@ -32,6 +32,7 @@
 #include "cockpithandlers.h"
 #include "cockpitbranding.h"
 
+#include "common/cockpitassetpack.h"
 #include "common/cockpitassets.h"
 #include "common/cockpitconf.h"
 #include "common/cockpitlog.h"
@@ -39,6 +40,9 @@
 #include "common/cockpitsystem.h"
 #include "common/cockpittest.h"
 
+/* Shared by all instances, built by root when cockpit.service starts */
+#define ASSET_PACK_DIR "/run/cockpit/assets"
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 static gint      opt_port         = 9090;
@@ -49,6 +53,7 @@ static gboolean  opt_proxy_tls_redirect = FALSE;
 static gboolean  opt_local_ssh    = FALSE;
 static gchar     *opt_local_session = NULL;
 static gboolean  opt_version      = FALSE;
+static gboolean  opt_build_assets = FALSE;
 
 static GOptionEntry cmd_entries[] = {
   {"port", 'p', 0, G_OPTION_ARG_INT, &opt_port, "Local port to bind to (9090 if unset)", NULL},
@@ -65,6 +70,8 @@ static GOptionEntry cmd_entries[] = {
       "Launch a bridge in the local session (path to cockpit-bridge or '-' for stdin/out); implies --no-tls",
       "BRIDGE" },
   {"version", 0, 0, G_OPTION_ARG_NONE, &opt_version, "Print version information", NULL },
+  {"build-assets", 0, 0, G_OPTION_ARG_NONE, &opt_build_assets,
+      "Build the shared pack of static files and exit", NULL },
   {NULL}
 };
 
@@ -171,6 +178,15 @@ main (int argc,
       goto out;
     }
 
+  if (opt_build_assets)
+    {
+      data.os_release = cockpit_system_load_os_release ();
+      roots = setup_static_roots (data.os_release);
+      if (cockpit_asset_pack_build (ASSET_PACK_DIR, (const gchar **)roots, &error))
+        ret = 0;
+      goto out;
+    }
+
   if (opt_for_tls_proxy)
     opt_no_tls = TRUE;
 
@@ -208,6 +224,14 @@ main (int argc,
   data.auth = cockpit_auth_new (opt_local_ssh, opt_for_tls_proxy ? COCKPIT_AUTH_FOR_TLS_PROXY : COCKPIT_AUTH_NONE);
   roots = setup_static_roots (data.os_release);
 
+  /* Not having a pack is fine, files are then read from disk */
+  cockpit_web_asset_pack = cockpit_asset_pack_open (ASSET_PACK_DIR, (const gchar **)roots, &error);
+  if (error)
+    {
+      g_message ("%s", error->message);
+      g_clear_error (&error);
+    }
+
   data.branding_roots = (const gchar **)roots;
   login_html = g_strdup (DATADIR "/cockpit/static/login.html");
   data.login_html = (const gchar *)login_html;
@@ -319,6 +343,8 @@ out:
   g_clear_object (&data.auth);
   if (data.os_release)
     g_hash_table_unref (data.os_release);
+  cockpit_asset_pack_free (cockpit_web_asset_pack);
+  cockpit_web_asset_pack = NULL;
   g_free (opt_address);
   g_free (opt_local_session);
   cockpit_conf_cleanup ();
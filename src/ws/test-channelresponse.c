@@ -783,6 +783,113 @@ test_resource_not_modified_cookie_language (TestResourceCase *tc,
   g_object_unref (response);
 }
 
+static void
+test_resource_package_checksum (TestResourceCase *tc,
+                                gconstpointer data)
+{
+  CockpitWebResponse *response;
+  GError *error = NULL;
+  GBytes *bytes;
+  gconstpointer str;
+  const gchar *expected = "HTTP/1.1 200 OK\r\n"
+    STATIC_HEADERS
+    "ETag: \"$0123abcd-c\"\r\n"
+    "Cache-Control: max-age=31556926, public\r\n"
+    "\r\n";
+
+  cockpit_web_service_set_host_package_checksums (tc->service, "localhost",
+                                                  "another=4567cdef test=0123abcd");
+
+  response = cockpit_web_response_new (tc->io, "/unused", "/unused", NULL, NULL, COCKPIT_WEB_RESPONSE_NONE);
+  cockpit_channel_response_serve (tc->service, tc->headers, response,
+                                  "$0123abcd", "/test/sub/file.ext");
+
+  while (cockpit_web_response_get_state (response) != COCKPIT_WEB_RESPONSE_SENT)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (G_OUTPUT_STREAM (tc->output), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (tc->output);
+  str = g_bytes_get_data (bytes, NULL);
+  g_assert (str_contains_strv (str, expected, "\n"));
+  cockpit_assert_strmatch (str,
+                           "*\r\n"
+                           "32\r\n"
+                           "These are the contents of file.ext\nOh marmalaaade\n"
+                           "\r\n"
+                           "0\r\n\r\n");
+
+  g_bytes_unref (bytes);
+  g_object_unref (response);
+}
+
+static void
+test_resource_package_checksum_redirect (TestResourceCase *tc,
+                                         gconstpointer data)
+{
+  CockpitWebResponse *response;
+  GError *error = NULL;
+  GBytes *bytes;
+  const gchar *expected = "HTTP/1.1 307 Temporary Redirect\r\n"
+    "Location: /cockpit/$4567cdef/another/test.html\r\n"
+    "Cache-Control: no-cache, no-store\r\n"
+    STATIC_HEADERS
+    "\r\n";
+
+  cockpit_web_service_set_host_package_checksums (tc->service, "localhost",
+                                                  "another=4567cdef test=0123abcd");
+
+  /* Another package relative to the checksum of "test" */
+  response = cockpit_web_response_new (tc->io, "/unused", "/unused", NULL, NULL, COCKPIT_WEB_RESPONSE_NONE);
+  cockpit_channel_response_serve (tc->service, tc->headers, response,
+                                  "$0123abcd", "/another/test.html");
+
+  while (cockpit_web_response_get_state (response) != COCKPIT_WEB_RESPONSE_SENT)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (G_OUTPUT_STREAM (tc->output), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (tc->output);
+  g_assert (str_contains_strv (g_bytes_get_data (bytes, NULL), expected, "\n"));
+
+  g_bytes_unref (bytes);
+  g_object_unref (response);
+}
+
+static void
+test_resource_package_checksum_shared (TestResourceCase *tc,
+                                       gconstpointer data)
+{
+  gchar *routes;
+
+  cockpit_web_service_set_host_package_checksums (tc->service, "localhost",
+                                                  "another=4567cdef test=0123abcd");
+  cockpit_web_service_set_host_package_checksums (tc->service, "same",
+                                                  "another=4567cdef test=0123abcd");
+  cockpit_web_service_set_host_package_checksums (tc->service, "different",
+                                                  "another=89abcdef test=0123abcd");
+
+  /* Identical hosts share all the routes */
+  routes = cockpit_web_service_get_package_routes (tc->service, "same");
+  g_assert_cmpstr (routes, ==, "another=4567cdef test=0123abcd");
+  g_free (routes);
+
+  /* Relative URLs from "test" would go to the wrong "another" here */
+  routes = cockpit_web_service_get_package_routes (tc->service, "different");
+  g_assert_cmpstr (routes, ==, "another=89abcdef");
+  g_free (routes);
+  g_assert_cmpstr (cockpit_web_service_get_package_host (tc->service, "0123abcd"), ==, "localhost");
+
+  /* Nor does localhost take over from a different host */
+  cockpit_web_service_set_host_package_checksums (tc->service, "localhost",
+                                                  "another=abababab test=89abcdef");
+  routes = cockpit_web_service_get_package_routes (tc->service, "localhost");
+  g_assert_cmpstr (routes, ==, "another=abababab");
+  g_free (routes);
+}
+
 static void
 test_resource_no_checksum (TestResourceCase *tc,
                            gconstpointer data)
@@ -1123,6 +1230,12 @@ main (int argc,
               setup_resource, test_resource_not_modified_new_language, teardown_resource);
   g_test_add ("/web-channel/resource/not-modified-cookie-language", TestResourceCase, &checksum_fixture,
               setup_resource, test_resource_not_modified_cookie_language, teardown_resource);
+  g_test_add ("/web-channel/resource/package-checksum", TestResourceCase, &checksum_fixture,
+              setup_resource, test_resource_package_checksum, teardown_resource);
+  g_test_add ("/web-channel/resource/package-checksum-redirect", TestResourceCase, &checksum_fixture,
+              setup_resource, test_resource_package_checksum_redirect, teardown_resource);
+  g_test_add ("/web-channel/resource/package-checksum-shared", TestResourceCase, &checksum_fixture,
+              setup_resource, test_resource_package_checksum_shared, teardown_resource);
   g_test_add ("/web-channel/resource/no-checksum", TestResourceCase, NULL,
               setup_resource, test_resource_no_checksum, teardown_resource);
   g_test_add ("/web-channel/resource/bad-checksum", TestResourceCase, NULL,